@@ -167,26 +167,26 @@ int Send(SOCKET sender, int bytes, const char* byte_stream);
 int SegmentationSend(SOCKET sender, const char* message, int message_len, int* obyte_sent);
 
 /// <summary>
-/// Read a byte stream from a connected socket 
+/// Read a byte stream from a connected socket into a buffer of the caller
 /// </summary>
 /// <param name="receiver">The connected socket that is used for receiving bytes stream</param>
 /// <param name="bytes">Number of bytes want to read</param>
-/// <param name="obyte_stream">[Output] The byte streams read</param>
+/// <param name="obuffer">[Output] The buffer receiving the byte stream. It has at least `bytes` bytes</param>
 /// <returns>1 if read successfully. 0 if cant read fully. -1 if have errors that the socket should be closed</returns>
-int Receive(SOCKET receiver, int bytes, char** obyte_stream);
+int Receive(SOCKET receiver, int bytes, char* obuffer);
 
 /// <summary>
-/// Read and Extract one part of/a segment of a message from a connected socket.
+/// Read the header of a segment of a message from a connected socket: The segment content is not read.
 /// </summary>
 /// <param name="receiver">The connected socket that is used for receiving byte streams</param>
-/// <param name="obyte_stream">[Output] The extracted segment, after removing SEGMENT_HEADER_SIZE first bytes from byte stream</param>
-/// <param name="ostream_len">[Output] The segment size, in bytes</param>
-/// <param name="oremain">[Output] Number of bytes in source message that have not been received</param>
+/// <param name="ocurrent">[Output] The size of the segment content, in bytes</param>
+/// <param name="oremain">[Output] Number of bytes in source message after the segment</param>
 /// <returns>1 if success. 0 if cant read fully. -1 if have errors that the socket should be closed</returns>
-int ReceiveSegment(SOCKET receiver, char** obyte_stream, int* ostream_len, int* oremain);
+int ReceiveSegmentHeader(SOCKET receiver, int* ocurrent, int* oremain);
 
 /// <summary>
 /// Read segments from a connected socket and Merge them into a complete message.
+/// The message is allocated once from the first segment header and the segment contents are read into it.
 /// </summary>
 /// <param name="socket">The connected socket used to receive segments</param>
 /// <param name="omessage">[Output] The merged message</param>
@@ -1,7 +1,8 @@
 #include "Server.h"
 
-ACCOUNTINFO* Accounts = NULL;
-CRITICAL_SECTION critical_section;
+ACCOUNTINDEX* Accounts = NULL; // The account index. Read-only after loading: Only the "status" field of accounts changes
+ARTICLESTORE* Articles = NULL; // The article store. Posts are appended to it
+unsigned int Crc32Table[256]; // Lookup table of Crc32(). See BuildCrc32Table()
 
 int main(int argc, char* argv[])
 {
@@ -18,19 +19,20 @@ int main(int argc, char* argv[])
 
 					printf("[%s] Listenning at port %d...\n", INFO_FLAGS, running_port);
 
-					if (LoadAccountList(ACCOUNT_FILE_PATH)) {
+					Articles = OpenArticleStore(ARTICLE_DIRECTORY);
+					if (Articles == NULL)
+						printf("[%s] %s\n", ERROR_FLAGS, _OPEN_ARTICLE_STORE_FAIL);
+					else if ((Accounts = LoadAccountIndex(ACCOUNT_FILE_PATH)) != NULL) {
 
-						InitializeCriticalSection(&critical_section);
 						while (1) {
 							SOCKET connector = GetConnectionSocket(listener);
 							if (connector != INVALID_SOCKET) {
 								CreateThreadForConnection(connector);
 							}
 						}
-						DeleteCriticalSection(&critical_section);
-
-						FreeAccountList(Accounts);
+						FreeAccountIndex(Accounts);
 					}
+					CloseArticleStore(Articles);
 				}
 			}
 		}
@@ -60,11 +62,12 @@ HANDLE CreateThreadForConnection(SOCKET socket)
 unsigned __stdcall Run(void* arguments)
 {
 	SOCKET connector = (SOCKET)arguments;
+	ACCOUNTINFO* session = NULL; // the account logged in on the connection
 	while (connector != INVALID_SOCKET) {
 		// communicate
-		int status = HandleRequest(connector);
+		int status = HandleRequest(connector, &session);
 		if (status == -1) {
-			EndSession(connector);
+			EndSession(&session);
 			CloseSocket(connector, CLOSE_SAFELY);
 			connector = INVALID_SOCKET;
 		}
@@ -72,87 +75,69 @@ unsigned __stdcall Run(void* arguments)
 	return 0; // terminate thread
 }
 
-void EndSession(SOCKET socket)
+void EndSession(ACCOUNTINFO** iosession)
 {
-	EnterCriticalSection(&critical_section);
-	ACCOUNTINFO* acc = FindFirstAccountInfo(Accounts, socket);
-	if (acc != NULL) {
-		acc->status = AS_FREE;
-		acc->socket = INVALID_SOCKET;
+	if (*iosession != NULL) {
+		InterlockedExchange(&(*iosession)->status, AS_FREE);
+		*iosession = NULL;
 	}
-	LeaveCriticalSection(&critical_section);
 }
 
 #pragma endregion
 
 #pragma region Handle Request
 
-MESSAGE HandlePostRequest(SOCKET socket, const char* arguments)
+const char* HandlePostRequest(SOCKET socket, const char* arguments, ACCOUNTINFO** iosession)
 {
-	EnterCriticalSection(&critical_section);
-	int is_not_log_in = (FindFirstAccountInfo(Accounts, socket) == NULL);
-	LeaveCriticalSection(&critical_section);
-
-	if (is_not_log_in) {
-		return CreateMessage(S_NOT_LOGIN, SM_NOT_LOGIN);
+	if (*iosession == NULL) {
+		return RM_NOT_LOGIN;
 	}
 
-	return CreateMessage(S_POST_SUCC, SM_POST_SUCC);
+	// the thread waits for the group commit: the posts of other connections share its flush
+	unsigned long long id;
+	if (!AppendArticle(Articles, (*iosession)->account, arguments, &id) || WaitArticleDurable(Articles, id) < id) {
+		return RM_POST_FAIL;
+	}
+	return RM_POST_SUCC;
 }
 
-MESSAGE HandleLoginRequest(SOCKET socket, const char* arguments)
+const char* HandleLoginRequest(SOCKET socket, const char* arguments, ACCOUNTINFO** iosession)
 {
-	EnterCriticalSection(&critical_section);
-	int is_login = (FindFirstAccountInfo(Accounts, socket) != NULL);
-	LeaveCriticalSection(&critical_section);
-
-	if (is_login) {
-		return CreateMessage(S_LOGGEDIN, SM_LOGGEDIN);
+	if (*iosession != NULL) {
+		return RM_LOGGEDIN;
 	}
 
-	EnterCriticalSection(&critical_section);
-	ACCOUNTINFO* acc = FindFirstAccountInfo(Accounts, arguments);
-	int status = acc == NULL ? -1 : acc->status;
-	LeaveCriticalSection(&critical_section);
-
-	if (status == -1) {
-		return CreateMessage(S_ACCOUNT_NOT_EXIST, SM_ACCOUNT_NOT_EXIST);
+	// the index is read-only: no lock
+	ACCOUNTINFO* acc = FindAccountInfo(Accounts, arguments);
+	if (acc == NULL) {
+		return RM_ACCOUNT_NOT_EXIST;
 	}
-	else if (status == AS_LOGGED_IN) {
-		return CreateMessage(S_ACCOUNT_LOGGEDIN, SM_ACCOUNT_LOGGEDIN);
+
+	// only one client takes a free account
+	LONG status = InterlockedCompareExchange(&acc->status, AS_LOGGED_IN, AS_FREE);
+	if (status == AS_LOGGED_IN) {
+		return RM_ACCOUNT_LOGGEDIN;
 	}
 	else if (status == AS_LOCK) {
-		return CreateMessage(S_ACCOUNT_LOCK, SM_ACCOUNT_LOCK);
-	}
-	else { // AS_FREE
-		EnterCriticalSection(&critical_section);
-		acc->status = AS_LOGGED_IN;
-		acc->socket = socket;
-		LeaveCriticalSection(&critical_section);
+		return RM_ACCOUNT_LOCK;
 	}
-	return CreateMessage(S_LOGIN_SUCC, SM_LOGIN_SUCC);
+	// AS_FREE
+	*iosession = acc;
+	return RM_LOGIN_SUCC;
 }
 
-MESSAGE HandleLogoutRequest(SOCKET socket)
+const char* HandleLogoutRequest(SOCKET socket, ACCOUNTINFO** iosession)
 {
-	EnterCriticalSection(&critical_section);
-	ACCOUNTINFO* acc = FindFirstAccountInfo(Accounts, socket);
-	int is_login = (acc != NULL);
-	LeaveCriticalSection(&critical_section);
-
-	if (!is_login) {
-		return CreateMessage(S_NOT_LOGIN, SM_NOT_LOGIN);
+	if (*iosession == NULL) {
+		return RM_NOT_LOGIN;
 	}
 	// if logged in
-	EnterCriticalSection(&critical_section);
-	acc->status = AS_FREE;
-	acc->socket = INVALID_SOCKET;
-	LeaveCriticalSection(&critical_section);
+	EndSession(iosession);
 
-	return CreateMessage(S_LOGOUT_SUCC, SM_LOGOUT_SUCC);
+	return RM_LOGOUT_SUCC;
 }
 
-int HandleRequest(SOCKET socket)
+int HandleRequest(SOCKET socket, ACCOUNTINFO** iosession)
 {
 	char* request, *arguments;
 	int status = 1;
@@ -162,104 +147,333 @@ int HandleRequest(SOCKET socket)
 		return status;
 	}
 
-	MESSAGE response = NULL;
+	const char* response = NULL;
 	// Handle request
 	int command = ExtractRequestCommand(request, &arguments);
 	if (command == C_POST) {
-		response = HandlePostRequest(socket, arguments);
+		response = HandlePostRequest(socket, arguments, iosession);
 	}
 	else if (command == C_LOGIN) {
-		response = HandleLoginRequest(socket, arguments);
+		response = HandleLoginRequest(socket, arguments, iosession);
 	}
 	else if (command == C_LOGOUT) {
-		response = HandleLogoutRequest(socket);
+		response = HandleLogoutRequest(socket, iosession);
 	}
 	else {
-		response = CreateMessage(S_UNREGCONIZE_COMMAND, SM_UNREGCONIZE_COMMAND);
+		response = RM_UNREGCONIZE_COMMAND;
 	}
 	free(request);
 
 	// Send response
 	status = SegmentationSend(socket, response, (int)strlen(response) + 1, NULL);
-	DestroyMessage(response);
 	return status;
 }
 
 int ExtractRequestCommand(const char* request, char** oarguments)
 {
-	char* space_pos = (char*)memchr(request, ' ', strlen(request));
-	if (space_pos == NULL) {
-		if (ICompare(request, CM_LOGOUT, (int)max(strlen(CM_LOGOUT), strlen(request))) == 0)
-			return C_LOGOUT;
-		return 0;
-	}
-
-	*oarguments = space_pos + 1;
-	// match command
-	if (ICompare(request, CM_POST,
-		(int)max((int)strlen(CM_POST), (space_pos - request)))
-		== 0)
-		return C_POST;
-	else if (ICompare(request, CM_LOGIN,
-		(int)max((int)strlen(CM_LOGIN), (space_pos - request)))
-		== 0)
-		return C_LOGIN;
-	else if (ICompare(request, CM_LOGOUT,
-		(int)max((int)strlen(CM_LOGOUT), (space_pos - request)))
-		== 0)
+	// one pass over the command text: its case-folded letters are packed into a number
+	unsigned long long command = 0;
+	int length = 0;
+	for (; request[length] != ' ' && request[length] != '\0'; ++length) {
+		if (length == COMMAND_MAX_LENGTH)
+			return 0;
+		command |= (unsigned long long)((unsigned char)request[length] | 0x20) << (8 * length);
+	}
+	int has_arguments = request[length] == ' ';
+	*oarguments = (char*)request + length + has_arguments;
+
+	switch (command) {
+	case PC_POST:
+		return has_arguments ? C_POST : 0;
+	case PC_LOGIN:
+		return has_arguments ? C_LOGIN : 0;
+	case PC_LOGOUT:
 		return C_LOGOUT;
-
+	}
 	return 0;
 }
 
 #pragma endregion
 
-#pragma region AccountInfo and Linked List
+#pragma region Article Store
 
-ACCOUNTINFO* Append(ACCOUNTINFO* prev, ACCOUNTINFO* current)
+ARTICLESTORE* OpenArticleStore(const char* directory)
 {
-	if (prev != NULL) {
-		current->next = prev->next;
-		prev->next = current;
+	if (!CreateDirectoryA(directory, NULL) && GetLastError() != ERROR_ALREADY_EXISTS) {
+		printf("[%s] Fail to create article directory: '%s'\n", ERROR_FLAGS, directory);
+		return NULL;
 	}
-	else {
-		current->next = Accounts;
-		Accounts = current;
+	BuildCrc32Table();
+
+	ARTICLESTORE* store = (ARTICLESTORE*)calloc(1, sizeof(ARTICLESTORE));
+	if (store == NULL) {
+		printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
+		return NULL;
+	}
+	store->directory = directory;
+	store->segment = INVALID_HANDLE_VALUE;
+	InitializeCriticalSection(&store->lock);
+	InitializeConditionVariable(&store->appended);
+	InitializeConditionVariable(&store->committed);
+	store->appending = (char*)malloc(ARTICLE_BUFFER_SIZE);
+	store->committing = (char*)malloc(ARTICLE_BUFFER_SIZE);
+	if (store->appending == NULL || store->committing == NULL) {
+		printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
+		CloseArticleStore(store);
+		return NULL;
+	}
+
+	if (!RecoverArticleStore(store)) {
+		CloseArticleStore(store);
+		return NULL;
+	}
+	store->thread = (HANDLE)_beginthreadex(NULL, 0, CommitArticles, (void*)store, 0, NULL);
+	if (store->thread == 0) {
+		printf("[%s] %s\n", WARNING_FLAGS, _TOO_MANY_THREADS);
+		CloseArticleStore(store);
+		return NULL;
+	}
+	printf("[%s] Article store '%s': %llu articles, segment %u\n", INFO_FLAGS, directory, store->last_id, store->segment_number);
+	return store;
+}
+
+int RecoverArticleStore(ARTICLESTORE* store)
+{
+	unsigned int last = 1;
+	HANDLE next;
+	while ((next = OpenArticleSegment(store->directory, last + 1, OPEN_EXISTING)) != INVALID_HANDLE_VALUE) {
+		CloseHandle(next);
+		last++;
+	}
+
+	store->segment_number = last;
+	store->segment = OpenArticleSegment(store->directory, last, OPEN_ALWAYS);
+	if (store->segment == INVALID_HANDLE_VALUE) {
+		printf("[%s] Fail to open article segment %u\n", ERROR_FLAGS, last);
+		return 0;
+	}
+	unsigned long long last_id = 0;
+	store->segment_size = RecoverArticleSegment(store->segment, &last_id);
+	if (store->segment_size < 0) {
+		printf("[%s] Fail to read article segment %u\n", ERROR_FLAGS, last);
+		return 0;
+	}
+	// the last segment has no article (rolled over just before a crash): the IDs continue from the previous one
+	for (unsigned int number = last - 1; last_id == 0 && number > 0; --number) {
+		HANDLE previous = OpenArticleSegment(store->directory, number, OPEN_EXISTING);
+		if (previous == INVALID_HANDLE_VALUE)
+			return 0;
+		long long size = RecoverArticleSegment(previous, &last_id);
+		CloseHandle(previous);
+		if (size < 0)
+			return 0;
+	}
+	store->last_id = last_id;
+	store->durable_id = last_id;
+	return 1;
+}
+
+void CloseArticleStore(ARTICLESTORE* store)
+{
+	if (store == NULL)
+		return;
+	if (store->thread != 0) {
+		EnterCriticalSection(&store->lock);
+		store->stopped = 1;
+		WakeAllConditionVariable(&store->appended);
+		WakeAllConditionVariable(&store->committed);
+		LeaveCriticalSection(&store->lock);
+		WaitForSingleObject(store->thread, INFINITE);
+		CloseHandle(store->thread);
+	}
+	if (store->segment != INVALID_HANDLE_VALUE)
+		CloseHandle(store->segment);
+	DeleteCriticalSection(&store->lock);
+	free(store->appending);
+	free(store->committing);
+	free(store);
+}
+
+int AppendArticle(ARTICLESTORE* store, const char* author, const char* content, unsigned long long* oid)
+{
+	if (author == NULL)
+		author = "";
+	ARTICLEHEADER header;
+	header.magic = ARTICLE_MAGIC;
+	header.id = 0;
+	header.length = (unsigned int)strlen(content);
+	header.author_length = (unsigned short)strlen(author);
+	header.reserved = 0;
+	int size = GetArticleRecordSize(&header);
+	if (size > ARTICLE_BUFFER_SIZE)
+		return 0;
+	// the payload is checksummed out of the lock: only the header fields depend on the ID
+	unsigned int payload_crc = Crc32(author, header.author_length + 1);
+	payload_crc = Crc32(content, header.length + 1, payload_crc);
+
+	int appended = 0;
+	EnterCriticalSection(&store->lock);
+	while (!store->failed && !store->stopped && store->used + size > ARTICLE_BUFFER_SIZE) {
+		SleepConditionVariableCS(&store->committed, &store->lock, INFINITE); // the buffer is full until the commit thread takes it
+	}
+	if (!store->failed && !store->stopped) {
+		header.id = ++store->last_id;
+		header.checksum = ChecksumArticle(&header, payload_crc);
+
+		char* record = store->appending + store->used;
+		int offset = sizeof(ARTICLEHEADER);
+		memcpy_s(record, size, &header, sizeof(ARTICLEHEADER));
+		memcpy_s(record + offset, size - offset, author, (size_t)header.author_length + 1);
+		offset += header.author_length + 1;
+		memcpy_s(record + offset, size - offset, content, (size_t)header.length + 1);
+		offset += header.length + 1;
+		memset(record + offset, 0, (size_t)size - offset); // padding
+
+		store->used += size;
+		*oid = header.id;
+		appended = 1;
+		WakeConditionVariable(&store->appended);
 	}
-	return current;
+	LeaveCriticalSection(&store->lock);
+	return appended;
 }
 
+unsigned long long WaitArticleDurable(ARTICLESTORE* store, unsigned long long id)
+{
+	EnterCriticalSection(&store->lock);
+	while (store->durable_id < id && !store->failed) {
+		SleepConditionVariableCS(&store->committed, &store->lock, INFINITE);
+	}
+	unsigned long long durable_id = store->durable_id;
+	LeaveCriticalSection(&store->lock);
+	return durable_id;
+}
+
+unsigned __stdcall CommitArticles(void* arguments)
+{
+	ARTICLESTORE* store = (ARTICLESTORE*)arguments;
+	EnterCriticalSection(&store->lock);
+	while (1) {
+		while (store->used == 0 && !store->stopped) {
+			SleepConditionVariableCS(&store->appended, &store->lock, INFINITE);
+		}
+		if (store->used == 0) // stopped: every appended article is committed
+			break;
+
+		// group commit: every article appended so far goes in one write and one flush.
+		// The posts keep appending to the other buffer meanwhile
+		char* batch = store->appending;
+		int size = store->used;
+		unsigned long long last_id = store->last_id;
+		int failed = store->failed;
+		store->appending = store->committing;
+		store->committing = batch;
+		store->used = 0;
+		WakeAllConditionVariable(&store->committed); // the posts waiting for a free buffer
+		LeaveCriticalSection(&store->lock);
+
+		// after a failure nothing is written: the articles after a broken record would be lost on recovery
+		int is_ok = !failed && WriteArticleBatch(store, batch, size);
+
+		EnterCriticalSection(&store->lock);
+		if (is_ok)
+			store->durable_id = last_id;
+		else
+			store->failed = 1;
+		WakeAllConditionVariable(&store->committed);
+	}
+	LeaveCriticalSection(&store->lock);
+	return 0; // terminate thread
+}
+
+unsigned int ChecksumArticle(const ARTICLEHEADER* header, unsigned int payload_crc)
+{
+	const char* fields = (const char*)&header->id;
+	return Crc32(fields, (int)(sizeof(ARTICLEHEADER) - (fields - (const char*)header)), payload_crc);
+}
+
+int GetArticleRecordSize(const ARTICLEHEADER* header)
+{
+	int size = (int)sizeof(ARTICLEHEADER) + header->author_length + 1 + (int)header->length + 1;
+	return (size + 7) & ~7; // the next header is aligned
+}
+
+#pragma endregion
+
+#pragma region AccountInfo and Linked List
+
 ACCOUNTINFO* CreateAccountInfo(const char* username, int namelen, int status)
 {
 	ACCOUNTINFO* acc = (ACCOUNTINFO*)malloc(sizeof(ACCOUNTINFO));
 	if (acc != NULL) {
-		acc->account = Clone(username, namelen);
+		acc->account = Clone(username, namelen + 1);
+		if (acc->account == NULL) {
+			free(acc);
+			return NULL;
+		}
 		acc->account[namelen] = '\0';
-		acc->socket = INVALID_SOCKET;
 		acc->status = status;
+		acc->hash = HashAccountName(acc->account);
 		acc->next = NULL;
 	}
 	return acc;
 }
 
-ACCOUNTINFO* FindFirstAccountInfo(ACCOUNTINFO* start, SOCKET socket)
+unsigned int HashAccountName(const char* username)
 {
-	ACCOUNTINFO* cur = start;
-	while (cur != NULL) {
-		if (socket == cur->socket)
-			return cur;
-		cur = cur->next;
+	unsigned int hash = 2166136261u;
+	for (const char* c = username; *c != '\0'; ++c) {
+		char folded = (*c >= 'A' && *c <= 'Z') ? *c - 'A' + 'a' : *c;
+		hash = (hash ^ (unsigned char)folded) * 16777619u;
 	}
-	return NULL;
+	return hash;
 }
 
-ACCOUNTINFO* FindFirstAccountInfo(ACCOUNTINFO* start, const char* username)
+ACCOUNTINDEX* CreateAccountIndex(ACCOUNTINFO* accounts)
 {
-	ACCOUNTINFO* cur = start;
-	while (cur != NULL) {
-		if (ICompare(username, cur->account) == 0)
-			return cur;
-		cur = cur->next;
+	unsigned int count = 0;
+	for (ACCOUNTINFO* cur = accounts; cur != NULL; cur = cur->next) {
+		count++;
+	}
+	unsigned int slots = ACCOUNT_INDEX_MIN_SLOTS;
+	while (slots < 2 * count) {
+		slots <<= 1;
+	}
+
+	ACCOUNTINDEX* index = (ACCOUNTINDEX*)malloc(sizeof(ACCOUNTINDEX));
+	if (index != NULL && (index->slots = (ACCOUNTINFO**)calloc(slots, sizeof(ACCOUNTINFO*))) == NULL) {
+		free(index);
+		index = NULL;
+	}
+	if (index == NULL) {
+		printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
+		return NULL;
+	}
+	index->accounts = accounts;
+	index->count = 0;
+	index->mask = slots - 1;
+
+	for (ACCOUNTINFO* cur = accounts; cur != NULL; cur = cur->next) {
+		unsigned int i = cur->hash & index->mask;
+		while (index->slots[i] != NULL &&
+			(index->slots[i]->hash != cur->hash || ICompare(cur->account, index->slots[i]->account) != 0)) {
+			i = (i + 1) & index->mask;
+		}
+		if (index->slots[i] == NULL) { // a duplicated name keeps the first one
+			index->slots[i] = cur;
+			index->count++;
+		}
+	}
+	return index;
+}
+
+ACCOUNTINFO* FindAccountInfo(const ACCOUNTINDEX* index, const char* username)
+{
+	unsigned int hash = HashAccountName(username);
+	for (unsigned int i = hash & index->mask; index->slots[i] != NULL; i = (i + 1) & index->mask) {
+		ACCOUNTINFO* acc = index->slots[i];
+		if (acc->hash == hash && ICompare(username, acc->account) == 0)
+			return acc;
 	}
 	return NULL;
 }
@@ -276,35 +490,135 @@ void FreeAccountList(ACCOUNTINFO* first)
 	}
 }
 
+void FreeAccountIndex(ACCOUNTINDEX* index)
+{
+	if (index == NULL)
+		return;
+	FreeAccountList(index->accounts);
+	free(index->slots);
+	free(index);
+}
+
 #pragma endregion
 
 #pragma region I/O Operations
 
-int LoadAccountList(const char* file)
+ACCOUNTINDEX* LoadAccountIndex(const char* file)
 {
 	FILE* fp;
 	fopen_s(&fp, file, "r");
 	if (fp == NULL) {
 		printf("[%s] Fail to open account file: '%s'\n", ERROR_FLAGS, file);
-		return 0;
+		return NULL;
 	}
 	char line[LINE_MAX_SIZE];
 	int status;
-	ACCOUNTINFO* cur = NULL;
+	ACCOUNTINFO* head = NULL, * tail = NULL, * acc = NULL;
 	while (fgets(line, LINE_MAX_SIZE, fp)) {
 		char* space_pos = (char*)memchr(line, ' ', strlen(line));
 		if (space_pos == NULL) {
-			if (strlen(line) > 1) {
-				status = AS_LOCK;
-				cur = Append(cur, CreateAccountInfo(line, (int)strlen(line), status));
-			}
+			if (strlen(line) <= 1)
+				continue;
+			status = AS_LOCK;
+			acc = CreateAccountInfo(line, (int)strlen(line), status);
 		}
 		else {
 			status = atoi(space_pos + 1);
-			cur = Append(cur, CreateAccountInfo(line, (int)(space_pos - line), status));
+			acc = CreateAccountInfo(line, (int)(space_pos - line), status);
 		}
+		if (acc == NULL)
+			continue;
+		// keep the file order: the first one of duplicated names is indexed
+		if (tail == NULL)
+			head = acc;
+		else
+			tail->next = acc;
+		tail = acc;
 	}
 	fclose(fp);
+
+	ACCOUNTINDEX* index = CreateAccountIndex(head);
+	if (index == NULL)
+		FreeAccountList(head);
+	return index;
+}
+
+HANDLE OpenArticleSegment(const char* directory, unsigned int number, DWORD disposition)
+{
+	char path[MAX_PATH];
+	sprintf_s(path, MAX_PATH, ARTICLE_SEGMENT_NAME, directory, number);
+	return CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, disposition, FILE_ATTRIBUTE_NORMAL, NULL);
+}
+
+long long RecoverArticleSegment(HANDLE segment, unsigned long long* olast_id)
+{
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(segment, &file_size))
+		return -1;
+	char* record = (char*)malloc(ARTICLE_BUFFER_SIZE);
+	if (record == NULL) {
+		printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
+		return -1;
+	}
+
+	long long valid_size = 0;
+	unsigned long long last_id = 0;
+	ARTICLEHEADER* header = (ARTICLEHEADER*)record;
+	DWORD read = 0;
+	while (ReadFile(segment, record, sizeof(ARTICLEHEADER), &read, NULL) && read == sizeof(ARTICLEHEADER)) {
+		// a torn write leaves a record with a wrong header or checksum: it and everything after it are dropped
+		if (header->magic != ARTICLE_MAGIC || header->id <= last_id || header->length > ARTICLE_BUFFER_SIZE)
+			break;
+		int size = GetArticleRecordSize(header);
+		if (size > ARTICLE_BUFFER_SIZE || valid_size + size > file_size.QuadPart)
+			break;
+		DWORD rest = (DWORD)(size - sizeof(ARTICLEHEADER));
+		if (!ReadFile(segment, record + sizeof(ARTICLEHEADER), rest, &read, NULL) || read != rest)
+			break;
+		unsigned int payload_crc = Crc32(record + sizeof(ARTICLEHEADER), header->author_length + 1 + (int)header->length + 1);
+		if (ChecksumArticle(header, payload_crc) != header->checksum)
+			break;
+		valid_size += size;
+		last_id = header->id;
+	}
+	free(record);
+
+	if (last_id != 0)
+		*olast_id = last_id;
+	LARGE_INTEGER end;
+	end.QuadPart = valid_size;
+	if (!SetFilePointerEx(segment, end, NULL, FILE_BEGIN))
+		return -1;
+	if (valid_size < file_size.QuadPart) {
+		printf("[%s] %s\n", WARNING_FLAGS, _DISCARD_INCOMPLETE_ARTICLE);
+		if (!SetEndOfFile(segment) || !FlushFileBuffers(segment))
+			return -1;
+	}
+	return valid_size;
+}
+
+int WriteArticleBatch(ARTICLESTORE* store, const char* batch, int size)
+{
+	// the records of a batch stay in one segment
+	if (store->segment_size > 0 && store->segment_size + size > ARTICLE_SEGMENT_MAX_SIZE) {
+		HANDLE next = OpenArticleSegment(store->directory, store->segment_number + 1, CREATE_ALWAYS);
+		if (next == INVALID_HANDLE_VALUE) {
+			printf("[%s:%d] %s\n", ERROR_FLAGS, (int)GetLastError(), _COMMIT_ARTICLES_FAIL);
+			return 0;
+		}
+		CloseHandle(store->segment);
+		store->segment = next;
+		store->segment_number++;
+		store->segment_size = 0;
+	}
+
+	DWORD written = 0;
+	if (!WriteFile(store->segment, batch, (DWORD)size, &written, NULL) || written != (DWORD)size ||
+		!FlushFileBuffers(store->segment)) {
+		printf("[%s:%d] %s\n", ERROR_FLAGS, (int)GetLastError(), _COMMIT_ARTICLES_FAIL);
+		return 0;
+	}
+	store->segment_size += size;
 	return 1;
 }
 
@@ -491,16 +805,9 @@ int SegmentationSend(SOCKET sender, const char* message, int message_len, int* o
 	return 1;
 }
 
-int Receive(SOCKET receiver, int length, char** obyte_stream)
+int Receive(SOCKET receiver, int bytes, char* obuffer)
 {
-	if (length > APPLICATION_BUFF_MAX_SIZE)
-	{
-		printf("[%s] %s\n", WARNING_FLAGS, _TOO_MUCH_BYTES);
-		length = APPLICATION_BUFF_MAX_SIZE;
-	}
-	char buffer[APPLICATION_BUFF_MAX_SIZE];
-
-	int ret = recv(receiver, buffer, length, 0);
+	int ret = recv(receiver, obuffer, bytes, MSG_WAITALL); // a segment may arrive in many pieces
 	if (ret == SOCKET_ERROR) {
 		int err = WSAGetLastError();
 		if (err == WSAECONNABORTED || err == WSAECONNRESET) {
@@ -514,78 +821,57 @@ int Receive(SOCKET receiver, int length, char** obyte_stream)
 	else if (ret == 0) {
 		return -1;
 	}
-	else if (ret < length) {
+	else if (ret < bytes) {
 		printf("[%s] %s\n", WARNING_FLAGS, _RECEIVE_UNEXPECTED_MESSAGE);
-		*obyte_stream = NULL;
 		return 0;
 	}
-	else {
-		*obyte_stream = Clone(buffer, length);
-	}
 	return 1;
 }
 
-int ReceiveSegment(SOCKET receiver, char** obyte_stream, int* ostream_len, int* oremain)
+int ReceiveSegmentHeader(SOCKET receiver, int* ocurrent, int* oremain)
 {
-	*obyte_stream = NULL;
-	char* read;
-	int remain;
-	int current;
-	// read number of bytes remain | number of bytes current
-	int ret = Receive(receiver, SEGMENT_HEADER_SIZE, &read);
-	if (ret == 1) {
-		current = ntohs(*(unsigned short*)read);
-		remain = ntohs(*(unsigned short*)(read + SEGMENT_HEADER_CURRENT_SIZE));
-
-		*ostream_len = current;
-		*oremain = remain;
-		free(read);
-	}
-	else {
-		*ostream_len = 0;
-		*oremain = 0;
+	char header[SEGMENT_HEADER_SIZE];
+	*ocurrent = 0;
+	*oremain = 0;
+	// read number of bytes current | number of bytes remain
+	int ret = Receive(receiver, SEGMENT_HEADER_SIZE, header);
+	if (ret != 1)
 		return ret;
-	}
 
-	// read message content
-	ret = Receive(receiver, current, &read);
-	if (ret == 1) {
-		*obyte_stream = Clone(read, current);
-		free(read);
-	}
-	else {
-		*ostream_len = 0;
-		*oremain = 0;
-		return ret;
-	}
+	*ocurrent = ntohs(*(unsigned short*)header);
+	*oremain = ntohs(*(unsigned short*)(header + SEGMENT_HEADER_CURRENT_SIZE));
 	return 1;
 }
 
 int SegmentationReceive(SOCKET socket, char** omessage)
 {
-	char* _message;
-	int mlen, remain, start_byte = 0;
-	int status = 1;
+	int current, remain, start_byte = 0;
 	*omessage = NULL;
+	// the first header gives the message size: the segment contents are read into the message directly
+	int status = ReceiveSegmentHeader(socket, &current, &remain);
+	if (status != 1)
+		return status;
+	int size = current + remain;
+	*omessage = (char*)malloc((size_t)size);
+	if (*omessage == NULL) {
+		printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
+		return 0;
+	}
+
 	while (1) {
-		status = ReceiveSegment(socket, &_message, &mlen, &remain);
-		if (status != 1) {
-			free(_message);
-			return status;
-		}
-		if (*omessage == NULL) {
-			*omessage = (char*)malloc((size_t)mlen + remain);
-			if (*omessage == NULL) {
-				printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
-				free(_message);
-				return 0;
-			}
+		if (current > size - start_byte) {
+			printf("[%s] %s\n", WARNING_FLAGS, _TOO_MUCH_BYTES);
+			return 0;
 		}
-		memcpy_s(*omessage + start_byte, mlen, _message, mlen);
-		start_byte += mlen;
-		free(_message);
+		status = Receive(socket, current, *omessage + start_byte);
+		if (status != 1)
+			return status;
+		start_byte += current;
 		if (remain <= 0)
 			break;
+		status = ReceiveSegmentHeader(socket, &current, &remain);
+		if (status != 1)
+			return status;
 	}
 	return status;
 }
@@ -622,6 +908,26 @@ IP CreateDefaultIP()
 	return addr;
 }
 
+void BuildCrc32Table()
+{
+	for (unsigned int i = 0; i < 256; ++i) {
+		unsigned int crc = i;
+		for (int bit = 0; bit < 8; ++bit) {
+			crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320u : crc >> 1;
+		}
+		Crc32Table[i] = crc;
+	}
+}
+
+unsigned int Crc32(const char* data, int length, unsigned int crc)
+{
+	crc = ~crc;
+	for (int i = 0; i < length; ++i) {
+		crc = Crc32Table[(crc ^ (unsigned char)data[i]) & 0xFF] ^ (crc >> 8);
+	}
+	return ~crc;
+}
+
 char* Clone(const char* source, int length, int start)
 {
 	char* _clone = (char*)malloc((size_t)length + start);
@@ -633,28 +939,6 @@ char* Clone(const char* source, int length, int start)
 	return _clone;
 }
 
-MESSAGE CreateMessage(int status, const char* message)
-{
-	MESSAGE m;
-	if (message == NULL) {
-		m = Clone("", 1, STATUS_LENGTH);
-	}
-	else {
-		m = Clone(message, (int)strlen(message) + 1, STATUS_LENGTH);
-	}
-	if (m != NULL) {
-		// accept 2 digits value for status
-		m[0] = status / 10 + '0';
-		m[1] = status % 10 + '0';
-	}
-	return m;
-}
-
-void DestroyMessage(MESSAGE m)
-{
-	free(m);
-}
-
 int ICompare(const char* first, const char* second, int length)
 {
 	int flen = (int)strlen(first) + 1;
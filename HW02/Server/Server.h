@@ -13,9 +13,16 @@
 #define MAX_CONNECTIONS SOMAXCONN
 
 #define LINE_MAX_SIZE 1024
+#define ACCOUNT_INDEX_MIN_SLOTS 64 // Minimum number of slots of the account index
 
 #define ACCOUNT_FILE_PATH ".//account.txt"
 
+#define ARTICLE_DIRECTORY ".//articles" // The directory of the article segment files
+#define ARTICLE_SEGMENT_NAME "%s//%08u.seg" // Segment file name: The directory and the segment number. The segments are numbered from 1 without gaps
+#define ARTICLE_SEGMENT_MAX_SIZE (64 * 1024 * 1024) // A segment rolls over before a commit makes it larger than this size, in bytes
+#define ARTICLE_BUFFER_SIZE (1024 * 1024) // Size of each of the two append buffers: Posts append to one while the other is committed
+#define ARTICLE_MAGIC 0x31545241 // "ART1": The first bytes of every article record
+
 #define S_LOGIN_SUCC 10
 #define S_ACCOUNT_LOCK 11
 #define S_ACCOUNT_NOT_EXIST 12
@@ -23,6 +30,7 @@
 #define S_LOGGEDIN 14
 #define S_POST_SUCC 20
 #define S_NOT_LOGIN 21
+#define S_POST_FAIL 22
 #define S_LOGOUT_SUCC 30
 #define S_UNREGCONIZE_COMMAND 99
 
@@ -33,9 +41,33 @@
 #define SM_LOGGEDIN "You already logged in"
 #define SM_POST_SUCC "Post the article successfully"
 #define SM_NOT_LOGIN "No permission because you are not logged in"
+#define SM_POST_FAIL "Fail to save the article"
 #define SM_LOGOUT_SUCC "Log out successfully"
 #define SM_UNREGCONIZE_COMMAND "Unregconize command"
 
+/// Preformatted responses: The status code (STATUS_LENGTH digits) followed by the status message. They are sent as they are
+#define _RESPONSE_STATUS(status) #status
+#define RESPONSE_MESSAGE(status, message) _RESPONSE_STATUS(status) message
+
+#define RM_LOGIN_SUCC RESPONSE_MESSAGE(S_LOGIN_SUCC, SM_LOGIN_SUCC)
+#define RM_ACCOUNT_LOCK RESPONSE_MESSAGE(S_ACCOUNT_LOCK, SM_ACCOUNT_LOCK)
+#define RM_ACCOUNT_NOT_EXIST RESPONSE_MESSAGE(S_ACCOUNT_NOT_EXIST, SM_ACCOUNT_NOT_EXIST)
+#define RM_ACCOUNT_LOGGEDIN RESPONSE_MESSAGE(S_ACCOUNT_LOGGEDIN, SM_ACCOUNT_LOGGEDIN)
+#define RM_LOGGEDIN RESPONSE_MESSAGE(S_LOGGEDIN, SM_LOGGEDIN)
+#define RM_POST_SUCC RESPONSE_MESSAGE(S_POST_SUCC, SM_POST_SUCC)
+#define RM_NOT_LOGIN RESPONSE_MESSAGE(S_NOT_LOGIN, SM_NOT_LOGIN)
+#define RM_POST_FAIL RESPONSE_MESSAGE(S_POST_FAIL, SM_POST_FAIL)
+#define RM_LOGOUT_SUCC RESPONSE_MESSAGE(S_LOGOUT_SUCC, SM_LOGOUT_SUCC)
+#define RM_UNREGCONIZE_COMMAND RESPONSE_MESSAGE(S_UNREGCONIZE_COMMAND, SM_UNREGCONIZE_COMMAND)
+
+#define COMMAND_MAX_LENGTH 6 // Maximum length of a command text. See PACK_COMMAND()
+/// Pack the lower-case letters of a command text into a number: The first letter in the lowest byte. See ExtractRequestCommand()
+#define PACK_COMMAND(a, b, c, d, e, f) ((unsigned long long)(a) | (unsigned long long)(b) << 8 | (unsigned long long)(c) << 16 | \
+		(unsigned long long)(d) << 24 | (unsigned long long)(e) << 32 | (unsigned long long)(f) << 40)
+#define PC_POST PACK_COMMAND('p', 'o', 's', 't', 0, 0) // CM_POST
+#define PC_LOGIN PACK_COMMAND('u', 's', 'e', 'r', 0, 0) // CM_LOGIN
+#define PC_LOGOUT PACK_COMMAND('b', 'y', 'e', 0, 0, 0) // CM_LOGOUT
+
 #define AS_FREE 0
 #define AS_LOCK 1
 #define AS_LOGGED_IN 2
@@ -45,27 +77,94 @@
 
 typedef struct accountinfo {
 
-	SOCKET socket; // The socket work on this account
-
 	char* account; // User name
 
-	int status; // Account status. See AS_ for some definitions of account status
+	volatile LONG status; // Account status. See AS_ for some definitions of account status. Changed by Interlocked functions only
+
+	unsigned int hash; // Hash of the case-folded user name. See HashAccountName()
 
 	struct accountinfo* next; // Next account. Linked List
 
 }ACCOUNTINFO;
 
-#pragma endregion
+/// <summary>
+/// Hash index of accounts: Open addressing (linear probing) keyed on the case-folded user name.
+/// The index is not changed after it is built, so lookups take no lock.
+/// </summary>
+typedef struct accountindex {
 
-#pragma region Function Declarations
+	ACCOUNTINFO* accounts; // All accounts read from file, in file order. Linked List. Owned by the index
+
+	unsigned int count; // Number of indexed accounts. A duplicated user name is indexed once: The first one in file
+
+	unsigned int mask; // Number of slots - 1. The number of slots is a power of 2, at least twice "count"
+
+	ACCOUNTINFO** slots; // The slots. NULL if the slot is empty
+
+}ACCOUNTINDEX;
 
 /// <summary>
-/// Append an item to linked list. [Preserve following items]
+/// The header of an article record. A record is the header, the author and the content (each one ends with '\0'), padded to 8 bytes.
+/// Records are appended to segment files and never changed.
 /// </summary>
-/// <param name="prev">The previous item. NULL if want to insert to head.</param>
-/// <param name="current">The item want to append</param>
-/// <returns>The item used to append [current]</returns>
-ACCOUNTINFO* Append(ACCOUNTINFO* prev, ACCOUNTINFO* current);
+typedef struct articleheader {
+
+	unsigned int magic; // ARTICLE_MAGIC
+
+	unsigned int checksum; // CRC-32 of the author and the content, continued over the header fields after this one. See ChecksumArticle()
+
+	unsigned long long id; // Article ID: Increases by 1 on each post, from 1
+
+	unsigned int length; // Length of the content, not including '\0'
+
+	unsigned short author_length; // Length of the author name, not including '\0'
+
+	unsigned short reserved; // 0
+
+} ARTICLEHEADER;
+
+/// <summary>
+/// Log-structured article store. Posts append records to the append buffer; The commit thread takes the whole buffer,
+/// writes it to the last segment and flushes it to the disk with one FlushFileBuffers() (group commit). An article is durable
+/// once "durable_id" reaches its ID.
+/// </summary>
+typedef struct articlestore {
+
+	const char* directory; // The directory of the segment files
+
+	char* appending; // The buffer posts append to
+
+	char* committing; // The buffer being written by the commit thread
+
+	int used; // Number of bytes appended to "appending"
+
+	unsigned long long last_id; // ID of the last appended article
+
+	unsigned long long durable_id; // ID of the last durable article: Every article up to it is on the disk
+
+	int failed; // 1 if a commit failed: No article is accepted anymore
+
+	int stopped; // 1 if the store is closing
+
+	HANDLE segment; // The last segment file. Used by the commit thread only
+
+	unsigned int segment_number; // The number of the last segment
+
+	long long segment_size; // Size of the last segment, in bytes
+
+	HANDLE thread; // The commit thread
+
+	CRITICAL_SECTION lock; // Protect the fields above, except the ones of the commit thread
+
+	CONDITION_VARIABLE appended; // Signaled when an article is appended or the store is closing
+
+	CONDITION_VARIABLE committed; // Signaled when the buffers are swapped or a commit ends
+
+} ARTICLESTORE;
+
+#pragma endregion
+
+#pragma region Function Declarations
 
 /// <summary>
 /// Create a ACCOUNTINFO node.
@@ -73,24 +172,30 @@ ACCOUNTINFO* Append(ACCOUNTINFO* prev, ACCOUNTINFO* current);
 /// <param name="username">The name is assigned to "account" field</param>
 /// <param name="namelen">The length of usernam used to assign</param>
 /// <param name="status">The status is assigned to "status" field</param>
-/// <returns>An ACCCOUNTINFO node that use INVALID_SOCKET for "socket" field and NULL for "next" field.</returns>
+/// <returns>An ACCCOUNTINFO node that use NULL for "next" field. NULL if fail to allocate memory</returns>
 ACCOUNTINFO* CreateAccountInfo(const char* username, int namelen, int status);
 
 /// <summary>
-/// Find first ACCOUNTINFO node that has "socket" field is equal to [socket] argument.
+/// Hash a user name (FNV-1a) after case folding: The names equal under ICompare() have the same hash.
+/// </summary>
+/// <param name="username">The user name</param>
+/// <returns>The hash</returns>
+unsigned int HashAccountName(const char* username);
+
+/// <summary>
+/// Build the hash index of accounts.
 /// </summary>
-/// <param name="start">The start node that searching begins</param>
-/// <param name="socket">The socket identifier used for searching</param>
-/// <returns>The first found node. NULL if have no node satisfies</returns>
-ACCOUNTINFO* FindFirstAccountInfo(ACCOUNTINFO* start, SOCKET socket);
+/// <param name="accounts">The head of the accounts linked list. The index owns the list if success</param>
+/// <returns>The index. NULL if fail to allocate memory</returns>
+ACCOUNTINDEX* CreateAccountIndex(ACCOUNTINFO* accounts);
 
 /// <summary>
-/// Find first ACCOUNTINFO node that has "account" field is equal to [username] argument. [Case-insensitive searching]
+/// Find the ACCOUNTINFO node that has "account" field is equal to [username] argument. [Case-insensitive searching]
 /// </summary>
-/// <param name="start">The start node that searching begins</param>
+/// <param name="index">The account index</param>
 /// <param name="username">The searching keyword</param>
-/// <returns>The first found node. NULL if have no node satisfies</returns>
-ACCOUNTINFO* FindFirstAccountInfo(ACCOUNTINFO* start, const char* username);
+/// <returns>The found node. NULL if have no node satisfies</returns>
+ACCOUNTINFO* FindAccountInfo(const ACCOUNTINDEX* index, const char* username);
 
 /// <summary>
 /// Free memory use for ACCOUNINFO linked list.
@@ -99,17 +204,115 @@ ACCOUNTINFO* FindFirstAccountInfo(ACCOUNTINFO* start, const char* username);
 void FreeAccountList(ACCOUNTINFO* first);
 
 /// <summary>
-/// Load ACCOUNTINFO nodes from file. [Set ACCOUNT_FILE_PATH]
+/// Free memory use for an account index and its accounts.
+/// </summary>
+/// <param name="index">The account index. May be NULL</param>
+void FreeAccountIndex(ACCOUNTINDEX* index);
+
+/// <summary>
+/// Load ACCOUNTINFO nodes from file and Build the hash index. [Set ACCOUNT_FILE_PATH]
 /// </summary>
 /// <param name="file">The path to the file want to read.</param>
-/// <returns>1 if success. 0 if have some errors on file operations.</returns>
-int LoadAccountList(const char* file);
+/// <returns>The account index. NULL if have some errors on file operations or memory allocation.</returns>
+ACCOUNTINDEX* LoadAccountIndex(const char* file);
+
+/// <summary>
+/// Open the article store in a directory: Recover the last segment and Begin the commit thread.
+/// The posts continue after the last durable article; An incomplete record at the end of a segment is discarded.
+/// </summary>
+/// <param name="directory">The directory of the segment files. Created if not exist</param>
+/// <returns>The article store. NULL if have errors</returns>
+ARTICLESTORE* OpenArticleStore(const char* directory);
+
+/// <summary>
+/// Find the last segment and Read it to the last valid record: Set the segment fields and the article IDs of the store.
+/// </summary>
+/// <param name="store">The article store</param>
+/// <returns>1 if success. 0 if have errors on file operations</returns>
+int RecoverArticleStore(ARTICLESTORE* store);
+
+/// <summary>
+/// Stop the commit thread after every appended article is committed, then Close the store and Free it.
+/// </summary>
+/// <param name="store">The article store. May be NULL</param>
+void CloseArticleStore(ARTICLESTORE* store);
+
+/// <summary>
+/// Append an article to the append buffer. If the buffer is full, Wait for the commit thread to take it.
+/// The article is not durable yet: See WaitArticleDurable()
+/// </summary>
+/// <param name="store">The article store</param>
+/// <param name="author">The user name of the author. NULL is saved as an empty name</param>
+/// <param name="content">The content of the article</param>
+/// <param name="oid">[Output] The ID of the article</param>
+/// <returns>1 if success. 0 if the article is larger than ARTICLE_BUFFER_SIZE or the store fails</returns>
+int AppendArticle(ARTICLESTORE* store, const char* author, const char* content, unsigned long long* oid);
+
+/// <summary>
+/// Wait until an article is durable or the store fails.
+/// </summary>
+/// <param name="store">The article store</param>
+/// <param name="id">The article ID</param>
+/// <returns>The ID of the last durable article: Less than "id" if the article could not be saved</returns>
+unsigned long long WaitArticleDurable(ARTICLESTORE* store, unsigned long long id);
+
+/// <summary>
+/// [Thread] Commit the appended articles: Take the whole append buffer at once, Write it to the last segment and Flush it to the disk.
+/// The posts appended during a commit are committed together by the next one.
+/// </summary>
+/// <param name="arguments">A pointer to the article store. [Cast directly]</param>
+/// <returns>0. [The thread is also terminated]</returns>
+unsigned __stdcall CommitArticles(void* arguments);
+
+/// <summary>
+/// Finish the checksum of an article record: Continue the CRC-32 of the author and the content over the header fields after "checksum"
+/// </summary>
+/// <param name="header">The record header. The "id" field is set</param>
+/// <param name="payload_crc">The CRC-32 of the author and the content, with their '\0'</param>
+/// <returns>The checksum</returns>
+unsigned int ChecksumArticle(const ARTICLEHEADER* header, unsigned int payload_crc);
+
+/// <summary>
+/// Get the size of an article record in a segment, including the padding
+/// </summary>
+/// <param name="header">The record header</param>
+/// <returns>The record size, in bytes</returns>
+int GetArticleRecordSize(const ARTICLEHEADER* header);
+
+/// <summary>
+/// Open a segment file of the article store
+/// </summary>
+/// <param name="directory">The directory of the segment files</param>
+/// <param name="number">The segment number</param>
+/// <param name="disposition">OPEN_EXISTING, OPEN_ALWAYS or CREATE_ALWAYS (See CreateFile())</param>
+/// <returns>The file handle, for reading and writing. INVALID_HANDLE_VALUE if have errors</returns>
+HANDLE OpenArticleSegment(const char* directory, unsigned int number, DWORD disposition);
+
+/// <summary>
+/// Read a segment file record by record and Check the checksums. The segment is truncated after the last valid record
+/// and the file pointer is left at its end.
+/// </summary>
+/// <param name="segment">The segment file handle</param>
+/// <param name="olast_id">[Output] The ID of the last valid record. Not changed if the segment has no valid record</param>
+/// <returns>The size of the valid records, in bytes. -1 if have errors on file operations</returns>
+long long RecoverArticleSegment(HANDLE segment, unsigned long long* olast_id);
+
+/// <summary>
+/// Write a batch of article records to the last segment and Flush it to the disk.
+/// Roll over to a new segment first if the batch makes the last one larger than ARTICLE_SEGMENT_MAX_SIZE. [Call on the commit thread]
+/// </summary>
+/// <param name="store">The article store</param>
+/// <param name="batch">The records</param>
+/// <param name="size">Size of the records, in bytes</param>
+/// <returns>1 if the batch is durable. 0 if have errors on file operations</returns>
+int WriteArticleBatch(ARTICLESTORE* store, const char* batch, int size);
 
 /// <summary>
-/// Extract command and arguments from a request.
+/// Extract command and arguments from a request in one pass: The command text is case-folded and packed into a number (See PACK_COMMAND()).
+/// [No allocation: The arguments point into the request]
 /// </summary>
 /// <param name="request">The input request.</param>
-/// <param name="oarguments">[Output] The command arguments</param>
+/// <param name="oarguments">[Output] The command arguments. Empty if the command has no arguments</param>
 /// <returns>The command code. See C_ for some command codes and CM_ for some commands text</returns>
 int ExtractRequestCommand(const char* request, char** oarguments);
 
@@ -155,39 +358,43 @@ unsigned __stdcall Run(void* arguments);
 /// <summary>
 /// End session for a connected socket. [Log out the account working on that socket, if have any]
 /// </summary>
-/// <param name="socket">The connected socket</param>
-void EndSession(SOCKET socket);
+/// <param name="iosession">[Input/Output] The account logged in on the socket. NULL if not logged in</param>
+void EndSession(ACCOUNTINFO** iosession);
 
 /// <summary>
 /// Processing the post request
 /// </summary>
 /// <param name="socket">The connected socket identify the client</param>
 /// <param name="arguments">The arguments for post request [The article want to post to server]</param>
-/// <returns>The response message for client</returns>
-MESSAGE HandlePostRequest(SOCKET socket, const char* arguments);
+/// <param name="iosession">[Input/Output] The account logged in on the socket. NULL if not logged in</param>
+/// <returns>The response message for client, after the article is durable. [Preformatted: See RM_]</returns>
+const char* HandlePostRequest(SOCKET socket, const char* arguments, ACCOUNTINFO** iosession);
 
 /// <summary>
 /// Processing the login request
 /// </summary>
 /// <param name="socket">The connected socket identify the client</param>
 /// <param name="arguments">The arguments for login request [The username want to login]</param>
-/// <returns>The response message for client</returns>
-MESSAGE HandleLoginRequest(SOCKET socket, const char* arguments);
+/// <param name="iosession">[Input/Output] The account logged in on the socket. NULL if not logged in</param>
+/// <returns>The response message for client. [Preformatted: See RM_]</returns>
+const char* HandleLoginRequest(SOCKET socket, const char* arguments, ACCOUNTINFO** iosession);
 
 /// <summary>
 /// Processing the logout request
 /// </summary>
 /// <param name="socket">The connected socket identify the client</param>
-/// <returns>The response message for client</returns>
-MESSAGE HandleLogoutRequest(SOCKET socket);
+/// <param name="iosession">[Input/Output] The account logged in on the socket. NULL if not logged in</param>
+/// <returns>The response message for client. [Preformatted: See RM_]</returns>
+const char* HandleLogoutRequest(SOCKET socket, ACCOUNTINFO** iosession);
 
 /// <summary>
 /// Handle request: Read requests from buffer, Processing requests and Send response back.
 /// </summary>
 /// <param name="socket">The connected socket to the remote process</param>
+/// <param name="iosession">[Input/Output] The account logged in on the socket. NULL if not logged in</param>
 /// <returns>1 if have no errors. 0 if request cant be processed completely. 
 /// -1 if have errors and the socket cant be used anymore (lost connection to remote process)</returns>
-int HandleRequest(SOCKET socket);
+int HandleRequest(SOCKET socket, ACCOUNTINFO** iosession);
 
 /// <summary>
 /// Extract port number from command-line arguments.
@@ -206,19 +413,18 @@ int ExtractCommand(int argc, char* argv[], int* oport);
 IP CreateDefaultIP();
 
 /// <summary>
-/// Create a Message object that contains a status.
-/// The first STATUS_LENGTH byte of Message is the status code: See S_ for some status code
+/// Build the lookup table of Crc32(). [Call before Crc32() is used]
 /// </summary>
-/// <param name="status">The status code</param>
-/// <param name="message">The response message. Use NULL if have no additional message</param>
-/// <returns>A command message. NULL if memory allocation fail</returns>
-MESSAGE CreateMessage(int status, const char* message);
+void BuildCrc32Table();
 
 /// <summary>
-/// Free memory for Message object
+/// Compute the CRC-32 (IEEE) of a byte stream, or Continue a previous CRC-32 over it
 /// </summary>
-/// <param name="m">The message want to free</param>
-void DestroyMessage(MESSAGE m);
+/// <param name="data">The byte stream</param>
+/// <param name="length">Number of bytes</param>
+/// <param name="crc">The CRC-32 of the previous bytes. Default: 0 (No previous bytes)</param>
+/// <returns>The CRC-32</returns>
+unsigned int Crc32(const char* data, int length, unsigned int crc = 0);
 
 /// <summary>
 /// Compare two string [case-insensitive]
@@ -34,11 +34,19 @@ int main(int argc, char* argv[])
                     printf("[%s] Ready to communicate...\n", INFO_FLAGS);
                     PrintMenu();
                     MESSAGE request;
+                    MESSAGE requests[PIPELINE_MAX_REQUESTS];
                     int status = 1;
                     while (status != -1) {
                         status = HandleInput(&request);
                         if (status == -1)
                             break;
+                        if (status == INPUT_BULK_POST) {
+                            int count = HandleBulkInput(requests, PIPELINE_MAX_REQUESTS);
+                            status = RunPipeline(socket, requests, count);
+                            for (int i = 0; i < count; ++i)
+                                DestroyMessage(requests[i]);
+                            continue;
+                        }
                         status = Run(socket, request);
                         DestroyMessage(request);
                     }
@@ -212,16 +220,9 @@ int SegmentationSend(SOCKET sender, const char* message, int message_len, int* o
     return 1;
 }
 
-int Receive(SOCKET receiver, int bytes, char** obyte_stream)
+int Receive(SOCKET receiver, int bytes, char* obuffer)
 {
-    if (bytes > APPLICATION_BUFF_MAX_SIZE)
-    {
-        printf("[%s] %s\n", WARNING_FLAGS, _TOO_MUCH_BYTES);
-        bytes = APPLICATION_BUFF_MAX_SIZE;
-    }
-    char buffer[APPLICATION_BUFF_MAX_SIZE];
-
-    int ret = recv(receiver, buffer, bytes, 0);
+    int ret = recv(receiver, obuffer, bytes, MSG_WAITALL); // a segment may arrive in many pieces
     if (ret == SOCKET_ERROR) {
         int err = WSAGetLastError();
         if (err == WSAECONNABORTED || err == WSAECONNRESET) {
@@ -237,76 +238,55 @@ int Receive(SOCKET receiver, int bytes, char** obyte_stream)
     }
     else if (ret < bytes) {
         printf("[%s] %s\n", WARNING_FLAGS, _RECEIVE_UNEXPECTED_MESSAGE);
-        *obyte_stream = NULL;
         return 0;
     }
-    else {
-        *obyte_stream = Clone(buffer, bytes);
-    }
     return 1;
 }
 
-int ReceiveSegment(SOCKET receiver, char** obyte_stream, int* ostream_len, int* oremain)
+int ReceiveSegmentHeader(SOCKET receiver, int* ocurrent, int* oremain)
 {
-    *obyte_stream = NULL;
-    char* read;
-    int remain;
-    int current;
-    // read number of bytes remain | number of bytes current
-    int ret = Receive(receiver, SEGMENT_HEADER_SIZE, &read);
-    if (ret == 1) {
-        current = ntohs(*(unsigned short*)read);
-        remain = ntohs(*(unsigned short*)(read + SEGMENT_HEADER_CURRENT_SIZE));
-
-        *ostream_len = current;
-        *oremain = remain;
-        free(read);
-    }
-    else {
-        *ostream_len = 0;
-        *oremain = 0;
+    char header[SEGMENT_HEADER_SIZE];
+    *ocurrent = 0;
+    *oremain = 0;
+    // read number of bytes current | number of bytes remain
+    int ret = Receive(receiver, SEGMENT_HEADER_SIZE, header);
+    if (ret != 1)
         return ret;
-    }
 
-    // read message content
-    ret = Receive(receiver, current, &read);
-    if (ret == 1) {
-        *obyte_stream = Clone(read, current);
-        free(read);
-    }
-    else {
-        *ostream_len = 0;
-        *oremain = 0;
-        return ret;
-    }
+    *ocurrent = ntohs(*(unsigned short*)header);
+    *oremain = ntohs(*(unsigned short*)(header + SEGMENT_HEADER_CURRENT_SIZE));
     return 1;
 }
 
 int SegmentationReceive(SOCKET socket, char** omessage)
 {
-    char* _message;
-    int mlen, remain, start_byte = 0;
-    int status = 1;
+    int current, remain, start_byte = 0;
     *omessage = NULL;
+    // the first header gives the message size: the segment contents are read into the message directly
+    int status = ReceiveSegmentHeader(socket, &current, &remain);
+    if (status != 1)
+        return status;
+    int size = current + remain;
+    *omessage = (char*)malloc((size_t)size);
+    if (*omessage == NULL) {
+        printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
+        return 0;
+    }
+
     while (1) {
-        status = ReceiveSegment(socket, &_message, &mlen, &remain);
-        if (status != 1) {
-            free(_message);
-            return status;
+        if (current > size - start_byte) {
+            printf("[%s] %s\n", WARNING_FLAGS, _TOO_MUCH_BYTES);
+            return 0;
         }
-        if (*omessage == NULL) {
-            *omessage = (char*)malloc((size_t)mlen + remain);
-            if (*omessage == NULL) {
-                printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
-                free(_message);
-                return 0;
-            }
-        }
-        memcpy_s(*omessage + start_byte, mlen, _message, mlen);
-        start_byte += mlen;
-        free(_message);
+        status = Receive(socket, current, *omessage + start_byte);
+        if (status != 1)
+            return status;
+        start_byte += current;
         if (remain <= 0)
             break;
+        status = ReceiveSegmentHeader(socket, &current, &remain);
+        if (status != 1)
+            return status;
     }
     return status;
 }
@@ -327,6 +307,27 @@ int Run(SOCKET socket, MESSAGE message)
     return status;
 }
 
+int RunPipeline(SOCKET socket, MESSAGE* requests, int count)
+{
+    int sent = 0, received = 0;
+    int status = 1;
+    while (received < count && status == 1) {
+        // keep up to PIPELINE_MAX_INFLIGHT requests waiting for response
+        while (sent < count && sent - received < PIPELINE_MAX_INFLIGHT && status == 1) {
+            if (requests[sent] != NULL)
+                status = SegmentationSend(socket, requests[sent], (int)strlen(requests[sent]) + 1, NULL);
+            sent++;
+        }
+        // responses come back in the order of requests
+        if (status == 1) {
+            if (requests[received] != NULL)
+                status = HandleResponse(socket);
+            received++;
+        }
+    }
+    return status;
+}
+
 int HandleResponse(SOCKET socket)
 {
     MESSAGE response = NULL;
@@ -362,6 +363,7 @@ void PrintMenu()
     printf("\t#     2. Post status               #\n");
     printf("\t#     3. Log out                   #\n");
     printf("\t#     4. Custom request            #\n");
+    printf("\t#     5. Post many articles        #\n");
     printf("\t# Other. Exit program              #\n");
     printf("\t####################################\n");
 }
@@ -403,12 +405,30 @@ int HandleInput(MESSAGE* omessage)
         gets_s(request, USER_INPUT_MAX_SIZE);
         *omessage = Clone(request, (int)strlen(request) + 1);
     }
+    else if (c == '5') {
+        scanf_s("%c", &c, 1); //consume \n
+        status = INPUT_BULK_POST;
+    }
     else {
         status = -1;
     }
     return status;
 }
 
+int HandleBulkInput(MESSAGE* orequests, int max_count)
+{
+    char request[USER_INPUT_MAX_SIZE];
+    int count = 0;
+    printf("[%s] [Post] Enter your articles, one per line. Enter an empty line to finish (max %d articles):\n", USER_INPUT_FLAGS, max_count);
+    while (count < max_count) {
+        gets_s(request, USER_INPUT_MAX_SIZE);
+        if (strlen(request) == 0)
+            break;
+        orequests[count++] = CreateMessage(CM_POST, request);
+    }
+    return count;
+}
+
 int ExtractCommand(int argc, char* argv[], int* oport, IP* oip)
 {
     int is_ok = 1;
@@ -9,6 +9,11 @@
 #pragma region Constants Definitions
 
 #define OUTPUT_FLAGS "**"
+
+#define INPUT_BULK_POST 2
+
+#define PIPELINE_MAX_REQUESTS 64 // Maximum number of requests read from user at once
+#define PIPELINE_MAX_INFLIGHT 16 // Maximum number of requests sent but not responded
 #pragma endregion
 
 #pragma region Function Declarations
@@ -29,6 +34,16 @@ int EstablishConnection(SOCKET socket, ADDRESS address);
 /// <returns>1 if success. 0 if have some errors while sending or receiving. -1 if have errors that the socket should be closed</returns>
 int Run(SOCKET socket, MESSAGE request);
 
+/// <summary>
+/// Send many requests to server without waiting for each response and Handle the responses in order.
+/// At most PIPELINE_MAX_INFLIGHT requests are waiting for response at a time.
+/// </summary>
+/// <param name="socket">The connected socket to server</param>
+/// <param name="requests">The requests want to send. NULL items are skipped</param>
+/// <param name="count">Number of requests</param>
+/// <returns>1 if success. 0 if have some errors while sending or receiving. -1 if have errors that the socket should be closed</returns>
+int RunPipeline(SOCKET socket, MESSAGE* requests, int count);
+
 /// <summary>
 /// Handle the response from remote process: Collect message segmentations, Merge them and Print to console
 /// </summary>
@@ -52,9 +67,17 @@ void PrintMenu();
 /// Get user command and create a Message from the result.
 /// </summary>
 /// <param name="omessage">[Output] The created message</param>
-/// <returns>1 if success. 0 if some user input is invalid. -1 if user choose a unsupported function</returns>
+/// <returns>1 if success. 0 if some user input is invalid. -1 if user choose a unsupported function. INPUT_BULK_POST if user choose to post many articles [See HandleBulkInput()]</returns>
 int HandleInput(MESSAGE* omessage);
 
+/// <summary>
+/// Get many articles from user, one per line, and create a post Message for each of them.
+/// </summary>
+/// <param name="orequests">[Output] The created messages</param>
+/// <param name="max_count">The maximum number of messages can be created</param>
+/// <returns>Number of created messages</returns>
+int HandleBulkInput(MESSAGE* orequests, int max_count);
+
 /// <summary>
 /// Extract port number and ipv4 string from command-line arguments.
 /// If has error, set oport = 0 and oip = NULL.
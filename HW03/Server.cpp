@@ -1,8 +1,9 @@
 #include "Server.h"
 
-ACCOUNTINFO* gAccounts = NULL;
+ACCOUNTINDEX* gAccounts = NULL; // The account index. Read-only after loading
+ARTICLESTORE* gArticles = NULL; // The article store. Posts are appended to it
+unsigned int gCrc32Table[256]; // Lookup table of Crc32(). See BuildCrc32Table()
 SOCKETSMANAGER* gSocketsManager = NULL;
-CRITICAL_SECTION gAccountCriticalSection;
 CRITICAL_SECTION gSocketsManagerCriticalSection;
 
 int main(int argc, char* argv[])
@@ -20,9 +21,11 @@ int main(int argc, char* argv[])
 
 					printf("[%s] Listenning at port %d...\n", INFO_FLAGS, running_port);
 
-					if (LoadAccountList(ACCOUNT_FILE_PATH)) {
+					gArticles = OpenArticleStore(ARTICLE_DIRECTORY);
+					if (gArticles == NULL)
+						printf("[%s] %s\n", ERROR_FLAGS, _OPEN_ARTICLE_STORE_FAIL);
+					else if ((gAccounts = LoadAccountIndex(ACCOUNT_FILE_PATH)) != NULL) {
 
-						InitializeCriticalSection(&gAccountCriticalSection);
 						InitializeCriticalSection(&gSocketsManagerCriticalSection);
 						while (1) {
 							SOCKET connector = GetConnectionSocket(listener);
@@ -39,10 +42,10 @@ int main(int argc, char* argv[])
 							}
 						}
 						DeleteCriticalSection(&gSocketsManagerCriticalSection);
-						DeleteCriticalSection(&gAccountCriticalSection);
 
-						FreeAccountList(gAccounts);
+						FreeAccountIndex(gAccounts);
 					}
+					CloseArticleStore(gArticles);
 				}
 			}
 		}
@@ -99,7 +102,7 @@ unsigned __stdcall Run(void* arguments)
 				LeaveCriticalSection(&gSocketsManagerCriticalSection);
 
 				if (FD_ISSET(connector, sset)) {
-					int status = HandleRequest(connector, &connector_account_status);
+					int status = HandleRequests(connector, &connector_account_status);
 
 					if (status == -1) { // have fatal error
 						CloseSocket(connector, CLOSE_SAFELY);
@@ -130,52 +133,56 @@ unsigned __stdcall Run(void* arguments)
 
 #pragma region Handle Request
 
-MESSAGE HandlePostRequest(SOCKET socket, const char* arguments, int* ioaccount_status)
+const char* HandlePostRequest(SOCKET socket, const char* arguments, int* ioaccount_status, unsigned long long* oarticle_id)
 {
+	*oarticle_id = 0;
 	if (*ioaccount_status == AS_FREE) {
-		return CreateMessage(S_NOT_LOGIN, SM_NOT_LOGIN);
+		return RM_NOT_LOGIN;
 	}
 
-	return CreateMessage(S_POST_SUCC, SM_POST_SUCC);
+	// the session does not keep the user name: the author is saved empty
+	if (!AppendArticle(gArticles, NULL, arguments, oarticle_id)) {
+		return RM_POST_FAIL;
+	}
+	return RM_POST_SUCC;
 }
 
-MESSAGE HandleLoginRequest(SOCKET socket, const char* arguments, int* ioaccount_status)
+const char* HandleLoginRequest(SOCKET socket, const char* arguments, int* ioaccount_status)
 {
 	if (*ioaccount_status == AS_LOGGED_IN) {
-		return CreateMessage(S_LOGGEDIN, SM_LOGGEDIN);
+		return RM_LOGGEDIN;
 	}
 
-	EnterCriticalSection(&gAccountCriticalSection);
-	ACCOUNTINFO* acc = FindFirstAccountInfo(gAccounts, arguments);
+	// the index is read-only: no lock
+	ACCOUNTINFO* acc = FindAccountInfo(gAccounts, arguments);
 	int status = acc == NULL ? -1 : acc->status;
-	LeaveCriticalSection(&gAccountCriticalSection);
 
 	if (status == -1) { // not found
-		return CreateMessage(S_ACCOUNT_NOT_EXIST, SM_ACCOUNT_NOT_EXIST);
+		return RM_ACCOUNT_NOT_EXIST;
 	}
 	//else if (status == AS_LOGGED_IN) {
-	//	return CreateMessage(S_ACCOUNT_LOGGEDIN, SM_ACCOUNT_LOGGEDIN);
+	//	return RM_ACCOUNT_LOGGEDIN;
 	//}
 	else if (status == AS_LOCK) {
-		return CreateMessage(S_ACCOUNT_LOCK, SM_ACCOUNT_LOCK);
+		return RM_ACCOUNT_LOCK;
 	}
 	else { // AS_FREE
 		*ioaccount_status = AS_LOGGED_IN;
 	}
-	return CreateMessage(S_LOGIN_SUCC, SM_LOGIN_SUCC);
+	return RM_LOGIN_SUCC;
 }
 
-MESSAGE HandleLogoutRequest(SOCKET socket, int* ioaccount_status)
+const char* HandleLogoutRequest(SOCKET socket, int* ioaccount_status)
 {
 	if (*ioaccount_status == AS_FREE) {
-		return CreateMessage(S_NOT_LOGIN, SM_NOT_LOGIN);
+		return RM_NOT_LOGIN;
 	}
 
 	*ioaccount_status = AS_FREE;
-	return CreateMessage(S_LOGOUT_SUCC, SM_LOGOUT_SUCC);
+	return RM_LOGOUT_SUCC;
 }
 
-int HandleRequest(SOCKET socket, int* ioaccount_status)
+int HandleRequest(SOCKET socket, int* ioaccount_status, const char** oresponse, unsigned long long* oarticle_id)
 {
 	char* request, *arguments;
 	int status = 1;
@@ -185,11 +192,12 @@ int HandleRequest(SOCKET socket, int* ioaccount_status)
 		return status;
 	}
 
-	MESSAGE response = NULL;
+	const char* response = NULL;
+	*oarticle_id = 0;
 	// Handle request
 	int command = ExtractRequestCommand(request, &arguments);
 	if (command == C_POST) {
-		response = HandlePostRequest(socket, arguments, ioaccount_status);
+		response = HandlePostRequest(socket, arguments, ioaccount_status, oarticle_id);
 	}
 	else if (command == C_LOGIN) {
 		response = HandleLoginRequest(socket, arguments, ioaccount_status);
@@ -198,45 +206,294 @@ int HandleRequest(SOCKET socket, int* ioaccount_status)
 		response = HandleLogoutRequest(socket, ioaccount_status);
 	}
 	else {
-		response = CreateMessage(S_UNREGCONIZE_COMMAND, SM_UNREGCONIZE_COMMAND);
+		response = RM_UNREGCONIZE_COMMAND;
 	}
 	free(request);
 
-	// Send response
-	status = SegmentationSend(socket, response, (int)strlen(response) + 1, NULL);
-	DestroyMessage(response);
+	*oresponse = response;
 	return status;
 }
 
-int ExtractRequestCommand(const char* request, char** oarguments)
+int HandleRequests(SOCKET socket, int* ioaccount_status)
+{
+	const char* responses[PIPELINE_MAX_REQUESTS];
+	unsigned long long article_ids[PIPELINE_MAX_REQUESTS];
+	unsigned long long last_id = 0;
+	int handled = 0;
+	int status = 1;
+	do {
+		status = HandleRequest(socket, ioaccount_status, &responses[handled], &article_ids[handled]);
+		if (status != 1)
+			break;
+		if (article_ids[handled] != 0)
+			last_id = article_ids[handled];
+	} while (++handled < PIPELINE_MAX_REQUESTS && HasCompleteRequest(socket));
+
+	// one wait for the posts of the batch: the articles are committed together
+	unsigned long long durable_id = last_id == 0 ? 0 : WaitArticleDurable(gArticles, last_id);
+
+	// Send responses
+	for (int i = 0; i < handled; ++i) {
+		const char* response = article_ids[i] > durable_id ? RM_POST_FAIL : responses[i];
+		int sent = SegmentationSend(socket, response, (int)strlen(response) + 1, NULL);
+		if (sent != 1)
+			return sent;
+	}
+	return status;
+}
+
+int HasCompleteRequest(SOCKET socket)
 {
-	char* space_pos = (char*)memchr(request, ' ', strlen(request));
-	if (space_pos == NULL) {
-		if (ICompare(request, CM_LOGOUT, (int)max(strlen(CM_LOGOUT), strlen(request))) == 0)
-			return C_LOGOUT;
+	char buffer[PIPELINE_PEEK_SIZE];
+	int ret = recv(socket, buffer, PIPELINE_PEEK_SIZE, MSG_PEEK);
+	if (ret == SOCKET_ERROR || ret == 0)
 		return 0;
+
+	// walk through the segment headers until the last segment of the request
+	int start_byte = 0;
+	while (start_byte + SEGMENT_HEADER_SIZE <= ret) {
+		int current = ntohs(*(unsigned short*)(buffer + start_byte));
+		int remain = ntohs(*(unsigned short*)(buffer + start_byte + SEGMENT_HEADER_CURRENT_SIZE));
+		start_byte += SEGMENT_HEADER_SIZE + current;
+		if (start_byte > ret)
+			return 0;
+		if (remain <= 0)
+			return 1;
 	}
+	return 0;
+}
 
-	*oarguments = space_pos + 1;
-	// match command
-	if (ICompare(request, CM_POST,
-		(int)max((int)strlen(CM_POST), (space_pos - request)))
-		== 0)
-		return C_POST;
-	else if (ICompare(request, CM_LOGIN,
-		(int)max((int)strlen(CM_LOGIN), (space_pos - request)))
-		== 0)
-		return C_LOGIN;
-	else if (ICompare(request, CM_LOGOUT,
-		(int)max((int)strlen(CM_LOGOUT), (space_pos - request)))
-		== 0)
+int ExtractRequestCommand(const char* request, char** oarguments)
+{
+	// one pass over the command text: its case-folded letters are packed into a number
+	unsigned long long command = 0;
+	int length = 0;
+	for (; request[length] != ' ' && request[length] != '\0'; ++length) {
+		if (length == COMMAND_MAX_LENGTH)
+			return 0;
+		command |= (unsigned long long)((unsigned char)request[length] | 0x20) << (8 * length);
+	}
+	int has_arguments = request[length] == ' ';
+	*oarguments = (char*)request + length + has_arguments;
+
+	switch (command) {
+	case PC_POST:
+		return has_arguments ? C_POST : 0;
+	case PC_LOGIN:
+		return has_arguments ? C_LOGIN : 0;
+	case PC_LOGOUT:
 		return C_LOGOUT;
-
+	}
 	return 0;
 }
 
 #pragma endregion
 
+#pragma region Article Store
+
+ARTICLESTORE* OpenArticleStore(const char* directory)
+{
+	if (!CreateDirectoryA(directory, NULL) && GetLastError() != ERROR_ALREADY_EXISTS) {
+		printf("[%s] Fail to create article directory: '%s'\n", ERROR_FLAGS, directory);
+		return NULL;
+	}
+	BuildCrc32Table();
+
+	ARTICLESTORE* store = (ARTICLESTORE*)calloc(1, sizeof(ARTICLESTORE));
+	if (store == NULL) {
+		printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
+		return NULL;
+	}
+	store->directory = directory;
+	store->segment = INVALID_HANDLE_VALUE;
+	InitializeCriticalSection(&store->lock);
+	InitializeConditionVariable(&store->appended);
+	InitializeConditionVariable(&store->committed);
+	store->appending = (char*)malloc(ARTICLE_BUFFER_SIZE);
+	store->committing = (char*)malloc(ARTICLE_BUFFER_SIZE);
+	if (store->appending == NULL || store->committing == NULL) {
+		printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
+		CloseArticleStore(store);
+		return NULL;
+	}
+
+	if (!RecoverArticleStore(store)) {
+		CloseArticleStore(store);
+		return NULL;
+	}
+	store->thread = (HANDLE)_beginthreadex(NULL, 0, CommitArticles, (void*)store, 0, NULL);
+	if (store->thread == 0) {
+		printf("[%s] %s\n", WARNING_FLAGS, _TOO_MANY_THREADS);
+		CloseArticleStore(store);
+		return NULL;
+	}
+	printf("[%s] Article store '%s': %llu articles, segment %u\n", INFO_FLAGS, directory, store->last_id, store->segment_number);
+	return store;
+}
+
+int RecoverArticleStore(ARTICLESTORE* store)
+{
+	unsigned int last = 1;
+	HANDLE next;
+	while ((next = OpenArticleSegment(store->directory, last + 1, OPEN_EXISTING)) != INVALID_HANDLE_VALUE) {
+		CloseHandle(next);
+		last++;
+	}
+
+	store->segment_number = last;
+	store->segment = OpenArticleSegment(store->directory, last, OPEN_ALWAYS);
+	if (store->segment == INVALID_HANDLE_VALUE) {
+		printf("[%s] Fail to open article segment %u\n", ERROR_FLAGS, last);
+		return 0;
+	}
+	unsigned long long last_id = 0;
+	store->segment_size = RecoverArticleSegment(store->segment, &last_id);
+	if (store->segment_size < 0) {
+		printf("[%s] Fail to read article segment %u\n", ERROR_FLAGS, last);
+		return 0;
+	}
+	// the last segment has no article (rolled over just before a crash): the IDs continue from the previous one
+	for (unsigned int number = last - 1; last_id == 0 && number > 0; --number) {
+		HANDLE previous = OpenArticleSegment(store->directory, number, OPEN_EXISTING);
+		if (previous == INVALID_HANDLE_VALUE)
+			return 0;
+		long long size = RecoverArticleSegment(previous, &last_id);
+		CloseHandle(previous);
+		if (size < 0)
+			return 0;
+	}
+	store->last_id = last_id;
+	store->durable_id = last_id;
+	return 1;
+}
+
+void CloseArticleStore(ARTICLESTORE* store)
+{
+	if (store == NULL)
+		return;
+	if (store->thread != 0) {
+		EnterCriticalSection(&store->lock);
+		store->stopped = 1;
+		WakeAllConditionVariable(&store->appended);
+		WakeAllConditionVariable(&store->committed);
+		LeaveCriticalSection(&store->lock);
+		WaitForSingleObject(store->thread, INFINITE);
+		CloseHandle(store->thread);
+	}
+	if (store->segment != INVALID_HANDLE_VALUE)
+		CloseHandle(store->segment);
+	DeleteCriticalSection(&store->lock);
+	free(store->appending);
+	free(store->committing);
+	free(store);
+}
+
+int AppendArticle(ARTICLESTORE* store, const char* author, const char* content, unsigned long long* oid)
+{
+	if (author == NULL)
+		author = "";
+	ARTICLEHEADER header;
+	header.magic = ARTICLE_MAGIC;
+	header.id = 0;
+	header.length = (unsigned int)strlen(content);
+	header.author_length = (unsigned short)strlen(author);
+	header.reserved = 0;
+	int size = GetArticleRecordSize(&header);
+	if (size > ARTICLE_BUFFER_SIZE)
+		return 0;
+	// the payload is checksummed out of the lock: only the header fields depend on the ID
+	unsigned int payload_crc = Crc32(author, header.author_length + 1);
+	payload_crc = Crc32(content, header.length + 1, payload_crc);
+
+	int appended = 0;
+	EnterCriticalSection(&store->lock);
+	while (!store->failed && !store->stopped && store->used + size > ARTICLE_BUFFER_SIZE) {
+		SleepConditionVariableCS(&store->committed, &store->lock, INFINITE); // the buffer is full until the commit thread takes it
+	}
+	if (!store->failed && !store->stopped) {
+		header.id = ++store->last_id;
+		header.checksum = ChecksumArticle(&header, payload_crc);
+
+		char* record = store->appending + store->used;
+		int offset = sizeof(ARTICLEHEADER);
+		memcpy_s(record, size, &header, sizeof(ARTICLEHEADER));
+		memcpy_s(record + offset, size - offset, author, (size_t)header.author_length + 1);
+		offset += header.author_length + 1;
+		memcpy_s(record + offset, size - offset, content, (size_t)header.length + 1);
+		offset += header.length + 1;
+		memset(record + offset, 0, (size_t)size - offset); // padding
+
+		store->used += size;
+		*oid = header.id;
+		appended = 1;
+		WakeConditionVariable(&store->appended);
+	}
+	LeaveCriticalSection(&store->lock);
+	return appended;
+}
+
+unsigned long long WaitArticleDurable(ARTICLESTORE* store, unsigned long long id)
+{
+	EnterCriticalSection(&store->lock);
+	while (store->durable_id < id && !store->failed) {
+		SleepConditionVariableCS(&store->committed, &store->lock, INFINITE);
+	}
+	unsigned long long durable_id = store->durable_id;
+	LeaveCriticalSection(&store->lock);
+	return durable_id;
+}
+
+unsigned __stdcall CommitArticles(void* arguments)
+{
+	ARTICLESTORE* store = (ARTICLESTORE*)arguments;
+	EnterCriticalSection(&store->lock);
+	while (1) {
+		while (store->used == 0 && !store->stopped) {
+			SleepConditionVariableCS(&store->appended, &store->lock, INFINITE);
+		}
+		if (store->used == 0) // stopped: every appended article is committed
+			break;
+
+		// group commit: every article appended so far goes in one write and one flush.
+		// The posts keep appending to the other buffer meanwhile
+		char* batch = store->appending;
+		int size = store->used;
+		unsigned long long last_id = store->last_id;
+		int failed = store->failed;
+		store->appending = store->committing;
+		store->committing = batch;
+		store->used = 0;
+		WakeAllConditionVariable(&store->committed); // the posts waiting for a free buffer
+		LeaveCriticalSection(&store->lock);
+
+		// after a failure nothing is written: the articles after a broken record would be lost on recovery
+		int is_ok = !failed && WriteArticleBatch(store, batch, size);
+
+		EnterCriticalSection(&store->lock);
+		if (is_ok)
+			store->durable_id = last_id;
+		else
+			store->failed = 1;
+		WakeAllConditionVariable(&store->committed);
+	}
+	LeaveCriticalSection(&store->lock);
+	return 0; // terminate thread
+}
+
+unsigned int ChecksumArticle(const ARTICLEHEADER* header, unsigned int payload_crc)
+{
+	const char* fields = (const char*)&header->id;
+	return Crc32(fields, (int)(sizeof(ARTICLEHEADER) - (fields - (const char*)header)), payload_crc);
+}
+
+int GetArticleRecordSize(const ARTICLEHEADER* header)
+{
+	int size = (int)sizeof(ARTICLEHEADER) + header->author_length + 1 + (int)header->length + 1;
+	return (size + 7) & ~7; // the next header is aligned
+}
+
+#pragma endregion
+
 #pragma region Linked Lists
 
 SOCKETSMANAGER* FindFirstFreeManagerOrCreateNew(int* ois_new)
@@ -321,39 +578,78 @@ void FreeSocketsManagerList(SOCKETSMANAGER* first)
 	}
 }
 
-ACCOUNTINFO* Append(ACCOUNTINFO* prev, ACCOUNTINFO* current)
-{
-	if (prev != NULL) {
-		current->next = prev->next;
-		prev->next = current;
-	}
-	else {
-		current->next = gAccounts;
-		gAccounts = current;
-	}
-	return current;
-}
-
 ACCOUNTINFO* CreateAccountInfo(const char* username, int namelen, int status)
 {
 	ACCOUNTINFO* acc = (ACCOUNTINFO*)malloc(sizeof(ACCOUNTINFO));
 	if (acc != NULL) {
-		acc->account = Clone(username, namelen);
+		acc->account = Clone(username, namelen + 1);
+		if (acc->account == NULL) {
+			free(acc);
+			return NULL;
+		}
 		acc->account[namelen] = '\0';
-		//acc->socket = INVALID_SOCKET;
 		acc->status = status;
+		acc->hash = HashAccountName(acc->account);
 		acc->next = NULL;
 	}
 	return acc;
 }
 
-ACCOUNTINFO* FindFirstAccountInfo(ACCOUNTINFO* start, const char* username)
+unsigned int HashAccountName(const char* username)
 {
-	ACCOUNTINFO* cur = start;
-	while (cur != NULL) {
-		if (ICompare(username, cur->account) == 0)
-			return cur;
-		cur = cur->next;
+	unsigned int hash = 2166136261u;
+	for (const char* c = username; *c != '\0'; ++c) {
+		char folded = (*c >= 'A' && *c <= 'Z') ? *c - 'A' + 'a' : *c;
+		hash = (hash ^ (unsigned char)folded) * 16777619u;
+	}
+	return hash;
+}
+
+ACCOUNTINDEX* CreateAccountIndex(ACCOUNTINFO* accounts)
+{
+	unsigned int count = 0;
+	for (ACCOUNTINFO* cur = accounts; cur != NULL; cur = cur->next) {
+		count++;
+	}
+	unsigned int slots = ACCOUNT_INDEX_MIN_SLOTS;
+	while (slots < 2 * count) {
+		slots <<= 1;
+	}
+
+	ACCOUNTINDEX* index = (ACCOUNTINDEX*)malloc(sizeof(ACCOUNTINDEX));
+	if (index != NULL && (index->slots = (ACCOUNTINFO**)calloc(slots, sizeof(ACCOUNTINFO*))) == NULL) {
+		free(index);
+		index = NULL;
+	}
+	if (index == NULL) {
+		printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
+		return NULL;
+	}
+	index->accounts = accounts;
+	index->count = 0;
+	index->mask = slots - 1;
+
+	for (ACCOUNTINFO* cur = accounts; cur != NULL; cur = cur->next) {
+		unsigned int i = cur->hash & index->mask;
+		while (index->slots[i] != NULL &&
+			(index->slots[i]->hash != cur->hash || ICompare(cur->account, index->slots[i]->account) != 0)) {
+			i = (i + 1) & index->mask;
+		}
+		if (index->slots[i] == NULL) { // a duplicated name keeps the first one
+			index->slots[i] = cur;
+			index->count++;
+		}
+	}
+	return index;
+}
+
+ACCOUNTINFO* FindAccountInfo(const ACCOUNTINDEX* index, const char* username)
+{
+	unsigned int hash = HashAccountName(username);
+	for (unsigned int i = hash & index->mask; index->slots[i] != NULL; i = (i + 1) & index->mask) {
+		ACCOUNTINFO* acc = index->slots[i];
+		if (acc->hash == hash && ICompare(username, acc->account) == 0)
+			return acc;
 	}
 	return NULL;
 }
@@ -370,35 +666,135 @@ void FreeAccountList(ACCOUNTINFO* first)
 	}
 }
 
+void FreeAccountIndex(ACCOUNTINDEX* index)
+{
+	if (index == NULL)
+		return;
+	FreeAccountList(index->accounts);
+	free(index->slots);
+	free(index);
+}
+
 #pragma endregion
 
 #pragma region I/O Operations
 
-int LoadAccountList(const char* file)
+ACCOUNTINDEX* LoadAccountIndex(const char* file)
 {
 	FILE* fp;
 	fopen_s(&fp, file, "r");
 	if (fp == NULL) {
 		printf("[%s] Fail to open account file: '%s'\n", ERROR_FLAGS, file);
-		return 0;
+		return NULL;
 	}
 	char line[LINE_MAX_SIZE];
 	int status;
-	ACCOUNTINFO* cur = NULL;
+	ACCOUNTINFO* head = NULL, * tail = NULL, * acc = NULL;
 	while (fgets(line, LINE_MAX_SIZE, fp)) {
 		char* space_pos = (char*)memchr(line, ' ', strlen(line));
 		if (space_pos == NULL) {
-			if (strlen(line) > 1) {
-				status = AS_LOCK;
-				cur = Append(cur, CreateAccountInfo(line, (int)strlen(line), status));
-			}
+			if (strlen(line) <= 1)
+				continue;
+			status = AS_LOCK;
+			acc = CreateAccountInfo(line, (int)strlen(line), status);
 		}
 		else {
 			status = atoi(space_pos + 1);
-			cur = Append(cur, CreateAccountInfo(line, (int)(space_pos - line), status));
+			acc = CreateAccountInfo(line, (int)(space_pos - line), status);
 		}
+		if (acc == NULL)
+			continue;
+		// keep the file order: the first one of duplicated names is indexed
+		if (tail == NULL)
+			head = acc;
+		else
+			tail->next = acc;
+		tail = acc;
 	}
 	fclose(fp);
+
+	ACCOUNTINDEX* index = CreateAccountIndex(head);
+	if (index == NULL)
+		FreeAccountList(head);
+	return index;
+}
+
+HANDLE OpenArticleSegment(const char* directory, unsigned int number, DWORD disposition)
+{
+	char path[MAX_PATH];
+	sprintf_s(path, MAX_PATH, ARTICLE_SEGMENT_NAME, directory, number);
+	return CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, disposition, FILE_ATTRIBUTE_NORMAL, NULL);
+}
+
+long long RecoverArticleSegment(HANDLE segment, unsigned long long* olast_id)
+{
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(segment, &file_size))
+		return -1;
+	char* record = (char*)malloc(ARTICLE_BUFFER_SIZE);
+	if (record == NULL) {
+		printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
+		return -1;
+	}
+
+	long long valid_size = 0;
+	unsigned long long last_id = 0;
+	ARTICLEHEADER* header = (ARTICLEHEADER*)record;
+	DWORD read = 0;
+	while (ReadFile(segment, record, sizeof(ARTICLEHEADER), &read, NULL) && read == sizeof(ARTICLEHEADER)) {
+		// a torn write leaves a record with a wrong header or checksum: it and everything after it are dropped
+		if (header->magic != ARTICLE_MAGIC || header->id <= last_id || header->length > ARTICLE_BUFFER_SIZE)
+			break;
+		int size = GetArticleRecordSize(header);
+		if (size > ARTICLE_BUFFER_SIZE || valid_size + size > file_size.QuadPart)
+			break;
+		DWORD rest = (DWORD)(size - sizeof(ARTICLEHEADER));
+		if (!ReadFile(segment, record + sizeof(ARTICLEHEADER), rest, &read, NULL) || read != rest)
+			break;
+		unsigned int payload_crc = Crc32(record + sizeof(ARTICLEHEADER), header->author_length + 1 + (int)header->length + 1);
+		if (ChecksumArticle(header, payload_crc) != header->checksum)
+			break;
+		valid_size += size;
+		last_id = header->id;
+	}
+	free(record);
+
+	if (last_id != 0)
+		*olast_id = last_id;
+	LARGE_INTEGER end;
+	end.QuadPart = valid_size;
+	if (!SetFilePointerEx(segment, end, NULL, FILE_BEGIN))
+		return -1;
+	if (valid_size < file_size.QuadPart) {
+		printf("[%s] %s\n", WARNING_FLAGS, _DISCARD_INCOMPLETE_ARTICLE);
+		if (!SetEndOfFile(segment) || !FlushFileBuffers(segment))
+			return -1;
+	}
+	return valid_size;
+}
+
+int WriteArticleBatch(ARTICLESTORE* store, const char* batch, int size)
+{
+	// the records of a batch stay in one segment
+	if (store->segment_size > 0 && store->segment_size + size > ARTICLE_SEGMENT_MAX_SIZE) {
+		HANDLE next = OpenArticleSegment(store->directory, store->segment_number + 1, CREATE_ALWAYS);
+		if (next == INVALID_HANDLE_VALUE) {
+			printf("[%s:%d] %s\n", ERROR_FLAGS, (int)GetLastError(), _COMMIT_ARTICLES_FAIL);
+			return 0;
+		}
+		CloseHandle(store->segment);
+		store->segment = next;
+		store->segment_number++;
+		store->segment_size = 0;
+	}
+
+	DWORD written = 0;
+	if (!WriteFile(store->segment, batch, (DWORD)size, &written, NULL) || written != (DWORD)size ||
+		!FlushFileBuffers(store->segment)) {
+		printf("[%s:%d] %s\n", ERROR_FLAGS, (int)GetLastError(), _COMMIT_ARTICLES_FAIL);
+		return 0;
+	}
+	store->segment_size += size;
 	return 1;
 }
 
@@ -585,16 +981,9 @@ int SegmentationSend(SOCKET sender, const char* message, int message_len, int* o
 	return 1;
 }
 
-int Receive(SOCKET receiver, int bytes, char** obyte_stream)
+int Receive(SOCKET receiver, int bytes, char* obuffer)
 {
-	if (bytes > APPLICATION_BUFF_MAX_SIZE)
-	{
-		printf("[%s] %s\n", WARNING_FLAGS, _TOO_MUCH_BYTES);
-		bytes = APPLICATION_BUFF_MAX_SIZE;
-	}
-	char buffer[APPLICATION_BUFF_MAX_SIZE];
-
-	int ret = recv(receiver, buffer, bytes, 0);
+	int ret = recv(receiver, obuffer, bytes, MSG_WAITALL); // a segment may arrive in many pieces
 	if (ret == SOCKET_ERROR) {
 		int err = WSAGetLastError();
 		if (err == WSAECONNABORTED || err == WSAECONNRESET) {
@@ -610,76 +999,55 @@ int Receive(SOCKET receiver, int bytes, char** obyte_stream)
 	}
 	else if (ret < bytes) {
 		printf("[%s] %s\n", WARNING_FLAGS, _RECEIVE_UNEXPECTED_MESSAGE);
-		*obyte_stream = NULL;
 		return 0;
 	}
-	else {
-		*obyte_stream = Clone(buffer, bytes);
-	}
 	return 1;
 }
 
-int ReceiveSegment(SOCKET receiver, char** obyte_stream, int* ostream_len, int* oremain)
+int ReceiveSegmentHeader(SOCKET receiver, int* ocurrent, int* oremain)
 {
-	*obyte_stream = NULL;
-	char* read;
-	int remain;
-	int current;
-	// read number of bytes remain | number of bytes current
-	int ret = Receive(receiver, SEGMENT_HEADER_SIZE, &read);
-	if (ret == 1) {
-		current = ntohs(*(unsigned short*)read);
-		remain = ntohs(*(unsigned short*)(read + SEGMENT_HEADER_CURRENT_SIZE));
-
-		*ostream_len = current;
-		*oremain = remain;
-		free(read);
-	}
-	else {
-		*ostream_len = 0;
-		*oremain = 0;
+	char header[SEGMENT_HEADER_SIZE];
+	*ocurrent = 0;
+	*oremain = 0;
+	// read number of bytes current | number of bytes remain
+	int ret = Receive(receiver, SEGMENT_HEADER_SIZE, header);
+	if (ret != 1)
 		return ret;
-	}
 
-	// read message content
-	ret = Receive(receiver, current, &read);
-	if (ret == 1) {
-		*obyte_stream = Clone(read, current);
-		free(read);
-	}
-	else {
-		*ostream_len = 0;
-		*oremain = 0;
-		return ret;
-	}
+	*ocurrent = ntohs(*(unsigned short*)header);
+	*oremain = ntohs(*(unsigned short*)(header + SEGMENT_HEADER_CURRENT_SIZE));
 	return 1;
 }
 
 int SegmentationReceive(SOCKET socket, char** omessage)
 {
-	char* _message;
-	int mlen, remain, start_byte = 0;
-	int status = 1;
+	int current, remain, start_byte = 0;
 	*omessage = NULL;
+	// the first header gives the message size: the segment contents are read into the message directly
+	int status = ReceiveSegmentHeader(socket, &current, &remain);
+	if (status != 1)
+		return status;
+	int size = current + remain;
+	*omessage = (char*)malloc((size_t)size);
+	if (*omessage == NULL) {
+		printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
+		return 0;
+	}
+
 	while (1) {
-		status = ReceiveSegment(socket, &_message, &mlen, &remain);
-		if (status != 1) {
-			free(_message);
-			return status;
-		}
-		if (*omessage == NULL) {
-			*omessage = (char*)malloc((size_t)mlen + remain);
-			if (*omessage == NULL) {
-				printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
-				free(_message);
-				return 0;
-			}
+		if (current > size - start_byte) {
+			printf("[%s] %s\n", WARNING_FLAGS, _TOO_MUCH_BYTES);
+			return 0;
 		}
-		memcpy_s(*omessage + start_byte, mlen, _message, mlen);
-		start_byte += mlen;
-		free(_message);
+		status = Receive(socket, current, *omessage + start_byte);
+		if (status != 1)
+			return status;
+		start_byte += current;
 		if (remain <= 0)
 			break;
+		status = ReceiveSegmentHeader(socket, &current, &remain);
+		if (status != 1)
+			return status;
 	}
 	return status;
 }
@@ -716,6 +1084,26 @@ IP CreateDefaultIP()
 	return addr;
 }
 
+void BuildCrc32Table()
+{
+	for (unsigned int i = 0; i < 256; ++i) {
+		unsigned int crc = i;
+		for (int bit = 0; bit < 8; ++bit) {
+			crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320u : crc >> 1;
+		}
+		gCrc32Table[i] = crc;
+	}
+}
+
+unsigned int Crc32(const char* data, int length, unsigned int crc)
+{
+	crc = ~crc;
+	for (int i = 0; i < length; ++i) {
+		crc = gCrc32Table[(crc ^ (unsigned char)data[i]) & 0xFF] ^ (crc >> 8);
+	}
+	return ~crc;
+}
+
 char* Clone(const char* source, int length, int start)
 {
 	char* _clone = (char*)malloc((size_t)length + start);
@@ -727,28 +1115,6 @@ char* Clone(const char* source, int length, int start)
 	return _clone;
 }
 
-MESSAGE CreateMessage(int status, const char* message)
-{
-	MESSAGE m;
-	if (message == NULL) {
-		m = Clone("", 1, STATUS_LENGTH);
-	}
-	else {
-		m = Clone(message, (int)strlen(message) + 1, STATUS_LENGTH);
-	}
-	if (m != NULL) {
-		// accept 2 digits value for status
-		m[0] = status / 10 + '0';
-		m[1] = status % 10 + '0';
-	}
-	return m;
-}
-
-void DestroyMessage(MESSAGE m)
-{
-	free(m);
-}
-
 int ICompare(const char* first, const char* second, int length)
 {
 	int flen = (int)strlen(first) + 1;
@@ -197,35 +197,58 @@ int Send(SOCKET sender, int bytes, const char* byte_stream)
     return 1;
 }
 
+int SendBuffers(SOCKET sender, WSABUF* buffers, int buffer_count)
+{
+    DWORD bytes = 0, sent = 0;
+    for (int i = 0; i < buffer_count; ++i) {
+        bytes += buffers[i].len;
+    }
+    if (WSASend(sender, buffers, buffer_count, &sent, 0, NULL, NULL) == SOCKET_ERROR) {
+        int err = WSAGetLastError();
+        if (err == WSAEHOSTUNREACH) {
+            printf("[%s:%d] %s\n", WARNING_FLAGS, err, _HOST_UNREACHABLE);
+        }
+        else if (err == WSAECONNABORTED || err == WSAECONNRESET) {
+            printf("[%s:%d] %s\n", ERROR_FLAGS, err, _CONNECTION_DROP);
+        }
+        else {
+            printf("[%s:%d] %s\n", WARNING_FLAGS, err, _SEND_FAIL);
+        }
+        return -1;
+    }
+    else if (sent < bytes) {
+        printf("[%s] %s\n", WARNING_FLAGS, _SEND_NOT_ALL);
+        return 0;
+    }
+    return 1;
+}
+
 int SegmentationSend(SOCKET sender, const char* message, int message_len, int* obyte_sent)
 {
+    WSABUF buffers[SEND_MAX_BUFFERS];
+    SEGMENT_LENGTH headers[SEND_MAX_BUFFERS / 2][2];
     int start_byte = 0; // start byte in message.
-    unsigned short bsend = 0; // number of bytes will send, not include header size.
-    unsigned short bremain = 0; // number of bytes remain.
-
-    char content[APPLICATION_BUFF_MAX_SIZE];
     while (start_byte < message_len) {
-        // Prepare content for sending: header (number of bytes send | number of bytes remain) + body (a part of message)
-        bsend = message_len - start_byte;
-        if (bsend + SEGMENT_HEADER_SIZE > APPLICATION_BUFF_MAX_SIZE) {
-            bsend = APPLICATION_BUFF_MAX_SIZE - SEGMENT_HEADER_SIZE;
-        }
-        bremain = message_len - start_byte - bsend;
-
-        int bsend_bigendian = htons(bsend); // uniform with many architectures.
-        int bremain_bigendian = htons(bremain);
-
-        memcpy_s(content, SEGMENT_HEADER_CURRENT_SIZE, &bsend_bigendian, SEGMENT_HEADER_CURRENT_SIZE);
-        memcpy_s(content + SEGMENT_HEADER_CURRENT_SIZE, SEGMENT_HEADER_REMAIN_SIZE, &bremain_bigendian, SEGMENT_HEADER_REMAIN_SIZE);
-        memcpy_s(content + SEGMENT_HEADER_SIZE, bsend, message + start_byte, bsend);
-        // Send
-        int ret = Send(sender, bsend + SEGMENT_HEADER_SIZE, content);
-        if (ret == 1) {
+        // Prepare the segments: header (number of bytes send | number of bytes remain) + body (a part of message, not copied)
+        int count = 0;
+        int batch_start = start_byte;
+        for (; start_byte < message_len && count + 2 <= SEND_MAX_BUFFERS; count += 2) {
+            int bsend = message_len - start_byte; // number of bytes will send, not include header size.
+            if (bsend > SEGMENT_MAX_SIZE)
+                bsend = SEGMENT_MAX_SIZE;
+            headers[count / 2][0] = ToSegmentLength(bsend); // uniform with many architectures.
+            headers[count / 2][1] = ToSegmentLength(message_len - start_byte - bsend);
+            buffers[count].buf = (char*)headers[count / 2];
+            buffers[count].len = SEGMENT_HEADER_SIZE;
+            buffers[count + 1].buf = (char*)message + start_byte;
+            buffers[count + 1].len = (ULONG)bsend;
             start_byte += bsend;
         }
-        else {
+        // Send the segments with one call
+        int ret = SendBuffers(sender, buffers, count);
+        if (ret != 1) {
             if (obyte_sent != NULL)
-                *obyte_sent = start_byte;
+                *obyte_sent = batch_start;
             return ret;
         }
     }
@@ -234,16 +257,9 @@ int SegmentationSend(SOCKET sender, const char* message, int message_len, int* o
     return 1;
 }
 
-int Receive(SOCKET receiver, int length, char** obyte_stream)
+int Receive(SOCKET receiver, int bytes, char* obuffer)
 {
-    if (length > APPLICATION_BUFF_MAX_SIZE)
-    {
-        printf("[%s] %s\n", WARNING_FLAGS, _TOO_MUCH_BYTES);
-        length = APPLICATION_BUFF_MAX_SIZE;
-    }
-    char buffer[APPLICATION_BUFF_MAX_SIZE];
-
-    int ret = recv(receiver, buffer, length, 0);
+    int ret = recv(receiver, obuffer, bytes, MSG_WAITALL); // a segment may arrive in many pieces
     if (ret == SOCKET_ERROR) {
         int err = WSAGetLastError();
         if (err == WSAECONNABORTED || err == WSAECONNRESET) {
@@ -257,78 +273,67 @@ int Receive(SOCKET receiver, int length, char** obyte_stream)
     else if (ret == 0) {
         return -1;
     }
-    else if (ret < length) {
+    else if (ret < bytes) {
         printf("[%s] %s\n", WARNING_FLAGS, _RECEIVE_UNEXPECTED_MESSAGE);
-        *obyte_stream = NULL;
         return 0;
     }
-    else {
-        *obyte_stream = Clone(buffer, length);
-    }
     return 1;
 }
 
-int ReceiveSegment(SOCKET receiver, char** obyte_stream, int* ostream_len, int* oremain)
+int ReceiveSegmentHeader(SOCKET receiver, int* ocurrent, int* oremain)
 {
-    *obyte_stream = NULL;
-    char* read;
-    int remain;
-    int current;
-    // read number of bytes remain | number of bytes current
-    int ret = Receive(receiver, SEGMENT_HEADER_SIZE, &read);
-    if (ret == 1) {
-        current = ntohs(*(unsigned short*)read);
-        remain = ntohs(*(unsigned short*)(read + SEGMENT_HEADER_CURRENT_SIZE));
-
-        *ostream_len = current;
-        *oremain = remain;
-        free(read);
-    }
-    else {
-        *ostream_len = 0;
-        *oremain = 0;
+    char header[SEGMENT_HEADER_SIZE];
+    *ocurrent = 0;
+    *oremain = 0;
+    // read number of bytes current | number of bytes remain
+    int ret = Receive(receiver, SEGMENT_HEADER_SIZE, header);
+    if (ret != 1)
         return ret;
-    }
 
-    // read message content
-    ret = Receive(receiver, current, &read);
-    if (ret == 1) {
-        *obyte_stream = Clone(read, current);
-        free(read);
-    }
-    else {
-        *ostream_len = 0;
-        *oremain = 0;
-        return ret;
+    unsigned int current = FromSegmentLength(*(SEGMENT_LENGTH*)header);
+    unsigned int remain = FromSegmentLength(*(SEGMENT_LENGTH*)(header + SEGMENT_HEADER_CURRENT_SIZE));
+    if (current > MESSAGE_MAX_LENGTH || remain > MESSAGE_MAX_LENGTH) {
+        printf("[%s] %s\n", WARNING_FLAGS, _TOO_MUCH_BYTES);
+        return -1; // the rest of the message can not be skipped
     }
+    *ocurrent = (int)current;
+    *oremain = (int)remain;
     return 1;
 }
 
 int SegmentationReceive(SOCKET socket, char** omessage)
 {
-    char* _message;
-    int mlen, remain, start_byte = 0;
-    int status = 1;
+    int current, remain, start_byte = 0;
     *omessage = NULL;
+    // the first header gives the message size: the segment contents are read into the message directly
+    int status = ReceiveSegmentHeader(socket, &current, &remain);
+    if (status != 1)
+        return status;
+    int size = current + remain;
+    if (size > MESSAGE_MAX_LENGTH) {
+        printf("[%s] %s\n", WARNING_FLAGS, _TOO_MUCH_BYTES);
+        return -1;
+    }
+    *omessage = (char*)malloc((size_t)size);
+    if (*omessage == NULL) {
+        printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
+        return 0;
+    }
+
     while (1) {
-        status = ReceiveSegment(socket, &_message, &mlen, &remain);
-        if (status != 1) {
-            free(_message);
-            return status;
-        }
-        if (*omessage == NULL) {
-            *omessage = (char*)malloc((size_t)mlen + remain);
-            if (*omessage == NULL) {
-                printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
-                free(_message);
-                return 0;
-            }
+        if (current > size - start_byte) {
+            printf("[%s] %s\n", WARNING_FLAGS, _TOO_MUCH_BYTES);
+            return 0;
         }
-        memcpy_s(*omessage + start_byte, mlen, _message, mlen);
-        start_byte += mlen;
-        free(_message);
+        status = Receive(socket, current, *omessage + start_byte);
+        if (status != 1)
+            return status;
+        start_byte += current;
         if (remain <= 0)
             break;
+        status = ReceiveSegmentHeader(socket, &current, &remain);
+        if (status != 1)
+            return status;
     }
     return status;
 }
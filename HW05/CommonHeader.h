@@ -28,17 +28,35 @@
 #define CLOSE_NORMAL 0
 #define CLOSE_SAFELY 1
 
+//#define SEGMENT_HEADER_16BIT // Framing mode: Define it in the server and both clients to talk with peers built for the 16-bit segment headers
+#ifdef SEGMENT_HEADER_16BIT
 #define SEGMENT_HEADER_REMAIN_SIZE 2
 #define SEGMENT_HEADER_CURRENT_SIZE 2
 #define SEGMENT_HEADER_SIZE 4
+#define SEGMENT_MAX_SIZE (APPLICATION_BUFF_MAX_SIZE - SEGMENT_HEADER_SIZE) // Maximum number of message bytes in a segment: A segment fits in the 1 KB buffer of the 16-bit peers
+#define MESSAGE_MAX_LENGTH 0xFFFF // Maximum length of a message accepted by SegmentationReceive(): The remain length is 16-bit
+#else
+#define SEGMENT_HEADER_REMAIN_SIZE 4
+#define SEGMENT_HEADER_CURRENT_SIZE 4
+#define SEGMENT_HEADER_SIZE 8
+#define SEGMENT_MAX_SIZE (64 * 1024) // Maximum number of message bytes in a segment: The lengths in a segment header are 32-bit
+#define MESSAGE_MAX_LENGTH (4 * 1024 * 1024) // Maximum length of a message accepted by SegmentationReceive()
+#endif // SEGMENT_HEADER_16BIT
+#define SEND_MAX_BUFFERS 512 // Maximum number of buffers given to one WSASend(): A longer message is sent with several calls
 
 #define C_LOGIN 1
 #define C_POST 2
 #define C_LOGOUT 3
+#define C_RECENT 4
+#define C_AUTHOR 5
+#define C_GET 6
 
 #define CM_LOGIN "USER"
 #define CM_POST "POST"
 #define CM_LOGOUT "BYE"
+#define CM_RECENT "RECENT"
+#define CM_AUTHOR "AUTHOR"
+#define CM_GET "GET"
 
 #define COMMAND_LENGTH 5
 #define STATUS_LENGTH 2
@@ -50,6 +68,16 @@
 #define IP IN_ADDR
 #define MESSAGE char*
 
+#ifdef SEGMENT_HEADER_16BIT
+#define SEGMENT_LENGTH u_short // A length in a segment header, big-endian
+#define ToSegmentLength(length) htons((u_short)(length))
+#define FromSegmentLength(length) ntohs(length)
+#else
+#define SEGMENT_LENGTH u_long // A length in a segment header, big-endian
+#define ToSegmentLength(length) htonl((u_long)(length))
+#define FromSegmentLength(length) ntohl(length)
+#endif // SEGMENT_HEADER_16BIT
+
 #pragma endregion
 
 #pragma region Error Debugging
@@ -79,6 +107,8 @@
 #define _LISTEN_EVENTS_FAIL "Fail to listen on sockets' events."
 #define _CHECK_EVENT_STATUS_FAIL "Fail to check status of the event for the socket."
 #define _ATTACH_EVENT_FAIL "Fail to attach a receive event for the socket."
+#define _POLL_SOCKETS_FAIL "Fail to poll on sockets."
+#define _SET_NON_BLOCKING_FAIL "Fail to set non-blocking mode for the socket."
 
 #define _TRANSLATE_DOMAIN_FAIL "Fail to translate the domain name."
 #define _TRANSLATE_IP_FAIL "Fail to translate the IP address."
@@ -105,6 +135,11 @@
 
 #define _TOO_MANY_THREADS "Too many threads are running. Can not create one more thread."
 #define _INSUFFICIENT_RESOURCES "Insufficient resources for creating one more thread."
+
+#define _OPEN_ARTICLE_STORE_FAIL "Fail to open the article store."
+#define _COMMIT_ARTICLES_FAIL "Fail to write the articles to the disk. No more article is accepted."
+#define _DISCARD_INCOMPLETE_ARTICLE "An incomplete article at the end of a segment is discarded."
+#define _CORRUPTED_ARTICLE_SEGMENT "An article segment is corrupted before the end of the store. Nothing is discarded, restore the segment first."
 #pragma endregion
 
 #pragma region Function Declarations
@@ -163,11 +198,21 @@ ADDRESS CreateSocketAddress(IP ip, int port);
 /// <returns>1 if success. 0 if number of bytes sent less than expected. -1 if have errors that the socket should be closed</returns>
 int Send(SOCKET sender, int bytes, const char* byte_stream);
 
+/// <summary>
+/// Write several buffers to the connected socket buffer and send them with one call (WSASend())
+/// </summary>
+/// <param name="sender">The connected socket that is used for sending byte stream</param>
+/// <param name="buffers">[Input/Output] The buffers, in order. They are advanced past the bytes sent</param>
+/// <param name="buffer_count">Number of buffers</param>
+/// <returns>1 if success. 0 if number of bytes sent less than expected. -1 if have errors that the socket should be closed</returns>
+int SendBuffers(SOCKET sender, WSABUF* buffers, int buffer_count);
+
 /// <summary>
 /// Segmentation a message into pieces/segment and Send them with a connected socket.
 /// Each piece attached with the header consists of SEGMENT_HEADER_CURRENT_SIZE first bytes
 /// is the length of message in the piece (not include header size) and SEGMENT_HEADER_REMAIN_SIZE next bytes
-/// is the number of bytes on message that has not been sent.
+/// is the number of bytes on message that has not been sent. Both are big-endian, 32-bit (16-bit if SEGMENT_HEADER_16BIT is defined).
+/// The headers and the pieces are sent from where they are with one SendBuffers() call, up to SEND_MAX_BUFFERS buffers.
 /// </summary>
 /// <param name="sender">The connected socket used for sending</param>
 /// <param name="message">The message want to segmentation and send</param>
@@ -177,28 +222,29 @@ int Send(SOCKET sender, int bytes, const char* byte_stream);
 int SegmentationSend(SOCKET sender, const char* message, int message_len, int* obyte_sent);
 
 /// <summary>
-/// Read a byte stream from a connected socket 
+/// Read a byte stream from a connected socket into a buffer of the caller
 /// </summary>
 /// <param name="receiver">The connected socket that is used for receiving bytes stream</param>
 /// <param name="bytes">Number of bytes want to read</param>
-/// <param name="obyte_stream">[Output] The byte streams read</param>
+/// <param name="obuffer">[Output] The buffer receiving the byte stream. It has at least `bytes` bytes</param>
 /// <returns>1 if read successfully. 0 if cant read fully. -1 if have errors that the socket should be closed</returns>
-int Receive(SOCKET receiver, int bytes, char** obyte_stream);
+int Receive(SOCKET receiver, int bytes, char* obuffer);
 
 int SegmentationReceive(SOCKET receiver, char** obyte_stream, int* ostream_len);
 
 /// <summary>
-/// Read and Extract one part of/a segment of a message from a connected socket.
+/// Read the header of a segment of a message from a connected socket: The segment content is not read.
 /// </summary>
 /// <param name="receiver">The connected socket that is used for receiving byte streams</param>
-/// <param name="obyte_stream">[Output] The extracted segment, after removing SEGMENT_HEADER_SIZE first bytes from byte stream</param>
-/// <param name="ostream_len">[Output] The segment size, in bytes</param>
-/// <param name="oremain">[Output] Number of bytes in source message that have not been received</param>
+/// <param name="ocurrent">[Output] The size of the segment content, in bytes</param>
+/// <param name="oremain">[Output] Number of bytes in source message after the segment</param>
 /// <returns>1 if success. 0 if cant read fully. -1 if have errors that the socket should be closed</returns>
-int ReceiveSegment(SOCKET receiver, char** obyte_stream, int* ostream_len, int* oremain);
+int ReceiveSegmentHeader(SOCKET receiver, int* ocurrent, int* oremain);
 
 /// <summary>
 /// Read segments from a connected socket and Merge them into a complete message.
+/// The message is allocated once from the first segment header and the segment contents are read into it.
+/// A message longer than MESSAGE_MAX_LENGTH is refused.
 /// </summary>
 /// <param name="socket">The connected socket used to receive segments</param>
 /// <param name="omessage">[Output] The merged message</param>
@@ -1,15 +1,19 @@
 #include "Server.h"
 
-ACCOUNTINFO* gAccounts = NULL;
+ACCOUNTINDEX* volatile gAccounts = NULL; // The current account index. Read it by AcquireAccountIndex(). Replaced on reload
+volatile LONG gAccountEpoch = 0; // The reader epoch: Readers count on gAccountReaders[epoch & 1]. Flipped on each reload
+volatile LONG gAccountReaders[2] = { 0, 0 }; // Number of readers of the account index in each epoch
+ARTICLESTORE* gArticles = NULL; // The article store. Posts are appended to it
+unsigned int gCrc32Table[256]; // Lookup table of Crc32(). See BuildCrc32Table()
 /// <summary>
-/// The default sockets manager on server.
-/// On start, its NULL, once have a accept connection, it will not be NULL anymore, but it may does not run on any thread.
-/// Every NEW connected socket will attach to this.
+/// The running sockets managers. On start, its NULL: The first accepted connection starts a manager.
+/// A manager runs on its own thread until it is retired (See RetireSocketsManager()).
 /// </summary>
-SOCKETSMANAGER* gLastSocketsManager = NULL;
 SOCKETSMANAGER* gSocketsManager = NULL;
-CRITICAL_SECTION gAccountCriticalSection; // manage gAccounts
-CRITICAL_SECTION gSocketsManagerCriticalSection; // manage gLastSocketsManager
+int gSocketsManagerCount = 0; // Number of running sockets managers
+int gMaxSocketsManagers = 1; // Maximum number of running sockets managers: One per processor
+SOCKET gWakeSocket = INVALID_SOCKET; // The UDP socket used to wake the threads of sockets managers
+CRITICAL_SECTION gSocketsManagerCriticalSection; // manage gSocketsManager list, the loads and the queued sockets of managers
 
 int main(int argc, char* argv[])
 {
@@ -26,24 +30,42 @@ int main(int argc, char* argv[])
 
 					printf("[%s] Listenning at port %d...\n", INFO_FLAGS, running_port);
 
-					if (LoadAccountList(ACCOUNT_FILE_PATH)) {
-
-						InitializeCriticalSection(&gAccountCriticalSection);
-						InitializeCriticalSection(&gSocketsManagerCriticalSection);
-						while (1) {
-							SOCKET connector = GetConnectionSocket(listener);
-							if (connector != INVALID_SOCKET) {
-								EnterSMCS(
-									AppendSocketOnAThread(connector);
-								)
+					InitializeCriticalSection(&gSocketsManagerCriticalSection); // the commit thread wakes the managers with parked posts
+					gArticles = OpenArticleStore(ARTICLE_DIRECTORY);
+					if (gArticles == NULL)
+						printf("[%s] %s\n", ERROR_FLAGS, _OPEN_ARTICLE_STORE_FAIL);
+					else if ((gAccounts = LoadAccountIndex(ACCOUNT_FILE_PATH)) != NULL) {
+
+						// account changes are applied without restarting
+						HANDLE watcher = (HANDLE)_beginthreadex(NULL, 0, WatchAccountFile, (void*)ACCOUNT_FILE_PATH, 0, NULL);
+						if (watcher == 0)
+							printf("[%s] %s\n", WARNING_FLAGS, _TOO_MANY_THREADS);
+						else
+							CloseHandle(watcher);
+
+						// event-loop threads start on demand, at most one per processor
+						gMaxSocketsManagers = GetProcessorCount();
+						gWakeSocket = CreateSocket(UDP);
+						if (gWakeSocket != INVALID_SOCKET) {
+							while (1) {
+								SOCKET connector = GetConnectionSocket(listener);
+								if (connector != INVALID_SOCKET) {
+									EnterSMCS(
+										AppendSocketOnAThread(connector);
+									)
+								}
 							}
 						}
-						DeleteCriticalSection(&gSocketsManagerCriticalSection);
-						DeleteCriticalSection(&gAccountCriticalSection);
-
-						free(gSocketsManager);
-						FreeAccountList(gAccounts);
+						while (gSocketsManager != NULL) {
+							SOCKETSMANAGER* next = gSocketsManager->next;
+							FreeSocketsManager(gSocketsManager);
+							gSocketsManager = next;
+						}
+						CloseSocket(gWakeSocket, CLOSE_NORMAL);
+						FreeAccountIndex(gAccounts);
 					}
+					CloseArticleStore(gArticles);
+					DeleteCriticalSection(&gSocketsManagerCriticalSection);
 				}
 			}
 		}
@@ -56,33 +78,92 @@ int main(int argc, char* argv[])
 
 #pragma region Thread and Session
 
-void AppendSocketOnAThread(SOCKET socket)
+SOCKETSMANAGER* StartSocketsManager()
+{
+	SOCKETSMANAGER* manager = CreateSocketsManager();
+	if (manager == NULL)
+		return NULL;
+	HANDLE thread = CreateThreadForSocketsManager(manager);
+	if (thread == 0) {
+		FreeSocketsManager(manager);
+		return NULL;
+	}
+	CloseHandle(thread); // the thread frees the manager itself
+
+	manager->next = gSocketsManager;
+	gSocketsManager = manager;
+	gSocketsManagerCount++;
+	return manager;
+}
+
+void UnlinkSocketsManager(SOCKETSMANAGER* manager)
 {
-	if (gLastSocketsManager == NULL) {
-		gSocketsManager = CreateSocketsManager();
-		gLastSocketsManager = gSocketsManager;
+	SOCKETSMANAGER** link = &gSocketsManager;
+	while (*link != NULL && *link != manager) {
+		link = &(*link)->next;
 	}
-	else if (gLastSocketsManager->free_index == MAX_CLIENTS_PER_THREAD) {  // null or full -> create new managers
-		SOCKETSMANAGER* manager = CreateSocketsManager();
-		gLastSocketsManager->next = manager; // old_last -> next = manager
-		gLastSocketsManager = manager; // manager is the last item
+	if (*link != NULL) {
+		*link = manager->next;
+		manager->next = NULL;
+		gSocketsManagerCount--;
 	}
+}
 
-	// always set socket to gLastSocketsManager
-	SetSocket(gLastSocketsManager, socket); // free_index now at least 1.
-
-	if (gLastSocketsManager->free_index == 1) { // the socket is the first item in sockets manager -> new thread
-		CreateThreadForSocketsManager(gLastSocketsManager);
+SOCKETSMANAGER* FindLeastLoadedManager()
+{
+	SOCKETSMANAGER* least = gSocketsManager;
+	for (SOCKETSMANAGER* cur = gSocketsManager; cur != NULL; cur = cur->next) {
+		if (cur->load < least->load)
+			least = cur;
 	}
+	return least;
 }
 
-void FreeEventsForSocketsManager(SOCKETSMANAGER* manager)
+void AppendSocketOnAThread(SOCKET socket, SESSION* session)
 {
-	int _count = manager->free_index;
-	for (int i = 0; i < _count; ++i) {
-		WSACloseEvent(manager->events[i]);
+	SOCKETSMANAGER* manager = FindLeastLoadedManager();
+	if ((manager == NULL || manager->load >= MANAGER_TARGET_LOAD) && gSocketsManagerCount < gMaxSocketsManagers) {
+		SOCKETSMANAGER* started = StartSocketsManager(); // every thread is busy -> new thread
+		if (started != NULL)
+			manager = started;
+	}
+
+	if (manager != NULL && QueueSocket(manager, socket, session)) {
+		manager->load++;
+		WakeSocketsManager(manager);
+	}
+	else {
+		CloseSocket(socket, CLOSE_SAFELY);
+		if (session != NULL)
+			FreeSession(session);
 	}
-	manager->free_index = 0;
+}
+
+int RetireSocketsManager(SOCKETSMANAGER* manager)
+{
+	int retired = 0;
+	EnterSMCS(
+		int spare = 0; // the sockets the other managers can take
+		for (SOCKETSMANAGER* cur = gSocketsManager; cur != NULL; cur = cur->next) {
+			if (cur != manager && cur->load < MANAGER_TARGET_LOAD)
+				spare += MANAGER_TARGET_LOAD - cur->load;
+		}
+		if (gSocketsManagerCount > 1 && manager->load < MANAGER_LOW_LOAD && spare >= manager->load) {
+			UnlinkSocketsManager(manager);
+			// the sockets keep their accounts and their transfers on the other managers
+			for (int i = 1; i < manager->free_index; ++i) {
+				AppendSocketOnAThread(manager->fds[i].fd, manager->sessions + i);
+			}
+			for (int i = 0; i < manager->pending_count; ++i) {
+				AppendSocketOnAThread(manager->pending[i], manager->pending_sessions + i);
+			}
+			manager->free_index = 1; // the wake socket only
+			manager->pending_count = 0;
+			manager->load = 0;
+			retired = 1;
+		}
+	)
+	return retired;
 }
 
 HANDLE CreateThreadForSocketsManager(SOCKETSMANAGER* manager)
@@ -105,219 +186,472 @@ HANDLE CreateThreadForSocketsManager(SOCKETSMANAGER* manager)
 unsigned __stdcall Run(void* arguments)
 {
 	SOCKETSMANAGER* manager = (SOCKETSMANAGER*)arguments;
-	int _release_count = 0; // Number of clients connection drop.
-	int _continue = 1;
-	while (_continue) {
-		EnterSMCS(
-			if (_release_count == manager->free_index) {
-				FreeEventsForSocketsManager(manager);
-				FreeSocketsManager(manager);
-				_continue = 0;
-			}
-		)
-		if (_continue == 0)
-			break;
-		int index = ListenEvents(manager->events, manager->free_index, LISTEN_WAIT_TIME);
-
-		if (index > -1) {
-			SOCKET socket = manager->sockets[index];
-			WSAEVENT socket_event = manager->events[index];
-			int account_status = manager->accounts_status[index];
-
-			long status = GetStatusOnSocketEvent(socket, socket_event);
-			// check close status first. If FD_CLOSE, dont need to care about FD_READ
-			if (status & FD_CLOSE) {
-				EnterSMCS(
-					ClearSocket(manager, index);
-				)
-				_release_count++;
-			}
-			else if (status & FD_READ) {
-				
-				int status = HandleRequest(socket, &account_status);
-
-				if (status == -1) { // fatal error
-					EnterSMCS(
-						ClearSocket(manager, index);
-					)
-					_release_count++;
-				}
-				else {
-					WSAResetEvent(socket_event); // set un-signaled state for the event
+	while (1) {
+		AdoptPendingSockets(manager);
+		int ready = PollSockets(manager->fds, manager->free_index);
+		if (ready <= 0)
+			continue;
+		if (manager->fds[0].revents != 0) { // the wake socket: new sockets are queued
+			DrainWakeSocket(manager->fds[0].fd);
+			ready--;
+		}
 
-					EnterSMCS(
-						manager->accounts_status[index] = account_status;
-					)
-				}
-			}
+		// service every ready client in one cycle, from a rotating start: no slot is always served first
+		int count = manager->free_index - 1;
+		if (count > 0)
+			manager->start_index = (manager->start_index + 1) % count;
+		for (int i = 0; i < count && ready > 0; ++i) {
+			int index = 1 + (manager->start_index + i) % count;
+			long status = GetStatusOnPollEvent(manager->fds + index);
+			if (status == 0)
+				continue;
+			ready--;
+			// check close status first. If FD_CLOSE, dont need to care about FD_READ/FD_WRITE
+			if ((status & FD_CLOSE) ||
+				((status & FD_WRITE) && ContinueResponses(manager, index) == -1) ||
+				((status & FD_READ) && HandleRequests(manager, index) == -1))
+				MarkSocketClosed(manager, index);
+			// requests over the budget stay in the buffer: the socket is ready again on the next poll
 		}
+		// the posts are acknowledged once they are on the disk: they wait parked, the loop does not
+		SendResponses(manager);
+		// the thread count follows the live connections: an underloaded thread hands its sockets over
+		if (ClearMarkedSockets(manager) > 0 && RetireSocketsManager(manager))
+			break;
 	}
 	printf("[%s] Thread manages sockets manager (%p) closing...\n", INFO_FLAGS, manager);
+	FreeSocketsManager(manager);
 	return 0; // terminate thread
 }
 
+void AdoptPendingSockets(SOCKETSMANAGER* manager)
+{
+	int parked = 0;
+	EnterSMCS(
+		for (int i = 0; i < manager->pending_count; ++i) {
+			if (!SetSocket(manager, manager->pending[i], manager->pending_sessions + i)) {
+				CloseSocket(manager->pending[i], CLOSE_SAFELY);
+				FreeSession(manager->pending_sessions + i);
+				manager->load--;
+			}
+			else if (manager->pending_sessions[i].parked_count > 0)
+				parked++;
+		}
+		manager->pending_count = 0;
+	)
+	if (parked > 0) { // moved sockets keep their parked responses: their posts may be durable already
+		InterlockedExchangeAdd(&manager->parked, parked);
+		WakeSocketsManager(manager);
+	}
+}
+
+void WakeWaitingPosts()
+{
+	EnterSMCS(
+		for (SOCKETSMANAGER* cur = gSocketsManager; cur != NULL; cur = cur->next) {
+			if (cur->parked > 0)
+				WakeSocketsManager(cur);
+		}
+	)
+}
+
 #pragma endregion
 
 #pragma region Handle Events
 
-long GetStatusOnSocketEvent(SOCKET socket, WSAEVENT socket_event)
+long GetStatusOnPollEvent(const WSAPOLLFD* fd)
 {
-	WSANETWORKEVENTS network_event;
-	int ret = WSAEnumNetworkEvents(socket, socket_event, &network_event);
 	long status = 0;
-	if (ret == SOCKET_ERROR) {
-		printf("[%s:%d] %s\n", WARNING_FLAGS, WSAGetLastError(), _CHECK_EVENT_STATUS_FAIL);
+	// If FD_CLOSE, dont need to check FD_READ/FD_WRITE
+	if (fd->revents & (POLLERR | POLLNVAL)) { // WSAENETDOWN || WSAECONNRESET || WSAECONNABORTED (Ctrl + C / Close Window)
+		printf("[%s] %s\n", WARNING_FLAGS, _CONNECTION_DROP);
+		status |= FD_CLOSE;
+	}
+	else if (fd->revents & POLLHUP) {
 		status |= FD_CLOSE;
 	}
 	else {
-		// If FD_CLOSE, dont need to check FD_READ
-		if (network_event.lNetworkEvents & FD_CLOSE) {
-			int err = network_event.iErrorCode[FD_CLOSE_BIT];
-			if (err != 0) { // WSAENETDOWN || WSAECONNRESET || WSAECONNABORTED (Ctrl + C / Close Window)
-				printf("[%s:%d] %s\n", WARNING_FLAGS, err, _CONNECTION_DROP);
-			}
-			status |= FD_CLOSE;
-		}
-		else if (network_event.lNetworkEvents & FD_READ) {
-			int err = network_event.iErrorCode[FD_READ_BIT];
-			if (err == 0) {
-				status |= FD_READ;
-			}
-			else { // WSAENETDOWN
-				printf("[%s:%d] %s\n", WARNING_FLAGS, err, _CONNECTION_DROP);
-				status |= FD_CLOSE;
-			}
-		}
+		if (fd->revents & POLLRDNORM)
+			status |= FD_READ;
+		if (fd->revents & POLLWRNORM)
+			status |= FD_WRITE;
 	}
 	return status;
 }
 
-int ListenEvents(WSAEVENT* events, int count, int time_wait)
+int PollSockets(WSAPOLLFD* fds, int count, int time_wait)
 {
-	int ret = WSAWaitForMultipleEvents(count, events, FALSE, time_wait, FALSE);
-	if (ret == WSA_WAIT_TIMEOUT) {
-		return -1;
-	}
-	else if (ret == WSA_WAIT_FAILED) {
-		printf("[%s:%d] %s\n", WARNING_FLAGS, WSAGetLastError(), _LISTEN_EVENTS_FAIL);
+	int ret = WSAPoll(fds, count, time_wait);
+	if (ret == SOCKET_ERROR) {
+		printf("[%s:%d] %s\n", WARNING_FLAGS, WSAGetLastError(), _POLL_SOCKETS_FAIL);
 		return -1;
 	}
-	return ret - WSA_WAIT_EVENT_0;
+	return ret;
 }
 
-int AttachReceiveEventForSocket(SOCKET socket, WSAEVENT socket_event)
+int SetNonBlockingMode(SOCKET socket)
 {
-	int ret = WSAEventSelect(socket, socket_event, FD_READ | FD_CLOSE);
-	if (ret == SOCKET_ERROR) {
-		printf("[%s:%d] %s\n", WARNING_FLAGS, WSAGetLastError(), _ATTACH_EVENT_FAIL);
+	u_long mode = 1;
+	if (ioctlsocket(socket, FIONBIO, &mode) == SOCKET_ERROR) {
+		printf("[%s:%d] %s\n", WARNING_FLAGS, WSAGetLastError(), _SET_NON_BLOCKING_FAIL);
 		return 0;
 	}
 	return 1;
 }
 
+SOCKET CreateWakeSocket(ADDRESS* oaddress)
+{
+	SOCKET wake = CreateSocket(UDP);
+	if (wake == INVALID_SOCKET)
+		return INVALID_SOCKET;
+
+	IP loopback;
+	loopback.s_addr = htonl(INADDR_LOOPBACK);
+	int addr_len = sizeof(ADDRESS);
+	// port 0: the system chooses a free port
+	if (!BindSocket(wake, CreateSocketAddress(loopback, 0)) ||
+		getsockname(wake, (SOCKADDR*)oaddress, &addr_len) == SOCKET_ERROR ||
+		!SetNonBlockingMode(wake)) {
+		CloseSocket(wake, CLOSE_NORMAL);
+		return INVALID_SOCKET;
+	}
+	return wake;
+}
+
+void WakeSocketsManager(SOCKETSMANAGER* manager)
+{
+	char signal = 0;
+	sendto(gWakeSocket, &signal, 1, 0, (SOCKADDR*)&manager->wake_address, sizeof(ADDRESS));
+}
+
+void DrainWakeSocket(SOCKET wake)
+{
+	char buffer[16];
+	while (recv(wake, buffer, sizeof(buffer), 0) > 0);
+}
+
 #pragma endregion
 
 #pragma region Handle Request
 
-MESSAGE HandlePostRequest(SOCKET socket, const char* arguments, int* ioaccount_status)
+const char* HandlePostRequest(SOCKET socket, const char* arguments, SESSION* iosession, unsigned long long* oarticle_id)
 {
-	if (*ioaccount_status == AS_FREE) {
-		return CreateMessage(S_NOT_LOGIN, SM_NOT_LOGIN);
+	*oarticle_id = 0;
+	if (iosession->status == AS_FREE) {
+		return RM_NOT_LOGIN;
 	}
 
-	return CreateMessage(S_POST_SUCC, SM_POST_SUCC);
+	if (!AppendArticle(gArticles, iosession->account, arguments, oarticle_id)) {
+		return RM_POST_FAIL;
+	}
+	return RM_POST_SUCC;
 }
 
-MESSAGE HandleLoginRequest(SOCKET socket, const char* arguments, int* ioaccount_status)
+const char* HandleLoginRequest(SOCKET socket, const char* arguments, SESSION* iosession)
 {
-	if (*ioaccount_status == AS_LOGGED_IN) {
-		return CreateMessage(S_LOGGEDIN, SM_LOGGEDIN);
+	if (iosession->status == AS_LOGGED_IN) {
+		return RM_LOGGEDIN;
 	}
 
-	EnterCriticalSection(&gAccountCriticalSection);
-	ACCOUNTINFO* acc = FindFirstAccountInfo(gAccounts, arguments);
+	// the index is read-only: no lock. A reload does not free it while reading
+	LONG epoch;
+	ACCOUNTINFO* acc = FindAccountInfo(AcquireAccountIndex(&epoch), arguments);
 	int status = acc == NULL ? -1 : acc->status;
-	LeaveCriticalSection(&gAccountCriticalSection);
+	// the articles keep the name as written in the account file
+	char* account = status != -1 && status != AS_LOCK ? Clone(acc->account, (int)strlen(acc->account) + 1) : NULL;
+	ReleaseAccountIndex(epoch);
 
 	if (status == -1) { // not found
-		return CreateMessage(S_ACCOUNT_NOT_EXIST, SM_ACCOUNT_NOT_EXIST);
+		return RM_ACCOUNT_NOT_EXIST;
 	}
 	else if (status == AS_LOCK) {
-		return CreateMessage(S_ACCOUNT_LOCK, SM_ACCOUNT_LOCK);
+		return RM_ACCOUNT_LOCK;
 	}
 	else { // AS_FREE
-		*ioaccount_status = AS_LOGGED_IN;
+		iosession->status = AS_LOGGED_IN;
+		iosession->account = account;
 	}
-	return CreateMessage(S_LOGIN_SUCC, SM_LOGIN_SUCC);
+	return RM_LOGIN_SUCC;
 }
 
-MESSAGE HandleLogoutRequest(SOCKET socket, int* ioaccount_status)
+const char* HandleLogoutRequest(SOCKET socket, SESSION* iosession)
 {
-	if (*ioaccount_status == AS_FREE) {
-		return CreateMessage(S_NOT_LOGIN, SM_NOT_LOGIN);
+	if (iosession->status == AS_FREE) {
+		return RM_NOT_LOGIN;
 	}
 
-	*ioaccount_status = AS_FREE;
-	return CreateMessage(S_LOGOUT_SUCC, SM_LOGOUT_SUCC);
+	iosession->status = AS_FREE;
+	free(iosession->account);
+	iosession->account = NULL;
+	return RM_LOGOUT_SUCC;
 }
 
-int HandleRequest(SOCKET socket, int* ioaccount_status)
+const char* HandleRecentRequest(SOCKET socket, const char* arguments, ARTICLEPAGE** opage)
 {
-	char* request, * arguments;
-	int status = 1;
-	status = SegmentationReceive(socket, &request);
-	if (status != 1) {
-		free(request);
-		return status;
+	*opage = (ARTICLEPAGE*)calloc(1, sizeof(ARTICLEPAGE));
+	if (*opage == NULL) {
+		printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
+		return NULL;
+	}
+
+	ReadRecentArticles(gArticles, strtoull(arguments, NULL, 10), *opage);
+	return CreatePageMessage(*opage);
+}
+
+const char* HandleAuthorRequest(SOCKET socket, const char* arguments, ARTICLEPAGE** opage)
+{
+	*opage = (ARTICLEPAGE*)calloc(1, sizeof(ARTICLEPAGE));
+	if (*opage == NULL) {
+		printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
+		return NULL;
+	}
+
+	// the author, then the ID: a user name has no space (See LoadAccountIndex())
+	const char* space_pos = strchr(arguments, ' ');
+	int namelen = space_pos == NULL ? (int)strlen(arguments) : (int)(space_pos - arguments);
+	if (namelen < LINE_MAX_SIZE) {
+		char author[LINE_MAX_SIZE];
+		memcpy_s(author, LINE_MAX_SIZE, arguments, namelen);
+		author[namelen] = '\0';
+		ReadAuthorArticles(gArticles, author, space_pos == NULL ? 0 : strtoull(space_pos + 1, NULL, 10), *opage);
+	}
+	return CreatePageMessage(*opage);
+}
+
+const char* HandleGetRequest(SOCKET socket, const char* arguments, ARTICLEPAGE** opage)
+{
+	char* count_pos;
+	unsigned long long from = strtoull(arguments, &count_pos, 10);
+	int count = (int)strtol(count_pos, NULL, 10);
+	if (count <= 0)
+		count = 1;
+	else if (count > ARTICLE_PAGE_SIZE)
+		count = ARTICLE_PAGE_SIZE;
+
+	*opage = (ARTICLEPAGE*)calloc(1, sizeof(ARTICLEPAGE));
+	if (*opage == NULL) {
+		printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
+		return NULL;
 	}
+	if (!ReadArticles(gArticles, from, count, *opage)) {
+		free(*opage);
+		*opage = NULL;
+		return RM_ARTICLE_NOT_FOUND;
+	}
+	return CreatePageMessage(*opage);
+}
 
-	MESSAGE response = NULL;
+const char* CreatePageMessage(ARTICLEPAGE* page)
+{
+	sprintf_s(page->message, ARTICLE_SUMMARY_SIZE, "%02d" SM_ARTICLES, S_ARTICLES, page->count, page->next);
+	return page->message;
+}
+
+void HandleRequest(SOCKET socket, const char* request, SESSION* iosession, RESPONSE* oresponse)
+{
+	char* arguments;
+	oresponse->message = NULL;
+	oresponse->article_id = 0;
+	oresponse->page = NULL;
+
+	const char* response = NULL;
 	// Handle request
 	int command = ExtractRequestCommand(request, &arguments);
 	if (command == C_POST) {
-		response = HandlePostRequest(socket, arguments, ioaccount_status);
+		response = HandlePostRequest(socket, arguments, iosession, &oresponse->article_id);
 	}
 	else if (command == C_LOGIN) {
-		response = HandleLoginRequest(socket, arguments, ioaccount_status);
+		response = HandleLoginRequest(socket, arguments, iosession);
 	}
 	else if (command == C_LOGOUT) {
-		response = HandleLogoutRequest(socket, ioaccount_status);
+		response = HandleLogoutRequest(socket, iosession);
+	}
+	else if (command == C_RECENT) {
+		response = HandleRecentRequest(socket, arguments, &oresponse->page);
+	}
+	else if (command == C_AUTHOR) {
+		response = HandleAuthorRequest(socket, arguments, &oresponse->page);
+	}
+	else if (command == C_GET) {
+		response = HandleGetRequest(socket, arguments, &oresponse->page);
 	}
 	else {
-		response = CreateMessage(S_UNREGCONIZE_COMMAND, SM_UNREGCONIZE_COMMAND);
+		response = RM_UNREGCONIZE_COMMAND;
 	}
-	free(request);
 
-	// Send response
-	status = SegmentationSend(socket, response, (int)strlen(response) + 1, NULL);
-	DestroyMessage(response);
-	return status;
+	oresponse->message = response;
+}
+
+int HandleRequests(SOCKETSMANAGER* manager, int index)
+{
+	SOCKET socket = manager->fds[index].fd;
+	SESSION* session = manager->sessions + index;
+	for (int handled = 0; handled < PIPELINE_MAX_REQUESTS; ++handled) {
+		// a request received partly stays in the transfer until the next POLLRDNORM
+		char* request;
+		int status = ReceiveRequest(socket, &session->transfer, &request);
+		if (status != 1)
+			return status;
+
+		RESPONSE response;
+		HandleRequest(socket, request, session, &response);
+		free(request);
+		response.index = index;
+		if (response.message == NULL || !QueueResponse(manager, &response)) {
+			free(response.page);
+			return -1; // the responses would be out of order
+		}
+	}
+	return 1;
+}
+
+int QueueResponse(SOCKETSMANAGER* manager, const RESPONSE* response)
+{
+	if (manager->response_count == manager->response_capacity) {
+		int capacity = manager->response_capacity == 0 ? POLL_INITIAL_CAPACITY : 2 * manager->response_capacity;
+		RESPONSE* responses = (RESPONSE*)realloc(manager->responses, capacity * sizeof(RESPONSE));
+		if (responses == NULL) {
+			printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
+			return 0;
+		}
+		manager->responses = responses;
+		manager->response_capacity = capacity;
+	}
+	manager->responses[manager->response_count++] = *response;
+	return 1;
+}
+
+void SendResponses(SOCKETSMANAGER* manager)
+{
+	if (manager->response_count == 0 && manager->parked == 0)
+		return;
+	int failed;
+	unsigned long long durable_id = GetDurableArticle(gArticles, &failed);
+
+	int parking = manager->parked > 0;
+	for (int i = 0; i < manager->response_count; ++i) {
+		RESPONSE* response = manager->responses + i;
+		SESSION* session = manager->sessions + response->index;
+		// a post waits for the commit thread, the later responses of its socket wait behind it
+		if (manager->fds[response->index].events != 0 &&
+			(session->parked_count > 0 || (!failed && response->article_id > durable_id))) {
+			if (ParkResponse(session, response)) {
+				parking = 1;
+				continue;
+			}
+			MarkSocketClosed(manager, response->index); // the responses would be out of order
+		}
+		SendResponse(manager, response->index, response, durable_id);
+	}
+	manager->response_count = 0;
+	if (!parking)
+		return;
+
+	// the flag is set before the store is checked again: a commit ending after the check wakes the thread
+	int parked = SendParkedResponses(manager, durable_id, failed);
+	InterlockedExchange(&manager->parked, parked);
+	while (parked > 0) {
+		unsigned long long checked_id = durable_id;
+		durable_id = GetDurableArticle(gArticles, &failed);
+		if (durable_id == checked_id && !failed)
+			break;
+		parked = SendParkedResponses(manager, durable_id, failed);
+		InterlockedExchange(&manager->parked, parked);
+	}
+}
+
+void SendResponse(SOCKETSMANAGER* manager, int index, RESPONSE* response, unsigned long long durable_id)
+{
+	if (response->article_id > durable_id) {
+		response->message = RM_POST_FAIL;
+	}
+	// a socket closed in the cycle gets no more responses
+	SOCKET socket = manager->fds[index].fd;
+	if (manager->fds[index].events != 0 && response->message != NULL) {
+		TRANSFER* transfer = &manager->sessions[index].transfer;
+		int ret = response->page == NULL ?
+			SegmentationSend(socket, transfer, response->message, (int)strlen(response->message) + 1) :
+			SendArticlePage(socket, transfer, response->message, response->page);
+		if (ret == -1)
+			MarkSocketClosed(manager, index);
+		else if (transfer->output != NULL) // the client reads slower than it sends: its requests wait until the responses are sent
+			manager->fds[index].events = POLLWRNORM;
+	}
+	free(response->page); // the message of a page is in the page
+	response->page = NULL;
+}
+
+int ParkResponse(SESSION* session, const RESPONSE* response)
+{
+	if (session->parked_count == session->parked_capacity) {
+		int capacity = session->parked_capacity == 0 ? PIPELINE_MAX_REQUESTS : 2 * session->parked_capacity;
+		RESPONSE* parked = (RESPONSE*)realloc(session->parked, capacity * sizeof(RESPONSE));
+		if (parked == NULL) {
+			printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
+			return 0;
+		}
+		session->parked = parked;
+		session->parked_capacity = capacity;
+	}
+	session->parked[session->parked_count++] = *response;
+	return 1;
+}
+
+int SendParkedResponses(SOCKETSMANAGER* manager, unsigned long long durable_id, int failed)
+{
+	int parked = 0;
+	for (int index = 1; index < manager->free_index; ++index) {
+		SESSION* session = manager->sessions + index;
+		if (session->parked_count == 0 || manager->fds[index].events == 0) // a closed socket frees them with its session
+			continue;
+		int sent = 0;
+		while (sent < session->parked_count && (failed || session->parked[sent].article_id <= durable_id)) {
+			SendResponse(manager, index, session->parked + sent, durable_id);
+			sent++;
+		}
+		session->parked_count -= sent;
+		memmove(session->parked, session->parked + sent, session->parked_count * sizeof(RESPONSE));
+		if (session->parked_count > 0)
+			parked++;
+	}
+	return parked;
+}
+
+int ContinueResponses(SOCKETSMANAGER* manager, int index)
+{
+	int ret = ContinueSend(manager->fds[index].fd, &manager->sessions[index].transfer);
+	if (ret == 1)
+		manager->fds[index].events = POLLRDNORM; // the requests waiting are read on the next poll
+	return ret;
 }
 
 int ExtractRequestCommand(const char* request, char** oarguments)
 {
-	char* space_pos = (char*)memchr(request, ' ', strlen(request));
-	if (space_pos == NULL) {
-		if (ICompare(request, CM_LOGOUT, (int)max(strlen(CM_LOGOUT), strlen(request))) == 0)
-			return C_LOGOUT;
-		return 0;
+	// one pass over the command text: its case-folded letters are packed into a number
+	unsigned long long command = 0;
+	int length = 0;
+	for (; request[length] != ' ' && request[length] != '\0'; ++length) {
+		if (length == COMMAND_MAX_LENGTH)
+			return 0;
+		command |= (unsigned long long)((unsigned char)request[length] | 0x20) << (8 * length);
 	}
+	int has_arguments = request[length] == ' ';
+	*oarguments = (char*)request + length + has_arguments;
 
-	*oarguments = space_pos + 1;
-	// match command
-	if (ICompare(request, CM_POST,
-		(int)max((int)strlen(CM_POST), (space_pos - request)))
-		== 0)
-		return C_POST;
-	else if (ICompare(request, CM_LOGIN,
-		(int)max((int)strlen(CM_LOGIN), (space_pos - request)))
-		== 0)
-		return C_LOGIN;
-	else if (ICompare(request, CM_LOGOUT,
-		(int)max((int)strlen(CM_LOGOUT), (space_pos - request)))
-		== 0)
+	switch (command) {
+	case PC_POST:
+		return has_arguments ? C_POST : 0;
+	case PC_LOGIN:
+		return has_arguments ? C_LOGIN : 0;
+	case PC_LOGOUT:
 		return C_LOGOUT;
-
+	case PC_RECENT:
+		return C_RECENT;
+	case PC_AUTHOR:
+		return has_arguments ? C_AUTHOR : 0;
+	case PC_GET:
+		return has_arguments ? C_GET : 0;
+	}
 	return 0;
 }
 
@@ -325,39 +659,123 @@ int ExtractRequestCommand(const char* request, char** oarguments)
 
 #pragma region SocketsManagers
 
-int SetSocket(SOCKETSMANAGER* manager, SOCKET socket)
+int SetSocket(SOCKETSMANAGER* manager, SOCKET socket, const SESSION* session)
 {
 	if (manager != NULL) {
-		if (manager->free_index == MAX_CLIENTS_PER_THREAD) {
+		if (manager->free_index == manager->capacity && !GrowSocketsManager(manager)) {
 			return 0;
 		}
-		WSAEVENT socket_event = WSACreateEvent();
-		if (AttachReceiveEventForSocket(socket, socket_event)) {
-			manager->sockets[manager->free_index] = socket;
-			manager->events[manager->free_index] = socket_event;
+		if (SetNonBlockingMode(socket)) {
+			SESSION* slot = manager->sessions + manager->free_index;
+			if (session != NULL) {
+				*slot = *session;
+			}
+			else {
+				memset(slot, 0, sizeof(SESSION));
+				slot->status = AS_FREE;
+			}
+			WSAPOLLFD* fd = manager->fds + manager->free_index;
+			fd->fd = socket;
+			fd->events = slot->transfer.output != NULL ? POLLWRNORM : POLLRDNORM; // a moved socket finishes sending first
+			fd->revents = 0;
 			manager->free_index++;
 			return 1;
 		}
-		else {
-			WSACloseEvent(socket_event);
-		}
 	}
 	return 0;
 }
 
-void ClearSocket(SOCKETSMANAGER* manager, int index)
+int QueueSocket(SOCKETSMANAGER* manager, SOCKET socket, const SESSION* session)
+{
+	if (manager->pending_count == manager->pending_capacity) {
+		int capacity = manager->pending_capacity == 0 ? POLL_INITIAL_CAPACITY : 2 * manager->pending_capacity;
+		SOCKET* pending = (SOCKET*)realloc(manager->pending, capacity * sizeof(SOCKET));
+		if (pending == NULL) {
+			printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
+			return 0;
+		}
+		manager->pending = pending;
+		SESSION* pending_sessions = (SESSION*)realloc(manager->pending_sessions, capacity * sizeof(SESSION));
+		if (pending_sessions == NULL) {
+			printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
+			return 0;
+		}
+		manager->pending_sessions = pending_sessions;
+		manager->pending_capacity = capacity;
+	}
+	SESSION* slot = manager->pending_sessions + manager->pending_count;
+	if (session != NULL) {
+		*slot = *session;
+	}
+	else {
+		memset(slot, 0, sizeof(SESSION));
+		slot->status = AS_FREE;
+	}
+	manager->pending[manager->pending_count++] = socket;
+	return 1;
+}
+
+int ClearMarkedSockets(SOCKETSMANAGER* manager)
+{
+	int cleared = 0;
+	// from the last slot: ClearSocket() moves the last socket, which is checked already
+	for (int index = manager->free_index - 1; index > 0; --index) {
+		if (manager->fds[index].events == 0) {
+			ClearSocket(manager, index);
+			cleared++;
+		}
+	}
+	if (cleared > 0) {
+		EnterSMCS(
+			manager->load -= cleared;
+		)
+	}
+	return cleared;
+}
+
+void MarkSocketClosed(SOCKETSMANAGER* manager, int index)
+{
+	manager->fds[index].events = 0;
+}
+
+void FreeSession(SESSION* session)
 {
-	CloseSocket(manager->sockets[index], CLOSE_SAFELY);
-	manager->sockets[index] = INVALID_SOCKET;
+	free(session->account);
+	free(session->transfer.request);
+	free(session->transfer.output);
+	for (int i = 0; i < session->parked_count; ++i) {
+		free(session->parked[i].page);
+	}
+	free(session->parked);
+}
 
-	manager->accounts_status[index] = AS_FREE;
+void ClearSocket(SOCKETSMANAGER* manager, int index)
+{
+	CloseSocket(manager->fds[index].fd, CLOSE_SAFELY);
+	FreeSession(manager->sessions + index);
 
-	WSAResetEvent(manager->events[index]);
-	// If close event, WSAWaitForMultipleEvents return error code 6: INVALID_HANDLE
-	//WSACloseEvent(manager->events[index]);   
-	//manager->events_count--;
+	int last = --manager->free_index;
+	manager->fds[index] = manager->fds[last];
+	manager->sessions[index] = manager->sessions[last];
+}
 
-	//manager->events[index] = WSA_INVALID_EVENT;
+int GrowSocketsManager(SOCKETSMANAGER* manager)
+{
+	int capacity = 2 * manager->capacity;
+	WSAPOLLFD* fds = (WSAPOLLFD*)realloc(manager->fds, capacity * sizeof(WSAPOLLFD));
+	if (fds == NULL) {
+		printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
+		return 0;
+	}
+	manager->fds = fds;
+	SESSION* sessions = (SESSION*)realloc(manager->sessions, capacity * sizeof(SESSION));
+	if (sessions == NULL) {
+		printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
+		return 0;
+	}
+	manager->sessions = sessions;
+	manager->capacity = capacity;
+	return 1;
 }
 
 SOCKETSMANAGER* CreateSocketsManager()
@@ -365,79 +783,128 @@ SOCKETSMANAGER* CreateSocketsManager()
 	SOCKETSMANAGER* mgr = (SOCKETSMANAGER*)malloc(sizeof(SOCKETSMANAGER));
 	if (mgr != NULL) {
 		mgr->free_index = 0;
+		mgr->capacity = POLL_INITIAL_CAPACITY;
+		mgr->fds = (WSAPOLLFD*)malloc(POLL_INITIAL_CAPACITY * sizeof(WSAPOLLFD));
+		mgr->sessions = (SESSION*)malloc(POLL_INITIAL_CAPACITY * sizeof(SESSION));
+		mgr->pending = NULL;
+		mgr->pending_sessions = NULL;
+		mgr->pending_count = 0;
+		mgr->pending_capacity = 0;
+		mgr->start_index = 0;
+		mgr->load = 0;
+		mgr->responses = NULL;
+		mgr->response_count = 0;
+		mgr->response_capacity = 0;
+		mgr->parked = 0;
 		mgr->next = NULL;
 
-		memset(mgr->accounts_status, AS_FREE, sizeof(mgr->accounts_status));
-		memset(mgr->sockets, (int)INVALID_SOCKET, sizeof(mgr->sockets));
-		//memset(mgr->events, (int)WSA_INVALID_EVENT, sizeof(mgr->sockets));
+		// the wake socket is always the first polled socket
+		SOCKET wake = mgr->fds != NULL && mgr->sessions != NULL ? CreateWakeSocket(&mgr->wake_address) : INVALID_SOCKET;
+		if (wake == INVALID_SOCKET || !SetSocket(mgr, wake)) {
+			CloseSocket(wake, CLOSE_NORMAL);
+			free(mgr->fds);
+			free(mgr->sessions);
+			free(mgr);
+			return NULL;
+		}
 	}
 	return mgr;
 }
 
-SOCKETSMANAGER* FindPreviousNode(SOCKETSMANAGER* manager)
-{
-	SOCKETSMANAGER* cur = gSocketsManager;
-	while (cur != NULL && cur->next != manager) {
-		cur = cur->next;
-	}
-	return cur;
-}
-
 void FreeSocketsManager(SOCKETSMANAGER* manager) 
 {
-	if (manager != gSocketsManager) {
-		SOCKETSMANAGER* prev = FindPreviousNode(manager);
-		if (manager == gLastSocketsManager) {
-			prev->next = NULL;
-			gLastSocketsManager = prev;
-		}
-		else{
-			prev->next = manager->next; // A -> B -> C => A -> C
-		}
-		free(manager);
-	}
-	else {
-		manager->free_index = 0;
-	}
+	for (int i = 0; i < manager->free_index; ++i) {
+		CloseSocket(manager->fds[i].fd, i == 0 ? CLOSE_NORMAL : CLOSE_SAFELY);
+		FreeSession(manager->sessions + i);
+	}
+	for (int i = 0; i < manager->pending_count; ++i) {
+		CloseSocket(manager->pending[i], CLOSE_SAFELY);
+		FreeSession(manager->pending_sessions + i);
+	}
+	free(manager->fds);
+	free(manager->sessions);
+	free(manager->pending);
+	free(manager->pending_sessions);
+	free(manager->responses);
+	free(manager);
 }
 
 #pragma endregion
 
 #pragma region AccountInfos
 
-ACCOUNTINFO* Append(ACCOUNTINFO* prev, ACCOUNTINFO* current)
-{
-	if (prev != NULL) {
-		current->next = prev->next;
-		prev->next = current;
-	}
-	else {
-		current->next = gAccounts;
-		gAccounts = current;
-	}
-	return current;
-}
-
 ACCOUNTINFO* CreateAccountInfo(const char* username, int namelen, int status)
 {
 	ACCOUNTINFO* acc = (ACCOUNTINFO*)malloc(sizeof(ACCOUNTINFO));
 	if (acc != NULL) {
-		acc->account = Clone(username, namelen);
+		acc->account = Clone(username, namelen + 1);
+		if (acc->account == NULL) {
+			free(acc);
+			return NULL;
+		}
 		acc->account[namelen] = '\0';
-		//acc->socket = INVALID_SOCKET;
 		acc->status = status;
+		acc->hash = HashAccountName(acc->account);
 		acc->next = NULL;
 	}
 	return acc;
 }
 
-ACCOUNTINFO* FindFirstAccountInfo(ACCOUNTINFO* start, const char* username)
+unsigned int HashAccountName(const char* username)
 {
-	ACCOUNTINFO* cur = start;
-	while (cur != NULL) {
-		if (ICompare(username, cur->account) == 0)
-			return cur;
-		cur = cur->next;
+	unsigned int hash = 2166136261u;
+	for (const char* c = username; *c != '\0'; ++c) {
+		char folded = (*c >= 'A' && *c <= 'Z') ? *c - 'A' + 'a' : *c;
+		hash = (hash ^ (unsigned char)folded) * 16777619u;
+	}
+	return hash;
+}
+
+ACCOUNTINDEX* CreateAccountIndex(ACCOUNTINFO* accounts)
+{
+	unsigned int count = 0;
+	for (ACCOUNTINFO* cur = accounts; cur != NULL; cur = cur->next) {
+		count++;
+	}
+	unsigned int slots = ACCOUNT_INDEX_MIN_SLOTS;
+	while (slots < 2 * count) {
+		slots <<= 1;
+	}
+
+	ACCOUNTINDEX* index = (ACCOUNTINDEX*)malloc(sizeof(ACCOUNTINDEX));
+	if (index != NULL && (index->slots = (ACCOUNTINFO**)calloc(slots, sizeof(ACCOUNTINFO*))) == NULL) {
+		free(index);
+		index = NULL;
+	}
+	if (index == NULL) {
+		printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
+		return NULL;
+	}
+	index->accounts = accounts;
+	index->count = 0;
+	index->mask = slots - 1;
+
+	for (ACCOUNTINFO* cur = accounts; cur != NULL; cur = cur->next) {
+		unsigned int i = cur->hash & index->mask;
+		while (index->slots[i] != NULL &&
+			(index->slots[i]->hash != cur->hash || ICompare(cur->account, index->slots[i]->account) != 0)) {
+			i = (i + 1) & index->mask;
+		}
+		if (index->slots[i] == NULL) { // a duplicated name keeps the first one
+			index->slots[i] = cur;
+			index->count++;
+		}
+	}
+	return index;
+}
+
+ACCOUNTINFO* FindAccountInfo(const ACCOUNTINDEX* index, const char* username)
+{
+	unsigned int hash = HashAccountName(username);
+	for (unsigned int i = hash & index->mask; index->slots[i] != NULL; i = (i + 1) & index->mask) {
+		ACCOUNTINFO* acc = index->slots[i];
+		if (acc->hash == hash && ICompare(username, acc->account) == 0)
+			return acc;
 	}
 	return NULL;
 }
@@ -454,36 +921,698 @@ void FreeAccountList(ACCOUNTINFO* first)
 	}
 }
 
+void FreeAccountIndex(ACCOUNTINDEX* index)
+{
+	if (index == NULL)
+		return;
+	FreeAccountList(index->accounts);
+	free(index->slots);
+	free(index);
+}
+
+#pragma endregion
+
+#pragma region Account Snapshot
+
+ACCOUNTINDEX* AcquireAccountIndex(LONG* oepoch)
+{
+	while (1) {
+		*oepoch = gAccountEpoch;
+		InterlockedIncrement(&gAccountReaders[*oepoch & 1]);
+		// the epoch may have flipped before counting: the reload that flipped it does not wait for this reader -> count again
+		if (gAccountEpoch == *oepoch)
+			break;
+		InterlockedDecrement(&gAccountReaders[*oepoch & 1]);
+	}
+	// read after counting on the current epoch: an index read here is not freed until the count drops
+	return gAccounts;
+}
+
+void ReleaseAccountIndex(LONG epoch)
+{
+	InterlockedDecrement(&gAccountReaders[epoch & 1]);
+}
+
+void PublishAccountIndex(ACCOUNTINDEX* index)
+{
+	ACCOUNTINDEX* old = (ACCOUNTINDEX*)InterlockedExchangePointer((void* volatile*)&gAccounts, index);
+	// readers of the old index counted on the old epoch. New readers count on the new epoch
+	LONG epoch = InterlockedIncrement(&gAccountEpoch) - 1;
+	while (gAccountReaders[epoch & 1] != 0) {
+		Sleep(1);
+	}
+	FreeAccountIndex(old);
+}
+
+unsigned __stdcall WatchAccountFile(void* arguments)
+{
+	const char* file = (const char*)arguments;
+	long long loaded_time = 0, loaded_size = 0, seen_time = 0, seen_size = 0;
+	GetFileVersion(file, &loaded_time, &loaded_size);
+	seen_time = loaded_time;
+	seen_size = loaded_size;
+
+	while (1) {
+		Sleep(ACCOUNT_RELOAD_INTERVAL);
+		long long modified, size;
+		if (!GetFileVersion(file, &modified, &size))
+			continue;
+		// reload once the file stops changing: a file being written is not loaded
+		int settled = modified == seen_time && size == seen_size;
+		seen_time = modified;
+		seen_size = size;
+		if (!settled || (modified == loaded_time && size == loaded_size))
+			continue;
+
+		ACCOUNTINDEX* index = LoadAccountIndex(file);
+		if (index == NULL)
+			continue;
+		loaded_time = modified;
+		loaded_size = size;
+		PublishAccountIndex(index);
+		printf("[%s] Reloaded %u accounts from '%s'\n", INFO_FLAGS, index->count, file);
+	}
+	return 0; // terminate thread
+}
+
+#pragma endregion
+
+#pragma region Article Store
+
+ARTICLESTORE* OpenArticleStore(const char* directory)
+{
+	if (!CreateDirectoryA(directory, NULL) && GetLastError() != ERROR_ALREADY_EXISTS) {
+		printf("[%s] Fail to create article directory: '%s'\n", ERROR_FLAGS, directory);
+		return NULL;
+	}
+	BuildCrc32Table();
+
+	ARTICLESTORE* store = (ARTICLESTORE*)calloc(1, sizeof(ARTICLESTORE));
+	if (store == NULL) {
+		printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
+		return NULL;
+	}
+	store->directory = directory;
+	store->segment = INVALID_HANDLE_VALUE;
+	InitializeSRWLock(&store->index_lock);
+	InitializeCriticalSection(&store->lock);
+	InitializeConditionVariable(&store->appended);
+	InitializeConditionVariable(&store->committed);
+	store->appending = (char*)malloc(ARTICLE_BUFFER_SIZE);
+	store->committing = (char*)malloc(ARTICLE_BUFFER_SIZE);
+	if (store->appending == NULL || store->committing == NULL) {
+		printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
+		CloseArticleStore(store);
+		return NULL;
+	}
+
+	if (!RecoverArticleStore(store)) {
+		CloseArticleStore(store);
+		return NULL;
+	}
+	store->thread = (HANDLE)_beginthreadex(NULL, 0, CommitArticles, (void*)store, 0, NULL);
+	if (store->thread == 0) {
+		printf("[%s] %s\n", WARNING_FLAGS, _TOO_MANY_THREADS);
+		CloseArticleStore(store);
+		return NULL;
+	}
+	printf("[%s] Article store '%s': %llu articles, segment %u\n", INFO_FLAGS, directory, store->last_id, store->segment_number);
+	return store;
+}
+
+int RecoverArticleStore(ARTICLESTORE* store)
+{
+	unsigned long long last_id = 0;
+	for (unsigned int number = 1; ; ++number) {
+		// the first segment is created on the first start
+		HANDLE segment = OpenArticleSegment(store->directory, number, number == 1 ? OPEN_ALWAYS : OPEN_EXISTING);
+		if (segment == INVALID_HANDLE_VALUE) {
+			if (number > 1 && GetLastError() == ERROR_FILE_NOT_FOUND)
+				break;
+			printf("[%s] Fail to open article segment %u\n", ERROR_FLAGS, number);
+			return 0;
+		}
+		if (number > 1 && !IsArticleTailClear(store->views + number - 2, store->segment_size)) {
+			// a later segment exists: the previous one was complete when it rolled over
+			printf("[%s] Segment %u: %s\n", ERROR_FLAGS, number - 1, _CORRUPTED_ARTICLE_SEGMENT);
+			CloseHandle(segment);
+			return 0;
+		}
+		if (!MapArticleSegment(store, segment)) {
+			printf("[%s] Fail to map article segment %u\n", ERROR_FLAGS, number);
+			CloseHandle(segment);
+			return 0;
+		}
+		long long size = ScanArticleSegment(store, store->views + number - 1, &last_id);
+
+		// only the last segment is written: the others are read from their views
+		if (store->segment != INVALID_HANDLE_VALUE)
+			CloseHandle(store->segment);
+		store->segment = segment;
+		store->segment_number = number;
+		store->segment_size = size;
+		if (size < 0)
+			return 0;
+	}
+	store->last_id = last_id;
+	store->durable_id = last_id;
+	return ClearArticleTail(store);
+}
+
+void CloseArticleStore(ARTICLESTORE* store)
+{
+	if (store == NULL)
+		return;
+	if (store->thread != 0) {
+		EnterCriticalSection(&store->lock);
+		store->stopped = 1;
+		WakeAllConditionVariable(&store->appended);
+		WakeAllConditionVariable(&store->committed);
+		LeaveCriticalSection(&store->lock);
+		WaitForSingleObject(store->thread, INFINITE);
+		CloseHandle(store->thread);
+	}
+	if (store->segment != INVALID_HANDLE_VALUE)
+		CloseHandle(store->segment);
+	FreeArticleIndex(store);
+	for (int i = 0; i < store->view_count; ++i) {
+		UnmapViewOfFile(store->views[i].base);
+		CloseHandle(store->views[i].mapping);
+	}
+	free(store->views);
+	DeleteCriticalSection(&store->lock);
+	free(store->appending);
+	free(store->committing);
+	free(store);
+}
+
+int AppendArticle(ARTICLESTORE* store, const char* author, const char* content, unsigned long long* oid)
+{
+	if (author == NULL)
+		author = "";
+	ARTICLEHEADER header;
+	header.magic = ARTICLE_MAGIC;
+	header.id = 0;
+	header.length = (unsigned int)strlen(content);
+	header.author_length = (unsigned short)strlen(author);
+	header.reserved = 0;
+	int size = GetArticleRecordSize(&header);
+	if (size > ARTICLE_BUFFER_SIZE)
+		return 0;
+	// the payload is checksummed out of the lock: only the header fields depend on the ID
+	unsigned int payload_crc = Crc32(author, header.author_length + 1);
+	payload_crc = Crc32(content, header.length + 1, payload_crc);
+
+	int appended = 0;
+	EnterCriticalSection(&store->lock);
+	while (!store->failed && !store->stopped && store->used + size > ARTICLE_BUFFER_SIZE) {
+		SleepConditionVariableCS(&store->committed, &store->lock, INFINITE); // the buffer is full until the commit thread takes it
+	}
+	if (!store->failed && !store->stopped) {
+		header.id = ++store->last_id;
+		header.checksum = ChecksumArticle(&header, payload_crc);
+
+		char* record = store->appending + store->used;
+		int offset = sizeof(ARTICLEHEADER);
+		memcpy_s(record, size, &header, sizeof(ARTICLEHEADER));
+		memcpy_s(record + offset, size - offset, author, (size_t)header.author_length + 1);
+		offset += header.author_length + 1;
+		memcpy_s(record + offset, size - offset, content, (size_t)header.length + 1);
+		offset += header.length + 1;
+		memset(record + offset, 0, (size_t)size - offset); // padding
+
+		store->used += size;
+		*oid = header.id;
+		appended = 1;
+		WakeConditionVariable(&store->appended);
+	}
+	LeaveCriticalSection(&store->lock);
+	return appended;
+}
+
+unsigned long long GetDurableArticle(ARTICLESTORE* store, int* ofailed)
+{
+	EnterCriticalSection(&store->lock);
+	unsigned long long durable_id = store->durable_id;
+	*ofailed = store->failed;
+	LeaveCriticalSection(&store->lock);
+	return durable_id;
+}
+
+unsigned __stdcall CommitArticles(void* arguments)
+{
+	ARTICLESTORE* store = (ARTICLESTORE*)arguments;
+	EnterCriticalSection(&store->lock);
+	while (1) {
+		while (store->used == 0 && !store->stopped) {
+			SleepConditionVariableCS(&store->appended, &store->lock, INFINITE);
+		}
+		if (store->used == 0) // stopped: every appended article is committed
+			break;
+
+		// group commit: every article appended so far goes in one write and one flush.
+		// The posts keep appending to the other buffer meanwhile
+		char* batch = store->appending;
+		int size = store->used;
+		unsigned long long last_id = store->last_id;
+		int failed = store->failed;
+		store->appending = store->committing;
+		store->committing = batch;
+		store->used = 0;
+		WakeAllConditionVariable(&store->committed); // the posts waiting for a free buffer
+		LeaveCriticalSection(&store->lock);
+
+		// after a failure nothing is written: the articles after a broken record would be lost on recovery
+		int is_ok = !failed && WriteArticleBatch(store, batch, size);
+		// the committed records are indexed in the view of the last segment, not in the batch
+		int is_indexed = is_ok &&
+			IndexArticles(store, store->views[store->segment_number - 1].base + store->segment_size - size, size);
+
+		EnterCriticalSection(&store->lock);
+		if (is_ok)
+			store->durable_id = last_id;
+		if (!is_indexed)
+			store->failed = 1; // the ID index would have a gap
+		WakeAllConditionVariable(&store->committed);
+		LeaveCriticalSection(&store->lock);
+
+		// the posts parked on the event loops are acknowledged now
+		WakeWaitingPosts();
+		EnterCriticalSection(&store->lock);
+	}
+	LeaveCriticalSection(&store->lock);
+	return 0; // terminate thread
+}
+
+unsigned int ChecksumArticle(const ARTICLEHEADER* header, unsigned int payload_crc)
+{
+	const char* fields = (const char*)&header->id;
+	return Crc32(fields, (int)(sizeof(ARTICLEHEADER) - (fields - (const char*)header)), payload_crc);
+}
+
+int GetArticleRecordSize(const ARTICLEHEADER* header)
+{
+	int size = (int)sizeof(ARTICLEHEADER) + header->author_length + 1 + (int)header->length + 1;
+	return (size + 7) & ~7; // the next header is aligned
+}
+
+#pragma endregion
+
+#pragma region Article Index
+
+int IndexArticles(ARTICLESTORE* store, const char* records, int size)
+{
+	int is_ok = 1;
+	AcquireSRWLockExclusive(&store->index_lock);
+	for (int offset = 0; offset < size && is_ok; ) {
+		const ARTICLEHEADER* article = (const ARTICLEHEADER*)(records + offset);
+		is_ok = IndexArticle(store, article);
+		offset += GetArticleRecordSize(article);
+	}
+	ReleaseSRWLockExclusive(&store->index_lock);
+	return is_ok;
+}
+
+int IndexArticle(ARTICLESTORE* store, const ARTICLEHEADER* article)
+{
+	if (store->article_count == store->article_capacity) {
+		unsigned long long capacity = store->article_capacity == 0 ? ARTICLE_INDEX_MIN_CAPACITY : 2 * store->article_capacity;
+		const ARTICLEHEADER** articles = (const ARTICLEHEADER**)realloc((void*)store->articles, (size_t)capacity * sizeof(ARTICLEHEADER*));
+		if (articles == NULL) {
+			printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
+			return 0;
+		}
+		store->articles = articles;
+		store->article_capacity = capacity;
+	}
+
+	AUTHORPOSTS* posts = AddAuthorPosts(store, (const char*)(article + 1));
+	if (posts == NULL)
+		return 0;
+	if (posts->count == posts->capacity) {
+		int capacity = posts->capacity == 0 ? ARTICLE_PAGE_SIZE : 2 * posts->capacity;
+		const ARTICLEHEADER** articles = (const ARTICLEHEADER**)realloc((void*)posts->articles, capacity * sizeof(ARTICLEHEADER*));
+		if (articles == NULL) {
+			printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
+			return 0;
+		}
+		posts->articles = articles;
+		posts->capacity = capacity;
+	}
+	posts->articles[posts->count++] = article;
+	store->articles[store->article_count++] = article;
+	return 1;
+}
+
+int GrowAuthorIndex(ARTICLESTORE* store)
+{
+	unsigned int slots = store->authors == NULL ? ARTICLE_AUTHOR_MIN_SLOTS : 2 * (store->author_mask + 1);
+	AUTHORPOSTS** authors = (AUTHORPOSTS**)calloc(slots, sizeof(AUTHORPOSTS*));
+	if (authors == NULL) {
+		printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
+		return 0;
+	}
+	unsigned int mask = slots - 1;
+	for (unsigned int i = 0; store->authors != NULL && i <= store->author_mask; ++i) {
+		AUTHORPOSTS* posts = store->authors[i];
+		if (posts == NULL)
+			continue;
+		unsigned int j = posts->hash & mask;
+		while (authors[j] != NULL) {
+			j = (j + 1) & mask;
+		}
+		authors[j] = posts;
+	}
+	free(store->authors);
+	store->authors = authors;
+	store->author_mask = mask;
+	return 1;
+}
+
+AUTHORPOSTS* AddAuthorPosts(ARTICLESTORE* store, const char* author)
+{
+	AUTHORPOSTS* posts = FindAuthorPosts(store, author);
+	if (posts != NULL)
+		return posts;
+	// at most half of the slots are used
+	unsigned int slots = store->authors == NULL ? 0 : store->author_mask + 1;
+	if (2 * (store->author_count + 1) > slots && !GrowAuthorIndex(store))
+		return NULL;
+
+	posts = (AUTHORPOSTS*)calloc(1, sizeof(AUTHORPOSTS));
+	if (posts == NULL) {
+		printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
+		return NULL;
+	}
+	posts->author = author;
+	posts->hash = HashAccountName(author);
+	unsigned int i = posts->hash & store->author_mask;
+	while (store->authors[i] != NULL) {
+		i = (i + 1) & store->author_mask;
+	}
+	store->authors[i] = posts;
+	store->author_count++;
+	return posts;
+}
+
+AUTHORPOSTS* FindAuthorPosts(const ARTICLESTORE* store, const char* author)
+{
+	if (store->authors == NULL)
+		return NULL;
+	unsigned int hash = HashAccountName(author);
+	for (unsigned int i = hash & store->author_mask; store->authors[i] != NULL; i = (i + 1) & store->author_mask) {
+		AUTHORPOSTS* posts = store->authors[i];
+		if (posts->hash == hash && ICompare(author, posts->author) == 0)
+			return posts;
+	}
+	return NULL;
+}
+
+void ReadRecentArticles(ARTICLESTORE* store, unsigned long long before, ARTICLEPAGE* opage)
+{
+	AcquireSRWLockShared(&store->index_lock);
+	unsigned long long id = store->article_count;
+	if (before != 0 && before - 1 < id)
+		id = before - 1;
+	while (id > 0 && AddArticleToPage(opage, store->articles[id - 1])) {
+		id--;
+	}
+	// the older articles are read from the last one of the page
+	opage->next = id > 0 ? opage->articles[opage->count - 1]->id : 0;
+	ReleaseSRWLockShared(&store->index_lock);
+}
+
+void ReadAuthorArticles(ARTICLESTORE* store, const char* author, unsigned long long before, ARTICLEPAGE* opage)
+{
+	AcquireSRWLockShared(&store->index_lock);
+	AUTHORPOSTS* posts = FindAuthorPosts(store, author);
+	if (posts != NULL) {
+		int i = posts->count;
+		if (before != 0) { // the first article from "before": the IDs increase along the list
+			int low = 0, high = posts->count;
+			while (low < high) {
+				int middle = (low + high) / 2;
+				if (posts->articles[middle]->id < before)
+					low = middle + 1;
+				else
+					high = middle;
+			}
+			i = low;
+		}
+		while (i > 0 && AddArticleToPage(opage, posts->articles[i - 1])) {
+			i--;
+		}
+		opage->next = i > 0 ? opage->articles[opage->count - 1]->id : 0;
+	}
+	ReleaseSRWLockShared(&store->index_lock);
+}
+
+int ReadArticles(ARTICLESTORE* store, unsigned long long from, int count, ARTICLEPAGE* opage)
+{
+	int found = 0;
+	AcquireSRWLockShared(&store->index_lock);
+	if (from >= 1 && from <= store->article_count) {
+		found = 1;
+		unsigned long long id = from;
+		while (id <= store->article_count && opage->count < count && AddArticleToPage(opage, store->articles[id - 1])) {
+			id++;
+		}
+		opage->next = id <= store->article_count ? id : 0;
+	}
+	ReleaseSRWLockShared(&store->index_lock);
+	return found;
+}
+
+int AddArticleToPage(ARTICLEPAGE* page, const ARTICLEHEADER* article)
+{
+	if (page->count == ARTICLE_PAGE_SIZE)
+		return 0;
+	unsigned int length = article->length;
+	int bytes = ARTICLE_LABEL_SIZE + article->author_length; // the label, the author and the separators
+	if ((long long)page->bytes + bytes + length > ARTICLE_PAGE_MAX_BYTES) {
+		if (page->count > 0)
+			return 0;
+		bytes += ARTICLE_TRUNCATED_MARK_SIZE; // the client sees where the content is cut
+		length = page->bytes + bytes >= ARTICLE_PAGE_MAX_BYTES ? 0 : ARTICLE_PAGE_MAX_BYTES - page->bytes - bytes;
+	}
+	page->articles[page->count] = article;
+	page->lengths[page->count++] = length;
+	page->bytes += bytes + (int)length;
+	return 1;
+}
+
+void FreeArticleIndex(ARTICLESTORE* store)
+{
+	for (unsigned int i = 0; store->authors != NULL && i <= store->author_mask; ++i) {
+		if (store->authors[i] != NULL) {
+			free((void*)store->authors[i]->articles);
+			free(store->authors[i]);
+		}
+	}
+	free(store->authors);
+	free((void*)store->articles);
+	store->authors = NULL;
+	store->articles = NULL;
+	store->article_count = 0;
+	store->author_count = 0;
+}
+
 #pragma endregion
 
 #pragma region I/O Operations
 
-int LoadAccountList(const char* file)
+int GetFileVersion(const char* file, long long* omodified, long long* osize)
+{
+	struct _stat64 info;
+	if (_stat64(file, &info) != 0)
+		return 0;
+	*omodified = (long long)info.st_mtime;
+	*osize = (long long)info.st_size;
+	return 1;
+}
+
+HANDLE OpenArticleSegment(const char* directory, unsigned int number, DWORD disposition)
+{
+	char path[MAX_PATH];
+	sprintf_s(path, MAX_PATH, ARTICLE_SEGMENT_NAME, directory, number);
+	return CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, disposition, FILE_ATTRIBUTE_NORMAL, NULL);
+}
+
+int MapArticleSegment(ARTICLESTORE* store, HANDLE segment)
+{
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(segment, &size))
+		return 0;
+	if (size.QuadPart < ARTICLE_SEGMENT_MAX_SIZE) {
+		// the segment gets its final size: the view sees the records written later
+		size.QuadPart = ARTICLE_SEGMENT_MAX_SIZE;
+		if (!SetFilePointerEx(segment, size, NULL, FILE_BEGIN) || !SetEndOfFile(segment))
+			return 0;
+	}
+	if (store->view_count == store->view_capacity) {
+		int capacity = store->view_capacity == 0 ? 16 : 2 * store->view_capacity;
+		SEGMENTVIEW* views = (SEGMENTVIEW*)realloc(store->views, capacity * sizeof(SEGMENTVIEW));
+		if (views == NULL) {
+			printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
+			return 0;
+		}
+		store->views = views;
+		store->view_capacity = capacity;
+	}
+
+	HANDLE mapping = CreateFileMappingA(segment, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mapping == NULL)
+		return 0;
+	const char* base = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (base == NULL) {
+		CloseHandle(mapping);
+		return 0;
+	}
+	SEGMENTVIEW* view = store->views + store->view_count++;
+	view->mapping = mapping;
+	view->base = base;
+	view->size = size.QuadPart;
+	return 1;
+}
+
+long long ScanArticleSegment(ARTICLESTORE* store, const SEGMENTVIEW* view, unsigned long long* iolast_id)
+{
+	long long offset = 0;
+	AcquireSRWLockExclusive(&store->index_lock);
+	while (offset + (long long)sizeof(ARTICLEHEADER) <= view->size) {
+		const ARTICLEHEADER* header = (const ARTICLEHEADER*)(view->base + offset);
+		// a torn commit leaves a record with a wrong header or checksum: it and the records after it are not durable
+		if (header->magic != ARTICLE_MAGIC || header->length > ARTICLE_BUFFER_SIZE)
+			break;
+		int size = GetArticleRecordSize(header);
+		if (size > ARTICLE_BUFFER_SIZE || offset + size > view->size)
+			break;
+		unsigned int payload_crc = Crc32((const char*)(header + 1), header->author_length + 1 + (int)header->length + 1);
+		if (ChecksumArticle(header, payload_crc) != header->checksum)
+			break;
+		if (header->id != *iolast_id + 1) { // a complete record is not torn: the records before it are lost
+			printf("[%s] Article %llu: %s\n", ERROR_FLAGS, *iolast_id + 1, _CORRUPTED_ARTICLE_SEGMENT);
+			offset = -1;
+			break;
+		}
+		if (!IndexArticle(store, header)) {
+			offset = -1;
+			break;
+		}
+		offset += size;
+		*iolast_id = header->id;
+	}
+	ReleaseSRWLockExclusive(&store->index_lock);
+	return offset;
+}
+
+int IsArticleTailClear(const SEGMENTVIEW* view, long long size)
+{
+	// a torn commit writes one batch at most
+	long long end = size + ARTICLE_BUFFER_SIZE;
+	if (end > view->size)
+		end = view->size;
+	while (size < end && view->base[size] == 0) {
+		size++;
+	}
+	return size == end;
+}
+
+int ClearArticleTail(ARTICLESTORE* store)
+{
+	const SEGMENTVIEW* view = store->views + store->segment_number - 1;
+	if (IsArticleTailClear(view, store->segment_size))
+		return 1;
+
+	printf("[%s] %s\n", WARNING_FLAGS, _DISCARD_INCOMPLETE_ARTICLE);
+	long long end = store->segment_size + ARTICLE_BUFFER_SIZE;
+	if (end > view->size)
+		end = view->size;
+	DWORD length = (DWORD)(end - store->segment_size);
+	char* zeros = (char*)calloc(length, 1);
+	if (zeros == NULL) {
+		printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
+		return 0;
+	}
+	LARGE_INTEGER offset;
+	offset.QuadPart = store->segment_size;
+	DWORD written = 0;
+	int is_ok = SetFilePointerEx(store->segment, offset, NULL, FILE_BEGIN) &&
+		WriteFile(store->segment, zeros, length, &written, NULL) && written == length &&
+		FlushFileBuffers(store->segment);
+	free(zeros);
+	return is_ok;
+}
+
+int WriteArticleBatch(ARTICLESTORE* store, const char* batch, int size)
+{
+	// the records of a batch stay in one segment
+	if (store->segment_size + size > ARTICLE_SEGMENT_MAX_SIZE) {
+		HANDLE next = OpenArticleSegment(store->directory, store->segment_number + 1, CREATE_ALWAYS);
+		if (next == INVALID_HANDLE_VALUE || !MapArticleSegment(store, next)) {
+			printf("[%s:%d] %s\n", ERROR_FLAGS, (int)GetLastError(), _COMMIT_ARTICLES_FAIL);
+			if (next != INVALID_HANDLE_VALUE)
+				CloseHandle(next);
+			return 0;
+		}
+		CloseHandle(store->segment);
+		store->segment = next;
+		store->segment_number++;
+		store->segment_size = 0;
+	}
+
+	// the segments have their final size: the batch is written over the zeros after the last record
+	LARGE_INTEGER offset;
+	offset.QuadPart = store->segment_size;
+	DWORD written = 0;
+	if (!SetFilePointerEx(store->segment, offset, NULL, FILE_BEGIN) ||
+		!WriteFile(store->segment, batch, (DWORD)size, &written, NULL) || written != (DWORD)size ||
+		!FlushFileBuffers(store->segment)) {
+		printf("[%s:%d] %s\n", ERROR_FLAGS, (int)GetLastError(), _COMMIT_ARTICLES_FAIL);
+		return 0;
+	}
+	store->segment_size += size;
+	return 1;
+}
+
+ACCOUNTINDEX* LoadAccountIndex(const char* file)
 {
 	FILE* fp;
 	fopen_s(&fp, file, "r");
 	if (fp == NULL) {
 		printf("[%s] Fail to open account file: '%s'\n", ERROR_FLAGS, file);
-		return 0;
+		return NULL;
 	}
 	char line[LINE_MAX_SIZE];
 	int status;
-	ACCOUNTINFO* cur = NULL;
+	ACCOUNTINFO* head = NULL, * tail = NULL, * acc = NULL;
 	while (fgets(line, LINE_MAX_SIZE, fp)) {
 		char* space_pos = (char*)memchr(line, ' ', strlen(line));
 		if (space_pos == NULL) {
-			if (strlen(line) > 1) {
-				status = AS_LOCK;
-				cur = Append(cur, CreateAccountInfo(line, (int)strlen(line), status));
-			}
+			if (strlen(line) <= 1)
+				continue;
+			status = AS_LOCK;
+			acc = CreateAccountInfo(line, (int)strlen(line), status);
 		}
 		else {
 			status = atoi(space_pos + 1);
-			cur = Append(cur, CreateAccountInfo(line, (int)(space_pos - line), status));
+			acc = CreateAccountInfo(line, (int)(space_pos - line), status);
 		}
+		if (acc == NULL)
+			continue;
+		// keep the file order: the first one of duplicated names is indexed
+		if (tail == NULL)
+			head = acc;
+		else
+			tail->next = acc;
+		tail = acc;
 	}
 	fclose(fp);
-	return 1;
+
+	ACCOUNTINDEX* index = CreateAccountIndex(head);
+	if (index == NULL)
+		FreeAccountList(head);
+	return index;
 }
 
 #pragma endregion
@@ -632,140 +1761,275 @@ int Send(SOCKET sender, int bytes, const char* byte_stream)
 	return 1;
 }
 
-int SegmentationSend(SOCKET sender, const char* message, int message_len, int* obyte_sent)
+int SendBuffers(SOCKET sender, WSABUF* buffers, int buffer_count)
 {
-	int start_byte = 0; // start byte in message.
-	unsigned short bsend = 0; // number of bytes will send, not include header size.
-	unsigned short bremain = 0; // number of bytes remain.
-
-	char content[APPLICATION_BUFF_MAX_SIZE];
-	while (start_byte < message_len) {
-		// Prepare content for sending: header (number of bytes send | number of bytes remain) + body (a part of message)
-		bsend = message_len - start_byte;
-		if (bsend + SEGMENT_HEADER_SIZE > APPLICATION_BUFF_MAX_SIZE) {
-			bsend = APPLICATION_BUFF_MAX_SIZE - SEGMENT_HEADER_SIZE;
+	int first = 0; // the first buffer not sent fully
+	while (first < buffer_count) {
+		DWORD sent = 0;
+		if (WSASend(sender, buffers + first, buffer_count - first, &sent, 0, NULL, NULL) == SOCKET_ERROR) {
+			int err = WSAGetLastError();
+			if (err == WSAEWOULDBLOCK) {
+				// non-blocking socket: the socket buffer is full until the client reads. The rest is sent on POLLWRNORM
+				return 0;
+			}
+			if (err == WSAEHOSTUNREACH) {
+				printf("[%s:%d] %s\n", WARNING_FLAGS, err, _HOST_UNREACHABLE);
+			}
+			else if (err == WSAECONNABORTED || err == WSAECONNRESET) {
+				printf("[%s:%d] %s\n", ERROR_FLAGS, err, _CONNECTION_DROP);
+			}
+			else {
+				printf("[%s:%d] %s\n", WARNING_FLAGS, err, _SEND_FAIL);
+			}
+			return -1;
 		}
-		bremain = message_len - start_byte - bsend;
-
-		int bsend_bigendian = htons(bsend); // uniform with many architectures.
-		int bremain_bigendian = htons(bremain);
-
-		memcpy_s(content, SEGMENT_HEADER_CURRENT_SIZE, &bsend_bigendian, SEGMENT_HEADER_CURRENT_SIZE);
-		memcpy_s(content + SEGMENT_HEADER_CURRENT_SIZE, SEGMENT_HEADER_REMAIN_SIZE, &bremain_bigendian, SEGMENT_HEADER_REMAIN_SIZE);
-		memcpy_s(content + SEGMENT_HEADER_SIZE, bsend, message + start_byte, bsend);
-		// Send
-		int ret = Send(sender, bsend + SEGMENT_HEADER_SIZE, content);
-		if (ret == 1) {
-			start_byte += bsend;
+		// skip the buffers sent: a partial send resumes inside a buffer
+		while (first < buffer_count && sent >= buffers[first].len) {
+			sent -= buffers[first].len;
+			buffers[first++].len = 0;
 		}
-		else {
-			if (obyte_sent != NULL)
-				*obyte_sent = start_byte;
-			return ret;
+		if (first < buffer_count) {
+			buffers[first].buf += sent;
+			buffers[first].len -= sent;
 		}
 	}
-	if (obyte_sent != NULL)
-		*obyte_sent = start_byte;
 	return 1;
 }
 
-int Receive(SOCKET receiver, int bytes, char** obyte_stream)
+int SegmentationSend(SOCKET sender, TRANSFER* iotransfer, const char* message, int message_len)
 {
-	if (bytes > APPLICATION_BUFF_MAX_SIZE)
-	{
-		printf("[%s] %s\n", WARNING_FLAGS, _TOO_MUCH_BYTES);
-		bytes = APPLICATION_BUFF_MAX_SIZE;
-	}
-	char buffer[APPLICATION_BUFF_MAX_SIZE];
+	WSABUF part;
+	part.buf = (char*)message;
+	part.len = (ULONG)message_len;
+	return SegmentationSendParts(sender, iotransfer, &part, 1);
+}
 
-	int ret = recv(receiver, buffer, bytes, 0);
-	if (ret == SOCKET_ERROR) {
-		int err = WSAGetLastError();
-		if (err == WSAECONNABORTED || err == WSAECONNRESET) {
-			printf("[%s:%d] %s\n", ERROR_FLAGS, err, _CONNECTION_DROP);
+int SegmentationSendParts(SOCKET sender, TRANSFER* iotransfer, const WSABUF* parts, int part_count)
+{
+	int message_len = 0;
+	for (int i = 0; i < part_count; ++i) {
+		message_len += (int)parts[i].len;
+	}
+	// bytes are waiting to be sent: the message goes after them
+	int queued = iotransfer->output != NULL;
+	WSABUF buffers[SEND_MAX_BUFFERS];
+	SEGMENT_LENGTH headers[SEND_MAX_BUFFERS / 2][2];
+	int start_byte = 0; // start byte in message.
+	int part = 0, part_offset = 0; // the part containing the start byte, and its offset in the part
+	int segment_left = 0; // number of bytes of the current segment not in the buffers yet
+	while (start_byte < message_len) {
+		// Prepare the segments: header (number of bytes send | number of bytes remain) + the slices of the parts in the segment
+		int count = 0, header_count = 0;
+		while (start_byte < message_len && count + 2 <= SEND_MAX_BUFFERS) {
+			if (segment_left == 0) {
+				segment_left = message_len - start_byte;
+				if (segment_left > SEGMENT_MAX_SIZE)
+					segment_left = SEGMENT_MAX_SIZE;
+				headers[header_count][0] = ToSegmentLength(segment_left); // uniform with many architectures.
+				headers[header_count][1] = ToSegmentLength(message_len - start_byte - segment_left);
+				buffers[count].buf = (char*)headers[header_count++];
+				buffers[count++].len = SEGMENT_HEADER_SIZE;
+			}
+			int bytes = (int)parts[part].len - part_offset;
+			if (bytes > segment_left)
+				bytes = segment_left;
+			buffers[count].buf = parts[part].buf + part_offset;
+			buffers[count++].len = (ULONG)bytes;
+			start_byte += bytes;
+			segment_left -= bytes;
+			part_offset += bytes;
+			if (part_offset == (int)parts[part].len) {
+				part++;
+				part_offset = 0;
+			}
 		}
-		else {
-			printf("[%s:%d] %s\n", WARNING_FLAGS, err, _RECEIVE_FAIL);
+		// Send the segments with one call. What the socket buffer can not take is copied and sent on POLLWRNORM
+		int ret = queued ? 0 : SendBuffers(sender, buffers, count);
+		if (ret == -1)
+			return -1;
+		if (ret == 0) {
+			if (!QueueOutput(iotransfer, buffers, count))
+				return -1; // the rest of the message can not be sent
+			queued = 1;
 		}
-		return -1;
 	}
-	else if (ret == 0) {
-		return -1;
+	return 1;
+}
+
+int SendArticlePage(SOCKET sender, TRANSFER* iotransfer, const char* message, const ARTICLEPAGE* page)
+{
+	WSABUF parts[3 + 5 * ARTICLE_PAGE_SIZE]; // the only article of a page may be cut
+	char labels[ARTICLE_PAGE_SIZE][ARTICLE_LABEL_SIZE];
+	int count = 0;
+	// the message without its '\0': the articles follow it
+	parts[count].buf = (char*)message;
+	parts[count++].len = (ULONG)strlen(message);
+	for (int i = 0; i < page->count; ++i) {
+		const ARTICLEHEADER* article = page->articles[i];
+		const char* author = (const char*)(article + 1);
+		sprintf_s(labels[i], ARTICLE_LABEL_SIZE, "#%llu [", article->id);
+		parts[count].buf = labels[i];
+		parts[count++].len = (ULONG)strlen(labels[i]);
+		parts[count].buf = (char*)author;
+		parts[count++].len = article->author_length;
+		parts[count].buf = (char*)"] ";
+		parts[count++].len = 2;
+		parts[count].buf = (char*)author + article->author_length + 1; // the content
+		parts[count++].len = page->lengths[i];
+		if (page->lengths[i] < article->length) {
+			parts[count].buf = (char*)ARTICLE_TRUNCATED_MARK;
+			parts[count++].len = ARTICLE_TRUNCATED_MARK_SIZE;
+		}
+		parts[count].buf = (char*)"\n";
+		parts[count++].len = 1;
 	}
-	else if (ret < bytes) {
-		printf("[%s] %s\n", WARNING_FLAGS, _RECEIVE_UNEXPECTED_MESSAGE);
-		*obyte_stream = NULL;
-		return 0;
+	parts[count].buf = (char*)"";
+	parts[count++].len = 1;
+	return SegmentationSendParts(sender, iotransfer, parts, count);
+}
+
+int QueueOutput(TRANSFER* iotransfer, const WSABUF* buffers, int buffer_count)
+{
+	int bytes = 0;
+	for (int i = 0; i < buffer_count; ++i) {
+		bytes += (int)buffers[i].len;
 	}
-	else {
-		*obyte_stream = Clone(buffer, bytes);
+	if (bytes == 0)
+		return 1;
+
+	// the bytes sent already are dropped with the copy
+	int kept = iotransfer->output_size - iotransfer->output_sent;
+	char* output = (char*)malloc((size_t)kept + bytes);
+	if (output == NULL) {
+		printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
+		return 0;
 	}
+	if (kept > 0)
+		memcpy(output, iotransfer->output + iotransfer->output_sent, (size_t)kept);
+	int size = kept;
+	for (int i = 0; i < buffer_count; ++i) {
+		memcpy(output + size, buffers[i].buf, buffers[i].len);
+		size += (int)buffers[i].len;
+	}
+	free(iotransfer->output);
+	iotransfer->output = output;
+	iotransfer->output_size = size;
+	iotransfer->output_sent = 0;
 	return 1;
 }
 
-int ReceiveSegment(SOCKET receiver, char** obyte_stream, int* ostream_len, int* oremain)
+int ContinueSend(SOCKET sender, TRANSFER* iotransfer)
 {
-	*obyte_stream = NULL;
-	char* read;
-	int remain;
-	int current;
-	// read number of bytes remain | number of bytes current
-	int ret = Receive(receiver, SEGMENT_HEADER_SIZE, &read);
-	if (ret == 1) {
-		current = ntohs(*(unsigned short*)read);
-		remain = ntohs(*(unsigned short*)(read + SEGMENT_HEADER_CURRENT_SIZE));
+	if (iotransfer->output == NULL)
+		return 1;
 
-		*ostream_len = current;
-		*oremain = remain;
-		free(read);
+	WSABUF buffer;
+	buffer.buf = iotransfer->output + iotransfer->output_sent;
+	buffer.len = (ULONG)(iotransfer->output_size - iotransfer->output_sent);
+	int ret = SendBuffers(sender, &buffer, 1);
+	if (ret == 0) {
+		iotransfer->output_sent = (int)(buffer.buf - iotransfer->output);
 	}
-	else {
-		*ostream_len = 0;
-		*oremain = 0;
-		return ret;
+	else if (ret == 1) {
+		free(iotransfer->output);
+		iotransfer->output = NULL;
+		iotransfer->output_size = 0;
+		iotransfer->output_sent = 0;
 	}
+	return ret;
+}
 
-	// read message content
-	ret = Receive(receiver, current, &read);
-	if (ret == 1) {
-		*obyte_stream = Clone(read, current);
-		free(read);
+int ReceiveAvailable(SOCKET receiver, int bytes, char* obuffer, int* oreceived)
+{
+	*oreceived = 0;
+	int ret = recv(receiver, obuffer, bytes, 0);
+	if (ret == SOCKET_ERROR) {
+		int err = WSAGetLastError();
+		if (err == WSAEWOULDBLOCK) {
+			// non-blocking socket: the rest comes with a later POLLRDNORM
+			return 1;
+		}
+		if (err == WSAECONNABORTED || err == WSAECONNRESET) {
+			printf("[%s:%d] %s\n", ERROR_FLAGS, err, _CONNECTION_DROP);
+		}
+		else {
+			printf("[%s:%d] %s\n", WARNING_FLAGS, err, _RECEIVE_FAIL);
+		}
+		return -1;
 	}
-	else {
-		*ostream_len = 0;
-		*oremain = 0;
-		return ret;
+	else if (ret == 0) {
+		return -1;
 	}
+	*oreceived = ret;
 	return 1;
 }
 
-int SegmentationReceive(SOCKET socket, char** omessage)
+int ReceiveRequest(SOCKET receiver, TRANSFER* iotransfer, char** orequest)
 {
-	char* _message;
-	int mlen, remain, start_byte = 0;
-	int status = 1;
-	*omessage = NULL;
+	*orequest = NULL;
 	while (1) {
-		status = ReceiveSegment(socket, &_message, &mlen, &remain);
-		if (status != 1) {
-			free(_message);
-			return status;
-		}
-		if (*omessage == NULL) {
-			*omessage = (char*)malloc((size_t)mlen + remain);
-			if (*omessage == NULL) {
-				printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
-				free(_message);
+		int received;
+		if (iotransfer->header_received < SEGMENT_HEADER_SIZE) {
+			// read number of bytes current | number of bytes remain
+			if (ReceiveAvailable(receiver, SEGMENT_HEADER_SIZE - iotransfer->header_received,
+				iotransfer->header + iotransfer->header_received, &received) == -1)
+				return -1;
+			if (received == 0)
 				return 0;
+			iotransfer->header_received += received;
+			if (iotransfer->header_received < SEGMENT_HEADER_SIZE)
+				continue;
+
+			unsigned int current = FromSegmentLength(*(SEGMENT_LENGTH*)iotransfer->header);
+			unsigned int remain = FromSegmentLength(*(SEGMENT_LENGTH*)(iotransfer->header + SEGMENT_HEADER_CURRENT_SIZE));
+			if (current > MESSAGE_MAX_LENGTH || remain > MESSAGE_MAX_LENGTH) {
+				printf("[%s] %s\n", WARNING_FLAGS, _TOO_MUCH_BYTES);
+				return -1; // the rest of the request can not be skipped
+			}
+			if (iotransfer->request == NULL) {
+				// the first header gives the request size: the segment contents are read into the request directly
+				if (remain > MESSAGE_MAX_LENGTH - current) {
+					printf("[%s] %s\n", WARNING_FLAGS, _TOO_MUCH_BYTES);
+					return -1;
+				}
+				iotransfer->request_size = (int)(current + remain);
+				iotransfer->request_received = 0;
+				iotransfer->request = (char*)malloc((size_t)iotransfer->request_size + 1); // + '\0'
+				if (iotransfer->request == NULL) {
+					printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
+					return -1;
+				}
+			}
+			if (current > (unsigned int)(iotransfer->request_size - iotransfer->request_received)) {
+				printf("[%s] %s\n", WARNING_FLAGS, _TOO_MUCH_BYTES);
+				return -1;
 			}
+			iotransfer->segment_left = (int)current;
+			iotransfer->last_segment = remain == 0;
+		}
+
+		if (iotransfer->segment_left > 0) {
+			if (ReceiveAvailable(receiver, iotransfer->segment_left,
+				iotransfer->request + iotransfer->request_received, &received) == -1)
+				return -1;
+			if (received == 0)
+				return 0;
+			iotransfer->request_received += received;
+			iotransfer->segment_left -= received;
+		}
+		else if (!iotransfer->last_segment) {
+			iotransfer->header_received = 0; // the next segment
+		}
+		else {
+			// the request is complete: the transfer is ready for the next one
+			iotransfer->request[iotransfer->request_received] = '\0';
+			*orequest = iotransfer->request;
+			iotransfer->request = NULL;
+			iotransfer->header_received = 0;
+			iotransfer->last_segment = 0;
+			return 1;
 		}
-		memcpy_s(*omessage + start_byte, mlen, _message, mlen);
-		start_byte += mlen;
-		free(_message);
-		if (remain <= 0)
-			break;
 	}
-	return status;
 }
 
 #pragma endregion
@@ -793,6 +2057,36 @@ int ExtractCommand(int argc, char* argv[], int* oport)
 	return is_ok;
 }
 
+int GetProcessorCount()
+{
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	int count = (int)info.dwNumberOfProcessors;
+	if (count < 1)
+		count = 1;
+	return count > MAX_EVENT_LOOPS ? MAX_EVENT_LOOPS : count;
+}
+
+void BuildCrc32Table()
+{
+	for (unsigned int i = 0; i < 256; ++i) {
+		unsigned int crc = i;
+		for (int bit = 0; bit < 8; ++bit) {
+			crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320u : crc >> 1;
+		}
+		gCrc32Table[i] = crc;
+	}
+}
+
+unsigned int Crc32(const char* data, int length, unsigned int crc)
+{
+	crc = ~crc;
+	for (int i = 0; i < length; ++i) {
+		crc = gCrc32Table[(crc ^ (unsigned char)data[i]) & 0xFF] ^ (crc >> 8);
+	}
+	return ~crc;
+}
+
 IP CreateDefaultIP()
 {
 	IP addr;
@@ -811,28 +2105,6 @@ char* Clone(const char* source, int length, int start)
 	return _clone;
 }
 
-MESSAGE CreateMessage(int status, const char* message)
-{
-	MESSAGE m;
-	if (message == NULL) {
-		m = Clone("", 1, STATUS_LENGTH);
-	}
-	else {
-		m = Clone(message, (int)strlen(message) + 1, STATUS_LENGTH);
-	}
-	if (m != NULL) {
-		// accept 2 digits value for status
-		m[0] = status / 10 + '0';
-		m[1] = status % 10 + '0';
-	}
-	return m;
-}
-
-void DestroyMessage(MESSAGE m)
-{
-	free(m);
-}
-
 int ICompare(const char* first, const char* second, int length)
 {
 	int flen = (int)strlen(first) + 1;
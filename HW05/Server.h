@@ -3,6 +3,7 @@
 #pragma region Header Declarations
 
 #include <process.h>
+#include <sys/stat.h>
 
 #include "CommonHeader.h"
 
@@ -10,14 +11,34 @@
 
 #pragma region Constants Definitions
 
-#define LISTEN_WAIT_TIME RECEIVE_TIMEOUT_INTERVAL / 2
 #define MAX_CONNECTIONS SOMAXCONN
-#define MAX_CLIENTS_PER_THREAD WSA_MAXIMUM_WAIT_EVENTS
+#define MAX_EVENT_LOOPS 64 // Maximum number of event-loop threads (sockets managers). One per processor
+#define MANAGER_TARGET_LOAD 256 // A new event-loop thread starts only when every running one holds this many sockets
+#define MANAGER_LOW_LOAD 32 // A thread holding fewer sockets hands them to the others and stops, if they stay under MANAGER_TARGET_LOAD
+#define POLL_INITIAL_CAPACITY 64 // Number of sockets a sockets manager allocates at first. The slots grow on demand
 
 #define LINE_MAX_SIZE 1024
+#define ACCOUNT_INDEX_MIN_SLOTS 64 // Minimum number of slots of the account index
+#define ACCOUNT_RELOAD_INTERVAL 2000 // Milliseconds between two checks of the account file for changes
+
+#define PIPELINE_MAX_REQUESTS 8 // Budget of a client per wakeup: The remaining requests wait for the next cycle, after the other ready clients
 
 #define ACCOUNT_FILE_PATH ".//account.txt"
 
+#define ARTICLE_DIRECTORY ".//articles" // The directory of the article segment files
+#define ARTICLE_SEGMENT_NAME "%s//%08u.seg" // Segment file name: The directory and the segment number. The segments are numbered from 1 without gaps
+#define ARTICLE_SEGMENT_MAX_SIZE (64 * 1024 * 1024) // A segment rolls over before a commit makes it larger than this size, in bytes
+#define ARTICLE_BUFFER_SIZE (2 * MESSAGE_MAX_LENGTH) // Size of each of the two append buffers: Posts append to one while the other is committed
+#define ARTICLE_MAGIC 0x31545241 // "ART1": The first bytes of every article record
+#define ARTICLE_INDEX_MIN_CAPACITY 1024 // Minimum number of articles the ID index allocates. The index grows on demand
+#define ARTICLE_AUTHOR_MIN_SLOTS 64 // Minimum number of slots of the author index
+#define ARTICLE_PAGE_SIZE 20 // Maximum number of articles in a response of a read command
+#define ARTICLE_PAGE_MAX_BYTES (MESSAGE_MAX_LENGTH - ARTICLE_SUMMARY_SIZE) // Maximum size of the articles in a response of a read command: The client accepts MESSAGE_MAX_LENGTH bytes
+#define ARTICLE_LABEL_SIZE 32 // Size of the label written before an article in a response: "#<id> [<author>] "
+#define ARTICLE_TRUNCATED_MARK " [truncated]" // Written after the content of an article cut to fit in a page. See AddArticleToPage()
+#define ARTICLE_TRUNCATED_MARK_SIZE ((int)sizeof(ARTICLE_TRUNCATED_MARK) - 1)
+#define ARTICLE_SUMMARY_SIZE 64 // Size of the response message of a page of articles. See SM_ARTICLES
+
 #define S_LOGIN_SUCC 10
 #define S_ACCOUNT_LOCK 11
 #define S_ACCOUNT_NOT_EXIST 12
@@ -25,7 +46,10 @@
 #define S_LOGGEDIN 14
 #define S_POST_SUCC 20
 #define S_NOT_LOGIN 21
+#define S_POST_FAIL 22
 #define S_LOGOUT_SUCC 30
+#define S_ARTICLES 40
+#define S_ARTICLE_NOT_FOUND 41
 #define S_UNREGCONIZE_COMMAND 99
 
 #define SM_LOGIN_SUCC "Login successfully"
@@ -35,9 +59,39 @@
 #define SM_LOGGEDIN "You already logged in"
 #define SM_POST_SUCC "Post the article successfully"
 #define SM_NOT_LOGIN "No permission because you are not logged in"
+#define SM_POST_FAIL "Fail to save the article"
 #define SM_LOGOUT_SUCC "Log out successfully"
+#define SM_ARTICLES "%d articles. Next page: %llu\n" // The number of articles and the argument reading the next page (0 if no more), then one article per line
+#define SM_ARTICLE_NOT_FOUND "Article not found"
 #define SM_UNREGCONIZE_COMMAND "Unregconize command"
 
+/// Preformatted responses: The status code (STATUS_LENGTH digits) followed by the status message. They are sent as they are
+#define _RESPONSE_STATUS(status) #status
+#define RESPONSE_MESSAGE(status, message) _RESPONSE_STATUS(status) message
+
+#define RM_LOGIN_SUCC RESPONSE_MESSAGE(S_LOGIN_SUCC, SM_LOGIN_SUCC)
+#define RM_ACCOUNT_LOCK RESPONSE_MESSAGE(S_ACCOUNT_LOCK, SM_ACCOUNT_LOCK)
+#define RM_ACCOUNT_NOT_EXIST RESPONSE_MESSAGE(S_ACCOUNT_NOT_EXIST, SM_ACCOUNT_NOT_EXIST)
+#define RM_ACCOUNT_LOGGEDIN RESPONSE_MESSAGE(S_ACCOUNT_LOGGEDIN, SM_ACCOUNT_LOGGEDIN)
+#define RM_LOGGEDIN RESPONSE_MESSAGE(S_LOGGEDIN, SM_LOGGEDIN)
+#define RM_POST_SUCC RESPONSE_MESSAGE(S_POST_SUCC, SM_POST_SUCC)
+#define RM_NOT_LOGIN RESPONSE_MESSAGE(S_NOT_LOGIN, SM_NOT_LOGIN)
+#define RM_POST_FAIL RESPONSE_MESSAGE(S_POST_FAIL, SM_POST_FAIL)
+#define RM_LOGOUT_SUCC RESPONSE_MESSAGE(S_LOGOUT_SUCC, SM_LOGOUT_SUCC)
+#define RM_ARTICLE_NOT_FOUND RESPONSE_MESSAGE(S_ARTICLE_NOT_FOUND, SM_ARTICLE_NOT_FOUND)
+#define RM_UNREGCONIZE_COMMAND RESPONSE_MESSAGE(S_UNREGCONIZE_COMMAND, SM_UNREGCONIZE_COMMAND)
+
+#define COMMAND_MAX_LENGTH 6 // Maximum length of a command text. See PACK_COMMAND()
+/// Pack the lower-case letters of a command text into a number: The first letter in the lowest byte. See ExtractRequestCommand()
+#define PACK_COMMAND(a, b, c, d, e, f) ((unsigned long long)(a) | (unsigned long long)(b) << 8 | (unsigned long long)(c) << 16 | \
+		(unsigned long long)(d) << 24 | (unsigned long long)(e) << 32 | (unsigned long long)(f) << 40)
+#define PC_POST PACK_COMMAND('p', 'o', 's', 't', 0, 0) // CM_POST
+#define PC_LOGIN PACK_COMMAND('u', 's', 'e', 'r', 0, 0) // CM_LOGIN
+#define PC_LOGOUT PACK_COMMAND('b', 'y', 'e', 0, 0, 0) // CM_LOGOUT
+#define PC_RECENT PACK_COMMAND('r', 'e', 'c', 'e', 'n', 't') // CM_RECENT
+#define PC_AUTHOR PACK_COMMAND('a', 'u', 't', 'h', 'o', 'r') // CM_AUTHOR
+#define PC_GET PACK_COMMAND('g', 'e', 't', 0, 0, 0) // CM_GET
+
 #define AS_FREE 0
 #define AS_LOCK 1
 #define AS_LOGGED_IN 2
@@ -54,26 +108,260 @@ typedef struct accountinfo {
 
 	int status; // Account status. See AS_ for some definitions of account status
 
+	unsigned int hash; // Hash of the case-folded user name. See HashAccountName()
+
 	struct accountinfo* next; // Next account. Linked List
 
 } ACCOUNTINFO;
 
 /// <summary>
-/// Manage sockets on a thread;
+/// Hash index of accounts: Open addressing (linear probing) keyed on the case-folded user name.
+/// The index is not changed after it is built, so lookups take no lock. A reload builds a new index (snapshot)
+/// and publishes it in place of the old one (See PublishAccountIndex()).
+/// </summary>
+typedef struct accountindex {
+
+	ACCOUNTINFO* accounts; // All accounts read from file, in file order. Linked List. Owned by the index
+
+	unsigned int count; // Number of indexed accounts. A duplicated user name is indexed once: The first one in file
+
+	unsigned int mask; // Number of slots - 1. The number of slots is a power of 2, at least twice "count"
+
+	ACCOUNTINFO** slots; // The slots. NULL if the slot is empty
+
+} ACCOUNTINDEX;
+
+/// <summary>
+/// The transfers in progress on a non-blocking socket: The request being received and the response bytes not sent yet.
+/// A transfer stops when the socket is not ready and continues on the next POLLRDNORM or POLLWRNORM: The thread never waits for a client
+/// </summary>
+typedef struct transfer {
+
+	char header[SEGMENT_HEADER_SIZE]; // The segment header being received
+
+	int header_received; // Number of bytes of "header" received
+
+	char* request; // The request being reassembled. NULL before its first segment header
+
+	int request_size; // Length of the request, from its first segment header
+
+	int request_received; // Number of bytes of "request" received
+
+	int segment_left; // Number of content bytes of the current segment not received yet
+
+	int last_segment; // 1 if the current segment is the last one of the request
+
+	char* output; // The response bytes (segment headers and contents) the socket buffer could not take. NULL if every response is sent
+
+	int output_size; // Number of bytes in "output"
+
+	int output_sent; // Number of bytes of "output" sent
+
+} TRANSFER;
+
+/// <summary>
+/// The account working on a socket
+/// </summary>
+typedef struct session {
+
+	int status; // Account status: AS_FREE or AS_LOGGED_IN
+
+	char* account; // The user name logged in on the socket, as written in the account file. NULL if not logged in. Owned by the session
+
+	TRANSFER transfer; // The transfers in progress on the socket. They move with the socket to another thread. Owned by the session
+
+	struct response* parked; // The responses waiting for a post to be durable, in the order of requests (See ParkResponse()). Owned by the session
+
+	int parked_count; // Number of parked responses. The later responses of the socket are parked behind them
+
+	int parked_capacity; // Number of slots allocated for "parked"
+
+} SESSION;
+
+/// <summary>
+/// The header of an article record. A record is the header, the author and the content (each one ends with '\0'), padded to 8 bytes.
+/// Records are appended to segment files and never changed: The mapped records are read in place.
+/// </summary>
+typedef struct articleheader {
+
+	unsigned int magic; // ARTICLE_MAGIC
+
+	unsigned int checksum; // CRC-32 of the author and the content, continued over the header fields after this one. See ChecksumArticle()
+
+	unsigned long long id; // Article ID: Increases by 1 on each post, from 1
+
+	unsigned int length; // Length of the content, not including '\0'
+
+	unsigned short author_length; // Length of the author name, not including '\0'
+
+	unsigned short reserved; // 0
+
+} ARTICLEHEADER;
+
+/// <summary>
+/// The articles of a response to a read command. The articles are sent from the mapped segments: They are not copied
+/// </summary>
+typedef struct articlepage {
+
+	int count; // Number of articles
+
+	const ARTICLEHEADER* articles[ARTICLE_PAGE_SIZE]; // The articles, in the mapped segments
+
+	unsigned int lengths[ARTICLE_PAGE_SIZE]; // Number of content bytes sent for each article. Less than its length if the page is too large
+
+	int bytes; // Size of the page in the response, at most. See ARTICLE_PAGE_MAX_BYTES
+
+	unsigned long long next; // The argument reading the next page. 0 if no more articles
+
+	char message[ARTICLE_SUMMARY_SIZE]; // The response message. See CreatePageMessage()
+
+} ARTICLEPAGE;
+
+/// <summary>
+/// A response waiting for the end of a cycle (See SendResponses()), or parked in the session until its post is durable (See ParkResponse())
+/// </summary>
+typedef struct response {
+
+	int index; // The index of the socket in the sockets manager. Not used once parked: The socket may move
+
+	const char* message; // The response message: Preformatted (See RM_), or in the page. Not freed
+
+	unsigned long long article_id; // The article posted by the request. The response is sent after it is durable. 0 if no article
+
+	ARTICLEPAGE* page; // The articles sent after the message. NULL if the request reads no article
+
+} RESPONSE;
+
+/// <summary>
+/// Manage sockets on an event-loop thread. The thread polls all its sockets at once with WSAPoll(), so a thread is not limited
+/// to WSA_MAXIMUM_WAIT_EVENTS sockets. New and moved sockets are queued by other threads and taken by the thread on the next wakeup.
 /// </summary>
 typedef struct thread_sockets_manager {
 
-	int free_index; // A index in "sockets" field is free || Number of attached events
+	int free_index; // A index in "fds" field is free || Number of polled sockets, including the wake socket
+
+	int capacity; // Number of slots allocated for "fds" and "sessions"
+
+	WSAPOLLFD* fds; // Polled sockets. The first one is the wake socket (See WakeSocketsManager()). Used by the thread only
+
+	SESSION* sessions; // Accounts running on the sockets. Used by the thread only
 
-	SOCKET sockets[MAX_CLIENTS_PER_THREAD]; // Managed sockets
+	SOCKET* pending; // Sockets queued for the thread, not polled yet. Protected by gSocketsManagerCriticalSection
 
-	int accounts_status[MAX_CLIENTS_PER_THREAD]; // Status of accounts running on the sockets
+	SESSION* pending_sessions; // Accounts running on the queued sockets (Moved sockets keep their accounts)
 
-	WSAEVENT events[MAX_CLIENTS_PER_THREAD]; // Events attached on sockets.
+	int pending_count; // Number of queued sockets
+
+	int pending_capacity; // Number of slots allocated for "pending"
+
+	ADDRESS wake_address; // The loopback address of the wake socket
+
+	int start_index; // The ready socket serviced first on a wakeup is the first one from this offset. Rotates on each wakeup
+
+	int load; // Number of client sockets: Polled + Queued. Protected by gSocketsManagerCriticalSection
+
+	RESPONSE* responses; // Responses of the current cycle, in the order of requests. Used by the thread only
+
+	int response_count; // Number of responses of the current cycle
+
+	int response_capacity; // Number of slots allocated for "responses"
+
+	volatile LONG parked; // Number of sockets with parked responses, as of the last cycle. The commit thread wakes the manager while it is not 0 (See WakeWaitingPosts())
 
 	struct thread_sockets_manager* next; // Next thread's sockets manager. Linked list
 } SOCKETSMANAGER;
 
+/// <summary>
+/// A segment file mapped into memory. The view covers the whole file: A segment is ARTICLE_SEGMENT_MAX_SIZE bytes from its creation,
+/// so the view of the last segment also sees the records written after it is mapped.
+/// </summary>
+typedef struct segmentview {
+
+	HANDLE mapping; // The file mapping object
+
+	const char* base; // The mapped view
+
+	long long size; // Size of the view, in bytes
+
+} SEGMENTVIEW;
+
+/// <summary>
+/// The articles of an author, in the order of IDs
+/// </summary>
+typedef struct authorposts {
+
+	const char* author; // The author name, in a mapped record
+
+	unsigned int hash; // Hash of the author name. See HashAccountName()
+
+	const ARTICLEHEADER** articles; // The articles, in the mapped segments
+
+	int count; // Number of articles
+
+	int capacity; // Number of slots allocated for "articles"
+
+} AUTHORPOSTS;
+
+/// <summary>
+/// Log-structured article store. Posts append records to the append buffer; The commit thread takes the whole buffer,
+/// writes it to the last segment and flushes it to the disk with one FlushFileBuffers() (group commit). An article is durable
+/// once "durable_id" reaches its ID. The segments stay mapped while the store is open: The durable articles are indexed
+/// by ID and by author, pointing into the mapped segments.
+/// </summary>
+typedef struct articlestore {
+
+	const char* directory; // The directory of the segment files
+
+	char* appending; // The buffer posts append to
+
+	char* committing; // The buffer being written by the commit thread
+
+	int used; // Number of bytes appended to "appending"
+
+	unsigned long long last_id; // ID of the last appended article
+
+	unsigned long long durable_id; // ID of the last durable article: Every article up to it is on the disk
+
+	int failed; // 1 if a commit failed: No article is accepted anymore
+
+	int stopped; // 1 if the store is closing
+
+	HANDLE segment; // The last segment file. Used by the commit thread only
+
+	unsigned int segment_number; // The number of the last segment
+
+	long long segment_size; // Size of the last segment, in bytes
+
+	HANDLE thread; // The commit thread
+
+	CRITICAL_SECTION lock; // Protect the fields above, except the ones of the commit thread
+
+	CONDITION_VARIABLE appended; // Signaled when an article is appended or the store is closing
+
+	CONDITION_VARIABLE committed; // Signaled when the buffers are swapped or a commit ends
+
+	SEGMENTVIEW* views; // The mapped segments, by segment number - 1. Used by the commit thread only
+
+	int view_count; // Number of mapped segments: The number of the last segment
+
+	int view_capacity; // Number of slots allocated for "views"
+
+	SRWLOCK index_lock; // Protect the indexes below: Shared by the readers, Exclusive by the commit thread
+
+	const ARTICLEHEADER** articles; // The durable articles, by ID - 1
+
+	unsigned long long article_count; // Number of indexed articles: The ID of the last indexed article
+
+	unsigned long long article_capacity; // Number of slots allocated for "articles"
+
+	AUTHORPOSTS** authors; // Hash index of authors: Open addressing (linear probing) keyed on the case-folded author name
+
+	unsigned int author_count; // Number of authors
+
+	unsigned int author_mask; // Number of slots - 1. The number of slots is a power of 2, at least twice "author_count"
+
+} ARTICLESTORE;
+
 #pragma endregion
 
 #pragma region Function Declarations
@@ -96,45 +384,105 @@ typedef struct thread_sockets_manager {
 HANDLE CreateThreadForSocketsManager(SOCKETSMANAGER* manager);
 
 /// <summary>
-/// Find proper thread (sockets manager) to attach a socket.
+/// Create a sockets manager, Begin its thread and Link it to gSocketsManager list. [Call in gSocketsManagerCriticalSection]
+/// </summary>
+/// <returns>The started sockets manager. NULL if have errors</returns>
+SOCKETSMANAGER* StartSocketsManager();
+
+/// <summary>
+/// Unlink a sockets manager from gSocketsManager list: No socket is attached to it anymore. [Call in gSocketsManagerCriticalSection]
+/// </summary>
+/// <param name="manager">A pointer to the sockets manager</param>
+void UnlinkSocketsManager(SOCKETSMANAGER* manager);
+
+/// <summary>
+/// Find the sockets manager holding the fewest sockets. [Call in gSocketsManagerCriticalSection]
+/// </summary>
+/// <returns>The least-loaded sockets manager. NULL if no manager is running</returns>
+SOCKETSMANAGER* FindLeastLoadedManager();
+
+/// <summary>
+/// Find proper thread (sockets manager) to attach a socket: Queue the socket on the least-loaded manager and Wake its thread.
+/// A new thread starts if every running one holds MANAGER_TARGET_LOAD sockets, up to gMaxSocketsManagers threads.
+/// [Call in gSocketsManagerCriticalSection]
 /// </summary>
 /// <param name="socket">The socket want to attach to a thread for running</param>
-void AppendSocketOnAThread(SOCKET socket);
+/// <param name="session">The account working on the socket. NULL for a new connection. Its account is released if the socket is closed</param>
+void AppendSocketOnAThread(SOCKET socket, SESSION* session = NULL);
+
+/// <summary>
+/// Stop an underloaded sockets manager: If it holds fewer than MANAGER_LOW_LOAD sockets and the other managers can take them
+/// without exceeding MANAGER_TARGET_LOAD, Unlink it and Move its sockets (with their accounts) to the others. [Call on the thread of the manager]
+/// </summary>
+/// <param name="manager">A pointer to the sockets manager</param>
+/// <returns>1 if the manager is stopped: Its thread should free it and terminate. 0 otherwise</returns>
+int RetireSocketsManager(SOCKETSMANAGER* manager);
 
 /// <summary>
-/// Callback method running on another thread created by CreateThreadForSocketsManager()
+/// Callback method running on another thread created by CreateThreadForSocketsManager().
+/// Poll all sockets of the manager, Handle every ready socket and Take the queued sockets on each wakeup.
+/// The ready sockets are serviced round-robin from a rotating start, each one within the PIPELINE_MAX_REQUESTS budget.
+/// The responses of a cycle are sent after the cycle, the posts once durable (See SendResponses()), then the sockets closed in the cycle are released. The thread terminates when the manager is retired (See RetireSocketsManager()).
 /// </summary>
 /// <param name="arguments">A pointer to the sockets manager. [Cast directly]</param>
 /// <returns>0. [The thread is also terminated]</returns>
 unsigned __stdcall Run(void* arguments);
 
+/// <summary>
+/// Move the sockets queued for a manager into its polled sockets. [Call on the thread of the manager]
+/// </summary>
+/// <param name="manager">A pointer to the sockets manager</param>
+void AdoptPendingSockets(SOCKETSMANAGER* manager);
+
+/// <summary>
+/// Wake the sockets managers with parked responses: Articles became durable. [Call on the commit thread, out of the lock of the store]
+/// </summary>
+void WakeWaitingPosts();
+
 #pragma endregion
 
 #pragma region Handle Events
 /// <summary>
-/// Wait for un-signaled sockets events change state (signaled). Time wait depend on the number of events
+/// Wait for sockets become ready to read or closed. The "revents" field of each ready socket is set
 /// </summary>
-/// <param name="events">The events list</param>
-/// <param name="count">Number of events want to wait</param>
-/// <param name="time_wait">The time interval want to wait. Default: WSA_INFINITE</param>
-/// <returns>The first event changes state if success. -1 otherwise [Time out/Errors]</returns>
-int ListenEvents(WSAEVENT* events, int count, int time_wait = WSA_INFINITE);
+/// <param name="fds">The polled sockets</param>
+/// <param name="count">Number of sockets want to poll</param>
+/// <param name="time_wait">The time interval want to wait, in milliseconds. Default: -1 (Infinite)</param>
+/// <returns>Number of ready sockets if success. 0 if time out. -1 if have errors</returns>
+int PollSockets(WSAPOLLFD* fds, int count, int time_wait = -1);
 
 /// <summary>
-/// Get a status on a socket event
+/// Get a status on a polled socket
 /// </summary>
-/// <param name="socket">The socket attached with the "socket_event" event</param>
-/// <param name="socket_event">The event</param>
-/// <returns>A number contains all the status of the socket event: FD_READ and/or FD_CLOSE</returns>
-long GetStatusOnSocketEvent(SOCKET socket, WSAEVENT socket_event);
+/// <param name="fd">The polled socket, after PollSockets()</param>
+/// <returns>A number contains the status of the socket: FD_READ and/or FD_WRITE, or FD_CLOSE. 0 if not ready</returns>
+long GetStatusOnPollEvent(const WSAPOLLFD* fd);
 
 /// <summary>
-/// Attach FD_READ and FD_CLOSE event listener on a socket
+/// Set non-blocking mode for a socket: A transfer that does not complete at once is continued on a later poll (See TRANSFER)
 /// </summary>
 /// <param name="socket">The socket</param>
-/// <param name="socket_event">The event want to attach to the socket</param>
 /// <returns>1 if success. 0 otherwise</returns>
-int AttachReceiveEventForSocket(SOCKET socket, WSAEVENT socket_event);
+int SetNonBlockingMode(SOCKET socket);
+
+/// <summary>
+/// Create a UDP socket bound to a loopback address. A datagram to the address wakes the thread polling the socket
+/// </summary>
+/// <param name="oaddress">[Output] The bound address</param>
+/// <returns>The wake socket. INVALID_SOCKET if have errors</returns>
+SOCKET CreateWakeSocket(ADDRESS* oaddress);
+
+/// <summary>
+/// Wake the thread of a sockets manager from PollSockets(): Send a datagram to its wake socket
+/// </summary>
+/// <param name="manager">A pointer to the sockets manager</param>
+void WakeSocketsManager(SOCKETSMANAGER* manager);
+
+/// <summary>
+/// Read all datagrams waiting on a wake socket
+/// </summary>
+/// <param name="wake">The wake socket</param>
+void DrainWakeSocket(SOCKET wake);
 #pragma endregion
 
 #pragma region Handle Request
@@ -143,69 +491,197 @@ int AttachReceiveEventForSocket(SOCKET socket, WSAEVENT socket_event);
 /// </summary>
 /// <param name="socket">The connected socket identify the client</param>
 /// <param name="arguments">The arguments for post request [The article want to post to server]</param>
-/// <param name="ioaccount_status">[Input/Output] The status of account working on the socket.</param>
-/// <returns>The response message for client</returns>
-MESSAGE HandlePostRequest(SOCKET socket, const char* arguments, int* ioaccount_status);
+/// <param name="iosession">[Input/Output] The account working on the socket.</param>
+/// <param name="oarticle_id">[Output] The ID of the appended article. 0 if the article is not appended</param>
+/// <returns>The response message for client. It must not be sent before the article is durable</returns>
+const char* HandlePostRequest(SOCKET socket, const char* arguments, SESSION* iosession, unsigned long long* oarticle_id);
 
 /// <summary>
 /// Processing the login request
 /// </summary>
 /// <param name="socket">The connected socket identify the client</param>
 /// <param name="arguments">The arguments for login request [The username want to login]</param>
-/// <param name="ioaccount_status">[Input/Output] The status of the account working on the socket.</param>
-/// <returns>The response message for client</returns>
-MESSAGE HandleLoginRequest(SOCKET socket, const char* arguments, int* ioaccount_status);
+/// <param name="iosession">[Input/Output] The account working on the socket.</param>
+/// <returns>The response message for client. [Preformatted: See RM_]</returns>
+const char* HandleLoginRequest(SOCKET socket, const char* arguments, SESSION* iosession);
 
 /// <summary>
 /// Processing the logout request
 /// </summary>
 /// <param name="socket">The connected socket identify the client</param>
-/// <param name="ioaccount_status">[Input/Output] The status of account working on the socket.</param>
-/// <returns>The response message for client</returns>
-MESSAGE HandleLogoutRequest(SOCKET socket, int* ioaccount_status);
+/// <param name="iosession">[Input/Output] The account working on the socket.</param>
+/// <returns>The response message for client. [Preformatted: See RM_]</returns>
+const char* HandleLogoutRequest(SOCKET socket, SESSION* iosession);
+
+/// <summary>
+/// Processing the request reading the recent articles: The newest articles first
+/// </summary>
+/// <param name="socket">The connected socket identify the client</param>
+/// <param name="arguments">The arguments for the request [Read the articles before this ID. Empty or 0: The newest ones]</param>
+/// <param name="opage">[Output] The articles. NULL if fail to allocate memory</param>
+/// <returns>The response message for client: In the page (See CreatePageMessage()), or preformatted. NULL if fail to allocate memory</returns>
+const char* HandleRecentRequest(SOCKET socket, const char* arguments, ARTICLEPAGE** opage);
+
+/// <summary>
+/// Processing the request reading the articles of an author: The newest articles first
+/// </summary>
+/// <param name="socket">The connected socket identify the client</param>
+/// <param name="arguments">The arguments for the request [The author name, then the ID to read the articles before. Empty or 0: The newest ones]</param>
+/// <param name="opage">[Output] The articles. NULL if fail to allocate memory</param>
+/// <returns>The response message for client: In the page (See CreatePageMessage()), or preformatted. NULL if fail to allocate memory</returns>
+const char* HandleAuthorRequest(SOCKET socket, const char* arguments, ARTICLEPAGE** opage);
 
 /// <summary>
-/// Handle request: Read requests from buffer, Processing requests and Send response back.
+/// Processing the request reading articles by ID: The articles from an ID, in the order of IDs
+/// </summary>
+/// <param name="socket">The connected socket identify the client</param>
+/// <param name="arguments">The arguments for the request [The first ID, then the number of articles. Default: 1 article]</param>
+/// <param name="opage">[Output] The articles. NULL if the article is not found or fail to allocate memory</param>
+/// <returns>The response message for client: In the page (See CreatePageMessage()), or preformatted. NULL if fail to allocate memory</returns>
+const char* HandleGetRequest(SOCKET socket, const char* arguments, ARTICLEPAGE** opage);
+
+/// <summary>
+/// Create the response message for a page of articles in the page: See SM_ARTICLES
+/// </summary>
+/// <param name="page">[Input/Output] The articles</param>
+/// <returns>The response message, freed with the page</returns>
+const char* CreatePageMessage(ARTICLEPAGE* page);
+
+/// <summary>
+/// Handle request: Processing a received request. The response is not sent
 /// </summary>
 /// <param name="socket">The connected socket to the remote process</param>
-/// <param name="ioaccount_status">[Input/Output] The status of account working on the socket.</param>
-/// <returns>1 if have no errors. 0 if request cant be processed completely. 
+/// <param name="request">The request, ends with '\0'</param>
+/// <param name="iosession">[Input/Output] The account working on the socket.</param>
+/// <param name="oresponse">[Output] The response: The message (NULL if fail to allocate memory), the posted article and the articles read</param>
+void HandleRequest(SOCKET socket, const char* request, SESSION* iosession, RESPONSE* oresponse);
+
+/// <summary>
+/// Handle pipelined requests: Receive the bytes available on the socket and Handle every request they complete,
+/// at most PIPELINE_MAX_REQUESTS requests. The responses are queued in the order of requests (See SendResponses()).
+/// A request received partly is continued on the next POLLRDNORM (See ReceiveRequest()).
+/// </summary>
+/// <param name="manager">A pointer to the sockets manager</param>
+/// <param name="index">The index of the socket</param>
+/// <returns>1 if the budget is used. 0 if the bytes available are handled. 
 /// -1 if have errors and the socket should not be used anymore (lost connection to remote process)</returns>
-int HandleRequest(SOCKET socket, int* ioaccount_status);
+int HandleRequests(SOCKETSMANAGER* manager, int index);
+
+/// <summary>
+/// Queue a response of the current cycle. [Call on the thread of the manager]
+/// </summary>
+/// <param name="manager">A pointer to the sockets manager</param>
+/// <param name="response">The response. Its message and page are freed by SendResponses()</param>
+/// <returns>1 if success. 0 if fail to allocate memory</returns>
+int QueueResponse(SOCKETSMANAGER* manager, const RESPONSE* response);
+
+/// <summary>
+/// Send the responses of the current cycle in order, without waiting for the disk: A post whose article is not durable yet is parked
+/// in its session with the later responses of the socket (See ParkResponse()). Then Send the parked responses whose posts are durable now.
+/// The manager is flagged while responses are parked: The commit thread wakes it after each commit (See WakeWaitingPosts()).
+/// A post whose article could not be saved gets S_POST_FAIL. The sockets failing to send are marked closed.
+/// A socket that can not take all of its responses is polled for POLLWRNORM only: No request is read until the rest is sent. [Call on the thread of the manager]
+/// </summary>
+/// <param name="manager">A pointer to the sockets manager</param>
+void SendResponses(SOCKETSMANAGER* manager);
+
+/// <summary>
+/// Send a response to its socket, unless the socket is marked closed, and Free its page. [Call on the thread of the manager]
+/// </summary>
+/// <param name="manager">A pointer to the sockets manager</param>
+/// <param name="index">The index of the socket</param>
+/// <param name="response">The response. A post not durable by "durable_id" (the store failed) gets S_POST_FAIL</param>
+/// <param name="durable_id">The ID of the last durable article</param>
+void SendResponse(SOCKETSMANAGER* manager, int index, RESPONSE* response, unsigned long long durable_id);
+
+/// <summary>
+/// Park a response in the session of its socket until the post before it is durable
+/// </summary>
+/// <param name="session">The session of the socket</param>
+/// <param name="response">The response. The session takes its page</param>
+/// <returns>1 if success. 0 if fail to allocate memory</returns>
+int ParkResponse(SESSION* session, const RESPONSE* response);
+
+/// <summary>
+/// Send the parked responses of every socket in order, until one waits for a post that is not durable yet. [Call on the thread of the manager]
+/// </summary>
+/// <param name="manager">A pointer to the sockets manager</param>
+/// <param name="durable_id">The ID of the last durable article</param>
+/// <param name="failed">1 if the store failed: No more article will be durable, the posts waiting get S_POST_FAIL</param>
+/// <returns>Number of sockets with parked responses left</returns>
+int SendParkedResponses(SOCKETSMANAGER* manager, unsigned long long durable_id, int failed);
+
+/// <summary>
+/// Continue sending the responses of a socket that is ready to send. Poll the socket for requests again once they are sent. [Call on the thread of the manager]
+/// </summary>
+/// <param name="manager">A pointer to the sockets manager</param>
+/// <param name="index">The index of the socket</param>
+/// <returns>1 if every response is sent. 0 if some bytes wait for the next POLLWRNORM. -1 if have errors that the socket should be closed</returns>
+int ContinueResponses(SOCKETSMANAGER* manager, int index);
 #pragma endregion
 
 #pragma region Sockets Manager
 
 /// <summary>
-/// Set a socket for SOCKETSMANAGER.
+/// Set a socket for SOCKETSMANAGER: Add it to the polled sockets. [Call on the thread of the manager]
 /// </summary>
 /// <param name="manager">The sockets manager</param>
 /// <param name="socket">The socket want to add</param>
-/// <returns>1 if add success. 0 if manager is NULL.</returns>
-int SetSocket(SOCKETSMANAGER* manager, SOCKET socket);
+/// <param name="session">The account working on the socket. NULL for a new connection</param>
+/// <returns>1 if add success. 0 if manager is NULL or have errors.</returns>
+int SetSocket(SOCKETSMANAGER* manager, SOCKET socket, const SESSION* session = NULL);
 
 /// <summary>
-/// Release/Close a socket and the attached event from SOCKETSMANAGER 
+/// Queue a socket for the thread of a SOCKETSMANAGER. [Call in gSocketsManagerCriticalSection]
+/// </summary>
+/// <param name="manager">The sockets manager</param>
+/// <param name="socket">The socket want to add</param>
+/// <param name="session">The account working on the socket. NULL for a new connection</param>
+/// <returns>1 if success. 0 if fail to allocate memory</returns>
+int QueueSocket(SOCKETSMANAGER* manager, SOCKET socket, const SESSION* session);
+
+/// <summary>
+/// Release/Close the sockets marked in a cycle (See MarkSocketClosed()). [Call on the thread of the manager]
+/// </summary>
+/// <param name="manager">A pointer to the socket manager</param>
+/// <returns>Number of released sockets</returns>
+int ClearMarkedSockets(SOCKETSMANAGER* manager);
+
+/// <summary>
+/// Mark a socket to release after the current cycle: Stop polling it. The slots do not move during a cycle
+/// </summary>
+/// <param name="manager">A pointer to the socket manager</param>
+/// <param name="index">The socket index</param>
+void MarkSocketClosed(SOCKETSMANAGER* manager, int index);
+
+/// <summary>
+/// Free the account, the transfers and the parked responses of a session
+/// </summary>
+/// <param name="session">The session</param>
+void FreeSession(SESSION* session);
+
+/// <summary>
+/// Release/Close a socket from SOCKETSMANAGER and Free its session. The last socket is moved into its slot, so the polled sockets stay contiguous
 /// </summary>
 /// <param name="manager">A pointer to the socket manager</param>
 /// <param name="index">The socket index</param>
 void ClearSocket(SOCKETSMANAGER* manager, int index);
 
 /// <summary>
-/// Create new SOCKETSMANAGER node and initialize all fields.
+/// Double the slots of a SOCKETSMANAGER
 /// </summary>
-/// <returns>Created SOCKETSMANAGER</returns>
-SOCKETSMANAGER* CreateSocketsManager();
+/// <param name="manager">A pointer to the socket manager</param>
+/// <returns>1 if success. 0 if fail to allocate memory</returns>
+int GrowSocketsManager(SOCKETSMANAGER* manager);
 
 /// <summary>
-/// Find previous node of a specified node in SOCKETSMANAGER list
+/// Create new SOCKETSMANAGER node and initialize all fields, including the wake socket.
 /// </summary>
-/// <param name="manager">Current node</param>
-/// <returns>Previous node. NULL if not found</returns>
-SOCKETSMANAGER* FindPreviousNode(SOCKETSMANAGER* manager);
+/// <returns>Created SOCKETSMANAGER. NULL if have errors</returns>
+SOCKETSMANAGER* CreateSocketsManager();
 
 /// <summary>
-/// Deallocate memory for sockets manager if the manager is not the default manager. Else, reset it.
+/// Close all sockets of a sockets manager and Deallocate memory for it.
 /// </summary>
 /// <param name="manager">The manager want to free</param>
 void FreeSocketsManager(SOCKETSMANAGER* manager);
@@ -230,45 +706,306 @@ void FreeSocketsManagerList(SOCKETSMANAGER* first);
 
 #pragma region Account Infos
 
-/// <summary>
-/// Append an item to linked list. [Preserve following items]
-/// </summary>
-/// <param name="prev">The previous item. NULL if want to insert to head.</param>
-/// <param name="current">The item want to append</param>
-/// <returns>The appended item [current]</returns>
-ACCOUNTINFO* Append(ACCOUNTINFO* prev, ACCOUNTINFO* current);
-
 /// <summary>
 /// Create a ACCOUNTINFO node.
 /// </summary>
 /// <param name="username">The name is assigned to "account" field</param>
 /// <param name="namelen">The length of usernam used to assign</param>
 /// <param name="status">The status is assigned to "status" field</param>
-/// <returns>An ACCCOUNTINFO node that use INVALID_SOCKET for "socket" field and NULL for "next" field.</returns>
+/// <returns>An ACCCOUNTINFO node that use NULL for "next" field. NULL if fail to allocate memory</returns>
 ACCOUNTINFO* CreateAccountInfo(const char* username, int namelen, int status);
 
 /// <summary>
-/// Find first ACCOUNTINFO node that has "account" field is equal to [username] argument. [Case-insensitive searching]
+/// Hash a user name (FNV-1a) after case folding: The names equal under ICompare() have the same hash.
 /// </summary>
-/// <param name="start">The start node that searching begins</param>
+/// <param name="username">The user name</param>
+/// <returns>The hash</returns>
+unsigned int HashAccountName(const char* username);
+
+/// <summary>
+/// Build the hash index of accounts.
+/// </summary>
+/// <param name="accounts">The head of the accounts linked list. The index owns the list if success</param>
+/// <returns>The index. NULL if fail to allocate memory</returns>
+ACCOUNTINDEX* CreateAccountIndex(ACCOUNTINFO* accounts);
+
+/// <summary>
+/// Find the ACCOUNTINFO node that has "account" field is equal to [username] argument. [Case-insensitive searching]
+/// </summary>
+/// <param name="index">The account index</param>
 /// <param name="username">The searching keyword</param>
-/// <returns>The first found node. NULL if have no node satisfies</returns>
-ACCOUNTINFO* FindFirstAccountInfo(ACCOUNTINFO* start, const char* username);
+/// <returns>The found node. NULL if have no node satisfies</returns>
+ACCOUNTINFO* FindAccountInfo(const ACCOUNTINDEX* index, const char* username);
 
 /// <summary>
 /// Free memory use for ACCOUNINFO linked list.
 /// </summary>
 /// <param name="first">The head of the linked list</param>
 void FreeAccountList(ACCOUNTINFO* first);
+
+/// <summary>
+/// Free memory use for an account index and its accounts.
+/// </summary>
+/// <param name="index">The account index. May be NULL</param>
+void FreeAccountIndex(ACCOUNTINDEX* index);
+#pragma endregion
+
+#pragma region Account Snapshot
+
+/// <summary>
+/// Begin reading the current account index. The index stays valid until ReleaseAccountIndex(). [Lock-free]
+/// </summary>
+/// <param name="oepoch">[Output] The reader epoch. Pass it to ReleaseAccountIndex()</param>
+/// <returns>The current account index</returns>
+ACCOUNTINDEX* AcquireAccountIndex(LONG* oepoch);
+
+/// <summary>
+/// End reading an account index got by AcquireAccountIndex().
+/// </summary>
+/// <param name="epoch">The reader epoch got by AcquireAccountIndex()</param>
+void ReleaseAccountIndex(LONG epoch);
+
+/// <summary>
+/// Replace the current account index with a new one: Swap the pointer, then Wait for the readers of the old index to end and Free it.
+/// Readers are never blocked. [Call on one thread only]
+/// </summary>
+/// <param name="index">The new account index</param>
+void PublishAccountIndex(ACCOUNTINDEX* index);
+
+/// <summary>
+/// [Thread] Check the account file every ACCOUNT_RELOAD_INTERVAL milliseconds. When it changes and stays unchanged for one interval,
+/// Load a new index and Publish it. If the file can not be loaded, the current index is kept.
+/// </summary>
+/// <param name="arguments">The path to the account file. [Cast directly]</param>
+/// <returns>0. [The thread is also terminated]</returns>
+unsigned __stdcall WatchAccountFile(void* arguments);
+
+#pragma endregion
+
+#pragma region Article Store
+
+/// <summary>
+/// Open the article store in a directory: Recover the last segment and Begin the commit thread.
+/// The posts continue after the last durable article; An incomplete record at the end of a segment is discarded.
+/// </summary>
+/// <param name="directory">The directory of the segment files. Created if not exist</param>
+/// <returns>The article store. NULL if have errors</returns>
+ARTICLESTORE* OpenArticleStore(const char* directory);
+
+/// <summary>
+/// Map every segment and Index their valid records, in order. Set the segment fields and the article IDs of the store.
+/// The garbage a torn commit left after the last valid record is cleared. Only the last segment may end with garbage:
+/// An invalid record in an earlier segment, or a gap in the IDs, is corruption and fails the recovery without clearing anything.
+/// </summary>
+/// <param name="store">The article store</param>
+/// <returns>1 if success. 0 if a segment is corrupted, or have errors on file operations or memory allocation</returns>
+int RecoverArticleStore(ARTICLESTORE* store);
+
+/// <summary>
+/// Stop the commit thread after every appended article is committed, then Unmap the segments, Close the store and Free it.
+/// </summary>
+/// <param name="store">The article store. May be NULL</param>
+void CloseArticleStore(ARTICLESTORE* store);
+
+/// <summary>
+/// Append an article to the append buffer. If the buffer is full, Wait for the commit thread to take it.
+/// The article is not durable yet: See GetDurableArticle()
+/// </summary>
+/// <param name="store">The article store</param>
+/// <param name="author">The user name of the author. NULL is saved as an empty name</param>
+/// <param name="content">The content of the article</param>
+/// <param name="oid">[Output] The ID of the article</param>
+/// <returns>1 if success. 0 if the article is larger than ARTICLE_BUFFER_SIZE or the store fails</returns>
+int AppendArticle(ARTICLESTORE* store, const char* author, const char* content, unsigned long long* oid);
+
+/// <summary>
+/// Get the ID of the last durable article, without waiting: Every article up to it is on the disk.
+/// The commit thread wakes the sockets managers waiting for it when it advances (See WakeWaitingPosts()).
+/// </summary>
+/// <param name="store">The article store</param>
+/// <param name="ofailed">[Output] 1 if a commit failed: The articles after the ID will never be durable</param>
+/// <returns>The ID of the last durable article</returns>
+unsigned long long GetDurableArticle(ARTICLESTORE* store, int* ofailed);
+
+/// <summary>
+/// [Thread] Commit the appended articles: Take the whole append buffer at once, Write it to the last segment and Flush it to the disk,
+/// then Index the committed records and Wake the sockets managers with parked posts. The posts appended during a commit are committed together by the next one.
+/// </summary>
+/// <param name="arguments">A pointer to the article store. [Cast directly]</param>
+/// <returns>0. [The thread is also terminated]</returns>
+unsigned __stdcall CommitArticles(void* arguments);
+
+/// <summary>
+/// Finish the checksum of an article record: Continue the CRC-32 of the author and the content over the header fields after "checksum"
+/// </summary>
+/// <param name="header">The record header. The "id" field is set</param>
+/// <param name="payload_crc">The CRC-32 of the author and the content, with their '\0'</param>
+/// <returns>The checksum</returns>
+unsigned int ChecksumArticle(const ARTICLEHEADER* header, unsigned int payload_crc);
+
+/// <summary>
+/// Get the size of an article record in a segment, including the padding
+/// </summary>
+/// <param name="header">The record header</param>
+/// <returns>The record size, in bytes</returns>
+int GetArticleRecordSize(const ARTICLEHEADER* header);
+
+#pragma endregion
+
+#pragma region Article Index
+
+/// <summary>
+/// Add a durable article to the ID index and the author index. [Call with "index_lock" held exclusively]
+/// </summary>
+/// <param name="store">The article store</param>
+/// <param name="article">The article, in a mapped segment. Its ID follows the last indexed one</param>
+/// <returns>1 if success. 0 if fail to allocate memory</returns>
+int IndexArticle(ARTICLESTORE* store, const ARTICLEHEADER* article);
+
+/// <summary>
+/// Index the records of a committed batch. [Call on the commit thread]
+/// </summary>
+/// <param name="store">The article store</param>
+/// <param name="records">The records, in a mapped segment</param>
+/// <param name="size">Size of the records, in bytes</param>
+/// <returns>1 if success. 0 if fail to allocate memory</returns>
+int IndexArticles(ARTICLESTORE* store, const char* records, int size);
+
+/// <summary>
+/// Double the slots of the author index, or Allocate ARTICLE_AUTHOR_MIN_SLOTS slots for an empty one. [Call with "index_lock" held exclusively]
+/// </summary>
+/// <param name="store">The article store</param>
+/// <returns>1 if success. 0 if fail to allocate memory</returns>
+int GrowAuthorIndex(ARTICLESTORE* store);
+
+/// <summary>
+/// Find the articles of an author, or Add an empty entry for the author. [Call with "index_lock" held exclusively]
+/// </summary>
+/// <param name="store">The article store</param>
+/// <param name="author">The author name, in a mapped record</param>
+/// <returns>The entry of the author. NULL if fail to allocate memory</returns>
+AUTHORPOSTS* AddAuthorPosts(ARTICLESTORE* store, const char* author);
+
+/// <summary>
+/// Find the articles of an author. [Case-insensitive searching. Call with "index_lock" held]
+/// </summary>
+/// <param name="store">The article store</param>
+/// <param name="author">The author name</param>
+/// <returns>The entry of the author. NULL if the author has no article</returns>
+AUTHORPOSTS* FindAuthorPosts(const ARTICLESTORE* store, const char* author);
+
+/// <summary>
+/// Read the newest durable articles before an ID.
+/// </summary>
+/// <param name="store">The article store</param>
+/// <param name="before">Read the articles before this ID. 0: The newest ones</param>
+/// <param name="opage">[Output] The articles, the newest first. An empty page (zeroed)</param>
+void ReadRecentArticles(ARTICLESTORE* store, unsigned long long before, ARTICLEPAGE* opage);
+
+/// <summary>
+/// Read the newest durable articles of an author before an ID.
+/// </summary>
+/// <param name="store">The article store</param>
+/// <param name="author">The author name</param>
+/// <param name="before">Read the articles before this ID. 0: The newest ones</param>
+/// <param name="opage">[Output] The articles, the newest first. An empty page (zeroed)</param>
+void ReadAuthorArticles(ARTICLESTORE* store, const char* author, unsigned long long before, ARTICLEPAGE* opage);
+
+/// <summary>
+/// Read the durable articles from an ID, in the order of IDs.
+/// </summary>
+/// <param name="store">The article store</param>
+/// <param name="from">The ID of the first article</param>
+/// <param name="count">Number of articles want to read. At most ARTICLE_PAGE_SIZE</param>
+/// <param name="opage">[Output] The articles. An empty page (zeroed)</param>
+/// <returns>1 if the first article exists. 0 otherwise</returns>
+int ReadArticles(ARTICLESTORE* store, unsigned long long from, int count, ARTICLEPAGE* opage);
+
+/// <summary>
+/// Add an article to a page if the page is not full. The only article of a page is cut to ARTICLE_PAGE_MAX_BYTES,
+/// and ARTICLE_TRUNCATED_MARK is sent after the cut content.
+/// </summary>
+/// <param name="page">The page</param>
+/// <param name="article">The article, in a mapped segment</param>
+/// <returns>1 if the article is added. 0 if the page is full</returns>
+int AddArticleToPage(ARTICLEPAGE* page, const ARTICLEHEADER* article);
+
+/// <summary>
+/// Free memory use for the indexes of an article store.
+/// </summary>
+/// <param name="store">The article store</param>
+void FreeArticleIndex(ARTICLESTORE* store);
+
 #pragma endregion
 
 #pragma region I/O Operations
 /// <summary>
-/// Load ACCOUNTINFO nodes from file. [Set ACCOUNT_FILE_PATH]
+/// Load ACCOUNTINFO nodes from file and Build the hash index. [Set ACCOUNT_FILE_PATH]
 /// </summary>
 /// <param name="file">The path to the file want to read.</param>
-/// <returns>1 if success. 0 if have some errors on file operations.</returns>
-int LoadAccountList(const char* file);
+/// <returns>The account index. NULL if have some errors on file operations or memory allocation.</returns>
+ACCOUNTINDEX* LoadAccountIndex(const char* file);
+
+/// <summary>
+/// Get the last modified time and the size of a file
+/// </summary>
+/// <param name="file">The path to the file</param>
+/// <param name="omodified">[Output] The last modified time</param>
+/// <param name="osize">[Output] The size of the file</param>
+/// <returns>1 if success. 0 if the file can not be accessed</returns>
+int GetFileVersion(const char* file, long long* omodified, long long* osize);
+
+/// <summary>
+/// Open a segment file of the article store
+/// </summary>
+/// <param name="directory">The directory of the segment files</param>
+/// <param name="number">The segment number</param>
+/// <param name="disposition">OPEN_EXISTING, OPEN_ALWAYS or CREATE_ALWAYS (See CreateFile())</param>
+/// <returns>The file handle, for reading and writing. INVALID_HANDLE_VALUE if have errors</returns>
+HANDLE OpenArticleSegment(const char* directory, unsigned int number, DWORD disposition);
+
+/// <summary>
+/// Map the next segment file into memory and Add the view to the store. A segment smaller than ARTICLE_SEGMENT_MAX_SIZE is extended first.
+/// </summary>
+/// <param name="store">The article store</param>
+/// <param name="segment">The segment file handle. Its number follows the last mapped segment</param>
+/// <returns>1 if success. 0 if have errors on file operations or memory allocation</returns>
+int MapArticleSegment(ARTICLESTORE* store, HANDLE segment);
+
+/// <summary>
+/// Check the records of a mapped segment in order and Index them, up to the first invalid record.
+/// </summary>
+/// <param name="store">The article store</param>
+/// <param name="view">The mapped segment</param>
+/// <param name="iolast_id">[Input/Output] The ID of the last valid record: The next record must follow it</param>
+/// <returns>The size of the valid records, in bytes. -1 if a complete record does not follow the last valid one (a gap in the IDs), or fail to allocate memory</returns>
+long long ScanArticleSegment(ARTICLESTORE* store, const SEGMENTVIEW* view, unsigned long long* iolast_id);
+
+/// <summary>
+/// Check that no byte follows the valid records of a mapped segment, as far as a torn commit could have written.
+/// </summary>
+/// <param name="view">The mapped segment</param>
+/// <param name="size">The size of the valid records, in bytes</param>
+/// <returns>1 if the bytes are all 0. 0 otherwise</returns>
+int IsArticleTailClear(const SEGMENTVIEW* view, long long size);
+
+/// <summary>
+/// Clear the garbage of a torn commit after the last valid record of the last segment: The commits after it
+/// must not leave an old record after their records. The file pointer is left at the end of the valid records.
+/// </summary>
+/// <param name="store">The article store. The segment fields are set</param>
+/// <returns>1 if success. 0 if have errors on file operations</returns>
+int ClearArticleTail(ARTICLESTORE* store);
+
+/// <summary>
+/// Write a batch of article records to the last segment and Flush it to the disk.
+/// Roll over to a new mapped segment first if the batch does not fit in the last one. [Call on the commit thread]
+/// </summary>
+/// <param name="store">The article store</param>
+/// <param name="batch">The records</param>
+/// <param name="size">Size of the records, in bytes</param>
+/// <returns>1 if the batch is durable. 0 if have errors on file operations</returns>
+int WriteArticleBatch(ARTICLESTORE* store, const char* batch, int size);
 #pragma endregion
 
 #pragma region Socket Common
@@ -301,6 +1038,75 @@ SOCKET GetConnectionSocket(SOCKET listener, ADDRESS* osender_address = NULL);
 
 #pragma region Send and Receive
 
+/// <summary>
+/// Segmentation a message and Send the segments with a non-blocking socket (See SegmentationSendParts())
+/// </summary>
+/// <param name="sender">The connected socket used for sending</param>
+/// <param name="iotransfer">[Input/Output] The transfers of the socket. The bytes not sent are appended to its output</param>
+/// <param name="message">The message want to segmentation and send</param>
+/// <param name="message_len">The length of the message</param>
+/// <returns>1 if the message is sent or queued. -1 if have errors that the socket should be closed</returns>
+int SegmentationSend(SOCKET sender, TRANSFER* iotransfer, const char* message, int message_len);
+
+/// <summary>
+/// Segmentation a message made of several parts and Send the segments with a non-blocking socket. The parts are sent
+/// as one message (See SegmentationSend()): The segments refer to the parts, nothing is copied while the socket buffer takes them.
+/// The bytes it can not take, and every byte after them, are copied to the output of the transfer and sent by ContinueSend().
+/// </summary>
+/// <param name="sender">The connected socket used for sending</param>
+/// <param name="iotransfer">[Input/Output] The transfers of the socket. The message is queued after its output, if any</param>
+/// <param name="parts">The parts of the message, in order</param>
+/// <param name="part_count">Number of parts</param>
+/// <returns>1 if the message is sent or queued. -1 if have errors that the socket should be closed</returns>
+int SegmentationSendParts(SOCKET sender, TRANSFER* iotransfer, const WSABUF* parts, int part_count);
+
+/// <summary>
+/// Send a response message followed by the articles of a page, from the mapped segments: One line per article, "#<id> [<author>] <content>"
+/// </summary>
+/// <param name="sender">The connected socket used for sending</param>
+/// <param name="iotransfer">[Input/Output] The transfers of the socket</param>
+/// <param name="message">The response message</param>
+/// <param name="page">The articles</param>
+/// <returns>1 if the page is sent or queued. -1 if have errors that the socket should be closed</returns>
+int SendArticlePage(SOCKET sender, TRANSFER* iotransfer, const char* message, const ARTICLEPAGE* page);
+
+/// <summary>
+/// Copy the bytes of some buffers to the end of the output of a transfer: They are sent when the socket is ready (See ContinueSend())
+/// </summary>
+/// <param name="iotransfer">[Input/Output] The transfer</param>
+/// <param name="buffers">The buffers, in order. Empty buffers are skipped</param>
+/// <param name="buffer_count">Number of buffers</param>
+/// <returns>1 if success. 0 if fail to allocate memory</returns>
+int QueueOutput(TRANSFER* iotransfer, const WSABUF* buffers, int buffer_count);
+
+/// <summary>
+/// Send the output of a transfer as far as the socket buffer takes it. Never waits
+/// </summary>
+/// <param name="sender">The connected socket used for sending</param>
+/// <param name="iotransfer">[Input/Output] The transfer. Its output is freed once it is sent</param>
+/// <returns>1 if the output is sent. 0 if some bytes wait for the next POLLWRNORM. -1 if have errors that the socket should be closed</returns>
+int ContinueSend(SOCKET sender, TRANSFER* iotransfer);
+
+/// <summary>
+/// Read the bytes waiting on a non-blocking socket. Never waits
+/// </summary>
+/// <param name="receiver">The connected socket that is used for receiving bytes stream</param>
+/// <param name="bytes">Maximum number of bytes want to read</param>
+/// <param name="obuffer">[Output] The buffer receiving the byte stream. It has at least `bytes` bytes</param>
+/// <param name="oreceived">[Output] Number of bytes read. 0 if no byte is waiting</param>
+/// <returns>1 if success, even if no byte is read. -1 if the connection is closed or have errors that the socket should be closed</returns>
+int ReceiveAvailable(SOCKET receiver, int bytes, char* obuffer, int* oreceived);
+
+/// <summary>
+/// Continue receiving the request of a transfer: Read the segment headers and Read the segment contents into the request directly.
+/// The request is allocated once from its first segment header. A request longer than MESSAGE_MAX_LENGTH is refused. Never waits
+/// </summary>
+/// <param name="receiver">The connected socket used to receive segments</param>
+/// <param name="iotransfer">[Input/Output] The transfers of the socket. Keep the request received partly</param>
+/// <param name="orequest">[Output] The complete request, ends with '\0'. Freed by the caller. NULL if the request is not complete</param>
+/// <returns>1 if a request is complete. 0 if the rest of the request has not arrived. -1 if have errors that the socket should be closed</returns>
+int ReceiveRequest(SOCKET receiver, TRANSFER* iotransfer, char** orequest);
+
 #pragma endregion
 
 #pragma region Utilities
@@ -316,25 +1122,30 @@ SOCKET GetConnectionSocket(SOCKET listener, ADDRESS* osender_address = NULL);
 int ExtractCommand(int argc, char* argv[], int* oport);
 
 /// <summary>
-/// Create a INADDR_ANY IP Address
+/// Get the number of processors, limited to 1..MAX_EVENT_LOOPS
 /// </summary>
-/// <returns>The INADDR_ANY IP</returns>
-IP CreateDefaultIP();
+/// <returns>The number of processors</returns>
+int GetProcessorCount();
 
 /// <summary>
-/// Create a Message object that contains a status.
-/// The first STATUS_LENGTH byte of Message is the status code: See S_ for some status code
+/// Build the lookup table of Crc32(). [Call before Crc32() is used]
 /// </summary>
-/// <param name="status">The status code</param>
-/// <param name="message">The response message. Use NULL if have no additional message</param>
-/// <returns>A command message. NULL if memory allocation fail</returns>
-MESSAGE CreateMessage(int status, const char* message);
+void BuildCrc32Table();
 
 /// <summary>
-/// Free memory for Message object
+/// Compute the CRC-32 (IEEE) of a byte stream, or Continue a previous CRC-32 over it
 /// </summary>
-/// <param name="m">The message want to free</param>
-void DestroyMessage(MESSAGE m);
+/// <param name="data">The byte stream</param>
+/// <param name="length">Number of bytes</param>
+/// <param name="crc">The CRC-32 of the previous bytes. Default: 0 (No previous bytes)</param>
+/// <returns>The CRC-32</returns>
+unsigned int Crc32(const char* data, int length, unsigned int crc = 0);
+
+/// <summary>
+/// Create a INADDR_ANY IP Address
+/// </summary>
+/// <returns>The INADDR_ANY IP</returns>
+IP CreateDefaultIP();
 
 /// <summary>
 /// Compare two string [case-insensitive]
@@ -346,10 +1157,11 @@ void DestroyMessage(MESSAGE m);
 int ICompare(const char* first, const char* second, int length = 0);
 
 /// <summary>
-/// Extract command and arguments from a request.
+/// Extract command and arguments from a request in one pass: The command text is case-folded and packed into a number (See PACK_COMMAND()).
+/// [No allocation: The arguments point into the request]
 /// </summary>
 /// <param name="request">The input request.</param>
-/// <param name="oarguments">[Output] The command arguments</param>
+/// <param name="oarguments">[Output] The command arguments. Empty if the command has no arguments</param>
 /// <returns>The command code. See C_ for some command codes and CM_ for some commands text</returns>
 int ExtractRequestCommand(const char* request, char** oarguments);
 #pragma endregion
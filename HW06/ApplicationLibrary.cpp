@@ -53,19 +53,35 @@ int ExtractMessage(const MESSAGE message, uint message_len, stream* opayload, ui
 		return INVALID_ARGUMENTS;
 	*opayload = NULL;
 
-	stream _payload = NULL;
+	stream _view;
+	uint _length;
+	int _code = ExtractMessageView(message, message_len, &_view, &_length);
+	if (_code == MC_INVALID)
+		return MC_INVALID;
+
+	stream _payload = Clone(message + MESSAGE_HEADER_SIZE, _length);
+	if (_payload == NULL)
+		return MC_INVALID;
+	*olength = _length;
+	*opayload = _payload;
+	return _code;
+}
+
+int ExtractMessageView(const MESSAGE message, uint message_len, stream* opayload, uint* olength)
+{
+	if (opayload == NULL || olength == NULL)
+		return INVALID_ARGUMENTS;
+	*opayload = NULL;
+	*olength = 0;
 
 	if (message_len >= MESSAGE_HEADER_SIZE) {
 		int _code = *(unsigned char*)(message)-'0'; // first byte
 		if (_code <= MC_ERROR && _code >= MC_ENCRYPT) {
 
 			uint _length = ToHostByteOrder(ToUnsignedInt(message + MESSAGE_HEADER_CODE_SIZE));
-			if (_code != MC_ERROR && _length <= MESSAGE_PAYLOAD_MAX_SIZE)
-				_payload = Clone(message + MESSAGE_HEADER_SIZE, _length);
-
-			if (_payload != NULL) {
+			if (_code != MC_ERROR && _length <= MESSAGE_PAYLOAD_MAX_SIZE && _length <= message_len - MESSAGE_HEADER_SIZE) {
 				*olength = _length;
-				*opayload = _payload;
+				*opayload = _length > 0 ? message + MESSAGE_HEADER_SIZE : NULL;
 				return _code;
 			}
 		}
@@ -80,109 +96,844 @@ void DestroyMessage(MESSAGE m)
 
 #pragma endregion
 
+#pragma region Frame
+
+stream CreateFrame(int version, uint stream_id, int code, int flags, const stream payload, uint length, uint* oframe_len)
+{
+	if (oframe_len == NULL)
+		return NULL;
+
+	if (version == PROTOCOL_V1) { // Segment Header | Code | Length | Payload
+		uint message_len;
+		MESSAGE message = CreateMessage(code, payload, length, &message_len);
+		if (message == NULL)
+			return NULL;
+		stream frame = CreateStream(message_len + SEGMENT_HEADER_SIZE);
+		if (frame != NULL)
+			CreateSegment(message, message_len, &frame, oframe_len);
+		DestroyMessage(message);
+		return frame;
+	}
+
+	if (length > MESSAGE_PAYLOAD_MAX_SIZE)
+		return NULL;
+	stream frame = CreateStream(FRAME_HEADER_MAX_SIZE + length);
+	if (frame != NULL) {
+		frame[0] = (char)((flags << FRAME_FLAGS_SHIFT) | (code & FRAME_TYPE_MASK));
+		uint header_len = FRAME_TYPE_SIZE;
+		header_len += WriteVarint(stream_id, frame + header_len);
+		header_len += WriteVarint(length, frame + header_len);
+		if (length > 0)
+			memcpy_s(frame + header_len, length, payload, length);
+		*oframe_len = header_len + length;
+	}
+	return frame;
+}
+
+stream CreateACK(int version, uint stream_id, uint limit, uint* oack_len)
+{
+	if (oack_len == NULL)
+		return NULL;
+
+	if (version == PROTOCOL_V1) {
+		stream ack = CreateStream(ACK_PACKET_SIZE);
+		if (ack != NULL) { // no limit: v1 is stop-and-wait
+			uint value = ACK_PACKET_VALUE;
+			memcpy_s(ack, ACK_PACKET_SIZE, &value, ACK_PACKET_SIZE);
+			*oack_len = ACK_PACKET_SIZE;
+		}
+		return ack;
+	}
+
+	if (limit == FLOW_CREDIT_END)
+		return CreateFrame(version, stream_id, MC_ACK, FF_END, NULLSTR, 0, oack_len);
+	char payload[VARINT_MAX_SIZE];
+	uint payload_len = WriteVarint(limit, payload);
+	return CreateFrame(version, stream_id, MC_ACK, 0, payload, payload_len, oack_len);
+}
+
+void WriteHello(int version, uint capabilities, stream ohello)
+{
+	memcpy_s(ohello, PROTOCOL_HELLO_MAGIC_SIZE, PROTOCOL_HELLO_MAGIC, PROTOCOL_HELLO_MAGIC_SIZE);
+	ohello[PROTOCOL_HELLO_MAGIC_SIZE] = (char)version;
+	uint be_capabilities = ToNetworkByteOrder(capabilities);
+	memcpy_s(ohello + PROTOCOL_HELLO_MAGIC_SIZE + 1, PROTOCOL_HELLO_CAPS_SIZE, &be_capabilities, PROTOCOL_HELLO_CAPS_SIZE);
+}
+
+int ExtractHello(const FRAME* frame, int* oversion, uint* ocapabilities)
+{
+	if (oversion == NULL || ocapabilities == NULL)
+		return INVALID_ARGUMENTS;
+	if (frame->code != MC_HELLO || frame->length != 1 + PROTOCOL_HELLO_CAPS_SIZE)
+		return FAIL;
+	*oversion = (unsigned char)frame->payload[0];
+	*ocapabilities = ToHostByteOrder(ToUnsignedInt(frame->payload + 1));
+	return SUCCESS;
+}
+
+uint ExtractACK(const FRAME* frame)
+{
+	if (frame->version == PROTOCOL_V1) // checked by ParseFrame()
+		return ACK_PACKET_VALUE;
+
+	if (frame->flags & FF_END)
+		return FLOW_CREDIT_END;
+	uint limit, size;
+	if (ReadVarint(frame->payload, frame->length, &limit, &size) != SUCCESS)
+		return 0; // never greater than the current limit -> ignored
+	return limit;
+}
+
+stream CreatePackedFrame(int version, uint capabilities, uint stream_id, int code, int flags, const stream payload, uint length, uint* oframe_len)
+{
+	if ((capabilities & CAP_COMPRESS) && length >= COMPRESS_MIN_SIZE && length <= MESSAGE_PAYLOAD_MAX_SIZE) {
+		char packed[MESSAGE_PAYLOAD_MAX_SIZE];
+		// only keep the compressed payload if it saves bytes: incompressible data is sent raw
+		uint packed_len = CompressLZ(payload, length, packed, length - 1);
+		if (packed_len > 0)
+			return CreateFrame(version, stream_id, code, flags | FF_COMPRESSED, packed, packed_len, oframe_len);
+	}
+	return CreateFrame(version, stream_id, code, flags, payload, length, oframe_len);
+}
+
+stream CreateDataFrame(int version, uint capabilities, uint stream_id, const stream content, uint content_len, uint* oframe_len)
+{
+	return CreatePackedFrame(version, capabilities, stream_id, MC_DATA, 0, content, content_len, oframe_len);
+}
+
+int InflateFrame(FRAME* frame, stream buffer, uint capacity)
+{
+	if ((frame->code != MC_DATA && frame->code != MC_BATCH) || (frame->flags & FF_COMPRESSED) == 0)
+		return SUCCESS;
+
+	uint length;
+	if (DecompressLZ(frame->payload, frame->length, buffer, capacity, &length) != SUCCESS)
+		return FAIL;
+	frame->payload = buffer;
+	frame->length = length;
+	frame->flags &= ~FF_COMPRESSED;
+	return SUCCESS;
+}
+
+#pragma endregion
+
+#pragma region Frame Parser
+
+void InitializeFrameParser(FRAMEPARSER* parser, stream buffer, uint capacity)
+{
+	parser->version = PROTOCOL_UNKNOWN;
+	parser->mode = PM_MESSAGE;
+	parser->capabilities = 0;
+	parser->buffer = buffer;
+	parser->capacity = capacity;
+	parser->start = parser->end = 0;
+}
+
+uint PrepareParserSpace(FRAMEPARSER* parser)
+{
+	if (parser->start > 0) {
+		uint remain = parser->end - parser->start;
+		if (remain > 0)
+			memmove(parser->buffer, parser->buffer + parser->start, remain);
+		parser->start = 0;
+		parser->end = remain;
+	}
+	return parser->capacity - parser->end;
+}
+
+void CommitParserBytes(FRAMEPARSER* parser, uint bytes)
+{
+	parser->end += bytes;
+}
+
+int ParseFrame(FRAMEPARSER* parser, FRAME* oframe)
+{
+	if (oframe == NULL)
+		return INVALID_ARGUMENTS;
+	oframe->payload = NULL;
+	oframe->length = 0;
+	oframe->flags = 0;
+	oframe->stream_id = STREAM_DEFAULT;
+
+	stream data = parser->buffer + parser->start;
+	uint available = parser->end - parser->start;
+
+	if (parser->version == PROTOCOL_UNKNOWN) {
+		if (available < PROTOCOL_HELLO_SIZE)
+			return WAIT;
+		if (memcmp(data, PROTOCOL_HELLO_MAGIC, PROTOCOL_HELLO_MAGIC_SIZE) == 0) {
+			oframe->version = PROTOCOL_UNKNOWN;
+			oframe->code = MC_HELLO;
+			oframe->payload = data + PROTOCOL_HELLO_MAGIC_SIZE;
+			oframe->length = PROTOCOL_HELLO_SIZE - PROTOCOL_HELLO_MAGIC_SIZE;
+			parser->start += PROTOCOL_HELLO_SIZE;
+			return SUCCESS;
+		}
+		parser->version = PROTOCOL_V1; // the remote machine does not say hello
+	}
+	oframe->version = parser->version;
+
+	uint header_len, length;
+	if (parser->version == PROTOCOL_V1) {
+		if (parser->mode == PM_ACK) { // raw ACK Packet
+			if (available < ACK_PACKET_SIZE)
+				return WAIT;
+			if (ToUnsignedInt(data) != ACK_PACKET_VALUE)
+				return FAIL;
+			oframe->code = MC_ACK;
+			header_len = 0;
+			length = ACK_PACKET_SIZE;
+		}
+		else { // Segment Header | Message
+			if (available < SEGMENT_HEADER_SIZE)
+				return WAIT;
+			uint message_len = ToHostByteOrder(ToUnsignedInt(data));
+			if (message_len > MESSAGE_MAX_SIZE)
+				return FAIL;
+			if (available < SEGMENT_HEADER_SIZE + message_len)
+				return WAIT;
+			parser->start += SEGMENT_HEADER_SIZE + message_len;
+			oframe->code = ExtractMessageView(data + SEGMENT_HEADER_SIZE, message_len, &(oframe->payload), &(oframe->length));
+			return oframe->code == MC_INVALID ? FAIL : SUCCESS;
+		}
+	}
+	else { // Type & Flags | Varint Stream ID | Varint Length | Payload
+		if (available < FRAME_TYPE_SIZE)
+			return WAIT;
+		uint size;
+		int ret;
+		header_len = FRAME_TYPE_SIZE;
+		ret = ReadVarint(data + header_len, available - header_len, &(oframe->stream_id), &size);
+		if (ret != SUCCESS)
+			return ret;
+		header_len += size;
+		ret = ReadVarint(data + header_len, available - header_len, &length, &size);
+		if (ret != SUCCESS)
+			return ret;
+		header_len += size;
+		oframe->code = data[0] & FRAME_TYPE_MASK;
+		oframe->flags = ((unsigned char)data[0]) >> FRAME_FLAGS_SHIFT;
+		if (oframe->code > MC_STRIPE || length > MESSAGE_PAYLOAD_MAX_SIZE)
+			return FAIL;
+		if (available < header_len + length)
+			return WAIT;
+	}
+
+	// no copy: the payload is valid until the parser receives more bytes
+	oframe->payload = length > 0 ? data + header_len : NULL;
+	oframe->length = length;
+	parser->start += header_len + length;
+	return SUCCESS;
+}
+
+#pragma endregion
+
 #pragma region Non-Overlapped IO
 
-int SendEncryptDecryptMessage(SOCKET sender, int request_type, int key)
+int NegotiateVersion(SOCKET socket, FRAMEPARSER* parser, int version, uint capabilities)
+{
+	char hello[PROTOCOL_HELLO_SIZE];
+	WriteHello(version, capabilities, hello);
+	int ret = Send(socket, 1, PROTOCOL_HELLO_SIZE, hello);
+	if (ret != SUCCESS)
+		return ret;
+
+	FRAME frame;
+	ret = ReceiveFrame(socket, parser, &frame);
+	if (ret == SUCCESS) {
+		int chosen;
+		uint chosen_capabilities;
+		if (ExtractHello(&frame, &chosen, &chosen_capabilities) == SUCCESS
+			&& chosen >= PROTOCOL_V1 && chosen <= version && (chosen_capabilities & ~capabilities) == 0) {
+			parser->version = chosen;
+			parser->capabilities = chosen_capabilities;
+		}
+		else
+			ret = FAIL;
+	}
+	return ret;
+}
+
+int SendEncryptDecryptMessage(SOCKET sender, int version, uint stream_id, int request_type, int key, int resumable)
 {
 	int status = FAIL;
-	uint message_len;
-	MESSAGE message = CreateMessage(request_type == RT_ENCRYPT ? MC_ENCRYPT : MC_DECRYPT, key, &message_len);
-	if (message != NULL) {
-		status = SendSegment(sender, 1, message, message_len);
+	uint frame_len;
+	// Key | [Resumable]. v1 servers do not accept longer payload
+	char payload[sizeof(uint) + 1];
+	uint be_key = ToNetworkByteOrder((uint)key);
+	memcpy_s(payload, sizeof(uint), &be_key, sizeof(uint));
+	payload[sizeof(uint)] = 1;
+	uint payload_len = (version >= PROTOCOL_V2 && resumable) ? sizeof(payload) : sizeof(uint);
+	stream frame = CreateFrame(version, stream_id, request_type == RT_ENCRYPT ? MC_ENCRYPT : MC_DECRYPT, 0, payload, payload_len, &frame_len);
+	if (frame != NULL) {
+		status = Send(sender, 1, frame_len, frame);
 	}
-	DestroyMessage(message);
+	DestroyStream(frame);
 	return status;
 }
 
-int SendDataMessage(SOCKET sender, const stream content, uint content_len)
+int SendResumeMessage(SOCKET sender, int version, ullong job_id, uint downloaded)
 {
 	int status = FAIL;
-	uint message_len;
-	MESSAGE message = CreateMessage(MC_DATA, content, content_len, &message_len);
-	if (message != NULL) {
-		status = SendSegment(sender, 1, message, message_len);
+	uint frame_len;
+	char payload[JOB_PAYLOAD_SIZE];
+	WriteJobPayload(job_id, downloaded, payload);
+	stream frame = CreateFrame(version, STREAM_DEFAULT, MC_RESUME, 0, payload, JOB_PAYLOAD_SIZE, &frame_len);
+	if (frame != NULL) {
+		status = Send(sender, 1, frame_len, frame);
 	}
-	DestroyMessage(message);
+	DestroyStream(frame);
 	return status;
 }
 
-int ReceiveMessage(SOCKET receiver, int* ocode, stream* opayload, uint* olength)
+int ReceiveJobMessage(SOCKET receiver, FRAMEPARSER* parser, ullong* iojob_id, uint* ocommitted)
 {
-	if (ocode == NULL || opayload == NULL || olength == NULL)
+	if (iojob_id == NULL || ocommitted == NULL)
 		return INVALID_ARGUMENTS;
 
-	*opayload = NULL;
-	MESSAGE message;
-	uint message_len;
-	int ret = ReceiveSegment(receiver, 1, &message, &message_len);
-	if (ret == FATAL_ERROR)
-		return ret;
+	FRAME frame;
+	int ret = ReceiveFrame(receiver, parser, &frame);
 	if (ret == SUCCESS) {
-		stream content;
-		uint content_len;
-		*ocode = ExtractMessage(message, message_len, &content, &content_len);
-		if (*ocode != MC_INVALID) {
-			*opayload = content;
-			*olength = content_len;
-		}
+		ullong reply_id;
+		if (frame.code != MC_JOB || ExtractJobPayload(&frame, &reply_id, ocommitted) != SUCCESS || reply_id == JOB_NONE ||
+			(*iojob_id != JOB_NONE && reply_id != *iojob_id))
+			ret = FAIL; // MC_ERROR: the job expired (or can not be kept)
 		else
-			ret = FAIL;
+			*iojob_id = reply_id;
 	}
-	DestroyMessage(message);
 	return ret;
 }
 
-int ReceiveACK(SOCKET receiver)
+int SendDataMessage(SOCKET sender, int version, uint capabilities, uint stream_id, const stream content, uint content_len)
 {
-	stream read;
+	int status = FAIL;
+	uint frame_len;
+	stream frame = CreateDataFrame(version, capabilities, stream_id, content, content_len, &frame_len);
+	if (frame != NULL) {
+		status = Send(sender, 1, frame_len, frame);
+	}
+	DestroyStream(frame);
+	return status;
+}
 
-	// read segment content size
-	int ret = Receive(receiver, 1, ACK_PACKET_SIZE, &read);
+int ReceiveFrame(SOCKET receiver, FRAMEPARSER* parser, FRAME* oframe)
+{
+	int ret;
+	while ((ret = ParseFrame(parser, oframe)) == WAIT) {
+		uint space = PrepareParserSpace(parser);
+		uint read_count;
+		if (ReceiveAvailable(receiver, parser->buffer + parser->end, space, &read_count) != SUCCESS)
+			return FATAL_ERROR;
+		CommitParserBytes(parser, read_count);
+	}
+	return ret;
+}
+
+int ReceiveACK(SOCKET receiver, FRAMEPARSER* parser, uint* olimit)
+{
+	if (olimit == NULL)
+		return INVALID_ARGUMENTS;
+
+	FRAME frame;
+	int ret = ReceiveFrame(receiver, parser, &frame);
 	if (ret == SUCCESS) {
-		ret = (ToUnsignedInt(read) == 0 ? SUCCESS : FAIL);
+		if (frame.code == MC_ACK)
+			*olimit = ExtractACK(&frame);
+		else
+			ret = FAIL;
+	}
+	return ret;
+}
+
+int SendACK(SOCKET sender, int version, uint stream_id, uint limit)
+{
+	int status = FAIL;
+	uint ack_len;
+	stream ack = CreateACK(version, stream_id, limit, &ack_len);
+	if (ack != NULL) {
+		status = Send(sender, 1, ack_len, ack);
 	}
-	DestroyStream(read);
+	DestroyStream(ack);
+	return status;
+}
+
+int WaitRequestACK(SOCKET receiver, FRAMEPARSER* parser)
+{
+	if (parser->capabilities & CAP_CREDIT)
+		return SUCCESS;
 
+	uint limit;
+	parser->mode = PM_ACK;
+	int ret = ReceiveACK(receiver, parser, &limit);
+	parser->mode = PM_MESSAGE;
 	return ret;
 }
 
-int SendACK(SOCKET sender)
+int WaitCredit(SOCKET receiver, FRAMEPARSER* parser, FLOWWINDOW* window)
 {
-	char ack[ACK_PACKET_SIZE];
-	uint value = 0;
-	memcpy_s(ack, ACK_PACKET_SIZE, &value, ACK_PACKET_SIZE);
-	return Send(sender, 1, ACK_PACKET_SIZE, ack);
+	uint limit;
+	int ret = SUCCESS;
+	while (!HasCredit(window)) {
+		ret = ReceiveACK(receiver, parser, &limit);
+		if (ret != SUCCESS)
+			return ret;
+		if (limit == FLOW_CREDIT_END)
+			return FAIL;
+		UpdateCredit(window, limit);
+	}
+	return ret;
+}
+
+int WaitCreditEnd(SOCKET receiver, FRAMEPARSER* parser)
+{
+	uint limit = (parser->capabilities & CAP_CREDIT) ? 0 : FLOW_CREDIT_END; // stop-and-wait: nothing left to receive
+	int ret = SUCCESS;
+	while (limit != FLOW_CREDIT_END) {
+		ret = ReceiveACK(receiver, parser, &limit);
+		if (ret != SUCCESS)
+			return FATAL_ERROR;
+	}
+	parser->mode = PM_MESSAGE;
+	return ret;
 }
 
 #pragma endregion
 
 #pragma region Overlapped IO
 
-int SendDataMessage(SOCKETEX* sender, const stream content, uint content_len)
+/// <summary>
+/// ACK frame closes the credits, shared by all connections. It is never released.
+/// </summary>
+char gCreditEndFrame[FRAME_TYPE_SIZE + 2] = { (FF_END << FRAME_FLAGS_SHIFT) | MC_ACK, STREAM_DEFAULT, 0 };
+SENDBUFFER gCreditEndFrameSendBuffer = { gCreditEndFrame, FRAME_TYPE_SIZE + 2, 1 };
+
+int EnqueueFrame(SOCKETEX* sender, stream frame, uint frame_len)
+{
+	if (frame == NULL)
+		return FAIL;
+
+	SENDBUFFER* buffer = CreateSendBuffer(frame, frame_len);
+	if (buffer == NULL) {
+		DestroyStream(frame);
+		return FAIL;
+	}
+	int ret = EnqueueSend(sender, buffer);
+	ReleaseSendBuffer(buffer);
+	return ret;
+}
+
+int SendHello(SOCKETEX* sender, int version, uint capabilities)
+{
+	stream hello = CreateStream(PROTOCOL_HELLO_SIZE);
+	if (hello != NULL)
+		WriteHello(version, capabilities, hello);
+	return EnqueueFrame(sender, hello, PROTOCOL_HELLO_SIZE);
+}
+
+int SendDataMessage(SOCKETEX* sender, int version, uint capabilities, uint stream_id, const stream content, uint content_len)
+{
+	uint frame_len;
+	stream frame = CreateDataFrame(version, capabilities, stream_id, content, content_len, &frame_len);
+	return EnqueueFrame(sender, frame, frame_len);
+}
+
+int SendACK(SOCKETEX* sender, int version, uint stream_id, uint limit)
+{
+	if (limit == FLOW_CREDIT_END && version >= PROTOCOL_V2 && stream_id == STREAM_DEFAULT) // v1 never closes the credits
+		return EnqueueSend(sender, &gCreditEndFrameSendBuffer);
+
+	uint ack_len;
+	stream ack = CreateACK(version, stream_id, limit, &ack_len);
+	return EnqueueFrame(sender, ack, ack_len);
+}
+
+int ReceiveFrames(SOCKETEX* receiver, FRAMEPARSER* parser)
+{
+	uint space = PrepareParserSpace(parser);
+	if (space == 0)
+		return FAIL;
+	PrepareBuffer(receiver, space, parser->end);
+	return Receive(receiver);
+}
+
+int SendJobMessage(SOCKETEX* sender, int version, uint stream_id, ullong job_id, uint committed)
+{
+	uint frame_len;
+	char payload[JOB_PAYLOAD_SIZE];
+	WriteJobPayload(job_id, committed, payload);
+	stream frame = CreateFrame(version, stream_id, MC_JOB, 0, payload, JOB_PAYLOAD_SIZE, &frame_len);
+	return EnqueueFrame(sender, frame, frame_len);
+}
+
+int SendErrorMessage(SOCKETEX* sender, int version, uint stream_id)
+{
+	uint frame_len;
+	stream frame = CreateFrame(version, stream_id, MC_ERROR, 0, NULLSTR, 0, &frame_len);
+	return EnqueueFrame(sender, frame, frame_len);
+}
+
+#pragma endregion
+
+#pragma region Flow Control
+
+void ResetFlowWindow(FLOWWINDOW* window, uint capabilities)
+{
+	window->transfered = 0;
+	window->chunks = (capabilities & CAP_CREDIT) ? FLOW_WINDOW_CHUNKS : FLOW_STOP_AND_WAIT;
+	window->limit = window->chunks;
+}
+
+int HasCredit(const FLOWWINDOW* window)
+{
+	return window->transfered < window->limit;
+}
+
+void UpdateCredit(FLOWWINDOW* window, uint limit)
+{
+	if (window->chunks == FLOW_STOP_AND_WAIT)
+		limit = window->transfered + FLOW_STOP_AND_WAIT; // the ACK Packet carries no limit
+	if (limit > window->limit)
+		window->limit = limit;
+}
+
+int ConsumeCredit(FLOWWINDOW* window, uint* olimit)
+{
+	if (olimit == NULL)
+		return INVALID_ARGUMENTS;
+	window->transfered++;
+	if (window->transfered + window->chunks / 2 < window->limit) // FLOW_UPDATE_THRESHOLD. Stop-and-wait: always
+		return FAIL;
+	window->limit = window->transfered + window->chunks;
+	*olimit = window->limit;
+	return SUCCESS;
+}
+
+#pragma endregion
+
+#pragma region Job
+
+ullong CreateRandomID()
+{
+	ullong id = JOB_NONE;
+	while (id == JOB_NONE) {
+		if (!BCRYPT_SUCCESS(BCryptGenRandom(NULL, (PUCHAR)&id, sizeof(id), BCRYPT_USE_SYSTEM_PREFERRED_RNG)))
+			return JOB_NONE;
+	}
+	return id;
+}
+
+void WriteRandomID(ullong id, stream opayload)
+{
+	for (int i = 0; i < JOB_ID_SIZE; ++i) // big endian
+		opayload[i] = (char)(id >> (8 * (JOB_ID_SIZE - 1 - i)));
+}
+
+ullong ExtractRandomID(const stream payload)
+{
+	ullong id = 0;
+	for (int i = 0; i < JOB_ID_SIZE; ++i)
+		id = (id << 8) | (unsigned char)payload[i];
+	return id;
+}
+
+void WriteJobPayload(ullong job_id, uint offset, stream opayload)
+{
+	uint be_offset = ToNetworkByteOrder(offset);
+	WriteRandomID(job_id, opayload);
+	memcpy_s(opayload + JOB_ID_SIZE, sizeof(uint), &be_offset, sizeof(uint));
+}
+
+int ExtractJobPayload(const FRAME* frame, ullong* ojob_id, uint* ooffset)
+{
+	if (ojob_id == NULL || ooffset == NULL)
+		return INVALID_ARGUMENTS;
+	if (frame->length < JOB_PAYLOAD_SIZE)
+		return FAIL;
+	*ojob_id = ExtractRandomID(frame->payload);
+	*ooffset = ToHostByteOrder(ToUnsignedInt(frame->payload + JOB_ID_SIZE));
+	return SUCCESS;
+}
+
+#pragma endregion
+
+#pragma region Probe
+
+int SendProbeMessage(SOCKET sender, int version, uint stream_id, const stream digest, uint size)
 {
-	uint message_len;
 	int status = FAIL;
+	uint frame_len;
+	char payload[PROBE_HASH_SIZE + VARINT_MAX_SIZE];
+	memcpy_s(payload, PROBE_HASH_SIZE, digest, PROBE_HASH_SIZE);
+	uint payload_len = PROBE_HASH_SIZE + WriteVarint(size, payload + PROBE_HASH_SIZE);
+	stream frame = CreateFrame(version, stream_id, MC_PROBE, 0, payload, payload_len, &frame_len);
+	if (frame != NULL) {
+		status = Send(sender, 1, frame_len, frame);
+	}
+	DestroyStream(frame);
+	return status;
+}
+
+int ReceiveHeldMessage(SOCKET receiver, FRAMEPARSER* parser, int* oheld)
+{
+	if (oheld == NULL)
+		return INVALID_ARGUMENTS;
 
-	MESSAGE message = CreateMessage(MC_DATA, content, content_len, &message_len);
-	if (message != NULL) {
-		status = SendSegment(sender, message, message_len);
+	FRAME frame;
+	int ret = ReceiveFrame(receiver, parser, &frame);
+	if (ret == SUCCESS) {
+		if (frame.code == MC_HELD && frame.length > 0)
+			*oheld = frame.payload[0] != 0;
+		else
+			ret = FAIL;
 	}
-	DestroyMessage(message);
+	return ret;
+}
+
+int ExtractProbe(const FRAME* frame, stream odigest, uint* osize)
+{
+	if (odigest == NULL || osize == NULL)
+		return INVALID_ARGUMENTS;
+	if (frame->length <= PROBE_HASH_SIZE)
+		return FAIL;
+
+	uint size;
+	if (ReadVarint(frame->payload + PROBE_HASH_SIZE, frame->length - PROBE_HASH_SIZE, osize, &size) != SUCCESS)
+		return FAIL;
+	memcpy_s(odigest, PROBE_HASH_SIZE, frame->payload, PROBE_HASH_SIZE);
+	return SUCCESS;
+}
+
+int SendHeldMessage(SOCKETEX* sender, int version, uint stream_id, int held)
+{
+	uint frame_len;
+	char payload = held ? 1 : 0;
+	stream frame = CreateFrame(version, stream_id, MC_HELD, 0, &payload, 1, &frame_len);
+	return EnqueueFrame(sender, frame, frame_len);
+}
+
+#pragma endregion
+
+#pragma region Batch
+
+int SendBatchManifest(SOCKET sender, int version, uint stream_id, uint count)
+{
+	int status = FAIL;
+	uint frame_len;
+	char payload[VARINT_MAX_SIZE];
+	uint payload_len = WriteVarint(count, payload);
+	stream frame = CreateFrame(version, stream_id, MC_BATCH, FF_MANIFEST, payload, payload_len, &frame_len);
+	if (frame != NULL) {
+		status = Send(sender, 1, frame_len, frame);
+	}
+	DestroyStream(frame);
 	return status;
 }
 
-int SendACK(SOCKETEX* sender)
+int SendBatchEntry(SOCKET sender, int version, uint capabilities, uint stream_id, uint index, int request_type, uint key, const stream content, uint content_len)
 {
-	PrepareBuffer(sender, ACK_PACKET_SIZE);
-	memset(sender->buffer.buf, 0, ACK_PACKET_SIZE);
+	if (content_len > BATCH_ENTRY_MAX_SIZE)
+		return FAIL;
 
-	return Send(sender);
+	int status = FAIL;
+	uint frame_len;
+	char payload[MESSAGE_PAYLOAD_MAX_SIZE];
+	uint payload_len = WriteVarint(index, payload);
+	payload[payload_len++] = (char)request_type;
+	payload_len += WriteVarint(key, payload + payload_len);
+	if (content_len > 0)
+		memcpy_s(payload + payload_len, MESSAGE_PAYLOAD_MAX_SIZE - payload_len, content, content_len);
+	stream frame = CreatePackedFrame(version, capabilities, stream_id, MC_BATCH, 0, payload, payload_len + content_len, &frame_len);
+	if (frame != NULL) {
+		status = Send(sender, 1, frame_len, frame);
+	}
+	DestroyStream(frame);
+	return status;
 }
 
-int ReceiveACK(SOCKETEX* receiver)
+int ExtractBatchManifest(const FRAME* frame, uint* ocount)
 {
-	PrepareBuffer(receiver, ACK_PACKET_SIZE);
-	return Receive(receiver);
+	if (ocount == NULL)
+		return INVALID_ARGUMENTS;
+	uint size;
+	if (ReadVarint(frame->payload, frame->length, ocount, &size) != SUCCESS || *ocount == 0)
+		return FAIL;
+	return SUCCESS;
+}
+
+int ExtractBatchEntry(const FRAME* frame, uint* oindex, int* orequest_type, uint* okey, stream* ocontent, uint* ocontent_len)
+{
+	if (oindex == NULL || orequest_type == NULL || okey == NULL || ocontent == NULL || ocontent_len == NULL)
+		return INVALID_ARGUMENTS;
+
+	uint offset, size;
+	if (ReadVarint(frame->payload, frame->length, oindex, &offset) != SUCCESS || offset >= frame->length)
+		return FAIL;
+	*orequest_type = (unsigned char)frame->payload[offset++];
+	if (*orequest_type != RT_ENCRYPT && *orequest_type != RT_DECRYPT)
+		return FAIL;
+	if (ReadVarint(frame->payload + offset, frame->length - offset, okey, &size) != SUCCESS)
+		return FAIL;
+	offset += size;
+	*ocontent_len = frame->length - offset;
+	*ocontent = *ocontent_len > 0 ? frame->payload + offset : NULL;
+	return SUCCESS;
+}
+
+int SendBatchResult(SOCKETEX* sender, int version, uint capabilities, uint stream_id, uint index, const stream content, uint content_len, int failed)
+{
+	if (failed)
+		content_len = 0;
+	if (content_len > MESSAGE_PAYLOAD_MAX_SIZE - VARINT_MAX_SIZE)
+		return FAIL;
+
+	uint frame_len;
+	char payload[MESSAGE_PAYLOAD_MAX_SIZE];
+	uint payload_len = WriteVarint(index, payload);
+	if (content_len > 0)
+		memcpy_s(payload + payload_len, MESSAGE_PAYLOAD_MAX_SIZE - payload_len, content, content_len);
+	stream frame = CreatePackedFrame(version, capabilities, stream_id, MC_BATCH, failed ? FF_FAILED : 0, payload, payload_len + content_len, &frame_len);
+	return EnqueueFrame(sender, frame, frame_len);
+}
+
+int ExtractBatchResult(const FRAME* frame, uint* oindex, stream* ocontent, uint* ocontent_len)
+{
+	if (oindex == NULL || ocontent == NULL || ocontent_len == NULL)
+		return INVALID_ARGUMENTS;
+
+	uint offset;
+	if (ReadVarint(frame->payload, frame->length, oindex, &offset) != SUCCESS)
+		return FAIL;
+	*ocontent_len = frame->length - offset;
+	*ocontent = *ocontent_len > 0 ? frame->payload + offset : NULL;
+	return SUCCESS;
+}
+
+#pragma endregion
+
+#pragma region Kept Upload
+
+int SendStoreMessage(SOCKET sender, int version, uint stream_id)
+{
+	int status = FAIL;
+	uint frame_len;
+	stream frame = CreateFrame(version, stream_id, MC_STORE, 0, NULLSTR, 0, &frame_len);
+	if (frame != NULL) {
+		status = Send(sender, 1, frame_len, frame);
+	}
+	DestroyStream(frame);
+	return status;
+}
+
+int SendHandleMessage(SOCKETEX* sender, int version, uint stream_id, ullong handle_id, uint ttl)
+{
+	uint frame_len;
+	char payload[HANDLE_PAYLOAD_SIZE];
+	WriteJobPayload(handle_id, ttl, payload);
+	stream frame = CreateFrame(version, stream_id, MC_STORE, 0, payload, HANDLE_PAYLOAD_SIZE, &frame_len);
+	return EnqueueFrame(sender, frame, frame_len);
+}
+
+int ReceiveHandleMessage(SOCKET receiver, FRAMEPARSER* parser, ullong* ohandle_id, uint* ottl)
+{
+	if (ohandle_id == NULL || ottl == NULL)
+		return INVALID_ARGUMENTS;
+
+	FRAME frame;
+	int ret = ReceiveFrame(receiver, parser, &frame);
+	if (ret == SUCCESS) {
+		if (frame.code != MC_STORE || ExtractJobPayload(&frame, ohandle_id, ottl) != SUCCESS || *ohandle_id == HANDLE_NONE)
+			ret = FAIL; // MC_ERROR: the upload can not be kept
+	}
+	return ret;
+}
+
+int SendApplyMessage(SOCKET sender, int version, uint stream_id, ullong handle_id, int request_type, uint key, uint offset, uint length)
+{
+	int status = FAIL;
+	uint frame_len;
+	char payload[APPLY_PAYLOAD_MAX_SIZE];
+	WriteRandomID(handle_id, payload);
+	uint payload_len = HANDLE_ID_SIZE;
+	payload[payload_len++] = (char)request_type;
+	payload_len += WriteVarint(key, payload + payload_len);
+	payload_len += WriteVarint(offset, payload + payload_len);
+	payload_len += WriteVarint(length, payload + payload_len);
+	stream frame = CreateFrame(version, stream_id, MC_APPLY, 0, payload, payload_len, &frame_len);
+	if (frame != NULL) {
+		status = Send(sender, 1, frame_len, frame);
+	}
+	DestroyStream(frame);
+	return status;
+}
+
+int ExtractApply(const FRAME* frame, ullong* ohandle_id, int* orequest_type, uint* okey, uint* ooffset, uint* olength)
+{
+	if (ohandle_id == NULL || orequest_type == NULL || okey == NULL || ooffset == NULL || olength == NULL)
+		return INVALID_ARGUMENTS;
+	if (frame->length <= HANDLE_ID_SIZE + 1)
+		return FAIL;
+
+	*ohandle_id = ExtractRandomID(frame->payload);
+	uint offset = HANDLE_ID_SIZE;
+	*orequest_type = (unsigned char)frame->payload[offset++];
+	if (*orequest_type != RT_ENCRYPT && *orequest_type != RT_DECRYPT)
+		return FAIL;
+	uint* fields[3] = { okey, ooffset, olength };
+	for (int i = 0; i < 3; ++i) {
+		uint size;
+		if (offset >= frame->length || ReadVarint(frame->payload + offset, frame->length - offset, fields[i], &size) != SUCCESS)
+			return FAIL;
+		offset += size;
+	}
+	return SUCCESS;
+}
+
+#pragma endregion
+
+#pragma region Stripe
+
+int SendStripeMessage(SOCKET sender, int version, uint stream_id, ullong job_id, int request_type, uint key, uint count, uint size, uint offset, uint length)
+{
+	int status = FAIL;
+	uint frame_len;
+	char payload[STRIPE_PAYLOAD_MAX_SIZE];
+	WriteRandomID(job_id, payload);
+	uint payload_len = JOB_ID_SIZE;
+	payload[payload_len++] = (char)request_type;
+	uint fields[5] = { key, count, size, offset, length };
+	for (int i = 0; i < 5; ++i)
+		payload_len += WriteVarint(fields[i], payload + payload_len);
+	stream frame = CreateFrame(version, stream_id, MC_STRIPE, 0, payload, payload_len, &frame_len);
+	if (frame != NULL) {
+		status = Send(sender, 1, frame_len, frame);
+	}
+	DestroyStream(frame);
+	return status;
+}
+
+int ExtractStripe(const FRAME* frame, ullong* ojob_id, int* orequest_type, uint* okey, uint* ocount, uint* osize, uint* ooffset, uint* olength)
+{
+	if (ojob_id == NULL || orequest_type == NULL || okey == NULL || ocount == NULL || osize == NULL || ooffset == NULL || olength == NULL)
+		return INVALID_ARGUMENTS;
+	if (frame->length <= JOB_ID_SIZE + 1)
+		return FAIL;
+
+	*ojob_id = ExtractRandomID(frame->payload);
+	uint offset = JOB_ID_SIZE;
+	*orequest_type = (unsigned char)frame->payload[offset++];
+	if (*ojob_id == JOB_NONE || (*orequest_type != RT_ENCRYPT && *orequest_type != RT_DECRYPT))
+		return FAIL;
+	uint* fields[5] = { okey, ocount, osize, ooffset, olength };
+	for (int i = 0; i < 5; ++i) {
+		uint size;
+		if (offset >= frame->length || ReadVarint(frame->payload + offset, frame->length - offset, fields[i], &size) != SUCCESS)
+			return FAIL;
+		offset += size;
+	}
+	// the range must be inside the content
+	if (*ocount == 0 || *ocount > MAX_STRIPES || *olength > *osize || *ooffset > *osize - *olength)
+		return FAIL;
+	return SUCCESS;
 }
 
 #pragma endregion
@@ -1,6 +1,7 @@
 #pragma once
 
 #pragma comment(lib, "Ws2_32.lib")
+#pragma comment(lib, "Bcrypt.lib")
 
 #pragma region Header Declarations
 
@@ -12,6 +13,8 @@
 #include "SocketLibrary.h"
 #include "Crypto.h"
 
+#include <bcrypt.h>
+
 #pragma endregion
 
 #pragma region Constants Definitions
@@ -22,8 +25,55 @@
 #define MESSAGE_PAYLOAD_MAX_SIZE	(MESSAGE_MAX_SIZE - MESSAGE_HEADER_SIZE)
 
 #define ACK_PACKET_SIZE				4
+#define ACK_PACKET_VALUE			0 // [v1] ACK Packets are a Segment Header = 0 (0x 0000 0000)
+
+#define PROTOCOL_UNKNOWN			0 // The version has not been known yet
+#define PROTOCOL_V1					1 // Segment Header | Code | Length | Payload. ACK Packets are sent raw. No Hello Packet: no capabilities
+#define PROTOCOL_V2					2 // Type & Flags | Varint Stream ID | Varint Length | Payload. ACK Packets are frames
+#define PROTOCOL_VERSION			PROTOCOL_V2 // The newest version supported. The features are negotiated by capabilities (See CAP_)
+
+#define PROTOCOL_HELLO_MAGIC		"ENC"
+#define PROTOCOL_HELLO_MAGIC_SIZE	3
+#define PROTOCOL_HELLO_CAPS_SIZE	4
+#define PROTOCOL_HELLO_SIZE			(PROTOCOL_HELLO_MAGIC_SIZE + 1 + PROTOCOL_HELLO_CAPS_SIZE) // Magic | Version | Capabilities. A v1 client sends a longer request (Segment Header | Message) before waiting
+
+#define CAP_CREDIT					0x0001 // MC_DATA messages are acknowledged cumulatively by credit (See FLOWWINDOW). Without it, one ACK Packet for each message (stop-and-wait)
+#define CAP_COMPRESS				0x0002 // MC_DATA (and MC_BATCH) payloads may be compressed (FF_COMPRESSED)
+#define CAP_STREAMS					0x0004 // Several jobs interleave on a connection, on different stream IDs. Needs CAP_CREDIT
+#define CAP_BATCH					0x0008 // A batch (MC_BATCH frames) carries many small files on a stream. Needs CAP_CREDIT
+#define CAP_PROBE					0x0010 // A probe (MC_PROBE) skips the upload of content the server holds
+#define CAP_STORE					0x0020 // An upload may be kept on the server (MC_STORE) and processed many times (MC_APPLY)
+#define CAP_STRIPE					0x0040 // A job may be split into byte ranges uploaded over several connections (MC_STRIPE)
+#define CAP_RESUME					0x0080 // A request interrupted by a lost connection may be resumed (MC_RESUME) with the job ID issued by the server (MC_JOB)
+#define CAP_SUPPORTED				(CAP_CREDIT | CAP_COMPRESS | CAP_STREAMS | CAP_BATCH | CAP_PROBE | CAP_STORE | CAP_STRIPE | CAP_RESUME) // The capabilities this side supports
+
+#define FRAME_TYPE_SIZE				1
+#define FRAME_TYPE_MASK				0x0F
+#define FRAME_FLAGS_SHIFT			4
+#define FRAME_HEADER_MAX_SIZE		(FRAME_TYPE_SIZE + 2 * VARINT_MAX_SIZE)
+#define FRAME_PARSER_SIZE			(2 * SEGMENT_MAX_SIZE) // The size of the receive buffer of a frame parser
+
+#define STREAM_DEFAULT				0 // The only stream without CAP_STREAMS
+#define MAX_STREAMS					8 // [CAP_STREAMS] Maximum number of concurrent jobs on a connection
+#define MAX_STRIPES					8 // [CAP_STRIPE] Maximum number of connections (byte ranges) of a striped job
+
+#define FF_END						0x01 // [v2, CAP_CREDIT] The ACK frame closes the credits
+#define FF_COMPRESSED				0x02 // [CAP_COMPRESS] The MC_DATA (or MC_BATCH) payload is compressed by CompressLZ()
+#define FF_MANIFEST					0x04 // [CAP_BATCH] The MC_BATCH frame opens a batch. Payload: Varint number of entries
+#define FF_FAILED					0x08 // [CAP_BATCH] The batch entry can not be processed. Payload: Varint index
+
+#define COMPRESS_MIN_SIZE			64 // Smaller MC_DATA payloads are always sent raw
+
+#define PM_MESSAGE					0 // [v1] The next bytes are Segments
+#define PM_ACK						1 // [v1] The next bytes are raw ACK Packets
+
+#define FLOW_WINDOW_CHUNKS			16 // [CAP_CREDIT] Credit (number of MC_DATA messages) a receiver grants in advance. Both sides start with this credit
+#define FLOW_UPDATE_THRESHOLD		(FLOW_WINDOW_CHUNKS / 2) // [CAP_CREDIT] The receiver grants new credit when the remain credit drops to this
+#define FLOW_STOP_AND_WAIT			1 // Credit without CAP_CREDIT: the sender waits for the ACK Packet of each MC_DATA message
+#define FLOW_CREDIT_END				UEOF // [CAP_CREDIT] The ACK Packet closes the credits of a transfer
 
 #define RECEIVE_TIMEOUT_INTERVAL	10000
+#define HELLO_TIMEOUT_INTERVAL		2000 // A v1 server never replies the Hello Packet
 #define USER_INPUT_MAX_SIZE			1023
 #define MAX_CLIENTS					777
 
@@ -34,11 +84,41 @@
 #define MC_DECRYPT					1
 #define MC_DATA						2
 #define MC_ERROR					3
+#define MC_ACK						4
+#define MC_HELLO					5
+#define MC_RESUME					6 // [CAP_RESUME] Job ID | Downloaded bytes. Continue a job after reconnecting
+#define MC_JOB						7 // [CAP_RESUME] Job ID | Committed upload bytes (JOB_UPLOADED if the upload completed). Also the reply of a resumable request, before the upload
+#define MC_BATCH					8 // [CAP_BATCH] Entry: Varint index | Request type | Varint key | Content. Result: Varint index | Content
+#define MC_PROBE					9 // [CAP_PROBE] Content digest (SHA-256, 32 bytes) | Varint content size. Sent after MC_ENCRYPT/MC_DECRYPT, before any MC_DATA
+#define MC_HELD						10 // [CAP_PROBE] The reply of MC_PROBE: 1 byte, 1 if the server holds the content (no upload, the result follows). 0 otherwise
+#define MC_STORE					11 // [CAP_STORE] Request: empty, the upload follows as MC_DATA and is kept. Reply (after the upload): Handle ID | TTL seconds
+#define MC_APPLY					12 // [CAP_STORE] Handle ID | Request type | Varint key | Varint offset | Varint length (0: to the end). The result follows as MC_DATA
+#define MC_STRIPE					13 // [CAP_STRIPE] Job ID | Request type | Varint key | Varint count | Varint size | Varint offset | Varint length. The range follows as MC_DATA, its result comes back on the same connection
 #define MC_INVALID					-1
 
 #define RT_ENCRYPT					0
 #define RT_DECRYPT					1
 #define RT_INVALID					2
+#define RT_BATCH					3 // [CAP_BATCH] Many small files on a stream. See MC_BATCH
+#define RT_STORE					5 // [CAP_STORE] An upload kept on the server. See MC_STORE
+
+#define JOB_NONE					0 // The request is not resumable
+#define JOB_ID_SIZE					8 // Random 64 bits from the server. The only secret of a job
+#define JOB_PAYLOAD_SIZE			(JOB_ID_SIZE + 4) // Payload of MC_RESUME and MC_JOB frames
+#define JOB_UPLOADED				UEOF // [MC_JOB] The upload completed, the server responds from the downloaded bytes
+
+#define BATCH_ENTRY_HEADER_MAX_SIZE	(2 * VARINT_MAX_SIZE + 1) // Varint index | Request type | Varint key
+#define BATCH_ENTRY_MAX_SIZE		(MESSAGE_PAYLOAD_MAX_SIZE - BATCH_ENTRY_HEADER_MAX_SIZE) // Larger files are sent as separate jobs
+
+#define HANDLE_NONE					0 // Not a kept upload
+#define HANDLE_ID_SIZE				JOB_ID_SIZE // Random 64 bits from the server, like job IDs (See CreateRandomID())
+#define HANDLE_PAYLOAD_SIZE			JOB_PAYLOAD_SIZE // Payload of the MC_STORE reply. Same layout as the MC_JOB payload
+#define APPLY_PAYLOAD_MAX_SIZE		(HANDLE_ID_SIZE + 1 + 3 * VARINT_MAX_SIZE)
+
+#define STRIPE_PAYLOAD_MAX_SIZE		(JOB_ID_SIZE + 1 + 5 * VARINT_MAX_SIZE)
+
+#define PROBE_HASH_SIZE				DIGEST_SIZE
+#define PROBE_MIN_SIZE				(FLOW_WINDOW_CHUNKS * MESSAGE_PAYLOAD_MAX_SIZE) // Smaller files are uploaded without a probe: the upload fits in the initial credit
 
 #define FILE_EXTENSION_SIZE			5
 #define ENCRYPT_FILE_EXTENSION		".enc"
@@ -51,6 +131,62 @@
 
 #define MESSAGE						char*
 
+/// <summary>
+/// Credit-based flow control for MC_DATA messages of a transfer (upload or download).
+/// With CAP_CREDIT, the receiver acknowledges cumulatively: each ACK Packet carries the new "limit".
+/// Otherwise each ACK Packet allows one more message (stop-and-wait), as the first version of the protocol.
+/// </summary>
+typedef struct flowwindow {
+
+	uint transfered; // Number of MC_DATA messages sent (sender side) or consumed (receiver side)
+
+	uint limit; // The sender can send MC_DATA messages until "transfered" reaches this
+
+	uint chunks; // The credit granted in advance. FLOW_WINDOW_CHUNKS with CAP_CREDIT. FLOW_STOP_AND_WAIT otherwise
+
+}FLOWWINDOW;
+
+/// <summary>
+/// A message (v1) or frame (v2) extracted by a frame parser
+/// </summary>
+typedef struct frame {
+
+	int version; // The protocol version the frame is parsed with
+
+	int code; // The frame code. See MC_ for some codes
+
+	int flags; // The frame flags. See FF_ for some flags. Always 0 in v1
+
+	uint stream_id; // The stream (job) the frame belongs to. Always STREAM_DEFAULT in v1
+
+	stream payload; // Points to the payload inside the parser buffer, valid until the parser receives more bytes. NULL if "length" is 0
+
+	uint length; // The payload size in bytes
+
+}FRAME;
+
+/// <summary>
+/// Incremental parser for both protocol versions. Received bytes are appended to "buffer" and frames are extracted from them.
+/// The version is detected from the first bytes: a Hello Packet or a v1 Segment.
+/// </summary>
+typedef struct frameparser {
+
+	int version; // The protocol version. See PROTOCOL_
+
+	int mode; // [v1] What the next bytes are, v1 ACK Packets are not self-described. See PM_
+
+	uint capabilities; // The features both sides support, chosen by the Hello Packets. See CAP_. 0 in v1
+
+	stream buffer; // Received bytes. The parser does not own the memory
+
+	uint capacity; // The size of "buffer"
+
+	uint start; // The first byte has not been parsed
+
+	uint end; // The byte after the last received byte
+
+}FRAMEPARSER;
+
 #pragma endregion
 
 #pragma region Function Declarations
@@ -86,78 +222,626 @@ MESSAGE CreateMessage(int code, uint value, uint* omessage_len);
 /// <returns>The MESSAGE's code. See MC_ for some message's code</returns>
 int ExtractMessage(const MESSAGE message, uint message_len, stream* opayload, uint* olength);
 
+/// <summary>
+/// Extract data (Payload) from MESSAGE object without copying it.
+/// </summary>
+/// <param name="message">The MESSAGE object</param>
+/// <param name="message_len">The MESSAGE's size in bytes</param>
+/// <param name="opayload">[Output:NotNull] Points to the payload inside "message". NULL if the payload is empty. Do not free it</param>
+/// <param name="olength">[Output:NotNull] The payload size in bytes</param>
+/// <returns>The MESSAGE's code. See MC_ for some message's code</returns>
+int ExtractMessageView(const MESSAGE message, uint message_len, stream* opayload, uint* olength);
+
 /// <summary>
 /// Free memory for the MESSAGE object
 /// </summary>
 /// <param name="m">The MESSAGE object</param>
 void DestroyMessage(MESSAGE m);
 
+#pragma region Frame
+
+/// <summary>
+/// Create the bytes of a frame in a protocol version.
+/// v1: Segment Header | Code | Length | Payload [See CreateMessage()]. v2: Type & Flags (1 byte) | Length (varint) | Payload
+/// </summary>
+/// <param name="version">The protocol version. See PROTOCOL_</param>
+/// <param name="stream_id">The stream of the frame. STREAM_DEFAULT without CAP_STREAMS</param>
+/// <param name="code">The code for the frame. See MC_ for some codes</param>
+/// <param name="flags">The flags for the frame [v2 only]. See FF_ for some flags</param>
+/// <param name="payload">The payload data</param>
+/// <param name="length">The length of the payload</param>
+/// <param name="oframe_len">[Output:NotNull] The length of the created frame</param>
+/// <returns>The created frame. NULL if fail to allocate memory or the payload is too large</returns>
+stream CreateFrame(int version, uint stream_id, int code, int flags, const stream payload, uint length, uint* oframe_len);
+
+/// <summary>
+/// Create the bytes of a ACK Packet in a protocol version.
+/// v1: ACK_PACKET_VALUE (ACK_PACKET_SIZE bytes), it carries no limit: one more message (stop-and-wait). v2: A MC_ACK frame with the credit limit (varint) or FF_END flag
+/// </summary>
+/// <param name="version">The protocol version. See PROTOCOL_</param>
+/// <param name="stream_id">The stream of the frame. STREAM_DEFAULT without CAP_STREAMS</param>
+/// <param name="limit">The credit limit. See FLOWWINDOW. Use FLOW_CREDIT_END to close the credits</param>
+/// <param name="oack_len">[Output:NotNull] The length of the created ACK Packet</param>
+/// <returns>The created ACK Packet. NULL if fail to allocate memory</returns>
+stream CreateACK(int version, uint stream_id, uint limit, uint* oack_len);
+
+/// <summary>
+/// Write a Hello Packet (PROTOCOL_HELLO_SIZE bytes): PROTOCOL_HELLO_MAGIC | Version | Capabilities (4 bytes)
+/// </summary>
+/// <param name="version">The protocol version. See PROTOCOL_</param>
+/// <param name="capabilities">The capabilities offered (or chosen in the reply). See CAP_</param>
+/// <param name="ohello">[Output:NotNull] The buffer for the Hello Packet. Need PROTOCOL_HELLO_SIZE bytes</param>
+void WriteHello(int version, uint capabilities, stream ohello);
+
 /// <summary>
-/// Create a Encrypt/Decrypt MESSAGE object and Send it to the remoted machine [Block]
-/// Message code = MC_ENCRYPT or MC_DECRYPT
+/// Extract the version and the capabilities from a received MC_HELLO frame
+/// </summary>
+/// <param name="frame">The MC_HELLO frame</param>
+/// <param name="oversion">[Output:NotNull] The protocol version</param>
+/// <param name="ocapabilities">[Output:NotNull] The capabilities. See CAP_</param>
+/// <returns>1 if success. 0 if the payload is invalid</returns>
+int ExtractHello(const FRAME* frame, int* oversion, uint* ocapabilities);
+
+/// <summary>
+/// Extract the credit limit from a received MC_ACK frame
+/// </summary>
+/// <param name="frame">The MC_ACK frame</param>
+/// <returns>The credit limit (ACK_PACKET_VALUE in v1). FLOW_CREDIT_END if the credits is closed</returns>
+uint ExtractACK(const FRAME* frame);
+
+/// <summary>
+/// Create a frame whose payload may be compressed: With CAP_COMPRESS, the payload is compressed (FF_COMPRESSED) if it becomes smaller, otherwise sent raw.
+/// </summary>
+/// <param name="version">The protocol version. See PROTOCOL_</param>
+/// <param name="capabilities">The negotiated capabilities. The payload is compressed only with CAP_COMPRESS</param>
+/// <param name="stream_id">The stream of the frame. STREAM_DEFAULT without CAP_STREAMS</param>
+/// <param name="code">The code for the frame. MC_DATA or MC_BATCH</param>
+/// <param name="flags">The other flags for the frame. See FF_ for some flags</param>
+/// <param name="payload">The payload data</param>
+/// <param name="length">The length of the payload</param>
+/// <param name="oframe_len">[Output:NotNull] The size of the created frame</param>
+/// <returns>The created frame. NULL if fail to allocate memory</returns>
+stream CreatePackedFrame(int version, uint capabilities, uint stream_id, int code, int flags, const stream payload, uint length, uint* oframe_len);
+
+/// <summary>
+/// Create a MC_DATA frame. With CAP_COMPRESS, the payload is compressed if it becomes smaller, otherwise sent raw (See CreatePackedFrame()).
+/// </summary>
+/// <param name="version">The protocol version. See PROTOCOL_</param>
+/// <param name="capabilities">The negotiated capabilities. The payload is compressed only with CAP_COMPRESS</param>
+/// <param name="stream_id">The stream of the frame. STREAM_DEFAULT without CAP_STREAMS</param>
+/// <param name="content">The data (payload) of the frame. Use NULLSTR if want to create a Upload End frame</param>
+/// <param name="content_len">The size of payload. Use 0 if want to create a Upload End frame</param>
+/// <param name="oframe_len">[Output:NotNull] The size of the created frame</param>
+/// <returns>The created frame. NULL if fail to allocate memory</returns>
+stream CreateDataFrame(int version, uint capabilities, uint stream_id, const stream content, uint content_len, uint* oframe_len);
+
+/// <summary>
+/// Decompress the payload of a MC_DATA or MC_BATCH frame if it has FF_COMPRESSED flag. Do nothing for other frames.
+/// </summary>
+/// <param name="frame">The frame. Its payload points to "buffer" after decompressing</param>
+/// <param name="buffer">The buffer for decompressed payload</param>
+/// <param name="capacity">The size of buffer. MESSAGE_PAYLOAD_MAX_SIZE is enough</param>
+/// <returns>1 if success. 0 if the compressed payload is corrupted</returns>
+int InflateFrame(FRAME* frame, stream buffer, uint capacity);
+
+#pragma endregion
+
+#pragma region Frame Parser
+
+/// <summary>
+/// Initialize a frame parser with an empty buffer and unknown version.
+/// </summary>
+/// <param name="parser">A pointer to the FRAMEPARSER object</param>
+/// <param name="buffer">The receive buffer. Should hold at least one frame of maximum size</param>
+/// <param name="capacity">The size of the buffer in bytes</param>
+void InitializeFrameParser(FRAMEPARSER* parser, stream buffer, uint capacity);
+
+/// <summary>
+/// Move unparsed bytes to the beginning of the buffer and Get the free space for receiving.
+/// Received bytes are written at "buffer" + "end" and committed by CommitParserBytes()
+/// </summary>
+/// <param name="parser">A pointer to the FRAMEPARSER object</param>
+/// <returns>Number of free bytes after "end"</returns>
+uint PrepareParserSpace(FRAMEPARSER* parser);
+
+/// <summary>
+/// Append received bytes (written at "buffer" + "end") to the parser
+/// </summary>
+/// <param name="parser">A pointer to the FRAMEPARSER object</param>
+/// <param name="bytes">Number of received bytes</param>
+void CommitParserBytes(FRAMEPARSER* parser, uint bytes);
+
+/// <summary>
+/// Extract the next complete frame from received bytes.
+/// If the version is unknown, a Hello Packet is extracted as a MC_HELLO frame (payload: Version | Capabilities, See ExtractHello()),
+/// otherwise the parser switches to v1.
+/// </summary>
+/// <param name="parser">A pointer to the FRAMEPARSER object</param>
+/// <param name="oframe">[Output:NotNull] The extracted frame. Its payload is a view into the parser buffer</param>
+/// <returns>1 if success. 99 if need more bytes. 0 if the bytes are invalid</returns>
+int ParseFrame(FRAMEPARSER* parser, FRAME* oframe);
+
+#pragma endregion
+
+/// <summary>
+/// Send a Hello Packet with the newest version and the capabilities supported, and Receive the version and the capabilities chosen by the remote machine [Block]
+/// </summary>
+/// <param name="socket">The connected socket</param>
+/// <param name="parser">The frame parser of the socket. Its version and capabilities are set to the chosen ones if success</param>
+/// <param name="version">The newest version supported. See PROTOCOL_</param>
+/// <param name="capabilities">The capabilities supported. See CAP_</param>
+/// <returns>1 if success. 0 if the reply is invalid. -1 if have fatal error that the socket should be closed</returns>
+int NegotiateVersion(SOCKET socket, FRAMEPARSER* parser, int version, uint capabilities);
+
+/// <summary>
+/// Create a Encrypt/Decrypt frame and Send it to the remoted machine [Block]
+/// Frame code = MC_ENCRYPT or MC_DECRYPT
 /// </summary>
 /// <param name="sender">The socket used for sending the request</param>
+/// <param name="version">The protocol version. See PROTOCOL_</param>
+/// <param name="stream_id">The stream of the frame. STREAM_DEFAULT without CAP_STREAMS</param>
 /// <param name="request_type">The request type from user. See RT_ for some requests type</param>
 /// <param name="key">The key (from user) used in encrypt/decrypt shift cipher</param>
+/// <param name="resumable">[CAP_RESUME] 1 if the request is resumable: the server replies the job ID (See ReceiveJobMessage()). 0 if not</param>
 /// <returns>1 if success. 0 if send fail or allocate memory fail. -1 if have fatal error that the socket should be closed</returns>
-int SendEncryptDecryptMessage(SOCKET sender, int request_type, int key);
+int SendEncryptDecryptMessage(SOCKET sender, int version, uint stream_id, int request_type, int key, int resumable);
+
+/// <summary>
+/// Create a Resume frame and Send it to the remoted machine [Block]
+/// Frame code = MC_RESUME. Need CAP_RESUME
+/// </summary>
+/// <param name="sender">The socket used for sending the request</param>
+/// <param name="version">The protocol version. See PROTOCOL_</param>
+/// <param name="job_id">The job ID of the interrupted request</param>
+/// <param name="downloaded">Number of result bytes received before the interruption</param>
+/// <returns>1 if success. 0 if send fail or allocate memory fail. -1 if have fatal error that the socket should be closed</returns>
+int SendResumeMessage(SOCKET sender, int version, ullong job_id, uint downloaded);
+
+/// <summary>
+/// Receive the reply of a resumable request (the job ID issued by the server) or a Resume frame (the checkpoint of the job) [Block]
+/// </summary>
+/// <param name="receiver">The connected socket to receive</param>
+/// <param name="parser">The frame parser of the socket</param>
+/// <param name="iojob_id">[Input/Output:NotNull] The job ID in the Resume frame. JOB_NONE for a new request: Set to the issued job ID</param>
+/// <param name="ocommitted">[Output:NotNull] The committed upload bytes. JOB_UPLOADED if the upload completed</param>
+/// <returns>1 if success. 0 if the remote machine does not know the job. -1 if have fatal error that the socket should be closed</returns>
+int ReceiveJobMessage(SOCKET receiver, FRAMEPARSER* parser, ullong* iojob_id, uint* ocommitted);
 
 /// <summary>
-/// Create a Data MESSAGE object and Send it to the remoted machine [Block]
-/// Message code = MC_DATA
+/// Create a Data frame (See CreateDataFrame()) and Send it to the remoted machine [Block]
+/// Frame code = MC_DATA
 /// </summary>
 /// <param name="sender">The socket used for sending the request</param>
+/// <param name="version">The protocol version. See PROTOCOL_</param>
+/// <param name="capabilities">The negotiated capabilities. The payload is compressed only with CAP_COMPRESS</param>
+/// <param name="stream_id">The stream of the frame. STREAM_DEFAULT without CAP_STREAMS</param>
 /// <param name="content">The data (payload) of the message. Use NULLSTR if want to create a Upload End message</param>
 /// <param name="content_len">The size of payload. Use 0 if want to create a Upload End message</param>
 /// <returns>1 if success. 0 if send fail or allocate memory fail. -1 if have fatal error that the socket should be closed</returns>
-int SendDataMessage(SOCKET sender, const stream content, uint content_len);
+int SendDataMessage(SOCKET sender, int version, uint capabilities, uint stream_id, const stream content, uint content_len);
 
 /// <summary>
-/// Receive a MESSAGE object and Extract information from it [Block[
+/// Receive bytes until the frame parser extracts a complete frame [Block]
 /// </summary>
 /// <param name="receiver">The connected socket to receive</param>
-/// <param name="ocode">[Output:NotNull] The message code</param>
-/// <param name="opayload">[Output:NotNull] The message payload</param>
-/// <param name="olength">[Output:NotNull] The message payload length</param>
-/// <returns>1 if success. 0 if the message is invalid. -1 if have fatal error that the socket should be closed</returns>
-int ReceiveMessage(SOCKET receiver, int* ocode, stream* opayload, uint* olength);
+/// <param name="parser">The frame parser of the socket</param>
+/// <param name="oframe">[Output:NotNull] The received frame. Its payload is valid until the next receive on the parser</param>
+/// <returns>1 if success. 0 if the frame is invalid. -1 if have fatal error that the socket should be closed</returns>
+int ReceiveFrame(SOCKET receiver, FRAMEPARSER* parser, FRAME* oframe);
 
 /// <summary>
-/// Receive a ACK Packet (A Segment with Header = 0 (0x 0000 0000)) from SOCKET
+/// Receive a ACK Packet (The credit limit) from SOCKET
 /// </summary>
 /// <param name="receiver">The connected socket used for receiving</param>
-/// <returns>1 if success. 0 if number of bytes receive less than expected [Never if recv_until_succ=1]. -1 if have some fatal errors that the socket should be closed</returns>
-int ReceiveACK(SOCKET receiver);
+/// <param name="parser">The frame parser of the socket</param>
+/// <param name="olimit">[Output:NotNull] The credit limit. FLOW_CREDIT_END if the receiver closes the credits</param>
+/// <returns>1 if success. 0 if receive other frames. -1 if have some fatal errors that the socket should be closed</returns>
+int ReceiveACK(SOCKET receiver, FRAMEPARSER* parser, uint* olimit);
 
 /// <summary>
-/// Create a ACK Packet (A Segment with Header = 0 (0x 0000 0000)) and Send them using SOCKET
+/// Create a ACK Packet (The credit limit) and Send them using SOCKET
 /// </summary>
 /// <param name="sender">The connected socket used for sending</param>
-/// <returns>1 if success. 0 if number of bytes sent less than expected [Never if send_until_succ=1]. -1 if have some fatal errors that the socket should be closed</returns>
-int SendACK(SOCKET sender);
+/// <param name="version">The protocol version. See PROTOCOL_</param>
+/// <param name="stream_id">The stream of the frame. STREAM_DEFAULT without CAP_STREAMS</param>
+/// <param name="limit">The credit limit. See FLOWWINDOW. Use FLOW_CREDIT_END to close the credits</param>
+/// <returns>1 if success. 0 if allocate memory fail. -1 if have some fatal errors that the socket should be closed</returns>
+int SendACK(SOCKET sender, int version, uint stream_id, uint limit);
+
+/// <summary>
+/// Receive the ACK Packet of a request (the first step message) if the credits are not negotiated: The upload starts after it.
+/// With CAP_CREDIT, requests are not ACKed, the sender starts with FLOW_WINDOW_CHUNKS credit: Do nothing.
+/// </summary>
+/// <param name="receiver">The connected socket used for receiving</param>
+/// <param name="parser">The frame parser of the socket</param>
+/// <returns>1 if success. 0 if receive other frames. -1 if have some fatal errors that the socket should be closed</returns>
+int WaitRequestACK(SOCKET receiver, FRAMEPARSER* parser);
+
+/// <summary>
+/// Receive ACK Packets from SOCKET and Update the credit limit until the sender can send one more MC_DATA message.
+/// </summary>
+/// <param name="receiver">The connected socket used for receiving</param>
+/// <param name="parser">The frame parser of the socket</param>
+/// <param name="window">The flow window of the sending transfer</param>
+/// <returns>1 if success. 0 if receive the ACK Packet closes the credits or other frames. -1 if have some fatal errors that the socket should be closed</returns>
+int WaitCredit(SOCKET receiver, FRAMEPARSER* parser, FLOWWINDOW* window);
+
+/// <summary>
+/// Receive (and Drop) ACK Packets from SOCKET until the ACK Packet closes the credits (FLOW_CREDIT_END).
+/// Without CAP_CREDIT, the credits are not closed: the ACK Packets of all messages must have been received (See WaitCredit()).
+/// The parser expects messages (PM_MESSAGE) after that.
+/// [Call after sending the Upload End message, before receiving the response]
+/// </summary>
+/// <param name="receiver">The connected socket used for receiving</param>
+/// <param name="parser">The frame parser of the socket</param>
+/// <returns>1 if success. -1 if have some fatal errors that the socket should be closed</returns>
+int WaitCreditEnd(SOCKET receiver, FRAMEPARSER* parser);
+
+/// <summary>
+/// [Overlapped] Append a created frame (or packet) to the send queue of the SOCKETEX
+/// </summary>
+/// <param name="sender">The socket extend used for sending</param>
+/// <param name="frame">The frame bytes. The send queue takes the ownership, do not free it after calling this function</param>
+/// <param name="frame_len">The size of the frame in bytes</param>
+/// <returns>99 if wait on completion routine. 0 if allocate memory fail. -1 if have fatal error that the socket should be closed</returns>
+int EnqueueFrame(SOCKETEX* sender, stream frame, uint frame_len);
 
 /// <summary>
-/// Create a Data MESSAGE object and Send it to the remoted machine [Overlapped]
-/// Message code = MC_DATA
+/// [Overlapped] Append a Hello Packet (the chosen version and capabilities) to the send queue of the SOCKETEX
+/// </summary>
+/// <param name="sender">The socket extend used for sending</param>
+/// <param name="version">The protocol version. See PROTOCOL_</param>
+/// <param name="capabilities">The chosen capabilities. See CAP_</param>
+/// <returns>99 if wait on completion routine. 0 if allocate memory fail. -1 if have fatal error that the socket should be closed</returns>
+int SendHello(SOCKETEX* sender, int version, uint capabilities);
+
+/// <summary>
+/// Create a Data frame (See CreateDataFrame()) and Append it to the send queue of the SOCKETEX [Overlapped]
+/// Frame code = MC_DATA
 /// </summary>
 /// <param name="sender">The socket extend used for sending the request</param>
+/// <param name="version">The protocol version. See PROTOCOL_</param>
+/// <param name="capabilities">The negotiated capabilities. The payload is compressed only with CAP_COMPRESS</param>
+/// <param name="stream_id">The stream of the frame. STREAM_DEFAULT without CAP_STREAMS</param>
 /// <param name="content">The data (payload) of the message. Use NULLSTR if want to create a Upload End message</param>
 /// <param name="content_len">The size of payload. Use 0 if want to create a Upload End message</param>
-/// <returns>1 if success [send right away]. 99 if will send in the future. 0 if send fail or allocate memory fail. -1 if have fatal error that the socket should be closed</returns>
-int SendDataMessage(SOCKETEX* sender, const stream content, uint content_len);
+/// <returns>99 if will send in the future. 0 if allocate memory fail. -1 if have fatal error that the socket should be closed</returns>
+int SendDataMessage(SOCKETEX* sender, int version, uint capabilities, uint stream_id, const stream content, uint content_len);
 
 /// <summary>
-/// [Overlapped] Create a ACK Packet (A Segment with Header = 0 (0x 0000 0000)) and Send them using SOCKETEX
+/// [Overlapped] Append a ACK Packet (The credit limit) to the send queue of the SOCKETEX
 /// </summary>
 /// <param name="sender">The socket extend used for sending the ACK Packet</param>
+/// <param name="version">The protocol version. See PROTOCOL_</param>
+/// <param name="stream_id">The stream of the frame. STREAM_DEFAULT without CAP_STREAMS</param>
+/// <param name="limit">The credit limit. See FLOWWINDOW. Use FLOW_CREDIT_END to close the credits</param>
+/// <returns>99 if wait on completion routine. 0 if allocate memory fail. -1 if have fatal error that the socket should be closed</returns>
+int SendACK(SOCKETEX* sender, int version, uint stream_id, uint limit);
+
+/// <summary>
+/// [Overlapped] Receive available bytes from SOCKETEX into the free space of a frame parser.
+/// Commit the received bytes with CommitParserBytes() after the operation completes.
+/// </summary>
+/// <param name="receiver">The socket extend used for receving</param>
+/// <param name="parser">The frame parser. Its buffer must be the "data" field of the SOCKETEX</param>
+/// <returns>1 if finish immediately. 99 if wait on completion routine. 0 if the parser buffer is full. -1 if have fatal error that the socket should be closed</returns>
+int ReceiveFrames(SOCKETEX* receiver, FRAMEPARSER* parser);
+
+#pragma region Flow Control
+
+/// <summary>
+/// Reset a FLOWWINDOW object before a new transfer. Both sides start with FLOW_WINDOW_CHUNKS credit, or FLOW_STOP_AND_WAIT without CAP_CREDIT
+/// </summary>
+/// <param name="window">A pointer to the FLOWWINDOW object</param>
+/// <param name="capabilities">The capabilities of the connection. See CAP_</param>
+void ResetFlowWindow(FLOWWINDOW* window, uint capabilities);
+
+/// <summary>
+/// [Sender side] Check whether the sender has credit to send one more MC_DATA message
+/// </summary>
+/// <param name="window">A pointer to the FLOWWINDOW object</param>
+/// <returns>1 if can send. 0 otherwise</returns>
+int HasCredit(const FLOWWINDOW* window);
+
+/// <summary>
+/// [Sender side] Update the credit limit from a received ACK Packet. Stale limits are ignored.
+/// Stop-and-wait: The ACK Packet allows one more message, whatever it carries.
+/// </summary>
+/// <param name="window">A pointer to the FLOWWINDOW object</param>
+/// <param name="limit">The credit limit in the ACK Packet</param>
+void UpdateCredit(FLOWWINDOW* window, uint limit);
+
+/// <summary>
+/// [Receiver side] Count a consumed MC_DATA message and Grant new credit if the remain credit of the sender is low.
+/// Stop-and-wait: Grant one more message for each consumed message.
+/// </summary>
+/// <param name="window">A pointer to the FLOWWINDOW object</param>
+/// <param name="olimit">[Output:NotNull] The new credit limit should be sent in a ACK Packet</param>
+/// <returns>1 if have new credit to send. 0 otherwise</returns>
+int ConsumeCredit(FLOWWINDOW* window, uint* olimit);
+
+#pragma endregion
+
+#pragma region Job
+
+/// <summary>
+/// Create an unguessable random ID (64 bits from the system RNG) for a job
+/// </summary>
+/// <returns>The ID. JOB_NONE if the RNG fails</returns>
+ullong CreateRandomID();
+
+/// <summary>
+/// Write a 64 bits ID in big endian (JOB_ID_SIZE bytes)
+/// </summary>
+/// <param name="id">The ID</param>
+/// <param name="opayload">[Output:NotNull] The buffer. Need JOB_ID_SIZE bytes</param>
+void WriteRandomID(ullong id, stream opayload);
+
+/// <summary>
+/// Read a 64 bits ID in big endian (JOB_ID_SIZE bytes)
+/// </summary>
+/// <param name="payload">The bytes. At least JOB_ID_SIZE bytes</param>
+/// <returns>The ID</returns>
+ullong ExtractRandomID(const stream payload);
+
+/// <summary>
+/// Write the payload of a MC_RESUME or MC_JOB frame
+/// </summary>
+/// <param name="job_id">The job ID</param>
+/// <param name="offset">The downloaded bytes (MC_RESUME) or the committed upload bytes (MC_JOB)</param>
+/// <param name="opayload">[Output:NotNull] The payload. Need JOB_PAYLOAD_SIZE bytes</param>
+void WriteJobPayload(ullong job_id, uint offset, stream opayload);
+
+/// <summary>
+/// Extract the payload of a MC_RESUME or MC_JOB frame
+/// </summary>
+/// <param name="frame">The frame</param>
+/// <param name="ojob_id">[Output:NotNull] The job ID</param>
+/// <param name="ooffset">[Output:NotNull] The downloaded bytes (MC_RESUME) or the committed upload bytes (MC_JOB)</param>
+/// <returns>1 if success. 0 if the payload is invalid</returns>
+int ExtractJobPayload(const FRAME* frame, ullong* ojob_id, uint* ooffset);
+
+/// <summary>
+/// Create a Job frame (The checkpoint of a job) and Append it to the send queue of the SOCKETEX [Overlapped]
+/// Frame code = MC_JOB. Need CAP_RESUME
+/// </summary>
+/// <param name="sender">The socket extend used for sending</param>
+/// <param name="version">The protocol version. See PROTOCOL_</param>
+/// <param name="stream_id">The stream of the frame. STREAM_DEFAULT without CAP_STREAMS</param>
+/// <param name="job_id">The job ID</param>
+/// <param name="committed">The committed upload bytes. JOB_UPLOADED if the upload completed</param>
 /// <returns>1 if finish immediately. 99 if wait on completion routine. -1 if have fatal error that the socket should be closed</returns>
-int SendACK(SOCKETEX* sender);
+int SendJobMessage(SOCKETEX* sender, int version, uint stream_id, ullong job_id, uint committed);
+
+/// <summary>
+/// Create a Error frame (empty payload) and Append it to the send queue of the SOCKETEX [Overlapped]
+/// Frame code = MC_ERROR
+/// </summary>
+/// <param name="sender">The socket extend used for sending</param>
+/// <param name="version">The protocol version. See PROTOCOL_</param>
+/// <param name="stream_id">The stream of the frame. STREAM_DEFAULT without CAP_STREAMS</param>
+/// <returns>1 if finish immediately. 99 if wait on completion routine. -1 if have fatal error that the socket should be closed</returns>
+int SendErrorMessage(SOCKETEX* sender, int version, uint stream_id);
+
+#pragma endregion
+
+#pragma region Probe
+
+/// <summary>
+/// Create a Probe frame (the hash and size of the content going to be uploaded) and Send it to the remoted machine [Block]
+/// Frame code = MC_PROBE. Need CAP_PROBE
+/// </summary>
+/// <param name="sender">The socket used for sending the request</param>
+/// <param name="version">The protocol version. See PROTOCOL_</param>
+/// <param name="stream_id">The stream of the job</param>
+/// <param name="digest">The digest of the content (See HashFile()). DIGEST_SIZE bytes</param>
+/// <param name="size">The size of the content</param>
+/// <returns>1 if success. 0 if send fail or allocate memory fail. -1 if have fatal error that the socket should be closed</returns>
+int SendProbeMessage(SOCKET sender, int version, uint stream_id, const stream digest, uint size);
+
+/// <summary>
+/// Receive the reply of a Probe frame [Block]
+/// </summary>
+/// <param name="receiver">The connected socket to receive</param>
+/// <param name="parser">The frame parser of the socket</param>
+/// <param name="oheld">[Output:NotNull] 1 if the remote machine holds the content. 0 if the content should be uploaded</param>
+/// <returns>1 if success. 0 if receive other frames. -1 if have fatal error that the socket should be closed</returns>
+int ReceiveHeldMessage(SOCKET receiver, FRAMEPARSER* parser, int* oheld);
+
+/// <summary>
+/// Extract the payload of a Probe frame (MC_PROBE)
+/// </summary>
+/// <param name="frame">The frame</param>
+/// <param name="odigest">[Output:NotNull] The digest of the content. Need DIGEST_SIZE bytes</param>
+/// <param name="osize">[Output:NotNull] The size of the content</param>
+/// <returns>1 if success. 0 if the payload is invalid</returns>
+int ExtractProbe(const FRAME* frame, stream odigest, uint* osize);
+
+/// <summary>
+/// Create a Held frame (the reply of a Probe frame) and Append it to the send queue of the SOCKETEX [Overlapped]
+/// Frame code = MC_HELD
+/// </summary>
+/// <param name="sender">The socket extend used for sending</param>
+/// <param name="version">The protocol version. See PROTOCOL_</param>
+/// <param name="stream_id">The stream of the job</param>
+/// <param name="held">1 if the content is held. 0 otherwise</param>
+/// <returns>99 if wait on completion routine. 0 if allocate memory fail. -1 if have fatal error that the socket should be closed</returns>
+int SendHeldMessage(SOCKETEX* sender, int version, uint stream_id, int held);
+
+#pragma endregion
+
+#pragma region Batch
+
+/// <summary>
+/// Create a Manifest frame (opens a batch) and Send it to the remoted machine [Block]
+/// Frame code = MC_BATCH with FF_MANIFEST. Need CAP_BATCH
+/// </summary>
+/// <param name="sender">The socket used for sending the request</param>
+/// <param name="version">The protocol version. See PROTOCOL_</param>
+/// <param name="stream_id">The stream of the batch</param>
+/// <param name="count">Number of entries in the batch. Not 0</param>
+/// <returns>1 if success. 0 if send fail or allocate memory fail. -1 if have fatal error that the socket should be closed</returns>
+int SendBatchManifest(SOCKET sender, int version, uint stream_id, uint count);
+
+/// <summary>
+/// Create a Entry frame (a small file of a batch) and Send it to the remoted machine [Block]
+/// Frame code = MC_BATCH. The payload may be compressed (See CreatePackedFrame())
+/// </summary>
+/// <param name="sender">The socket used for sending the request</param>
+/// <param name="version">The protocol version. See PROTOCOL_</param>
+/// <param name="capabilities">The negotiated capabilities. The payload is compressed only with CAP_COMPRESS</param>
+/// <param name="stream_id">The stream of the batch</param>
+/// <param name="index">The index of the entry in the batch</param>
+/// <param name="request_type">The request type of the entry. RT_ENCRYPT or RT_DECRYPT</param>
+/// <param name="key">The key used in encrypt/decrypt shift cipher</param>
+/// <param name="content">The content of the file</param>
+/// <param name="content_len">The size of the file. Not exceed BATCH_ENTRY_MAX_SIZE</param>
+/// <returns>1 if success. 0 if send fail or allocate memory fail. -1 if have fatal error that the socket should be closed</returns>
+int SendBatchEntry(SOCKET sender, int version, uint capabilities, uint stream_id, uint index, int request_type, uint key, const stream content, uint content_len);
+
+/// <summary>
+/// Extract the number of entries from a Manifest frame (MC_BATCH with FF_MANIFEST)
+/// </summary>
+/// <param name="frame">The frame</param>
+/// <param name="ocount">[Output:NotNull] Number of entries in the batch</param>
+/// <returns>1 if success. 0 if the payload is invalid</returns>
+int ExtractBatchManifest(const FRAME* frame, uint* ocount);
+
+/// <summary>
+/// Extract a Entry frame (MC_BATCH) after decompressing (See InflateFrame())
+/// </summary>
+/// <param name="frame">The frame</param>
+/// <param name="oindex">[Output:NotNull] The index of the entry</param>
+/// <param name="orequest_type">[Output:NotNull] The request type of the entry. RT_ENCRYPT or RT_DECRYPT</param>
+/// <param name="okey">[Output:NotNull] The key of the entry</param>
+/// <param name="ocontent">[Output:NotNull] Points to the content inside the frame payload. NULL if the content is empty</param>
+/// <param name="ocontent_len">[Output:NotNull] The size of the content</param>
+/// <returns>1 if success. 0 if the payload is invalid</returns>
+int ExtractBatchEntry(const FRAME* frame, uint* oindex, int* orequest_type, uint* okey, stream* ocontent, uint* ocontent_len);
+
+/// <summary>
+/// Create a Result frame (the result of a batch entry) and Append it to the send queue of the SOCKETEX [Overlapped]
+/// Frame code = MC_BATCH, with FF_FAILED if the entry can not be processed
+/// </summary>
+/// <param name="sender">The socket extend used for sending</param>
+/// <param name="version">The protocol version. See PROTOCOL_</param>
+/// <param name="capabilities">The negotiated capabilities. The payload is compressed only with CAP_COMPRESS</param>
+/// <param name="stream_id">The stream of the batch</param>
+/// <param name="index">The index of the entry</param>
+/// <param name="content">The result. Ignored if "failed"</param>
+/// <param name="content_len">The size of the result</param>
+/// <param name="failed">1 if the entry can not be processed. 0 otherwise</param>
+/// <returns>99 if wait on completion routine. 0 if allocate memory fail. -1 if have fatal error that the socket should be closed</returns>
+int SendBatchResult(SOCKETEX* sender, int version, uint capabilities, uint stream_id, uint index, const stream content, uint content_len, int failed);
+
+/// <summary>
+/// Extract a Result frame (MC_BATCH) after decompressing (See InflateFrame())
+/// </summary>
+/// <param name="frame">The frame</param>
+/// <param name="oindex">[Output:NotNull] The index of the entry</param>
+/// <param name="ocontent">[Output:NotNull] Points to the result inside the frame payload. NULL if the result is empty</param>
+/// <param name="ocontent_len">[Output:NotNull] The size of the result</param>
+/// <returns>1 if success. 0 if the payload is invalid</returns>
+int ExtractBatchResult(const FRAME* frame, uint* oindex, stream* ocontent, uint* ocontent_len);
+
+#pragma endregion
+
+#pragma region Kept Upload
 
 /// <summary>
-/// [Overlapped] Receive a ACK Packet (A Segment with Header = 0 (0x 0000 0000)) from SOCKETEX
+/// Create a Store frame (open an upload kept on the remote machine) and Send it to the remoted machine [Block]
+/// Frame code = MC_STORE. Need CAP_STORE
 /// </summary>
-/// <param name="receiver">The socket extend used for receving the ACK Packet</param>
+/// <param name="sender">The socket used for sending the request</param>
+/// <param name="version">The protocol version. See PROTOCOL_</param>
+/// <param name="stream_id">The stream of the upload</param>
+/// <returns>1 if success. 0 if send fail or allocate memory fail. -1 if have fatal error that the socket should be closed</returns>
+int SendStoreMessage(SOCKET sender, int version, uint stream_id);
+
+/// <summary>
+/// Create the reply of a Store frame (the handle of the kept upload) and Append it to the send queue of the SOCKETEX [Overlapped]
+/// Frame code = MC_STORE
+/// </summary>
+/// <param name="sender">The socket extend used for sending</param>
+/// <param name="version">The protocol version. See PROTOCOL_</param>
+/// <param name="stream_id">The stream of the upload</param>
+/// <param name="handle_id">The handle ID</param>
+/// <param name="ttl">The upload is dropped if not used in this time (seconds)</param>
 /// <returns>1 if finish immediately. 99 if wait on completion routine. -1 if have fatal error that the socket should be closed</returns>
-int ReceiveACK(SOCKETEX* receiver);
+int SendHandleMessage(SOCKETEX* sender, int version, uint stream_id, ullong handle_id, uint ttl);
+
+/// <summary>
+/// Receive the reply of a Store frame after the upload [Block]
+/// </summary>
+/// <param name="receiver">The connected socket to receive</param>
+/// <param name="parser">The frame parser of the socket</param>
+/// <param name="ohandle_id">[Output:NotNull] The handle ID</param>
+/// <param name="ottl">[Output:NotNull] The upload is dropped if not used in this time (seconds)</param>
+/// <returns>1 if success. 0 if receive other frames (MC_ERROR: the upload can not be kept). -1 if have fatal error that the socket should be closed</returns>
+int ReceiveHandleMessage(SOCKET receiver, FRAMEPARSER* parser, ullong* ohandle_id, uint* ottl);
+
+/// <summary>
+/// Create a Apply frame (process a byte range of a kept upload) and Send it to the remoted machine [Block]
+/// Frame code = MC_APPLY. Need CAP_STORE
+/// </summary>
+/// <param name="sender">The socket used for sending the request</param>
+/// <param name="version">The protocol version. See PROTOCOL_</param>
+/// <param name="stream_id">The stream of the job</param>
+/// <param name="handle_id">The handle of the kept upload</param>
+/// <param name="request_type">RT_ENCRYPT or RT_DECRYPT</param>
+/// <param name="key">The key for encrypt/decrypt</param>
+/// <param name="offset">The first byte to process</param>
+/// <param name="length">Number of bytes to process. 0 to the end of the upload</param>
+/// <returns>1 if success. 0 if send fail or allocate memory fail. -1 if have fatal error that the socket should be closed</returns>
+int SendApplyMessage(SOCKET sender, int version, uint stream_id, ullong handle_id, int request_type, uint key, uint offset, uint length);
+
+/// <summary>
+/// Extract the payload of a Apply frame (MC_APPLY)
+/// </summary>
+/// <param name="frame">The frame</param>
+/// <param name="ohandle_id">[Output:NotNull] The handle of the kept upload</param>
+/// <param name="orequest_type">[Output:NotNull] RT_ENCRYPT or RT_DECRYPT</param>
+/// <param name="okey">[Output:NotNull] The key for encrypt/decrypt</param>
+/// <param name="ooffset">[Output:NotNull] The first byte to process</param>
+/// <param name="olength">[Output:NotNull] Number of bytes to process. 0 to the end of the upload</param>
+/// <returns>1 if success. 0 if the payload is invalid</returns>
+int ExtractApply(const FRAME* frame, ullong* ohandle_id, int* orequest_type, uint* okey, uint* ooffset, uint* olength);
+
+#pragma endregion
+
+#pragma region Stripe
+
+/// <summary>
+/// Create a Stripe frame (join a byte range to a job split over several connections) and Send it to the remoted machine [Block]
+/// Frame code = MC_STRIPE. Need CAP_STRIPE
+/// </summary>
+/// <param name="sender">The socket used for sending the request</param>
+/// <param name="version">The protocol version. See PROTOCOL_</param>
+/// <param name="stream_id">The stream of the range on the connection</param>
+/// <param name="job_id">The job ID (See CreateRandomID()). The same for all ranges of the job</param>
+/// <param name="request_type">RT_ENCRYPT or RT_DECRYPT</param>
+/// <param name="key">The key for encrypt/decrypt</param>
+/// <param name="count">Number of ranges of the job</param>
+/// <param name="size">The size of the whole content</param>
+/// <param name="offset">The first byte of the range</param>
+/// <param name="length">The size of the range</param>
+/// <returns>1 if success. 0 if send fail or allocate memory fail. -1 if have fatal error that the socket should be closed</returns>
+int SendStripeMessage(SOCKET sender, int version, uint stream_id, ullong job_id, int request_type, uint key, uint count, uint size, uint offset, uint length);
+
+/// <summary>
+/// Extract the payload of a Stripe frame (MC_STRIPE)
+/// </summary>
+/// <param name="frame">The frame</param>
+/// <param name="ojob_id">[Output:NotNull] The job ID. Never JOB_NONE</param>
+/// <param name="orequest_type">[Output:NotNull] RT_ENCRYPT or RT_DECRYPT</param>
+/// <param name="okey">[Output:NotNull] The key for encrypt/decrypt</param>
+/// <param name="ocount">[Output:NotNull] Number of ranges of the job. Not exceed MAX_STRIPES</param>
+/// <param name="osize">[Output:NotNull] The size of the whole content</param>
+/// <param name="ooffset">[Output:NotNull] The first byte of the range</param>
+/// <param name="olength">[Output:NotNull] The size of the range. The range is inside the content</param>
+/// <returns>1 if success. 0 if the payload is invalid</returns>
+int ExtractStripe(const FRAME* frame, ullong* ojob_id, int* orequest_type, uint* okey, uint* ocount, uint* osize, uint* ooffset, uint* olength);
+
+#pragma endregion
 
 #pragma endregion
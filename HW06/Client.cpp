@@ -5,11 +5,17 @@ int main(int argc, char* argv[])
     int server_port;
     IP server_ip;
     int is_ok = 1;
+    // headless mode: no input is asked
+    int is_bench = argc > 3 && strcmp(argv[3], BENCH_COMMAND) == 0;
     // Handle command line
     if (ExtractCommand(argc, argv, &server_port, &server_ip) == 0) {
 #ifdef _ERROR_DEBUGGING
         printf("[%s] %s\n", WARNING_FLAGS, _CONVERT_ARGUMENTS_FAIL);
 #endif // _ERROR_DEBUGGING
+        if (is_bench) {
+            printf("[%s] " BENCH_USAGE, OUTPUT_FLAGS, BENCH_COMMAND, BENCH_MAX_CONCURRENCY);
+            return 1;
+        }
         printf("[%s] Do you want to use default address? (y/n): ", INPUT_FLAGS);
         char c;
         scanf_s("%c", &c, 1);
@@ -22,32 +28,62 @@ int main(int argc, char* argv[])
         scanf_s("%c", &c, 1); // consume '\n'
     }
 
-    if (is_ok && WSInitialize()) {
-        SOCKET socket = CreateSocket(TCP);
-        if (socket != INVALID_SOCKET) {
-            SetReceiveTimeout(socket, RECEIVE_TIMEOUT_INTERVAL);
-            SetSendBufferSize(socket, 3 * 4096); // config for all connectors get from this listener
-            SetReceiveBufferSize(socket, 3 * 4096);
+    if (is_ok && is_bench) {
+        int status = FATAL_ERROR;
+        if (WSInitialize()) {
+            status = BenchRequests(CreateSocketAddress(server_ip, server_port), argc - 4, argv + 4);
+            WSCleanup();
+        }
+        return status == SUCCESS ? 0 : 1;
+    }
 
+    if (is_ok && WSInitialize()) {
+        SOCKET socket = INVALID_SOCKET;
+        FRAMEPARSER parser;
+        stream parser_buffer = CreateStream(FRAME_PARSER_SIZE);
+        if (parser_buffer != NULL) {
             ADDRESS server = CreateSocketAddress(server_ip, server_port);
+            InitializeFrameParser(&parser, parser_buffer, FRAME_PARSER_SIZE);
 
             int try_establish = 0;
             do {
-                if (EstablishConnection(socket, server)) {
+                if (OpenConnection(&socket, server, &parser) == SUCCESS) {
                     try_establish = 0;
+                    int status = SUCCESS;
 #ifdef _ERROR_DEBUGGING
-                    printf("[%s] Ready to communicate...\n", INFO_FLAGS);
+                    printf("[%s] Ready to communicate (protocol v%d)...\n", INFO_FLAGS, parser.version);
 #endif // _ERROR_DEBUGGING
                     PrintMenu();
 
                     int request_type, key;
                     char* file;
-                    int status = SUCCESS;
+                    ullong job_id;
 
                     while (status != FATAL_ERROR) {
-                        if ((status = HandleInput(&request_type, &key, &file)) == SUCCESS) {
-                            if ((status = SendRequest(socket, request_type, key, file)) == SUCCESS) {
-                                    status = HandleResponse(socket, request_type, file);
+                        if ((status = HandleInput(&request_type, &key, &file)) == SUCCESS && request_type == RT_MULTIPLEX) {
+                            status = MultiplexRequests(socket, &parser);
+                        }
+                        else if (status == SUCCESS && request_type == RT_BATCH) {
+                            status = BatchRequests(socket, &parser, file);
+                        }
+                        else if (status == SUCCESS && request_type == RT_STORE) {
+                            status = StoreRequest(socket, &parser, file);
+                        }
+                        else if (status == SUCCESS && request_type == RT_APPLY) {
+                            status = ApplyRequest(socket, &parser);
+                        }
+                        else if (status == SUCCESS && request_type == RT_STRIPE) {
+                            status = StripeRequest(socket, &parser, server);
+                        }
+                        else if (status == SUCCESS) {
+                            // servers with CAP_RESUME keep the job if the connection is lost: they issue the job ID
+                            job_id = JOB_NONE;
+                            if ((status = SendRequest(socket, &parser, request_type, key, (parser.capabilities & CAP_RESUME) != 0, &job_id, file)) == SUCCESS) {
+                                    status = HandleResponse(socket, &parser, request_type, file, 0);
+                            }
+                            while (status == FATAL_ERROR && job_id != JOB_NONE && AskResume(file)) {
+                                if ((status = Reconnect(&socket, server, &parser)) == SUCCESS)
+                                    status = ResumeRequest(socket, &parser, request_type, job_id, file);
                             }
                         }
                         free(file);
@@ -55,6 +91,8 @@ int main(int argc, char* argv[])
                 }
                 // Handle establish fail
                 else {
+                    CloseSocket(socket, CLOSE_SAFELY, SD_BOTH);
+                    socket = INVALID_SOCKET;
                     // Let user wait and try again
                     printf("[%s] Try establish the connection again? (y/n): ", INPUT_FLAGS);
                     char c;
@@ -64,6 +102,7 @@ int main(int argc, char* argv[])
                 }
             } while (try_establish);
 
+            DestroyStream(parser_buffer);
         }
         CloseSocket(socket, CLOSE_SAFELY, SD_BOTH);
         WSCleanup();
@@ -76,100 +115,1227 @@ int main(int argc, char* argv[])
 
 #pragma region Handle Request & Response
 
-int SendRequest(SOCKET socket, int request_type, int key, const char* file)
+int SendRequest(SOCKET socket, FRAMEPARSER* parser, int request_type, int key, int resumable, ullong* ojob_id, const char* file)
 {
     int status = SUCCESS;
     if (request_type == RT_ENCRYPT || request_type == RT_DECRYPT) {
-        // The first step message: Request type (Encrypt/Decrypt) | Key
-        status = SendEncryptDecryptMessage(socket, request_type, key);
-        if (status == SUCCESS) {
-            status = ReceiveACK(socket);
+        FILE* fp = OpenFile(file, FOM_READ);
+        if (fp == NULL)
+            return FAIL;
+
+        // The first step message: Request type (Encrypt/Decrypt) | Key | [Resumable]. ACKed only without credits (CAP_CREDIT), the server grants initial credit for the upload
+        status = SendEncryptDecryptMessage(socket, parser->version, STREAM_DEFAULT, request_type, key, resumable);
+        if (status == SUCCESS && resumable) { // the server issues the job ID first
+            uint committed;
+            status = ReceiveJobMessage(socket, parser, ojob_id, &committed) == SUCCESS ? SUCCESS : FATAL_ERROR;
         }
-        if (status == SUCCESS) {
+        if (status == SUCCESS)
+            status = WaitRequestACK(socket, parser) == SUCCESS ? SUCCESS : FATAL_ERROR;
+        int held = 0;
+        if (status == SUCCESS)
+            status = ProbeUpload(socket, parser, fp, GetFileLength(file), &held);
+        if (status == SUCCESS && !held)
+            status = UploadFile(socket, parser, fp, UEOF);
+        CloseFile(fp);
+    }
+    return status;
+}
 
-            FILE* fp = OpenFile(file, FOM_READ);
-            
-            if (fp != NULL) {
-                stream read;
-                uint read_count;
-                int read_status;
-                while (1) {
-                    read_status = ReadFromFile(fp, MESSAGE_PAYLOAD_MAX_SIZE, &read, &read_count);
-                    if (read_status != FATAL_ERROR) { // SUCCESS or FAIL (EOF)
-                        // The second step messages: The content of the file
-                        status = SendDataMessage(socket, read, read_count);
-                        if (status == SUCCESS) {
-                            status = ReceiveACK(socket);
-                        }
-                    }
-                    DestroyStream(read);
+int ProbeUpload(SOCKET socket, FRAMEPARSER* parser, FILE* fp, uint size, int* oheld)
+{
+    *oheld = 0;
+    char digest[DIGEST_SIZE];
+    // the probe costs a round trip: only worth for the files larger than the initial credit
+    if (!(parser->capabilities & CAP_PROBE) || size == UEOF || size < PROBE_MIN_SIZE || HashFile(fp, digest) != SUCCESS)
+        return SUCCESS;
 
-                    if (status == SUCCESS && read_status == FAIL) {
-                        // The third step messages: The upload end message
-                        status = SendDataMessage(socket, NULLSTR, 0);
-                    }
-                    
-                    if (read_status != SUCCESS || status != SUCCESS)
-                        break;
-                }
+    int status = SendProbeMessage(socket, parser->version, STREAM_DEFAULT, digest, size);
+    if (status == SUCCESS)
+        status = ReceiveHeldMessage(socket, parser, oheld);
+    if (status != SUCCESS)
+        return FATAL_ERROR;
+#ifdef _ERROR_DEBUGGING
+    if (*oheld)
+        printf("[%s] The server holds the content, skip uploading %u bytes\n", INFO_FLAGS, size);
+#endif // _ERROR_DEBUGGING
+    return SUCCESS;
+}
 
-                CloseFile(fp);
+int UploadFile(SOCKET socket, FRAMEPARSER* parser, FILE* fp, uint length)
+{
+    parser->mode = PM_ACK; // the server sends only ACK packets during the upload
+    FLOWWINDOW window;
+    ResetFlowWindow(&window, parser->capabilities);
+
+    // the file is read ahead on another thread: disk and network overlap
+    CHUNKRING* ring = CreateChunkRing(fp, length);
+    HANDLE reader = ring != NULL ? (HANDLE)_beginthreadex(NULL, 0, ReadAhead, (void*)ring, 0, NULL) : 0;
+    if (reader == 0) {
+        if (ring != NULL)
+            DestroyChunkRing(ring);
+        return FATAL_ERROR;
+    }
+
+    stream chunk;
+    uint chunk_len;
+    int status = SUCCESS;
+    while (1) {
+        chunk = TakeChunk(ring, &chunk_len);
+        if (chunk == NULL) {
+            if (ring->failed) { // can not read the file: the job stays on the server for resuming
+                status = FATAL_ERROR;
+                break;
             }
-            else {
-                status = FAIL;
+            // stop-and-wait: the ACK of the last chunk comes before the upload end message
+            if (!(parser->capabilities & CAP_CREDIT) && WaitCredit(socket, parser, &window) != SUCCESS) {
+                status = FATAL_ERROR;
+                break;
             }
+            // The third step messages: The upload end message
+            status = SendDataMessage(socket, parser->version, parser->capabilities, STREAM_DEFAULT, NULLSTR, 0);
+            // Drop remain ACKs of the upload before receiving the response
+            if (status == SUCCESS)
+                status = WaitCreditEnd(socket, parser);
+            break;
         }
+
+        // wait for ACKs only when the window is exhausted
+        status = WaitCredit(socket, parser, &window);
+        if (status != SUCCESS) {
+            status = FATAL_ERROR;
+            break;
+        }
+        // The second step messages: The content of the file
+        status = SendDataMessage(socket, parser->version, parser->capabilities, STREAM_DEFAULT, chunk, chunk_len);
+        window.transfered++;
+        ReleaseChunk(ring);
+        if (status != SUCCESS)
+            break;
     }
+
+    StopChunkRing(ring, 0);
+    WaitForSingleObject(reader, INFINITE);
+    CloseHandle(reader);
+    DestroyChunkRing(ring);
     return status;
 }
 
-int HandleResponse(SOCKET socket, int request_type, const char* file)
+CHUNKRING* CreateChunkRing(FILE* fp, uint length)
+{
+    CHUNKRING* ring = (CHUNKRING*)malloc(sizeof(CHUNKRING));
+    if (ring == NULL)
+        return NULL;
+    ring->buffer = CreateStream(PIPELINE_SLOTS * MESSAGE_PAYLOAD_MAX_SIZE);
+    if (ring->buffer == NULL) {
+        free(ring);
+        return NULL;
+    }
+    ring->produced = 0;
+    ring->consumed = 0;
+    ring->finished = 0;
+    ring->stopped = 0;
+    ring->failed = 0;
+    ring->fp = fp;
+    ring->length = length;
+    InitializeCriticalSection(&ring->lock);
+    InitializeConditionVariable(&ring->changed);
+    return ring;
+}
+
+void DestroyChunkRing(CHUNKRING* ring)
+{
+    DeleteCriticalSection(&ring->lock);
+    DestroyStream(ring->buffer);
+    free(ring);
+}
+
+stream AcquireChunk(CHUNKRING* ring)
+{
+    EnterCriticalSection(&ring->lock);
+    while (!ring->stopped && ring->produced - ring->consumed == PIPELINE_SLOTS)
+        SleepConditionVariableCS(&ring->changed, &ring->lock, INFINITE);
+    stream slot = ring->stopped ? NULL : ring->buffer + (ring->produced % PIPELINE_SLOTS) * MESSAGE_PAYLOAD_MAX_SIZE;
+    LeaveCriticalSection(&ring->lock);
+    return slot;
+}
+
+void CommitChunk(CHUNKRING* ring, uint length)
+{
+    EnterCriticalSection(&ring->lock);
+    ring->lengths[ring->produced % PIPELINE_SLOTS] = length;
+    ring->produced++;
+    LeaveCriticalSection(&ring->lock);
+    WakeAllConditionVariable(&ring->changed);
+}
+
+void FinishChunks(CHUNKRING* ring)
+{
+    EnterCriticalSection(&ring->lock);
+    ring->finished = 1;
+    LeaveCriticalSection(&ring->lock);
+    WakeAllConditionVariable(&ring->changed);
+}
+
+stream TakeChunk(CHUNKRING* ring, uint* olength)
+{
+    EnterCriticalSection(&ring->lock);
+    while (!ring->stopped && !ring->finished && ring->produced == ring->consumed)
+        SleepConditionVariableCS(&ring->changed, &ring->lock, INFINITE);
+    stream chunk = NULL;
+    if (!ring->stopped && ring->produced != ring->consumed) {
+        chunk = ring->buffer + (ring->consumed % PIPELINE_SLOTS) * MESSAGE_PAYLOAD_MAX_SIZE;
+        *olength = ring->lengths[ring->consumed % PIPELINE_SLOTS];
+    }
+    LeaveCriticalSection(&ring->lock);
+    return chunk;
+}
+
+void ReleaseChunk(CHUNKRING* ring)
+{
+    EnterCriticalSection(&ring->lock);
+    ring->consumed++;
+    LeaveCriticalSection(&ring->lock);
+    WakeAllConditionVariable(&ring->changed);
+}
+
+void StopChunkRing(CHUNKRING* ring, int failed)
+{
+    EnterCriticalSection(&ring->lock);
+    ring->stopped = 1;
+    ring->failed |= failed;
+    LeaveCriticalSection(&ring->lock);
+    WakeAllConditionVariable(&ring->changed);
+}
+
+unsigned __stdcall ReadAhead(void* arguments)
+{
+    CHUNKRING* ring = (CHUNKRING*)arguments;
+    uint remain = ring->length;
+    stream slot;
+    while ((slot = AcquireChunk(ring)) != NULL) {
+        uint chunk = remain < MESSAGE_PAYLOAD_MAX_SIZE ? remain : MESSAGE_PAYLOAD_MAX_SIZE;
+        uint read_count = 0;
+        int read_status = chunk > 0 ? ReadIntoStream(ring->fp, chunk, slot, &read_count) : FAIL; // FAIL: the end of the range
+        if (read_status == FATAL_ERROR) {
+            StopChunkRing(ring, 1);
+            break;
+        }
+        if (remain != UEOF)
+            remain -= read_count;
+        if (read_count > 0)
+            CommitChunk(ring, read_count);
+        if (read_status == FAIL) { // eof
+            FinishChunks(ring);
+            break;
+        }
+    }
+    return 0;
+}
+
+unsigned __stdcall WriteBehind(void* arguments)
+{
+    CHUNKRING* ring = (CHUNKRING*)arguments;
+    stream chunk;
+    uint chunk_len;
+    while ((chunk = TakeChunk(ring, &chunk_len)) != NULL) {
+        if (ring->fp != NULL && WriteToFile(ring->fp, chunk_len, chunk) != SUCCESS) {
+            StopChunkRing(ring, 1);
+            break;
+        }
+        ReleaseChunk(ring);
+    }
+    return 0;
+}
+
+int ResumeRequest(SOCKET socket, FRAMEPARSER* parser, int request_type, ullong job_id, const char* file)
+{
+    if (!(parser->capabilities & CAP_RESUME))
+        return FAIL;
+
+    // the result file holds the downloaded bytes
+    char result_file[USER_INPUT_MAX_SIZE + FILE_EXTENSION_SIZE];
+    CreateResultPath(request_type, file, result_file);
+    uint downloaded = IsExist(result_file) ? GetFileLength(result_file) : 0;
+    if (downloaded == UEOF) { // the offset can not be sent in 32 bits
+        printf("[%s] Can not resume the request on file '%s': The result file is too large.\n", OUTPUT_FLAGS, file);
+        return FAIL;
+    }
+
+    uint committed;
+    int status = SendResumeMessage(socket, parser->version, job_id, downloaded);
+    if (status == SUCCESS)
+        status = ReceiveJobMessage(socket, parser, &job_id, &committed);
+    if (status == FAIL)
+        printf("[%s] The server has dropped the request on file '%s'. Please send it again.\n", OUTPUT_FLAGS, file);
+    if (status != SUCCESS)
+        return status;
+
+    if (committed == JOB_UPLOADED) // continue downloading the result
+        return HandleResponse(socket, parser, request_type, file, 1);
+
+    // continue uploading from the checkpoint of the server
+    FILE* fp = OpenFile(file, FOM_READ);
+    if (fp == NULL)
+        return FAIL;
+    status = MoveFilePointer(fp, SEEK_SET, committed) ? UploadFile(socket, parser, fp, UEOF) : FAIL;
+    CloseFile(fp);
+    if (status == SUCCESS)
+        status = HandleResponse(socket, parser, request_type, file, 0);
+    return status;
+}
+
+int ConnectServer(SOCKET* osocket, ADDRESS server)
+{
+    *osocket = CreateSocket(TCP);
+    if (*osocket == INVALID_SOCKET)
+        return FATAL_ERROR;
+    SetReceiveTimeout(*osocket, RECEIVE_TIMEOUT_INTERVAL);
+    SetSendBufferSize(*osocket, 3 * 4096);
+    SetReceiveBufferSize(*osocket, 3 * 4096);
+    return EstablishConnection(*osocket, server) ? SUCCESS : FATAL_ERROR;
+}
+
+int OpenConnection(SOCKET* osocket, ADDRESS server, FRAMEPARSER* parser)
+{
+    if (ConnectServer(osocket, server) != SUCCESS)
+        return FATAL_ERROR;
+    InitializeFrameParser(parser, parser->buffer, parser->capacity);
+
+    // an old server does not know the Hello Packet and never replies: wait shortly
+    SetReceiveTimeout(*osocket, HELLO_TIMEOUT_INTERVAL);
+    if (NegotiateVersion(*osocket, parser, PROTOCOL_VERSION, CAP_SUPPORTED) != SUCCESS) {
+        // the server already read the Hello Packet as a broken request -> talk v1 on a new connection
+#ifdef _ERROR_DEBUGGING
+        printf("[%s] The server does not reply the Hello Packet, fall back to protocol v1\n", WARNING_FLAGS);
+#endif // _ERROR_DEBUGGING
+        CloseSocket(*osocket, CLOSE_SAFELY, SD_BOTH);
+        if (ConnectServer(osocket, server) != SUCCESS)
+            return FATAL_ERROR;
+        InitializeFrameParser(parser, parser->buffer, parser->capacity);
+        parser->version = PROTOCOL_V1; // no Hello Packet: no capabilities
+    }
+    SetReceiveTimeout(*osocket, RECEIVE_TIMEOUT_INTERVAL);
+    return SUCCESS;
+}
+
+int Reconnect(SOCKET* osocket, ADDRESS server, FRAMEPARSER* parser)
+{
+    CloseSocket(*osocket, CLOSE_SAFELY, SD_BOTH);
+    return OpenConnection(osocket, server, parser);
+}
+
+void CreateResultPath(int request_type, const char* file, char* oresult_file)
+{
+    uint file_len = strlen(file);
+    memcpy_s(oresult_file, USER_INPUT_MAX_SIZE, file, file_len); // fails on a longer path instead of writing past the buffer
+    memcpy_s(oresult_file + file_len, FILE_EXTENSION_SIZE,
+        request_type == RT_ENCRYPT ? ENCRYPT_FILE_EXTENSION : DECRYPT_FILE_EXTENSION, FILE_EXTENSION_SIZE);
+}
+
+int HandleResponse(SOCKET socket, FRAMEPARSER* parser, int request_type, const char* file, int resume)
 {
     // Create result file
-	uint file_len = strlen(file);
     char result_file[USER_INPUT_MAX_SIZE + FILE_EXTENSION_SIZE];
-    memcpy_s(result_file, file_len, file, file_len);
-	memcpy_s(result_file + file_len, FILE_EXTENSION_SIZE,
-		request_type == RT_ENCRYPT ? ENCRYPT_FILE_EXTENSION : DECRYPT_FILE_EXTENSION, FILE_EXTENSION_SIZE);
-    if (IsExist(result_file)) {
+    CreateResultPath(request_type, file, result_file);
+    if (!resume && IsExist(result_file)) {
         printf("[%s] The file %s has already existed. Please restore the data on file before going further!\n", OUTPUT_FLAGS, result_file);
         char c;  scanf_s("%c", &c, 1);
         RemoveFile(result_file);
     }
     // receive
-    stream payload;
-    uint payload_len;
-    int code;
+    FRAME frame;
+    char inflate_buffer[MESSAGE_PAYLOAD_MAX_SIZE];
+
+    FLOWWINDOW window;
+    ResetFlowWindow(&window, parser->capabilities);
+    uint limit;
+
+    // the result is written on another thread while the next frames are received
+    FILE* fp = OpenFile(result_file, FOM_APPEND);
+    CHUNKRING* ring = CreateChunkRing(fp, UEOF);
+    HANDLE writer = ring != NULL ? (HANDLE)_beginthreadex(NULL, 0, WriteBehind, (void*)ring, 0, NULL) : 0;
+    if (writer == 0) {
+        if (ring != NULL)
+            DestroyChunkRing(ring);
+        if (fp != NULL)
+            CloseFile(fp);
+        return FATAL_ERROR;
+    }
 
-    int _continue = 1, status;
+    stream slot;
+    int _continue = 1, done = 0, status;
 	while (_continue) {
         _continue = 0;
-        status = ReceiveMessage(socket, &code, &payload, &payload_len);
+        status = ReceiveFrame(socket, parser, &frame);
+        if (status == SUCCESS && InflateFrame(&frame, inflate_buffer, MESSAGE_PAYLOAD_MAX_SIZE) != SUCCESS)
+            status = FATAL_ERROR; // the stream is broken
         if (status == SUCCESS) {
-            if (code == MC_DATA) {
-                if (payload_len > 0) {
+            if (frame.code == MC_DATA) {
+                if (frame.length > 0) {
                     _continue = 1;
-                    FILE* fp = OpenFile(result_file, FOM_APPEND);
-                    if (fp != NULL) {
-                        WriteToFile(fp, payload_len, payload);
-                        CloseFile(fp);
+                    slot = AcquireChunk(ring);
+                    if (slot != NULL) { // NULL: the writer failed, drop the rest
+                        memcpy_s(slot, MESSAGE_PAYLOAD_MAX_SIZE, frame.payload, frame.length);
+                        CommitChunk(ring, frame.length);
                     }
-                    status = SendACK(socket);
+                    // Grant new credit cumulatively, not one ACK for each message
+                    if (ConsumeCredit(&window, &limit) == SUCCESS)
+                        status = SendACK(socket, parser->version, STREAM_DEFAULT, limit);
                 }
-                else { // receive upload end message -> stop
-                    printf("[%s] Handle request success. Check result file: %s\n", OUTPUT_FLAGS, result_file);
+                else { // receive upload end message -> stop. Not ACKed without credits
+                    if (parser->capabilities & CAP_CREDIT)
+                        status = SendACK(socket, parser->version, STREAM_DEFAULT, FLOW_CREDIT_END);
+                    done = 1;
                 }
             }
-            else if (code == MC_ERROR) {
+            else if (frame.code == MC_ERROR) {
                 printf("[%s] Fail to process request %s on file '%s'.\n", OUTPUT_FLAGS,
                     (request_type == RT_ENCRYPT ? "ENCRYPT" : "DECRYPT"), file);
+                status = FAIL;
             }
         }
-        DestroyStream(payload);
 	}
+
+    // the result is complete only when the writer drains the ring
+    FinishChunks(ring);
+    WaitForSingleObject(writer, INFINITE);
+    CloseHandle(writer);
+    if (done) {
+        if (ring->failed) {
+            printf("[%s] Fail to write result file: %s\n", OUTPUT_FLAGS, result_file);
+            status = status == SUCCESS ? FAIL : status;
+        }
+        else
+            printf("[%s] Handle request success. Check result file: %s\n", OUTPUT_FLAGS, result_file);
+    }
+    DestroyChunkRing(ring);
+    if (fp != NULL)
+        CloseFile(fp);
+    return status;
+}
+
+int StoreRequest(SOCKET socket, FRAMEPARSER* parser, const char* file)
+{
+    if (!(parser->capabilities & CAP_STORE)) {
+        printf("[%s] The server can not keep files.\n", OUTPUT_FLAGS);
+        return FAIL;
+    }
+    FILE* fp = OpenFile(file, FOM_READ);
+    if (fp == NULL)
+        return FAIL;
+
+    // the upload is the same as a Encrypt/Decrypt request, the server replies the handle instead of the result
+    int status = SendStoreMessage(socket, parser->version, STREAM_DEFAULT);
+    if (status == SUCCESS)
+        status = WaitRequestACK(socket, parser) == SUCCESS ? SUCCESS : FATAL_ERROR;
+    if (status == SUCCESS)
+        status = UploadFile(socket, parser, fp, UEOF);
+    CloseFile(fp);
+
+    ullong handle_id;
+    uint ttl;
+    if (status == SUCCESS)
+        status = ReceiveHandleMessage(socket, parser, &handle_id, &ttl);
+    if (status == SUCCESS)
+        printf("[%s] The file '%s' is kept as handle %llu. It expires if not used in %u seconds.\n", OUTPUT_FLAGS, file, handle_id, ttl);
+    else if (status == FAIL)
+        printf("[%s] The server can not keep the file '%s'.\n", OUTPUT_FLAGS, file);
+    return status;
+}
+
+int ApplyRequest(SOCKET socket, FRAMEPARSER* parser)
+{
+    ullong handle_id;
+    uint offset, length;
+    int request_type, key;
+    char* file;
+    if (GetApply(&handle_id, &request_type, &key, &offset, &length, &file) != SUCCESS)
+        return FAIL;
+
+    int status = FAIL;
+    if (!(parser->capabilities & CAP_STORE))
+        printf("[%s] The server can not keep files.\n", OUTPUT_FLAGS);
+    else if ((status = SendApplyMessage(socket, parser->version, STREAM_DEFAULT, handle_id, request_type, key, offset, length)) == SUCCESS)
+        status = HandleResponse(socket, parser, request_type, file, 0); // MC_ERROR if the handle has expired
+    free(file);
+    return status;
+}
+
+int StripeRequest(SOCKET socket, FRAMEPARSER* parser, ADDRESS server)
+{
+    STRIPEDREQUEST request;
+    char* file;
+    if (GetStripe(&request.request_type, &request.key, &file) != SUCCESS)
+        return FAIL;
+
+    // small files use fewer connections: each range has at least STRIPE_MIN_SIZE bytes
+    request.size = GetFileLength(file);
+    uint count = request.size == UEOF ? 1 : request.size / STRIPE_MIN_SIZE;
+    if (count > STRIPE_CONNECTIONS)
+        count = STRIPE_CONNECTIONS;
+
+    int status;
+    if (!(parser->capabilities & CAP_STRIPE) || count <= 1) { // the whole file on the current connection
+        if ((status = SendRequest(socket, parser, request.request_type, request.key, 0, NULL, file)) == SUCCESS)
+            status = HandleResponse(socket, parser, request.request_type, file, 0);
+        free(file);
+        return status;
+    }
+
+    // the first range runs on the current connection. Fewer ranges if the server refuses more connections
+    FRAMEPARSER parsers[MAX_STRIPES];
+    request.stripes[0].socket = socket;
+    request.stripes[0].parser = parser;
+    request.count = 1;
+    while (request.count < count) {
+        STRIPE* stripe = request.stripes + request.count;
+        stripe->parser = parsers + request.count;
+        InitializeFrameParser(stripe->parser, CreateStream(FRAME_PARSER_SIZE), FRAME_PARSER_SIZE);
+        if (stripe->parser->buffer == NULL)
+            break;
+        if (OpenConnection(&stripe->socket, server, stripe->parser) != SUCCESS || !(stripe->parser->capabilities & CAP_STRIPE)) {
+            if (stripe->socket != INVALID_SOCKET)
+                CloseSocket(stripe->socket, CLOSE_SAFELY, SD_BOTH);
+            DestroyStream(stripe->parser->buffer);
+            break;
+        }
+        request.count++;
+    }
+
+    request.job_id = CreateRandomID();
+    request.file = file;
+    CreateResultPath(request.request_type, file, request.result_file);
+    status = request.job_id != JOB_NONE ? RunStripes(&request) : FAIL;
+
+    for (uint i = 1; i < request.count; ++i) {
+        CloseSocket(request.stripes[i].socket, CLOSE_SAFELY, SD_BOTH);
+        DestroyStream(request.stripes[i].parser->buffer);
+    }
+    free(file);
+    return status;
+}
+
+int RunStripes(STRIPEDREQUEST* request)
+{
+    // an empty result file: the ranges are written in place
+    FILE* fp = OpenFile(request->result_file, FOM_WRITE);
+    if (fp == NULL)
+        return FAIL;
+    CloseFile(fp);
+
+    uint range = request->size / request->count;
+    for (uint i = 0; i < request->count; ++i) {
+        STRIPE* stripe = request->stripes + i;
+        stripe->request = request;
+        stripe->offset = i * range;
+        stripe->length = i + 1 < request->count ? range : request->size - stripe->offset; // the last range takes the rest
+        stripe->status = FATAL_ERROR;
+    }
+    request->uploaded = 0;
+    InitializeCriticalSection(&request->lock);
+    InitializeConditionVariable(&request->changed);
+
+    HANDLE threads[MAX_STRIPES];
+    for (uint i = 1; i < request->count; ++i) {
+        threads[i] = (HANDLE)_beginthreadex(NULL, 0, RunStripe, (void*)(request->stripes + i), 0, NULL);
+        if (threads[i] == 0) { // the range is never sent: the other ranges time out
+            EnterCriticalSection(&request->lock);
+            request->uploaded++;
+            LeaveCriticalSection(&request->lock);
+        }
+    }
+    RunStripe(request->stripes);
+    for (uint i = 1; i < request->count; ++i) {
+        if (threads[i] != 0) {
+            WaitForSingleObject(threads[i], INFINITE);
+            CloseHandle(threads[i]);
+        }
+    }
+    DeleteCriticalSection(&request->lock);
+
+    int status = SUCCESS;
+    for (uint i = 0; i < request->count; ++i) {
+        if (request->stripes[i].status != SUCCESS)
+            status = FAIL;
+    }
+    if (status == SUCCESS)
+        printf("[%s] Handle request success over %u connections. Check result file: %s\n", OUTPUT_FLAGS, request->count, request->result_file);
+    else {
+        printf("[%s] Fail to process request %s on file '%s'.\n", OUTPUT_FLAGS,
+            (request->request_type == RT_ENCRYPT ? "ENCRYPT" : "DECRYPT"), request->file);
+        RemoveFile(request->result_file);
+    }
+    return request->stripes[0].status == FATAL_ERROR ? FATAL_ERROR : status;
+}
+
+unsigned __stdcall RunStripe(void* arguments)
+{
+    STRIPE* stripe = (STRIPE*)arguments;
+    STRIPEDREQUEST* request = stripe->request;
+    stripe->status = UploadStripe(stripe);
+
+    // the server responds when all ranges are uploaded: wait for the other uploads, so the receive timeout counts only the response
+    EnterCriticalSection(&request->lock);
+    request->uploaded++;
+    WakeAllConditionVariable(&request->changed);
+    while (request->uploaded < request->count)
+        SleepConditionVariableCS(&request->changed, &request->lock, INFINITE);
+    LeaveCriticalSection(&request->lock);
+
+    if (stripe->status == SUCCESS)
+        stripe->status = DownloadStripe(stripe);
+    return 0;
+}
+
+int UploadStripe(STRIPE* stripe)
+{
+    STRIPEDREQUEST* request = stripe->request;
+    int version = stripe->parser->version;
+    // The first step message: the range and the job it belongs to. ACKed only without credits (CAP_CREDIT), the server grants initial credit for the upload
+    if (SendStripeMessage(stripe->socket, version, STREAM_DEFAULT, request->job_id, request->request_type, request->key,
+        request->count, request->size, stripe->offset, stripe->length) != SUCCESS ||
+        WaitRequestACK(stripe->socket, stripe->parser) != SUCCESS)
+        return FATAL_ERROR;
+
+    int status;
+    FILE* fp = OpenFile(request->file, FOM_READ);
+    if (fp != NULL && MoveFilePointer(fp, SEEK_SET, stripe->offset))
+        status = UploadFile(stripe->socket, stripe->parser, fp, stripe->length);
+    else // end the upload early: the range is incomplete, the server fails the request
+        status = SendDataMessage(stripe->socket, version, stripe->parser->capabilities, STREAM_DEFAULT, NULLSTR, 0);
+    CloseFile(fp);
+    return status == SUCCESS ? SUCCESS : FATAL_ERROR;
+}
+
+int DownloadStripe(STRIPE* stripe)
+{
+    FILE* fp = OpenFile(stripe->request->result_file, FOM_UPDATE);
+    if (fp != NULL && !MoveFilePointer(fp, SEEK_SET, stripe->offset)) {
+        CloseFile(fp);
+        fp = NULL;
+    }
+
+    FRAME frame;
+    char inflate_buffer[MESSAGE_PAYLOAD_MAX_SIZE];
+    FLOWWINDOW window;
+    ResetFlowWindow(&window, stripe->parser->capabilities);
+    uint limit;
+    int written = (fp != NULL);
+    int status;
+    while (1) {
+        status = ReceiveFrame(stripe->socket, stripe->parser, &frame);
+        if (status == SUCCESS && InflateFrame(&frame, inflate_buffer, MESSAGE_PAYLOAD_MAX_SIZE) != SUCCESS)
+            status = FATAL_ERROR; // the stream is broken
+        if (status != SUCCESS) {
+            status = FATAL_ERROR;
+            break;
+        }
+        if (frame.code == MC_ERROR) {
+            status = FAIL;
+            break;
+        }
+        if (frame.code != MC_DATA) // the remaining ACK packets of an upload ended early
+            continue;
+
+        if (frame.length == 0) { // the result of the range ends
+            status = (stripe->parser->capabilities & CAP_CREDIT) ? SendACK(stripe->socket, stripe->parser->version, STREAM_DEFAULT, FLOW_CREDIT_END) : SUCCESS;
+            if (status == SUCCESS && !written)
+                status = FAIL;
+            break;
+        }
+        if (written && WriteToFile(fp, frame.length, frame.payload) != SUCCESS)
+            written = 0; // keep receiving, the range fails
+        // Grant new credit cumulatively, not one ACK for each message
+        if (ConsumeCredit(&window, &limit) == SUCCESS && SendACK(stripe->socket, stripe->parser->version, STREAM_DEFAULT, limit) != SUCCESS) {
+            status = FATAL_ERROR;
+            break;
+        }
+    }
+    CloseFile(fp);
     return status;
 }
 
+int MultiplexRequests(SOCKET socket, FRAMEPARSER* parser)
+{
+    MULTIPLEX mux;
+    mux.count = GetRequests(mux.jobs);
+    if (mux.count == 0)
+        return FAIL;
+
+    int status = SUCCESS;
+    if (parser->capabilities & CAP_STREAMS) {
+        mux.socket = socket;
+        mux.parser = parser;
+        status = RunMultiplex(&mux);
+    }
+    else {
+        // the server runs one request at a time on a connection
+        for (int i = 0; i < mux.count && status != FATAL_ERROR; ++i) {
+            if ((status = SendRequest(socket, parser, mux.jobs[i].request_type, mux.jobs[i].key, 0, NULL, mux.jobs[i].file)) == SUCCESS)
+                status = HandleResponse(socket, parser, mux.jobs[i].request_type, mux.jobs[i].file, 0);
+        }
+    }
+
+    for (int i = 0; i < mux.count; ++i)
+        free(mux.jobs[i].file);
+    return status == FATAL_ERROR ? FATAL_ERROR : SUCCESS;
+}
+
+int RunMultiplex(MULTIPLEX* mux)
+{
+    int status = SUCCESS;
+    mux->running = 0;
+    mux->receive_status = SUCCESS;
+    for (int i = 0; i < mux->count; ++i) {
+        STREAMJOB* job = &mux->jobs[i];
+        job->id = i;
+        job->pending_ack = 0;
+        ResetFlowWindow(&job->upload_window, mux->parser->capabilities);
+        ResetFlowWindow(&job->download_window, mux->parser->capabilities);
+        CreateResultPath(job->request_type, job->file, job->result_file);
+        if (IsExist(job->result_file)) {
+            printf("[%s] The file %s has already existed. Please restore the data on file before going further!\n", OUTPUT_FLAGS, job->result_file);
+            char c;  scanf_s("%c", &c, 1);
+            RemoveFile(job->result_file);
+        }
+
+        job->fp = OpenFile(job->file, FOM_READ);
+        job->state = job->fp != NULL ? JS_UPLOADING : JS_FAILED;
+        if (job->state == JS_FAILED)
+            continue;
+        // The first step message of each stream. The server grants initial credit for the upload
+        status = SendEncryptDecryptMessage(mux->socket, mux->parser->version, job->id, job->request_type, job->key, 0);
+        if (status != SUCCESS)
+            break;
+        mux->running++;
+    }
+
+    HANDLE receiver = 0;
+    if (status == SUCCESS && mux->running > 0) {
+        InitializeCriticalSection(&mux->lock);
+        InitializeConditionVariable(&mux->changed);
+        receiver = (HANDLE)_beginthreadex(NULL, 0, ReceiveResponses, (void*)mux, 0, NULL);
+        if (receiver == 0)
+            status = FATAL_ERROR;
+    }
+
+    stream read;
+    uint read_count, ack_limit;
+    int read_status, next = 0;
+    if (receiver != 0) {
+        EnterCriticalSection(&mux->lock);
+        while (status == SUCCESS) {
+            // Streams take turns: one ACK packet or one Data Request of each stream in a round
+            STREAMJOB* job = NULL;
+            for (int k = 0; k < mux->count && job == NULL; ++k) {
+                STREAMJOB* candidate = &mux->jobs[(next + k) % mux->count];
+                if (candidate->pending_ack != 0 ||
+                    (candidate->state == JS_UPLOADING && candidate->fp != NULL && HasCredit(&candidate->upload_window)))
+                    job = candidate;
+            }
+            if (job == NULL) {
+                if (mux->running == 0 || mux->receive_status != SUCCESS)
+                    break;
+                SleepConditionVariableCS(&mux->changed, &mux->lock, INFINITE);
+                continue;
+            }
+            next = (job->id + 1) % mux->count;
+            ack_limit = job->pending_ack;
+            job->pending_ack = 0;
+            if (ack_limit == 0)
+                job->upload_window.transfered++;
+            LeaveCriticalSection(&mux->lock);
+
+            if (ack_limit != 0) {
+                status = SendACK(mux->socket, mux->parser->version, job->id, ack_limit);
+            }
+            else {
+                read_status = ReadFromFile(job->fp, MESSAGE_PAYLOAD_MAX_SIZE, &read, &read_count);
+                if (read_status != FATAL_ERROR && read_count > 0)
+                    status = SendDataMessage(mux->socket, mux->parser->version, mux->parser->capabilities, job->id, read, read_count);
+                DestroyStream(read);
+                if (status == SUCCESS && read_status != SUCCESS) {
+                    // EOF (or can not read the rest): The upload end message
+                    status = SendDataMessage(mux->socket, mux->parser->version, mux->parser->capabilities, job->id, NULLSTR, 0);
+                    CloseFile(job->fp);
+                    job->fp = NULL;
+                }
+            }
+            if (status != SUCCESS)
+                status = FATAL_ERROR;
+
+            EnterCriticalSection(&mux->lock);
+        }
+        if (mux->receive_status != SUCCESS)
+            status = FATAL_ERROR;
+        LeaveCriticalSection(&mux->lock);
+
+        // the receiver thread returns when all requests end or the connection is broken (at most the receive timeout)
+        WaitForSingleObject(receiver, INFINITE);
+        CloseHandle(receiver);
+        DeleteCriticalSection(&mux->lock);
+    }
+
+    for (int i = 0; i < mux->count; ++i) {
+        if (mux->jobs[i].fp != NULL)
+            CloseFile(mux->jobs[i].fp);
+    }
+    return status == SUCCESS ? SUCCESS : FATAL_ERROR;
+}
+
+unsigned __stdcall ReceiveResponses(void* arguments)
+{
+    MULTIPLEX* mux = (MULTIPLEX*)arguments;
+    FRAME frame;
+    char inflate_buffer[MESSAGE_PAYLOAD_MAX_SIZE];
+    int status = SUCCESS;
+    uint limit;
+
+    EnterCriticalSection(&mux->lock);
+    while (mux->running > 0 && status == SUCCESS) {
+        LeaveCriticalSection(&mux->lock);
+        status = ReceiveFrame(mux->socket, mux->parser, &frame);
+        if (status == SUCCESS && InflateFrame(&frame, inflate_buffer, MESSAGE_PAYLOAD_MAX_SIZE) != SUCCESS)
+            status = FATAL_ERROR; // the stream is broken
+        EnterCriticalSection(&mux->lock);
+        if (status != SUCCESS)
+            break;
+        if (frame.stream_id >= (uint)mux->count)
+            continue; // not our stream
+        STREAMJOB* job = &mux->jobs[frame.stream_id];
+        if (job->state == JS_DONE || job->state == JS_FAILED)
+            continue;
+
+        if (frame.code == MC_ACK) {
+            limit = ExtractACK(&frame);
+            if (limit == FLOW_CREDIT_END)
+                job->state = JS_DOWNLOADING;
+            else
+                UpdateCredit(&job->upload_window, limit);
+        }
+        else if (frame.code == MC_DATA && frame.length > 0) {
+            // the result file is written by this thread only
+            FILE* fp = OpenFile(job->result_file, FOM_APPEND);
+            if (fp != NULL) {
+                WriteToFile(fp, frame.length, frame.payload);
+                CloseFile(fp);
+            }
+            if (ConsumeCredit(&job->download_window, &limit) == SUCCESS)
+                job->pending_ack = limit;
+        }
+        else if (frame.code == MC_DATA) { // receive upload end message -> the request completes
+            job->pending_ack = FLOW_CREDIT_END;
+            job->state = JS_DONE;
+            mux->running--;
+            printf("[%s] Handle request success. Check result file: %s\n", OUTPUT_FLAGS, job->result_file);
+        }
+        else if (frame.code == MC_ERROR) {
+            job->state = JS_FAILED;
+            mux->running--;
+            printf("[%s] Fail to process request %s on file '%s'.\n", OUTPUT_FLAGS,
+                (job->request_type == RT_ENCRYPT ? "ENCRYPT" : "DECRYPT"), job->file);
+        }
+        WakeConditionVariable(&mux->changed);
+    }
+    if (status != SUCCESS)
+        mux->receive_status = FATAL_ERROR;
+    WakeConditionVariable(&mux->changed);
+    LeaveCriticalSection(&mux->lock);
+    return 0;
+}
+
+int BatchRequests(SOCKET socket, FRAMEPARSER* parser, const char* manifest)
+{
+    BATCH batch;
+    batch.count = ReadManifest(manifest, &batch.entries);
+    if (batch.count == 0) {
+        printf("[%s] No valid request in the manifest '%s'.\n", OUTPUT_FLAGS, manifest);
+        free(batch.entries);
+        return FAIL;
+    }
+
+    // small files go in a batch, one frame each
+    int in_batch = (parser->capabilities & CAP_BATCH) != 0;
+    batch.total = 0;
+    for (uint i = 0; i < batch.count; ++i) {
+        if (batch.entries[i].length == UEOF)
+            printf("[%s] Can not open file '%s' to read.\n", OUTPUT_FLAGS, batch.entries[i].file);
+        else if (in_batch && batch.entries[i].length <= BATCH_ENTRY_MAX_SIZE)
+            batch.total++;
+    }
+
+    int status = SUCCESS;
+    if (batch.total > 0) {
+        batch.socket = socket;
+        batch.parser = parser;
+        status = RunBatch(&batch);
+    }
+
+    // the larger files (all files without CAP_BATCH) run one after another
+    for (uint i = 0; i < batch.count && status != FATAL_ERROR; ++i) {
+        BATCHENTRY* entry = batch.entries + i;
+        if (entry->length == UEOF || (in_batch && entry->length <= BATCH_ENTRY_MAX_SIZE))
+            continue;
+        if ((status = SendRequest(socket, parser, entry->request_type, entry->key, 0, NULL, entry->file)) == SUCCESS)
+            status = HandleResponse(socket, parser, entry->request_type, entry->file, 0);
+    }
+
+    for (uint i = 0; i < batch.count; ++i)
+        free(batch.entries[i].file);
+    free(batch.entries);
+    return status == FATAL_ERROR ? FATAL_ERROR : SUCCESS;
+}
+
+uint ReadManifest(const char* manifest, BATCHENTRY** oentries)
+{
+    *oentries = NULL;
+    FILE* fp = OpenFile(manifest, FOM_READ);
+    if (fp == NULL)
+        return 0;
+
+    uint count = 0, capacity = 0;
+    char line[MANIFEST_LINE_MAX_SIZE];
+    int is_rest = 0; // the line is the rest of an over-long line: fgets() splits it
+    while (fgets(line, MANIFEST_LINE_MAX_SIZE, fp) != NULL) {
+        uint line_len = strlen(line);
+        int is_cut = line_len == MANIFEST_LINE_MAX_SIZE - 1 && line[line_len - 1] != '\n';
+        int is_skipped = is_rest || is_cut;
+        is_rest = is_cut;
+        if (is_skipped)
+            continue;
+
+        char op;
+        int key, offset = 0;
+        if (sscanf_s(line, " %c %d %n", &op, 1, &key, &offset) < 2 || offset == 0 || key < 0)
+            continue;
+        if (op != 'E' && op != 'e' && op != 'D' && op != 'd')
+            continue;
+        char* path = line + offset;
+        uint path_len = strcspn(path, "\r\n");
+        if (path_len == 0 || path_len >= USER_INPUT_MAX_SIZE) // the result path adds an extension: See CreateResultPath()
+            continue;
+        path[path_len] = 0;
+
+        if (count == capacity) {
+            capacity = capacity == 0 ? 64 : 2 * capacity;
+            BATCHENTRY* grown = (BATCHENTRY*)realloc(*oentries, capacity * sizeof(BATCHENTRY));
+            if (grown == NULL)
+                break;
+            *oentries = grown;
+        }
+        BATCHENTRY* entry = *oentries + count;
+        if ((entry->file = Clone(path, path_len + 1)) == NULL)
+            break;
+        entry->request_type = (op == 'E' || op == 'e') ? RT_ENCRYPT : RT_DECRYPT;
+        entry->key = key;
+        entry->length = GetFileLength(entry->file);
+        count++;
+    }
+    CloseFile(fp);
+    return count;
+}
+
+int RunBatch(BATCH* batch)
+{
+    // The manifest opens the batch. The server grants initial credit for the entries
+    if (SendBatchManifest(batch->socket, batch->parser->version, STREAM_DEFAULT, batch->total) != SUCCESS)
+        return FATAL_ERROR;
+
+    batch->received = 0;
+    batch->failed = 0;
+    batch->pending_ack = 0;
+    batch->receive_status = SUCCESS;
+    ResetFlowWindow(&batch->upload_window, batch->parser->capabilities);
+    ResetFlowWindow(&batch->download_window, batch->parser->capabilities);
+    InitializeCriticalSection(&batch->lock);
+    InitializeConditionVariable(&batch->changed);
+    HANDLE receiver = (HANDLE)_beginthreadex(NULL, 0, ReceiveBatchResults, (void*)batch, 0, NULL);
+    if (receiver == 0) {
+        DeleteCriticalSection(&batch->lock);
+        return FATAL_ERROR;
+    }
+
+    int status = SUCCESS;
+    uint next = 0, ack_limit, read_count;
+    stream read;
+    EnterCriticalSection(&batch->lock);
+    while (status == SUCCESS) {
+        while (next < batch->count && (batch->entries[next].length == UEOF || batch->entries[next].length > BATCH_ENTRY_MAX_SIZE))
+            next++; // not in the batch
+        if (batch->pending_ack == 0 && (next == batch->count || !HasCredit(&batch->upload_window))) {
+            if (batch->receive_status != SUCCESS || batch->received == batch->total)
+                break;
+            SleepConditionVariableCS(&batch->changed, &batch->lock, INFINITE);
+            continue;
+        }
+        ack_limit = batch->pending_ack;
+        batch->pending_ack = 0;
+        if (ack_limit == 0)
+            batch->upload_window.transfered++;
+        LeaveCriticalSection(&batch->lock);
+
+        if (ack_limit != 0) {
+            status = SendACK(batch->socket, batch->parser->version, STREAM_DEFAULT, ack_limit);
+        }
+        else {
+            BATCHENTRY* entry = batch->entries + next;
+            read = NULL;
+            read_count = 0;
+            FILE* fp = OpenFile(entry->file, FOM_READ);
+            if (fp != NULL) {
+                ReadFromFile(fp, BATCH_ENTRY_MAX_SIZE, &read, &read_count);
+                CloseFile(fp);
+            }
+            else { // removed after reading the manifest: the entry is still sent, its result is not written
+                printf("[%s] Can not open file '%s' to read.\n", OUTPUT_FLAGS, entry->file);
+                EnterCriticalSection(&batch->lock);
+                entry->length = UEOF;
+                LeaveCriticalSection(&batch->lock);
+            }
+            status = SendBatchEntry(batch->socket, batch->parser->version, batch->parser->capabilities, STREAM_DEFAULT, next, entry->request_type, entry->key, read, read_count);
+            DestroyStream(read);
+            next++;
+        }
+        if (status != SUCCESS)
+            status = FATAL_ERROR;
+
+        EnterCriticalSection(&batch->lock);
+    }
+    if (status == SUCCESS)
+        status = batch->receive_status;
+    LeaveCriticalSection(&batch->lock);
+
+    // the receiver thread returns when all results are received or the connection is broken (at most the receive timeout)
+    WaitForSingleObject(receiver, INFINITE);
+    CloseHandle(receiver);
+    DeleteCriticalSection(&batch->lock);
+
+    if (status == FAIL)
+        printf("[%s] The server failed the batch. Please send it again.\n", OUTPUT_FLAGS);
+    else if (status == SUCCESS)
+        printf("[%s] Handle batch success: %u of %u files processed. Check the result files next to them.\n", OUTPUT_FLAGS,
+            batch->total - batch->failed, batch->total);
+    return status;
+}
+
+unsigned __stdcall ReceiveBatchResults(void* arguments)
+{
+    BATCH* batch = (BATCH*)arguments;
+    FRAME frame;
+    char inflate_buffer[MESSAGE_PAYLOAD_MAX_SIZE];
+    char result_file[USER_INPUT_MAX_SIZE + FILE_EXTENSION_SIZE];
+    stream content;
+    uint index, content_len, limit;
+    int status = SUCCESS, done = 0;
+
+    while (!done) {
+        status = ReceiveFrame(batch->socket, batch->parser, &frame);
+        if (status == SUCCESS && InflateFrame(&frame, inflate_buffer, MESSAGE_PAYLOAD_MAX_SIZE) != SUCCESS)
+            status = FATAL_ERROR; // the stream is broken
+        if (status == SUCCESS && frame.code == MC_BATCH &&
+            (ExtractBatchResult(&frame, &index, &content, &content_len) != SUCCESS || index >= batch->count))
+            status = FATAL_ERROR;
+        if (status != SUCCESS)
+            status = FATAL_ERROR;
+        else if (frame.code == MC_ERROR)
+            status = FAIL; // the server fails the batch
+
+        int write = 0;
+        EnterCriticalSection(&batch->lock);
+        if (status == SUCCESS && frame.code == MC_ACK) {
+            UpdateCredit(&batch->upload_window, ExtractACK(&frame));
+        }
+        else if (status == SUCCESS && frame.code == MC_BATCH) {
+            batch->received++;
+            if (frame.flags & FF_FAILED) {
+                batch->failed++;
+                printf("[%s] Fail to process request %s on file '%s'.\n", OUTPUT_FLAGS,
+                    (batch->entries[index].request_type == RT_ENCRYPT ? "ENCRYPT" : "DECRYPT"), batch->entries[index].file);
+            }
+            else
+                write = batch->entries[index].length != UEOF;
+            // Grant new credit cumulatively. Close the credits after the last result
+            if (batch->received == batch->total)
+                batch->pending_ack = FLOW_CREDIT_END;
+            else if (ConsumeCredit(&batch->download_window, &limit) == SUCCESS)
+                batch->pending_ack = limit;
+        }
+        if (status != SUCCESS)
+            batch->receive_status = status;
+        done = status != SUCCESS || batch->received == batch->total;
+        WakeConditionVariable(&batch->changed);
+        LeaveCriticalSection(&batch->lock);
+
+        if (write) { // the result files are written by this thread only
+            CreateResultPath(batch->entries[index].request_type, batch->entries[index].file, result_file);
+            FILE* fp = OpenFile(result_file, FOM_WRITE);
+            if (fp != NULL) {
+                if (content_len > 0)
+                    WriteToFile(fp, content_len, content);
+                CloseFile(fp);
+            }
+        }
+    }
+    return 0;
+}
+
+int BenchRequests(ADDRESS server, int argc, char* argv[])
+{
+    BENCH bench;
+    bench.concurrency = argc > 0 ? atoi(argv[0]) : 0;
+    if (bench.concurrency == 0 || bench.concurrency > BENCH_MAX_CONCURRENCY) {
+        printf("[%s] " BENCH_USAGE, OUTPUT_FLAGS, BENCH_COMMAND, BENCH_MAX_CONCURRENCY);
+        return FAIL;
+    }
+    bench.count = ExtractBench(argc - 1, argv + 1, &bench.entries);
+    if (bench.count == 0) {
+        printf("[%s] No valid job.\n", OUTPUT_FLAGS);
+        free(bench.entries);
+        return FAIL;
+    }
+    if (bench.concurrency > bench.count)
+        bench.concurrency = bench.count;
+
+    bench.server = server;
+    bench.next = 0;
+    bench.latencies = (double*)malloc(bench.count * sizeof(double));
+    bench.statuses = (int*)malloc(bench.count * sizeof(int));
+    HANDLE workers[BENCH_MAX_CONCURRENCY];
+    uint started = 0;
+    int status = SUCCESS;
+    LARGE_INTEGER start, end;
+    if (bench.latencies == NULL || bench.statuses == NULL)
+        status = FATAL_ERROR;
+    else {
+        QueryPerformanceFrequency(&bench.frequency);
+        QueryPerformanceCounter(&start);
+        for (; started < bench.concurrency; ++started) {
+            workers[started] = (HANDLE)_beginthreadex(NULL, 0, RunBenchJobs, (void*)&bench, 0, NULL);
+            if (workers[started] == 0)
+                break;
+        }
+        if (started == 0)
+            status = FATAL_ERROR;
+        // WaitForMultipleObjects is limited to MAXIMUM_WAIT_OBJECTS handles
+        for (uint i = 0; i < started; ++i) {
+            WaitForSingleObject(workers[i], INFINITE);
+            CloseHandle(workers[i]);
+        }
+        QueryPerformanceCounter(&end);
+    }
+
+    if (status == SUCCESS) {
+        PrintBenchReport(&bench, ElapsedMilliseconds(bench.frequency, start, end));
+        for (uint i = 0; i < bench.count; ++i)
+            if (bench.statuses[i] != SUCCESS)
+                status = FAIL;
+    }
+
+    for (uint i = 0; i < bench.count; ++i)
+        free(bench.entries[i].file);
+    free(bench.entries);
+    free(bench.latencies);
+    free(bench.statuses);
+    return status;
+}
+
+unsigned __stdcall RunBenchJobs(void* arguments)
+{
+    BENCH* bench = (BENCH*)arguments;
+    SOCKET socket = INVALID_SOCKET;
+    FRAMEPARSER parser;
+    parser.buffer = CreateStream(FRAME_PARSER_SIZE);
+    parser.capacity = FRAME_PARSER_SIZE;
+    int connected = 0;
+
+    LONG index;
+    LARGE_INTEGER start, end;
+    char result_file[USER_INPUT_MAX_SIZE + FILE_EXTENSION_SIZE];
+    while ((index = InterlockedIncrement(&bench->next) - 1) < (LONG)bench->count) {
+        BATCHENTRY* entry = bench->entries + index;
+        bench->latencies[index] = 0;
+        if (entry->length == UEOF) {
+            bench->statuses[index] = FAIL;
+            continue;
+        }
+        if (!connected) {
+            if (socket != INVALID_SOCKET)
+                CloseSocket(socket, CLOSE_SAFELY, SD_BOTH);
+            connected = parser.buffer != NULL && OpenConnection(&socket, bench->server, &parser) == SUCCESS;
+            if (!connected) {
+                bench->statuses[index] = FATAL_ERROR;
+                continue;
+            }
+        }
+        // the result file is replaced without asking
+        CreateResultPath(entry->request_type, entry->file, result_file);
+        RemoveFile(result_file);
+
+        QueryPerformanceCounter(&start);
+        int status = SendRequest(socket, &parser, entry->request_type, entry->key, 0, NULL, entry->file);
+        if (status == SUCCESS)
+            status = HandleResponse(socket, &parser, entry->request_type, entry->file, 0);
+        QueryPerformanceCounter(&end);
+
+        bench->latencies[index] = ElapsedMilliseconds(bench->frequency, start, end);
+        bench->statuses[index] = status;
+        connected = status != FATAL_ERROR;
+    }
+
+    if (socket != INVALID_SOCKET)
+        CloseSocket(socket, CLOSE_SAFELY, SD_BOTH);
+    DestroyStream(parser.buffer);
+    return 0;
+}
+
+void PrintBenchReport(BENCH* bench, double elapsed)
+{
+    double* sorted = (double*)malloc(bench->count * sizeof(double));
+    uint done = 0;
+    ullong total = 0;
+    printf("[%s] %-4s %-6s %12s %12s %10s  %s\n", OUTPUT_FLAGS, "Op", "Key", "Bytes", "Time (ms)", "MB/s", "File");
+    for (uint i = 0; i < bench->count; ++i) {
+        BATCHENTRY* entry = bench->entries + i;
+        const char* op = entry->request_type == RT_ENCRYPT ? "E" : "D";
+        if (bench->statuses[i] != SUCCESS) {
+            printf("[%s] %-4s %-6d %12s %12s %10s  %s\n", OUTPUT_FLAGS, op, entry->key, "-", "-", "FAILED", entry->file);
+            continue;
+        }
+        double seconds = bench->latencies[i] / 1000;
+        printf("[%s] %-4s %-6d %12u %12.2f %10.2f  %s\n", OUTPUT_FLAGS, op, entry->key, entry->length, bench->latencies[i],
+            seconds > 0 ? entry->length / seconds / (1024 * 1024) : 0, entry->file);
+        total += entry->length;
+        if (sorted != NULL)
+            sorted[done] = bench->latencies[i];
+        done++;
+    }
+
+    printf("[%s] Jobs: %u success, %u failed on %u connections in %.2f ms\n", OUTPUT_FLAGS, done, bench->count - done, bench->concurrency, elapsed);
+    if (done > 0 && sorted != NULL) {
+        qsort(sorted, done, sizeof(double), CompareLatency);
+        printf("[%s] Throughput: %.2f MB/s. Latency: p50 %.2f ms, p99 %.2f ms\n", OUTPUT_FLAGS,
+            elapsed > 0 ? total / (elapsed / 1000) / (1024 * 1024) : 0, Percentile(sorted, done, 50), Percentile(sorted, done, 99));
+    }
+    free(sorted);
+}
+
+double ElapsedMilliseconds(LARGE_INTEGER frequency, LARGE_INTEGER start, LARGE_INTEGER end)
+{
+    return (double)(end.QuadPart - start.QuadPart) * 1000 / frequency.QuadPart;
+}
+
+double Percentile(const double* sorted, uint count, uint percentile)
+{
+    uint rank = (count * percentile + 99) / 100; // ceil
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+int CompareLatency(const void* a, const void* b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
 #pragma endregion
 
 #pragma region Handle I/O
@@ -179,6 +1345,11 @@ void PrintMenu()
     printf("\t############### COMMANDS ###############\n");
     printf("\t#    1. Encrypt File (Shift Cipher)    #\n");
     printf("\t#    2. Decrypt File (Shift Cipher)    #\n");
+    printf("\t#    3. Several Files At Once          #\n");
+    printf("\t#    4. Files Listed In A Manifest     #\n");
+    printf("\t#    5. Keep A File On The Server      #\n");
+    printf("\t#    6. Process A Kept File            #\n");
+    printf("\t#    7. Split Over Several Connections #\n");
     printf("\t#    Other. Exit program               #\n");
     printf("\t########################################\n");
 }
@@ -223,6 +1394,120 @@ int GetRequest(const char* option_str, int* okey, char** ofile)
     return SUCCESS;
 }
 
+int GetFile(const char* option_str, char** ofile)
+{
+    if (ofile == NULL)
+        return INVALID_ARGUMENTS;
+    *ofile = NULL;
+    char c;
+    char file[USER_INPUT_MAX_SIZE];
+
+    printf("[%s] [%s] Enter the file path: ", INPUT_FLAGS, option_str);
+    scanf_s("%c", &c, 1); //consume \n
+    gets_s(file, USER_INPUT_MAX_SIZE);
+    if (strlen(file) == 0 || !IsExist(file)) {
+        printf("[%s] Can not open file '%s' to read.\n", OUTPUT_FLAGS, file);
+        return FAIL;
+    }
+    *ofile = Clone(file, strlen(file) + 1);
+    return SUCCESS;
+}
+
+int GetApply(ullong* ohandle_id, int* orequest_type, int* okey, uint* ooffset, uint* olength, char** ofile)
+{
+    if (ohandle_id == NULL || orequest_type == NULL || okey == NULL || ooffset == NULL || olength == NULL || ofile == NULL)
+        return INVALID_ARGUMENTS;
+    *ofile = NULL;
+    char c, operation;
+    char file[USER_INPUT_MAX_SIZE];
+
+    printf("[%s] [Kept File] Enter the handle: ", INPUT_FLAGS);
+    scanf_s("%llu", ohandle_id);
+    printf("[%s] [Kept File] Enter 1 (Encrypt) or 2 (Decrypt): ", INPUT_FLAGS);
+    scanf_s(" %c", &operation, 1);
+    printf("[%s] [Kept File] Enter the key: ", INPUT_FLAGS);
+    scanf_s("%d", okey);
+    printf("[%s] [Kept File] Enter the first byte and the number of bytes (0: to the end): ", INPUT_FLAGS);
+    scanf_s("%u %u", ooffset, olength);
+    scanf_s("%c", &c, 1); //consume \n
+    printf("[%s] [Kept File] Enter the result path (without extension): ", INPUT_FLAGS);
+    gets_s(file, USER_INPUT_MAX_SIZE);
+
+    if (operation != '1' && operation != '2') {
+        printf("[%s] Unknown request type.\n", OUTPUT_FLAGS);
+        return FAIL;
+    }
+    if (*okey < 0) {
+        printf("[%s] The key can not be less than 0.\n", OUTPUT_FLAGS);
+        return FAIL;
+    }
+    if (strlen(file) == 0) {
+        printf("[%s] The file path can not be null.\n", OUTPUT_FLAGS);
+        return FAIL;
+    }
+    *orequest_type = operation == '1' ? RT_ENCRYPT : RT_DECRYPT;
+    *ofile = Clone(file, strlen(file) + 1);
+    return SUCCESS;
+}
+
+int GetStripe(int* orequest_type, int* okey, char** ofile)
+{
+    if (orequest_type == NULL || okey == NULL || ofile == NULL)
+        return INVALID_ARGUMENTS;
+    *ofile = NULL;
+    char operation;
+
+    printf("[%s] [Striped] Enter 1 (Encrypt) or 2 (Decrypt): ", INPUT_FLAGS);
+    scanf_s(" %c", &operation, 1);
+    if (operation != '1' && operation != '2') {
+        char c;
+        scanf_s("%c", &c, 1); //consume \n
+        printf("[%s] Unknown request type.\n", OUTPUT_FLAGS);
+        return FAIL;
+    }
+    *orequest_type = operation == '1' ? RT_ENCRYPT : RT_DECRYPT;
+    return GetRequest(operation == '1' ? "Encrypt" : "Decrypt", okey, ofile);
+}
+
+int GetManifest(char** ofile)
+{
+    if (ofile == NULL)
+        return INVALID_ARGUMENTS;
+    *ofile = NULL;
+    char c;
+    char file[USER_INPUT_MAX_SIZE];
+
+    printf("[%s] [Manifest] Each line: E|D Key Path. Enter the manifest path: ", INPUT_FLAGS);
+    scanf_s("%c", &c, 1); //consume \n
+    gets_s(file, USER_INPUT_MAX_SIZE);
+    if (strlen(file) == 0 || !IsExist(file)) {
+        printf("[%s] Can not open file '%s' to read.\n", OUTPUT_FLAGS, file);
+        return FAIL;
+    }
+    *ofile = Clone(file, strlen(file) + 1);
+    return SUCCESS;
+}
+
+int GetRequests(STREAMJOB* ojobs)
+{
+    char c;
+    int count = 0;
+    scanf_s("%c", &c, 1); //consume \n
+    while (count < MAX_STREAMS) {
+        printf("[%s] [Request %d] Enter 1 (Encrypt), 2 (Decrypt) or Other (Done): ", INPUT_FLAGS, count + 1);
+        scanf_s("%c", &c, 1);
+        if (c != '1' && c != '2') {
+            if (c != '\n')
+                scanf_s("%c", &c, 1); //consume \n
+            break;
+        }
+        ojobs[count].request_type = (c == '1' ? RT_ENCRYPT : RT_DECRYPT);
+        if (GetRequest(c == '1' ? "Encrypt" : "Decrypt", &ojobs[count].key, &ojobs[count].file) == SUCCESS)
+            count++;
+    }
+    return count;
+}
+
 int HandleInput(int* orequest_type, int* okey, char** ofile)
 {
     if (orequest_type == NULL || okey == NULL || ofile == NULL)
@@ -241,12 +1526,39 @@ int HandleInput(int* orequest_type, int* okey, char** ofile)
         *orequest_type = RT_DECRYPT;
         status = GetRequest("Decrypt", okey, ofile);
     }
+    else if (c == '3') {
+        *orequest_type = RT_MULTIPLEX;
+    }
+    else if (c == '4') {
+        *orequest_type = RT_BATCH;
+        status = GetManifest(ofile);
+    }
+    else if (c == '5') {
+        *orequest_type = RT_STORE;
+        status = GetFile("Keep", ofile);
+    }
+    else if (c == '6') {
+        *orequest_type = RT_APPLY;
+    }
+    else if (c == '7') {
+        *orequest_type = RT_STRIPE;
+    }
     else {
         status = FATAL_ERROR;
     }
     return status;
 }
 
+int AskResume(const char* file)
+{
+    printf("[%s] The connection is lost. Resume the request on file '%s'? (y/n): ", INPUT_FLAGS, file);
+    char c;
+    scanf_s("%c", &c, 1);
+    int resume = (c == 'y' || c == 'Y');
+    scanf_s("%c", &c, 1); // consume '\n'
+    return resume;
+}
+
 int ExtractCommand(int argc, char* argv[], int* oport, IP* oip)
 {
     int is_ok = 1;
@@ -263,5 +1575,60 @@ int ExtractCommand(int argc, char* argv[], int* oport, IP* oip)
     return is_ok;
 }
 
+uint ExtractBench(int argc, char* argv[], BATCHENTRY** oentries)
+{
+    *oentries = NULL;
+    uint count = 0, capacity = 0;
+    for (int i = 0; i < argc; ++i) {
+        char op = argv[i][0];
+        int is_job = argv[i][1] == 0 && (op == 'E' || op == 'e' || op == 'D' || op == 'd') && i + 2 < argc;
+        uint added = 0;
+        BATCHENTRY* listed = NULL;
+        if (!is_job) { // a list file
+            added = ReadManifest(argv[i], &listed);
+            if (added == 0) {
+                printf("[%s] No valid job in the list file '%s'.\n", OUTPUT_FLAGS, argv[i]);
+                free(listed);
+                continue;
+            }
+        }
+        else
+            added = 1;
+
+        if (count + added > capacity) {
+            capacity = count + added > 2 * capacity ? count + added : 2 * capacity;
+            BATCHENTRY* grown = (BATCHENTRY*)realloc(*oentries, capacity * sizeof(BATCHENTRY));
+            if (grown == NULL) {
+                for (uint j = 0; j < added && listed != NULL; ++j)
+                    free(listed[j].file);
+                free(listed);
+                break;
+            }
+            *oentries = grown;
+        }
+        if (!is_job) {
+            memcpy_s(*oentries + count, added * sizeof(BATCHENTRY), listed, added * sizeof(BATCHENTRY));
+            free(listed);
+            count += added;
+            continue;
+        }
+
+        BATCHENTRY* entry = *oentries + count;
+        entry->key = atoi(argv[i + 1]);
+        uint path_len = strlen(argv[i + 2]);
+        // the result path adds an extension to the path: See CreateResultPath()
+        if (entry->key < 0 || path_len >= USER_INPUT_MAX_SIZE || (entry->file = Clone(argv[i + 2], path_len + 1)) == NULL) {
+            printf("[%s] Invalid job: %s %s %s\n", OUTPUT_FLAGS, argv[i], argv[i + 1], argv[i + 2]);
+            i += 2;
+            continue;
+        }
+        entry->request_type = (op == 'E' || op == 'e') ? RT_ENCRYPT : RT_DECRYPT;
+        entry->length = GetFileLength(entry->file);
+        count++;
+        i += 2;
+    }
+    return count;
+}
+
 #pragma endregion
 
@@ -2,6 +2,7 @@
 
 #pragma region Header Declarations
 
+#include <process.h>
 #include "ApplicationLibrary.h"
 
 #pragma endregion
@@ -11,29 +12,571 @@
 #define INPUT_FLAGS ">>"
 #define OUTPUT_FLAGS "**"
 
+#define RT_MULTIPLEX 4 // [Client only] Several Encrypt/Decrypt requests on the connection at once
+#define RT_APPLY 6 // [Client only] Encrypt/Decrypt a file kept on the server (See RT_STORE)
+#define RT_STRIPE 7 // [Client only] Encrypt/Decrypt a file split into byte ranges over several connections at once
+
+#define STRIPE_CONNECTIONS 4 // Connections of a striped request, including the current one. Not exceed MAX_STRIPES
+#define STRIPE_MIN_SIZE (FLOW_WINDOW_CHUNKS * MESSAGE_PAYLOAD_MAX_SIZE) // Each range has at least this size: small files use fewer connections
+
+#define MANIFEST_LINE_MAX_SIZE (USER_INPUT_MAX_SIZE + 32) // A manifest line: E|D Key Path
+
+#define BENCH_COMMAND "-bench" // Command-line switch of the headless mode: Client <ip> <port> -bench <concurrency> <job>...
+#define BENCH_MAX_CONCURRENCY 64 // Maximum connections of the headless mode
+#define BENCH_USAGE "Usage: Client <ip> <port> %s <concurrency: 1..%d> <E|D key path | list file>...\n" // Format arguments: BENCH_COMMAND, BENCH_MAX_CONCURRENCY
+
+#define PIPELINE_SLOTS 4 // Chunks buffered between the disk thread and the network thread of a transfer
+
+#define JS_UPLOADING	0 // The file is being uploaded
+#define JS_DOWNLOADING	1 // The upload completes. The result is being downloaded
+#define JS_DONE			2 // The result has been downloaded
+#define JS_FAILED		3 // The server failed to process the request
+
+#pragma endregion
+
+#pragma region Types Definitions
+
+/// <summary>
+/// A ring of chunks between a producer and a consumer on two threads, so disk IO and network IO of a transfer overlap.
+/// Upload: a reader thread reads the file ahead (See ReadAhead()). Download: a writer thread writes the received chunks (See WriteBehind()).
+/// </summary>
+typedef struct _chunk_ring {
+
+	stream buffer; // The memory of all slots: PIPELINE_SLOTS * MESSAGE_PAYLOAD_MAX_SIZE bytes
+
+	uint lengths[PIPELINE_SLOTS]; // The size of the chunk in each slot
+
+	uint produced; // Number of chunks committed. The next slot to fill is "produced" % PIPELINE_SLOTS
+
+	uint consumed; // Number of chunks released. The next chunk to take is "consumed" % PIPELINE_SLOTS
+
+	int finished; // 1 if the producer commits no more chunk
+
+	int stopped; // 1 if a side stops early (on errors, or the transfer ends): the other side stops too
+
+	int failed; // 1 if the disk thread fails to read or write the file
+
+	FILE* fp; // The file the disk thread reads or writes. May be NULL for a writer: the chunks are dropped
+
+	uint length; // [Reader] Number of bytes to read. UEOF to the end of the file
+
+	CRITICAL_SECTION lock; // Protect all fields except "buffer" and "fp"
+
+	CONDITION_VARIABLE changed; // Signaled when a chunk is committed or released, or the ring stops
+
+} CHUNKRING;
+
+/// <summary>
+/// A request runs on a stream of the connection (See RT_MULTIPLEX)
+/// </summary>
+typedef struct _stream_job {
+
+	uint id; // The stream ID of the request
+
+	int request_type; // RT_ENCRYPT || RT_DECRYPT
+
+	int key; // The key for encrypt/decrypt request
+
+	char* file; // The file path want to encrypt/decrypt
+
+	FILE* fp; // The file being uploaded. NULL after the Upload End Request is sent
+
+	char result_file[USER_INPUT_MAX_SIZE + FILE_EXTENSION_SIZE]; // The path of the result file
+
+	FLOWWINDOW upload_window; // Credit granted by the server for uploading
+
+	FLOWWINDOW download_window; // Credit granted to the server for downloading the result
+
+	uint pending_ack; // The credit limit waits for sending to the server. 0 if nothing
+
+	int state; // See JS_ for some job states
+
+} STREAMJOB;
+
+/// <summary>
+/// The requests run on the connection at once. The main thread sends all frames, a receiver thread receives all frames,
+/// so the uploads of some requests and the downloads of the others never block each other.
+/// </summary>
+typedef struct _multiplex {
+
+	SOCKET socket; // The socket to the server
+
+	FRAMEPARSER* parser; // The frame parser of the socket. Used by the receiver thread only
+
+	STREAMJOB jobs[MAX_STREAMS]; // The requests. The stream ID of a request is its index
+
+	int count; // Number of requests
+
+	int running; // Number of requests not DONE or FAILED
+
+	int receive_status; // 1 while the receiver thread runs normally. -1 if the connection is broken
+
+	CRITICAL_SECTION lock; // Protect the jobs, running and receive_status fields
+
+	CONDITION_VARIABLE changed; // Signaled by the receiver thread when the main thread has something to send
+
+} MULTIPLEX;
+
+/// <summary>
+/// A file listed in a manifest (See RT_BATCH)
+/// </summary>
+typedef struct _batch_entry {
+
+	int request_type; // RT_ENCRYPT || RT_DECRYPT
+
+	int key; // The key for encrypt/decrypt request
+
+	char* file; // The file path want to encrypt/decrypt
+
+	uint length; // The size of the file. UEOF if the file can not be opened
+
+} BATCHENTRY;
+
+/// <summary>
+/// The small files of a manifest sent in a batch on the connection. As in MULTIPLEX, the main thread sends all frames
+/// and a receiver thread receives the results.
+/// </summary>
+typedef struct _batch {
+
+	SOCKET socket; // The socket to the server
+
+	FRAMEPARSER* parser; // The frame parser of the socket. Used by the receiver thread only
+
+	BATCHENTRY* entries; // The entries of the manifest. The index of an entry in a frame is its index in this array
+
+	uint count; // Number of entries in the manifest
+
+	uint total; // Number of entries in the batch: The entries with "length" not exceed BATCH_ENTRY_MAX_SIZE
+
+	uint received; // Number of results received
+
+	uint failed; // Number of entries the server failed to process
+
+	FLOWWINDOW upload_window; // Credit granted by the server for sending entries
+
+	FLOWWINDOW download_window; // Credit granted to the server for sending results
+
+	uint pending_ack; // The credit limit waits for sending to the server. 0 if nothing
+
+	int receive_status; // 1 while the receiver thread runs normally. 0 if the server fails the batch. -1 if the connection is broken
+
+	CRITICAL_SECTION lock; // Protect all fields except "socket", "parser" and "entries"
+
+	CONDITION_VARIABLE changed; // Signaled by the receiver thread when the main thread has something to send
+
+} BATCH;
+
+/// <summary>
+/// A byte range of a striped request, uploaded and downloaded on a connection of its own (See RT_STRIPE)
+/// </summary>
+typedef struct _stripe {
+
+	struct _striped_request* request; // The request the range belongs to
+
+	SOCKET socket; // The connection of the range
+
+	FRAMEPARSER* parser; // The frame parser of the connection
+
+	uint offset; // The first byte of the range
+
+	uint length; // The size of the range
+
+	int status; // 1 if the result of the range is written. 0 if the server fails the request. -1 if the connection is broken
+
+} STRIPE;
+
+/// <summary>
+/// A request split into byte ranges, each runs on a thread and a connection of its own. The server joins the ranges
+/// into one job by the job ID, and responds each range on its connection.
+/// </summary>
+typedef struct _striped_request {
+
+	ullong job_id; // The job ID, chosen at random. The same for all ranges
+
+	int request_type; // RT_ENCRYPT || RT_DECRYPT
+
+	int key; // The key for encrypt/decrypt request
+
+	const char* file; // The file path want to encrypt/decrypt
+
+	char result_file[USER_INPUT_MAX_SIZE + FILE_EXTENSION_SIZE]; // The path of the result file. The ranges are written in place
+
+	uint size; // The size of the file
+
+	STRIPE stripes[MAX_STRIPES]; // The ranges. The first one runs on the current connection
+
+	uint count; // Number of ranges
+
+	uint uploaded; // Number of ranges whose upload ended. The downloads start when all uploads end
+
+	CRITICAL_SECTION lock; // Protect the "uploaded" field
+
+	CONDITION_VARIABLE changed; // Signaled when the upload of a range ends
+
+} STRIPEDREQUEST;
+
+/// <summary>
+/// The jobs of the headless mode. Each worker thread opens its own connection and takes the next job until no job remains.
+/// </summary>
+typedef struct _bench {
+
+	ADDRESS server; // The address of the server
+
+	BATCHENTRY* entries; // The jobs, from the command line and the list files
+
+	uint count; // Number of jobs
+
+	uint concurrency; // Number of worker threads (connections)
+
+	volatile LONG next; // The index of the next job to take
+
+	double* latencies; // The time of each job in milliseconds: From sending the request to receiving the whole result
+
+	int* statuses; // The result of each job: The return value of the request. FAIL if the file can not be opened
+
+	LARGE_INTEGER frequency; // The frequency of the performance counter
+
+} BENCH;
+
 #pragma endregion
 
 #pragma region Function Declarations
 
 #pragma region Handle Request & Response
 /// <summary>
-/// Send requests: Encrypt/Decrypt Request + Data Requests + Upload End Request
+/// Send requests: Encrypt/Decrypt Request + Data Requests + Upload End Request.
+/// Data Requests are sent without waiting while the server grants credit (See FLOWWINDOW)
 /// </summary>
 /// <param name="socket">The socket to the server</param>
+/// <param name="parser">The frame parser of the socket, used to receive ACK packets</param>
 /// <param name="request_type">The request type. See RT_ for some</param>
 /// <param name="key">The key for encrypt/decrypt request</param>
+/// <param name="resumable">Non-zero to make the request resumable (needs CAP_RESUME): The server issues a job ID</param>
+/// <param name="ojob_id">[Output:Nullable if not resumable] The job ID issued by the server</param>
 /// <param name="file">The file path want to encrypt/decrypt</param>
 /// <returns>1 if success. 0 if fail. -1 if have fatal errors</returns>
-int SendRequest(SOCKET socket, int request_type, int key, const char* file);
+int SendRequest(SOCKET socket, FRAMEPARSER* parser, int request_type, int key, int resumable, ullong* ojob_id, const char* file);
+
+/// <summary>
+/// [CAP_PROBE] Send the hash and size of a file before uploading it, and Receive whether the server holds the content.
+/// If held, the server runs the job on its copy: the upload is skipped. Files smaller than PROBE_MIN_SIZE are not probed.
+/// </summary>
+/// <param name="socket">The socket to the server</param>
+/// <param name="parser">The frame parser of the socket</param>
+/// <param name="fp">The opened file want to encrypt/decrypt. The file pointer is at the beginning after this function</param>
+/// <param name="size">The size of the file. UEOF if unknown</param>
+/// <param name="oheld">[Output:NotNull] 1 if the server holds the content. 0 if the file should be uploaded</param>
+/// <returns>1 if success. -1 if have fatal errors</returns>
+int ProbeUpload(SOCKET socket, FRAMEPARSER* parser, FILE* fp, uint size, int* oheld);
+
+/// <summary>
+/// Send Data Requests from the current file pointer + Upload End Request, while the server grants credit (See FLOWWINDOW).
+/// A reader thread reads the next chunks while the chunks before are sent (See ReadAhead()).
+/// </summary>
+/// <param name="socket">The socket to the server</param>
+/// <param name="parser">The frame parser of the socket, used to receive ACK packets</param>
+/// <param name="fp">The opened file want to encrypt/decrypt</param>
+/// <param name="length">Number of bytes to upload. UEOF to the end of the file</param>
+/// <returns>1 if success. 0 if fail. -1 if have fatal errors</returns>
+int UploadFile(SOCKET socket, FRAMEPARSER* parser, FILE* fp, uint length);
+
+/// <summary>
+/// Create a chunk ring for a transfer.
+/// </summary>
+/// <param name="fp">The file the disk thread reads or writes</param>
+/// <param name="length">[Reader] Number of bytes to read. UEOF to the end of the file</param>
+/// <returns>The chunk ring. NULL if fail to allocate memory</returns>
+CHUNKRING* CreateChunkRing(FILE* fp, uint length);
+
+/// <summary>
+/// Free memory for a chunk ring. The file is not closed.
+/// </summary>
+/// <param name="ring">A pointer to the ring. Both sides have returned</param>
+void DestroyChunkRing(CHUNKRING* ring);
+
+/// <summary>
+/// [Producer] Wait for a free slot.
+/// </summary>
+/// <param name="ring">A pointer to the ring</param>
+/// <returns>The slot to fill. MESSAGE_PAYLOAD_MAX_SIZE bytes. NULL if the ring stopped</returns>
+stream AcquireChunk(CHUNKRING* ring);
+
+/// <summary>
+/// [Producer] Publish the acquired slot to the consumer.
+/// </summary>
+/// <param name="ring">A pointer to the ring</param>
+/// <param name="length">The size of the chunk in the slot</param>
+void CommitChunk(CHUNKRING* ring, uint length);
+
+/// <summary>
+/// [Producer] Mark the end of the chunks. The consumer takes the committed chunks, then stops.
+/// </summary>
+/// <param name="ring">A pointer to the ring</param>
+void FinishChunks(CHUNKRING* ring);
+
+/// <summary>
+/// [Consumer] Wait for the next chunk. The chunk is valid until ReleaseChunk().
+/// </summary>
+/// <param name="ring">A pointer to the ring</param>
+/// <param name="olength">[Output:NotNull] The size of the chunk</param>
+/// <returns>The chunk. NULL if no more chunk (finished or stopped)</returns>
+stream TakeChunk(CHUNKRING* ring, uint* olength);
+
+/// <summary>
+/// [Consumer] Free the slot of the taken chunk for the producer.
+/// </summary>
+/// <param name="ring">A pointer to the ring</param>
+void ReleaseChunk(CHUNKRING* ring);
+
+/// <summary>
+/// Stop both sides of a ring early. Waiting calls return at once.
+/// </summary>
+/// <param name="ring">A pointer to the ring</param>
+/// <param name="failed">1 if the disk thread fails on the file. 0 otherwise</param>
+void StopChunkRing(CHUNKRING* ring, int failed);
+
+/// <summary>
+/// [Thread] Read the file of a ring into its slots ahead of the sender, until the end of the file (or "length" bytes) or the ring stops.
+/// </summary>
+/// <param name="arguments">A pointer to the CHUNKRING object</param>
+/// <returns>0</returns>
+unsigned __stdcall ReadAhead(void* arguments);
+
+/// <summary>
+/// [Thread] Write the chunks of a ring to its file behind the receiver, until the chunks finish or the ring stops.
+/// </summary>
+/// <param name="arguments">A pointer to the CHUNKRING object</param>
+/// <returns>0</returns>
+unsigned __stdcall WriteBehind(void* arguments);
+
+/// <summary>
+/// Continue a request interrupted by a lost connection (on a new connection): Get the checkpoint from the server,
+/// then Upload the rest of the file or Download the rest of the result.
+/// </summary>
+/// <param name="socket">The new socket to the server</param>
+/// <param name="parser">The frame parser of the socket</param>
+/// <param name="request_type">The request type. See RT_ for some</param>
+/// <param name="job_id">The job ID issued by the server</param>
+/// <param name="file">The file path want to encrypt/decrypt</param>
+/// <returns>1 if success. 0 if fail or the server dropped the job. -1 if have fatal errors</returns>
+int ResumeRequest(SOCKET socket, FRAMEPARSER* parser, int request_type, ullong job_id, const char* file);
+
+/// <summary>
+/// Create a socket and Establish a connection to the server. The receive timeout is RECEIVE_TIMEOUT_INTERVAL.
+/// </summary>
+/// <param name="osocket">[Output:NotNull] The new socket. Close it even if fail, unless INVALID_SOCKET</param>
+/// <param name="server">The address of the server</param>
+/// <returns>1 if success. -1 if fail</returns>
+int ConnectServer(SOCKET* osocket, ADDRESS server);
+
+/// <summary>
+/// Create a socket, Establish a connection to the server and Negotiate the protocol version.
+/// If the server does not reply the Hello Packet in HELLO_TIMEOUT_INTERVAL (a v1 server), Establish a new connection and talk v1 without Hello Packet.
+/// </summary>
+/// <param name="osocket">[Output:NotNull] The new socket. Close it even if fail, unless INVALID_SOCKET</param>
+/// <param name="server">The address of the server</param>
+/// <param name="parser">The frame parser for the connection. Its buffer must be set, it is reset for the connection</param>
+/// <returns>1 if success. -1 if fail</returns>
+int OpenConnection(SOCKET* osocket, ADDRESS server, FRAMEPARSER* parser);
+
+/// <summary>
+/// Close the lost connection, Establish a new one and Negotiate the protocol version again.
+/// </summary>
+/// <param name="osocket">[Output:NotNull] The socket to the server. Replaced by the new socket</param>
+/// <param name="server">The address of the server</param>
+/// <param name="parser">The frame parser of the socket. Reset for the new connection</param>
+/// <returns>1 if success. -1 if fail</returns>
+int Reconnect(SOCKET* osocket, ADDRESS server, FRAMEPARSER* parser);
 
 /// <summary>
-/// Handle the response from remote process: Collect message segmentations, Extract content and Write result to file
+/// Create the path of the result file: The file path + ENCRYPT_FILE_EXTENSION or DECRYPT_FILE_EXTENSION
+/// </summary>
+/// <param name="request_type">The request type. See RT_ for some</param>
+/// <param name="file">The file path want to encrypt/decrypt. Shorter than USER_INPUT_MAX_SIZE</param>
+/// <param name="oresult_file">[Output:NotNull] The result path. Need USER_INPUT_MAX_SIZE + FILE_EXTENSION_SIZE bytes</param>
+void CreateResultPath(int request_type, const char* file, char* oresult_file);
+
+/// <summary>
+/// Handle the response from remote process: Collect frames, Extract content and Write result to file.
+/// A writer thread writes the result while the next frames are received (See WriteBehind()).
 /// </summary>
 /// <param name="socket">The connected socket used to communicate with remote process</param>
+/// <param name="parser">The frame parser of the socket</param>
 /// <param name="request_type">The type of the request sent before</param>
 /// <param name="file">The file use for encrypt/decrypt before</param>
+/// <param name="resume">1 if continue downloading: Append to the result file. 0 if start a new result file</param>
+/// <returns>1 if success. 0 if fail. -1 if have errors that the socket should be closed</returns>
+int HandleResponse(SOCKET socket, FRAMEPARSER* parser, int request_type, const char* file, int resume);
+
+/// <summary>
+/// Get several requests from User input and Run them on the connection.
+/// With CAP_STREAMS, the requests run at once (See RunMultiplex()). Otherwise, they run one after another.
+/// The requests are not resumable.
+/// </summary>
+/// <param name="socket">The socket to the server</param>
+/// <param name="parser">The frame parser of the socket</param>
+/// <returns>1 if success. 0 if no request. -1 if have errors that the socket should be closed</returns>
+int MultiplexRequests(SOCKET socket, FRAMEPARSER* parser);
+
+/// <summary>
+/// Send the requests on their streams and Upload the files in turn while the server grants credit.
+/// Also send the ACK packets asked by the receiver thread (See ReceiveResponses()). Return when all requests end.
+/// </summary>
+/// <param name="mux">The requests. The "jobs" and "count" fields must be set</param>
+/// <returns>1 if success. -1 if have errors that the socket should be closed</returns>
+int RunMultiplex(MULTIPLEX* mux);
+
+/// <summary>
+/// [Thread] Receive frames of all streams: Update the upload credit, Write the results and Ask the main thread to send ACK packets.
+/// Return when all requests end or the connection is broken.
+/// </summary>
+/// <param name="arguments">A pointer to the MULTIPLEX object</param>
+/// <returns>0</returns>
+unsigned __stdcall ReceiveResponses(void* arguments);
+
+/// <summary>
+/// Run the requests listed in a manifest file. Each line of the manifest: E|D Key Path.
+/// With CAP_BATCH, the files not larger than BATCH_ENTRY_MAX_SIZE are sent in a batch (See RunBatch()),
+/// the larger ones (and all files without CAP_BATCH) run one after another. The requests are not resumable.
+/// </summary>
+/// <param name="socket">The socket to the server</param>
+/// <param name="parser">The frame parser of the socket</param>
+/// <param name="manifest">The path of the manifest file</param>
+/// <returns>1 if success. 0 if the manifest is empty or invalid. -1 if have errors that the socket should be closed</returns>
+int BatchRequests(SOCKET socket, FRAMEPARSER* parser, const char* manifest);
+
+/// <summary>
+/// Read the entries of a manifest file. Invalid lines are skipped: So are the lines longer than MANIFEST_LINE_MAX_SIZE
+/// and the paths of USER_INPUT_MAX_SIZE characters or more.
+/// </summary>
+/// <param name="manifest">The path of the manifest file</param>
+/// <param name="oentries">[Output:NotNull] The entries. Free the "file" field of each entry and the array after using</param>
+/// <returns>Number of entries. 0 if the manifest can not be opened or has no valid line</returns>
+uint ReadManifest(const char* manifest, BATCHENTRY** oentries);
+
+/// <summary>
+/// Send the small entries of a manifest in a batch while the server grants credit, and the ACK packets asked by the receiver thread
+/// (See ReceiveBatchResults()). Return when all results are received. Existing result files are replaced.
+/// </summary>
+/// <param name="batch">The batch. The "socket", "parser", "entries", "count" and "total" fields must be set</param>
+/// <returns>1 if success. 0 if the server fails the batch. -1 if have errors that the socket should be closed</returns>
+int RunBatch(BATCH* batch);
+
+/// <summary>
+/// [Thread] Receive the results of a batch: Write the result files, Update the credit and Ask the main thread to send ACK packets.
+/// Return when all results are received, the server fails the batch or the connection is broken.
+/// </summary>
+/// <param name="arguments">A pointer to the BATCH object</param>
+/// <returns>0</returns>
+unsigned __stdcall ReceiveBatchResults(void* arguments);
+
+/// <summary>
+/// [CAP_STORE] Upload a file to be kept on the server and Print its handle. The file can be processed many times
+/// by its handle (See ApplyRequest()) until the handle expires.
+/// </summary>
+/// <param name="socket">The socket to the server</param>
+/// <param name="parser">The frame parser of the socket</param>
+/// <param name="file">The file path want to keep</param>
+/// <returns>1 if success. 0 if fail or the server can not keep the file. -1 if have fatal errors</returns>
+int StoreRequest(SOCKET socket, FRAMEPARSER* parser, const char* file);
+
+/// <summary>
+/// [CAP_STORE] Get a request on a kept file from User input, then Encrypt/Decrypt a byte range of the file without uploading it.
+/// </summary>
+/// <param name="socket">The socket to the server</param>
+/// <param name="parser">The frame parser of the socket</param>
+/// <returns>1 if success. 0 if fail or the handle has expired. -1 if have errors that the socket should be closed</returns>
+int ApplyRequest(SOCKET socket, FRAMEPARSER* parser);
+
+/// <summary>
+/// [CAP_STRIPE] Get a request from User input, then Split the file into byte ranges transferred over several connections at once
+/// (See RunStripes()). Without CAP_STRIPE, or for small files, the request runs on the current connection only.
+/// The request is not resumable.
+/// </summary>
+/// <param name="socket">The socket to the server</param>
+/// <param name="parser">The frame parser of the socket</param>
+/// <param name="server">The address of the server, for opening more connections</param>
 /// <returns>1 if success. 0 if fail. -1 if have errors that the socket should be closed</returns>
-int HandleResponse(SOCKET socket, int request_type, const char* file);
+int StripeRequest(SOCKET socket, FRAMEPARSER* parser, ADDRESS server);
+
+/// <summary>
+/// Split the file of a striped request into ranges and Run each range on its connection: the first one on this thread,
+/// the others on threads of their own (See RunStripe()). The result file is replaced, and removed if the request fails.
+/// </summary>
+/// <param name="request">The request. All fields except "stripes", "uploaded", "lock" and "changed" must be set,
+/// and the "socket" and "parser" fields of the first "count" stripes</param>
+/// <returns>1 if success. 0 if fail. -1 if the current connection (the first range) is broken</returns>
+int RunStripes(STRIPEDREQUEST* request);
+
+/// <summary>
+/// [Thread] Upload a range, Wait until the uploads of all ranges end (the server responds after that), then Download the result of the range.
+/// </summary>
+/// <param name="arguments">A pointer to the STRIPE object. Its "status" field is set</param>
+/// <returns>0</returns>
+unsigned __stdcall RunStripe(void* arguments);
+
+/// <summary>
+/// Send the Stripe Request of a range and Upload the range. If the file can not be read, the upload ends early and the server fails the request.
+/// </summary>
+/// <param name="stripe">A pointer to the range</param>
+/// <returns>1 if success. -1 if have fatal errors</returns>
+int UploadStripe(STRIPE* stripe);
+
+/// <summary>
+/// Receive the result of a range and Write it into the result file at the offset of the range.
+/// </summary>
+/// <param name="stripe">A pointer to the range</param>
+/// <returns>1 if success. 0 if the server fails the request or the result can not be written. -1 if have fatal errors</returns>
+int DownloadStripe(STRIPE* stripe);
+
+/// <summary>
+/// Run the headless mode: Run the jobs on several connections at once, then Print the time of each job and the throughput.
+/// Existing result files are replaced. No input is asked.
+/// </summary>
+/// <param name="server">The address of the server</param>
+/// <param name="argc">Number of arguments after BENCH_COMMAND</param>
+/// <param name="argv">The arguments after BENCH_COMMAND: concurrency, then jobs (See ExtractBench())</param>
+/// <returns>1 if all jobs success. 0 if some jobs fail or the arguments are invalid. -1 if have fatal errors</returns>
+int BenchRequests(ADDRESS server, int argc, char* argv[]);
+
+/// <summary>
+/// [Thread] Open a connection and Run the jobs of a bench one after another, until no job remains.
+/// A broken connection is opened again for the next job.
+/// </summary>
+/// <param name="arguments">A pointer to the BENCH object</param>
+/// <returns>0</returns>
+unsigned __stdcall RunBenchJobs(void* arguments);
+
+/// <summary>
+/// Print the size, time and throughput of each job, the aggregate throughput and the p50/p99 job latency.
+/// </summary>
+/// <param name="bench">The bench after all jobs</param>
+/// <param name="elapsed">The wall time of all jobs in milliseconds</param>
+void PrintBenchReport(BENCH* bench, double elapsed);
+
+/// <summary>
+/// Get the time in milliseconds between two values of the performance counter.
+/// </summary>
+/// <param name="frequency">The frequency of the performance counter</param>
+/// <param name="start">The start value</param>
+/// <param name="end">The end value</param>
+/// <returns>The time in milliseconds</returns>
+double ElapsedMilliseconds(LARGE_INTEGER frequency, LARGE_INTEGER start, LARGE_INTEGER end);
+
+/// <summary>
+/// Get the latency at a percentile of sorted latencies (nearest rank).
+/// </summary>
+/// <param name="sorted">The latencies in ascending order</param>
+/// <param name="count">Number of latencies. Greater than 0</param>
+/// <param name="percentile">The percentile: 1..100</param>
+/// <returns>The latency at the percentile</returns>
+double Percentile(const double* sorted, uint count, uint percentile);
+
+/// <summary>
+/// [qsort] Compare two latencies.
+/// </summary>
+/// <returns>Negative, 0 or positive as the first latency is less than, equal to or greater than the second</returns>
+int CompareLatency(const void* a, const void* b);
 
 #pragma endregion
 
@@ -53,6 +596,49 @@ void PrintMenu();
 /// <returns>1 if user input is valid. 0 otherwise</returns>
 int GetRequest(const char* option_str, int* okey, char** ofile);
 
+/// <summary>
+/// Get several requests from User input until the user chooses neither Encrypt nor Decrypt, or MAX_STREAMS requests.
+/// </summary>
+/// <param name="ojobs">[Output:NotNull] The requests. Need MAX_STREAMS items</param>
+/// <returns>Number of requests</returns>
+int GetRequests(STREAMJOB* ojobs);
+
+/// <summary>
+/// Get the path of an existing file from User input
+/// </summary>
+/// <param name="option_str">A string describe the request type [Just for displaying to console]</param>
+/// <param name="ofile">[Output:NotNull] The file path</param>
+/// <returns>1 if user input is valid. 0 otherwise</returns>
+int GetFile(const char* option_str, char** ofile);
+
+/// <summary>
+/// Get a request on a kept file from User input: The handle, The request type, The key, The byte range and The result name
+/// </summary>
+/// <param name="ohandle_id">[Output:NotNull] The handle of the kept file</param>
+/// <param name="orequest_type">[Output:NotNull] RT_ENCRYPT or RT_DECRYPT</param>
+/// <param name="okey">[Output:NotNull] The key for encrypt/decrypt</param>
+/// <param name="ooffset">[Output:NotNull] The first byte to process</param>
+/// <param name="olength">[Output:NotNull] Number of bytes to process. 0 to the end of the file</param>
+/// <param name="ofile">[Output:NotNull] The result is written to this path + ENCRYPT_FILE_EXTENSION or DECRYPT_FILE_EXTENSION</param>
+/// <returns>1 if user input is valid. 0 otherwise</returns>
+int GetApply(ullong* ohandle_id, int* orequest_type, int* okey, uint* ooffset, uint* olength, char** ofile);
+
+/// <summary>
+/// Get a striped request from User input: The request type, The key and The file
+/// </summary>
+/// <param name="orequest_type">[Output:NotNull] RT_ENCRYPT or RT_DECRYPT</param>
+/// <param name="okey">[Output:NotNull] The key for encrypt/decrypt</param>
+/// <param name="ofile">[Output:NotNull] The file path want to encrypt/decrypt</param>
+/// <returns>1 if user input is valid. 0 otherwise</returns>
+int GetStripe(int* orequest_type, int* okey, char** ofile);
+
+/// <summary>
+/// Get the path of a manifest file from User input
+/// </summary>
+/// <param name="ofile">[Output:NotNull] The manifest path</param>
+/// <returns>1 if user input is valid. 0 otherwise</returns>
+int GetManifest(char** ofile);
+
 /// <summary>
 /// Get user command.
 /// </summary>
@@ -62,6 +648,13 @@ int GetRequest(const char* option_str, int* okey, char** ofile);
 /// <returns>1 if user input is valid. 0 otherwise</returns>
 int HandleInput(int* ocode, int* okey, char** ofile);
 
+/// <summary>
+/// Ask user whether to resume a request after the connection is lost.
+/// </summary>
+/// <param name="file">The file of the request [Just for displaying to console]</param>
+/// <returns>1 if user wants to resume. 0 otherwise</returns>
+int AskResume(const char* file);
+
 /// <summary>
 /// Extract port number and ipv4 string from command-line arguments.
 /// If has error, set oport = 0 and oip = NULL.
@@ -73,6 +666,17 @@ int HandleInput(int* ocode, int* okey, char** ofile);
 /// <returns>1 if extract successfully. 0 otherwise, has error</returns>
 int ExtractCommand(int argc, char* argv[], int* oport, IP* oip);
 
+/// <summary>
+/// Extract the jobs of the headless mode from command-line arguments. A job is "E|D key path",
+/// any other argument is a list file with a job per line (the manifest format, See ReadManifest()).
+/// A job with a path of USER_INPUT_MAX_SIZE characters or more is skipped.
+/// </summary>
+/// <param name="argc">Number of job arguments</param>
+/// <param name="argv">The job arguments</param>
+/// <param name="oentries">[Output:NotNull] The jobs. Free the "file" field of each entry and the array after using</param>
+/// <returns>Number of jobs. 0 if no valid job</returns>
+uint ExtractBench(int argc, char* argv[], BATCHENTRY** oentries);
+
 #pragma endregion
 
 #pragma endregion
\ No newline at end of file
@@ -1,5 +1,10 @@
 #include "Crypto.h"
 
+#pragma comment(lib, "Bcrypt.lib")
+
+#include <windows.h>
+#include <bcrypt.h>
+
 stream EncryptShiftCipher(uint key, const stream data, uint length)
 {
 	stream encrypt_data = CreateStream(length);
@@ -19,4 +24,71 @@ stream DecryptShiftCipher(uint key, const stream data, uint length)
 		}
 	}
 	return decrypt_data;
-}
\ No newline at end of file
+}
+
+int BeginHash(HASHSTATE* ostate)
+{
+	if (ostate == NULL)
+		return INVALID_ARGUMENTS;
+	ostate->algorithm = NULL;
+	ostate->hash = NULL;
+
+	BCRYPT_ALG_HANDLE algorithm = NULL;
+	BCRYPT_HASH_HANDLE hash = NULL;
+	if (!BCRYPT_SUCCESS(BCryptOpenAlgorithmProvider(&algorithm, BCRYPT_SHA256_ALGORITHM, NULL, 0)))
+		return FATAL_ERROR;
+	if (!BCRYPT_SUCCESS(BCryptCreateHash(algorithm, &hash, NULL, 0, NULL, 0, 0))) {
+		BCryptCloseAlgorithmProvider(algorithm, 0);
+		return FATAL_ERROR;
+	}
+	ostate->algorithm = algorithm;
+	ostate->hash = hash;
+	return SUCCESS;
+}
+
+int UpdateHash(HASHSTATE* state, const stream data, uint length)
+{
+	if (state == NULL || state->hash == NULL)
+		return INVALID_ARGUMENTS;
+	return BCRYPT_SUCCESS(BCryptHashData((BCRYPT_HASH_HANDLE)state->hash, (PUCHAR)data, length, 0)) ? SUCCESS : FATAL_ERROR;
+}
+
+int FinishHash(HASHSTATE* state, stream odigest)
+{
+	if (state == NULL || state->hash == NULL || odigest == NULL)
+		return INVALID_ARGUMENTS;
+	int status = BCRYPT_SUCCESS(BCryptFinishHash((BCRYPT_HASH_HANDLE)state->hash, (PUCHAR)odigest, DIGEST_SIZE, 0)) ? SUCCESS : FATAL_ERROR;
+	AbortHash(state);
+	return status;
+}
+
+void AbortHash(HASHSTATE* state)
+{
+	if (state == NULL || state->hash == NULL)
+		return;
+	BCryptDestroyHash((BCRYPT_HASH_HANDLE)state->hash);
+	BCryptCloseAlgorithmProvider((BCRYPT_ALG_HANDLE)state->algorithm, 0);
+	state->hash = NULL;
+	state->algorithm = NULL;
+}
+
+int HashFile(FILE* fp, stream odigest)
+{
+	if (fp == NULL || odigest == NULL)
+		return INVALID_ARGUMENTS;
+
+	HASHSTATE state;
+	int status = BeginHash(&state);
+
+	char buffer[4096];
+	uint read_count;
+	rewind(fp);
+	while (status == SUCCESS && (read_count = fread(buffer, sizeof(char), sizeof(buffer), fp)) > 0)
+		status = UpdateHash(&state, buffer, read_count);
+	if (status == SUCCESS)
+		status = ferror(fp) ? FATAL_ERROR : FinishHash(&state, odigest);
+	rewind(fp);
+
+	AbortHash(&state);
+	return status;
+}
@@ -3,6 +3,18 @@
 #include "Utilities.h"
 
 #define SHIFT_KEY_SPACE 256
+#define DIGEST_SIZE 32 // SHA-256
+
+/// <summary>
+/// An incremental SHA-256 of a byte stream: BeginHash(), UpdateHash() for each part, FinishHash()
+/// </summary>
+typedef struct hashstate {
+
+	void* algorithm; // The BCrypt algorithm provider. NULL if the hash is not begun
+
+	void* hash; // The BCrypt hash object. NULL if the hash is not begun
+
+} HASHSTATE;
 
 /// <summary>
 /// Encrypt a byte stream using Shift Cipher.
@@ -20,4 +32,43 @@ stream EncryptShiftCipher(uint key, const stream data, uint length);
 /// <param name="data">The byte stream want to decrypt</param>
 /// <param name="length">The length of the byte stream</param>
 /// <returns>The decrypted stream. NULL if fail to allocate memory</returns>
-stream DecryptShiftCipher(uint key, const stream data, uint length);
\ No newline at end of file
+stream DecryptShiftCipher(uint key, const stream data, uint length);
+
+/// <summary>
+/// Begin an incremental SHA-256.
+/// </summary>
+/// <param name="ostate">[Output:NotNull] The hash. Release it by FinishHash() or AbortHash()</param>
+/// <returns>1 if success. -1 if have some errors on the hash provider: The hash is not begun</returns>
+int BeginHash(HASHSTATE* ostate);
+
+/// <summary>
+/// Hash the next part of the byte stream.
+/// </summary>
+/// <param name="state">A begun hash</param>
+/// <param name="data">The next bytes</param>
+/// <param name="length">The number of bytes</param>
+/// <returns>1 if success. -1 if have some errors on the hash provider. -2 if the hash is not begun</returns>
+int UpdateHash(HASHSTATE* state, const stream data, uint length);
+
+/// <summary>
+/// Get the digest of the hashed bytes and Release the hash.
+/// </summary>
+/// <param name="state">A begun hash. Not begun after the call</param>
+/// <param name="odigest">[Output:NotNull] The digest. Need DIGEST_SIZE bytes</param>
+/// <returns>1 if success. -1 if have some errors on the hash provider. -2 if the hash is not begun</returns>
+int FinishHash(HASHSTATE* state, stream odigest);
+
+/// <summary>
+/// Release a hash without a digest. Nothing happens if the hash is not begun.
+/// </summary>
+/// <param name="state">The hash. Not begun after the call</param>
+void AbortHash(HASHSTATE* state);
+
+/// <summary>
+/// Hash the whole content of a file with SHA-256. The file pointer is moved back to the beginning.
+/// Collision resistant: The digest identifies the content.
+/// </summary>
+/// <param name="fp">The FILE* object point to the opened file</param>
+/// <param name="odigest">[Output:NotNull] The digest of the content. Need DIGEST_SIZE bytes</param>
+/// <returns>1 if success. -1 if have some errors on file or on the hash provider.</returns>
+int HashFile(FILE* fp, stream odigest);
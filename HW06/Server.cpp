@@ -4,12 +4,31 @@ CLIENTINFO clients[MAX_CLIENTS];
 int clients_count = 0;
 int new_client_index;
 CRITICAL_SECTION critical_section;
+JOBINFO jobs[MAX_JOBS]; // Interrupted jobs. Only used by the IO thread
+CACHEENTRY cache[MAX_CACHE_ENTRIES]; // Results of finished jobs. Only used by the IO thread
+uint cache_bytes = 0; // Total size of the cached results
+ullong cache_clock = 0; // Increase each time a result is stored or served. Order the results by recent use
+CACHEMETRICS cache_metrics = { 0, 0, 0, 0 };
+HANDLEINFO handles[MAX_HANDLES]; // Kept uploads. Only used by the IO thread
+STRIPEJOB stripe_jobs[MAX_STRIPE_JOBS]; // Jobs split over several connections. Only used by the IO thread
+char inflate_buffer[MESSAGE_PAYLOAD_MAX_SIZE]; // Decompressed payload of a MC_DATA or MC_BATCH frame. Only used by the IO thread
+
+BATCHQUEUE pending_tasks = { NULL, NULL }; // Batch entries wait for the worker threads
+BATCHQUEUE completed_tasks = { NULL, NULL }; // Batch entries wait for the IO thread to send the results
+CRITICAL_SECTION batch_lock; // Protect the batch queues
+CONDITION_VARIABLE batch_ready; // Signaled when a task is appended to the pending queue
+WSAEVENT batch_event; // Signaled when a task is appended to the completed queue
+int batch_workers = 0; // Number of worker threads
+uint batch_serial = 0; // The serial of the last opened batch. Only used by the IO thread
 
 int main(int argc, char* argv[])
 {
 	if (!IsExist(DEFAULT_TEMP_FOLDER)) {
 		CreateFolder(DEFAULT_TEMP_FOLDER);
 	}
+	if (!IsExist(DEFAULT_CACHE_FOLDER)) {
+		CreateFolder(DEFAULT_CACHE_FOLDER);
+	}
 	if (WSInitialize()) {
 		SOCKET listener = CreateSocket(TCP);
 		//SetSendBufferSize(listener, 3 * 4096); // config for all connectors get from this listener
@@ -26,15 +45,21 @@ int main(int argc, char* argv[])
 					printf("[%s] Listenning at port %d...\n", INFO_FLAGS, DEFAULT_PORT);
 #endif // _ERROR_DEBUGGING
 
+					batch_event = WSACreateEvent();
+					InitializeCriticalSection(&batch_lock);
+					InitializeConditionVariable(&batch_ready);
+					batch_workers = CreateBatchWorkers(BATCH_WORKERS);
+
 					WSAEVENT listener_event = WSACreateEvent();
 					CreateThread(listener_event);
 					InitializeCriticalSection(&critical_section);
 					while (1) {
-						SOCKET connector = GetConnectionSocket(listener);
+						ADDRESS client_address;
+						SOCKET connector = GetConnectionSocket(listener, &client_address);
 						if (connector != INVALID_SOCKET) {
 
 							EnterCriticalSection(&critical_section);
-							new_client_index = AppendSocketToManager(connector);
+							new_client_index = AppendSocketToManager(connector, client_address);
 							LeaveCriticalSection(&critical_section);
 
 							if (new_client_index > -1) {
@@ -61,13 +86,22 @@ int main(int argc, char* argv[])
 
 unsigned __stdcall RunOverlappedIO(void* arguments_wsaevent)
 {
-	WSAEVENT accepted_event = (WSAEVENT)arguments_wsaevent;
+	WSAEVENT events[2] = { (WSAEVENT)arguments_wsaevent, batch_event };
+	WSAEVENT accepted_event = events[0];
 	while (1) {
-		int ret = ListenEvents(&accepted_event, 1);
+		int ret = ListenEvents(events, 2);
 		if (ret == FATAL_ERROR) {
 			return 0;
 		}
 
+		if (ret == 1) { // batch results signal
+			WSAResetEvent(batch_event);
+
+			EnterCriticalSection(&critical_section);
+			CompleteBatchTasks();
+			LeaveCriticalSection(&critical_section);
+		}
+
 		if (ret == 0) { // accepted socket signal
 			WSAResetEvent(accepted_event);
 
@@ -76,7 +110,7 @@ unsigned __stdcall RunOverlappedIO(void* arguments_wsaevent)
 			CLIENTINFO* client = clients + new_client_index;
 
 			// invoke receive to initiate overlapped event
-			if (ReceiveRequestHeader(client) == FATAL_ERROR) {
+			if (ReceiveRequests(client) == FATAL_ERROR) {
 				RemoveClientFromManager(client);
 			}
 			LeaveCriticalSection(&critical_section);
@@ -101,58 +135,231 @@ HANDLE CreateThread(WSAEVENT listener_event)
 
 #pragma endregion
 
-#pragma region Winsock Completion IO
+#pragma region Batch Workers
 
-int HandleIOResult(CLIENTINFO* client, int sockex_status)
+int CreateBatchWorkers(int count)
 {
-	switch (sockex_status) {
-	case SS_RECH: // receive segment header success -> continue receive message in this segment
-		return ReceiveRequestContent(client);
+	int created = 0;
+	for (int i = 0; i < count; ++i) {
+		HANDLE thread = (HANDLE)_beginthreadex(NULL, 0, RunBatchWorker, NULL, 0, NULL);
+		if (thread == 0) {
+			printf("[%s] %s\n", WARNING_FLAGS, errno == EAGAIN ? _TOO_MANY_THREADS : _INSUFFICIENT_RESOURCES);
+			break;
+		}
+		CloseHandle(thread); // the workers run until the process exits
+		created++;
+	}
+	return created;
+}
 
-	case SS_RECC: // receive message success -> handle request for the message
-		return Request(client);
+unsigned __stdcall RunBatchWorker(void* arguments)
+{
+	while (1) {
+		EnterCriticalSection(&batch_lock);
+		while (pending_tasks.head == NULL)
+			SleepConditionVariableCS(&batch_ready, &batch_lock, INFINITE);
+		BATCHTASK* task = PopBatchTask(&pending_tasks);
+		LeaveCriticalSection(&batch_lock);
+
+		ProcessBatchTask(task);
+
+		EnterCriticalSection(&batch_lock);
+		PushBatchTask(&completed_tasks, task);
+		LeaveCriticalSection(&batch_lock);
+		SignalEvent(batch_event); // the IO thread sends the result
+	}
+	return 0;
+}
 
-	case SS_SENA: // successful send ack for the receiving -> continue receive
-		return ReceiveRequestHeader(client);
+BATCHTASK* CreateBatchTask(CLIENTINFO* client, STREAMINFO* sinfo, uint index, int request_type, uint key, const stream content, uint content_len)
+{
+	BATCHTASK* task = (BATCHTASK*)malloc(sizeof(BATCHTASK));
+	if (task == NULL)
+		return NULL;
+	task->data = NULL;
+	if (content_len > 0 && (task->data = Clone(content, content_len)) == NULL) {
+		free(task);
+		return NULL;
+	}
+	task->client = client;
+	task->socket = client->socketex.socket;
+	task->stream_id = sinfo->id;
+	task->serial = sinfo->batch_serial;
+	task->index = index;
+	task->request_type = request_type;
+	task->key = key;
+	task->length = content_len;
+	task->status = FAIL;
+	task->next = NULL;
+	return task;
+}
 
-	case SS_RECA: // receive ack -> continue send
-		return Respond(client);
+void DestroyBatchTask(BATCHTASK* task)
+{
+	DestroyStream(task->data);
+	free(task);
+}
+
+void PushBatchTask(BATCHQUEUE* queue, BATCHTASK* task)
+{
+	task->next = NULL;
+	if (queue->head == NULL)
+		queue->head = task;
+	else
+		queue->tail->next = task;
+	queue->tail = task;
+}
+
+BATCHTASK* PopBatchTask(BATCHQUEUE* queue)
+{
+	BATCHTASK* task = queue->head;
+	if (task != NULL) {
+		queue->head = task->next;
+		if (queue->head == NULL)
+			queue->tail = NULL;
+		task->next = NULL;
+	}
+	return task;
+}
+
+void FreeBatchTasks(BATCHQUEUE* queue)
+{
+	BATCHTASK* task;
+	while ((task = PopBatchTask(queue)) != NULL)
+		DestroyBatchTask(task);
+}
+
+void ProcessBatchTask(BATCHTASK* task)
+{
+	task->status = SUCCESS;
+	if (task->length == 0)
+		return;
+
+	stream result = task->request_type == RT_ENCRYPT ?
+		EncryptShiftCipher(task->key, task->data, task->length) : DecryptShiftCipher(task->key, task->data, task->length);
+	if (result == NULL)
+		task->status = FAIL;
+	DestroyStream(task->data);
+	task->data = result;
+}
+
+void SubmitBatchTask(BATCHTASK* task)
+{
+	EnterCriticalSection(&batch_lock);
+	PushBatchTask(&pending_tasks, task);
+	LeaveCriticalSection(&batch_lock);
+	WakeConditionVariable(&batch_ready);
+}
+
+void CompleteBatchTasks()
+{
+	BATCHQUEUE completed;
+	EnterCriticalSection(&batch_lock);
+	completed = completed_tasks;
+	completed_tasks.head = completed_tasks.tail = NULL;
+	LeaveCriticalSection(&batch_lock);
+
+	BATCHTASK* task;
+	while ((task = PopBatchTask(&completed)) != NULL) {
+		CLIENTINFO* client = task->client;
+		STREAMINFO* sinfo = client->socketex.socket == task->socket ? FindStream(client, task->stream_id) : NULL;
+		if (sinfo == NULL || sinfo->request_type != RT_BATCH || sinfo->batch_serial != task->serial) { // the client or the batch is gone
+			DestroyBatchTask(task);
+			continue;
+		}
+		sinfo->batch_pending--;
+		PushBatchTask(&(sinfo->batch_results), task);
+		if (Respond(client) == FATAL_ERROR)
+			RemoveClientFromManager(client);
+	}
+}
+
+#pragma endregion
 
-	case SS_SEND: // send success -> receive ack for this sending
-		return ReceiveAckSendStatus(client);
+#pragma region Winsock Completion IO
 
-	case SS_FREE: // response success -> start new request.
-		Reset(client);
-		return ReceiveRequestHeader(client);
+int HandleIOResult(CLIENTINFO* client, int sockex_status)
+{
+	switch (sockex_status) {
+	case SS_RECF: // receive bytes success -> handle complete frames in them
+		return HandleFrames(client);
 
 	default:
 		return SUCCESS;
 	}
 }
 
-int SendAckReceiveStatus(CLIENTINFO* client)
+int SendAckReceiveStatus(CLIENTINFO* client, STREAMINFO* sinfo)
+{
+	uint limit;
+	if (ConsumeCredit(&(sinfo->receive_window), &limit) == SUCCESS)
+		return SendACK(&(client->socketex), client->parser.version, sinfo->id, limit);
+	return SUCCESS;
+}
+
+int AcceptUpload(CLIENTINFO* client, STREAMINFO* sinfo)
+{
+	if (client->parser.capabilities & CAP_CREDIT) // not ACKed: the client starts with FLOW_WINDOW_CHUNKS credit
+		return SUCCESS;
+	// stop-and-wait: the ACK Packet of the request allows the first MC_DATA message
+	return SendACK(&(client->socketex), client->parser.version, sinfo->id, sinfo->receive_window.limit);
+}
+
+int ResumePausedOperation(CLIENTINFO* client)
 {
-	UpdateStatus(&(client->socketex), SS_SENA);
-	return SendACK(&(client->socketex));
+	int operation = client->paused_operation;
+	client->paused_operation = CS_FREE;
+
+	int status = SUCCESS;
+	if (operation & CS_RESPONDING)
+		status = Respond(client);
+	if (status != FATAL_ERROR && (operation & CS_RECEIVING))
+		status = HandleFrames(client);
+	return status;
 }
 
-int ReceiveRequestHeader(CLIENTINFO* client)
+int ReceiveRequests(CLIENTINFO* client)
 {
-	UpdateStatus(&(client->socketex), SS_RECH);
-	return ReceiveSegmentHeader(&(client->socketex)); // new session
+	UpdateStatus(&(client->socketex), SS_RECF);
+	return ReceiveFrames(&(client->socketex), &(client->parser));
 }
 
-int ReceiveRequestContent(CLIENTINFO* client)
+int HandleFrames(CLIENTINFO* client)
 {
-	uint message_size_from_header = ToHostByteOrder(ToUnsignedInt(client->socketex.buffer.buf));
-	UpdateStatus(&(client->socketex), SS_RECC);
-	return ReceiveSegmentContent(&(client->socketex), message_size_from_header);
+	FRAME frame;
+	int status = SUCCESS;
+	while (status != FATAL_ERROR) {
+		if (IsSendQueuePaused(&(client->socketex))) { // handling more requests queues more bytes -> wait for the queue drains
+			client->paused_operation |= CS_RECEIVING;
+			return WAIT;
+		}
+
+		int ret = ParseFrame(&(client->parser), &frame);
+		if (ret == WAIT) // need more bytes
+			return ReceiveRequests(client);
+		if (ret != SUCCESS) { // can not find the next frame in the stream
+#ifdef _ERROR_DEBUGGING
+			printf("[%s] Receive invalid frame from client %d\n", WARNING_FLAGS, client->socketex.socket);
+#endif // _ERROR_DEBUGGING
+			return FATAL_ERROR;
+		}
+
+		status = Request(client, &frame);
+		if (status == FAIL) // invalid request or the temp file is broken -> close the connection
+			status = FATAL_ERROR;
+	}
+	return status;
 }
 
-int ReceiveAckSendStatus(CLIENTINFO* client)
+int HandleACK(CLIENTINFO* client, STREAMINFO* sinfo, uint limit)
 {
-	UpdateStatus(&(client->socketex), SS_RECA);
-	return ReceiveACK(&(client->socketex));
+	if (limit == FLOW_CREDIT_END) { // the client received all response -> the job completes
+		CloseStream(client, sinfo);
+		return SUCCESS;
+	}
+
+	UpdateCredit(&(sinfo->send_window), limit);
+	return Respond(client);
 }
 
 void CALLBACK RoutineCallback(DWORD error, DWORD transfered_bytes, LPWSAOVERLAPPED overlapped, DWORD flags)
@@ -171,29 +378,9 @@ void CALLBACK RoutineCallback(DWORD error, DWORD transfered_bytes, LPWSAOVERLAPP
 	if (transfered_bytes == 0) {
 		operation_status = FATAL_ERROR;
 	}
-	else if (transfered_bytes < sockex->buffer.len) {
-		int status = SUCCESS;
-		switch (sockex->status) {
-			case SS_RECH:
-				//printf("[%s] Receive segment header fail at client %d: %d/%d\n", WARNING_FLAGS,
-				//sockex->socket, transfered_bytes, sockex->buffer.len);
-			case SS_RECC:
-				//printf("[%s] Receive segment content fail at client %d: %d/%d\n", WARNING_FLAGS,
-					//sockex->socket, transfered_bytes, sockex->buffer.len);
-				status = ContinueReceive(sockex, sockex->buffer.len - transfered_bytes, transfered_bytes);
-				if (status != FATAL_ERROR)
-					return;
-				break;
-			case SS_SEND:
-				//printf("[%s] Send segment fail at client %d: %d/%d\n", WARNING_FLAGS,
-				//	sockex->socket, transfered_bytes, sockex->buffer.len);
-				status = ContinueSend(sockex, sockex->buffer.len - transfered_bytes, transfered_bytes);
-				if (status != FATAL_ERROR)
-					return;
-				break;
-		}
-		if (status == FATAL_ERROR)
-			operation_status = FATAL_ERROR;
+	else if (sockex->status == SS_RECF) {
+		// any number of bytes is fine, the parser waits for the rest of a frame
+		CommitParserBytes(&(client->parser), transfered_bytes);
 	}
 
 	if (operation_status == SUCCESS) {
@@ -207,40 +394,145 @@ void CALLBACK RoutineCallback(DWORD error, DWORD transfered_bytes, LPWSAOVERLAPP
 	}
 }
 
+void CALLBACK SendRoutineCallback(DWORD error, DWORD transfered_bytes, LPWSAOVERLAPPED overlapped, DWORD flags)
+{
+	CLIENTINFO* client = GetClientInfo(GetSocketExtend(overlapped));
+	SOCKETEX* sockex = &(client->socketex);
+	int resumed;
+	if (sockex->socket == (SOCKET)0) { // removed, the send is cancelled -> release the buffers it was reading
+		CompleteQueuedSend(sockex, 0, &resumed);
+		return;
+	}
+
+	if (error != 0) {
+		printf("[%s:%d] Have some errors on Completion Routine\n", WARNING_FLAGS, error);
+		transfered_bytes = 0;
+	}
+
+	int operation_status = CompleteQueuedSend(sockex, transfered_bytes, &resumed);
+	if (operation_status != FATAL_ERROR && resumed) {
+		operation_status = ResumePausedOperation(client);
+	}
+
+	if (operation_status == FATAL_ERROR) {
+		EnterCriticalSection(&critical_section);
+		RemoveClientFromManager(client);
+		LeaveCriticalSection(&critical_section);
+	}
+}
+
 #pragma endregion
 
 #pragma region Client Manager
 
-CLIENTINFO CreateClientInfo(SOCKET socket)
+CLIENTINFO CreateClientInfo(SOCKET socket, ADDRESS address)
 {
 	CLIENTINFO c; {
-		c.key = 0;
-		c.socketex = CreateSocketExtend(socket, SEGMENT_MAX_SIZE, RoutineCallback);
-		c.request_type = RT_INVALID;
-		c.temp_file_path = NULL;
-		c.temp_file_position = 0;
+		c.socketex = CreateSocketExtend(socket, FRAME_PARSER_SIZE, RoutineCallback, SendRoutineCallback);
+		c.address = address;
+		c.paused_operation = CS_FREE;
+		InitializeFrameParser(&(c.parser), c.socketex.data, FRAME_PARSER_SIZE);
+		for (int i = 0; i < MAX_STREAMS; ++i) {
+			c.streams[i].temp_file_path = NULL;
+			c.streams[i].response_file = NULL;
+			c.streams[i].batch_results.head = NULL;
+			c.streams[i].cached = NULL;
+			c.streams[i].cache_file_path = NULL;
+			c.streams[i].cache_file = NULL;
+			c.streams[i].handle = NULL;
+			c.streams[i].stripe = NULL;
+			c.streams[i].upload_hash.hash = NULL;
+			ResetStream(c.streams + i);
+		}
+		c.next_stream = 0;
 	}
 	return c;
 }
 
-void Reset(CLIENTINFO* client)
+void ResetStream(STREAMINFO* sinfo)
 {
-	// SOCKETEX
-	Reset(&(client->socketex));
-	// CLIENTINFO
-	client->key = 0;
-	client->request_type = RT_INVALID;
-	free(client->temp_file_path);
-	client->temp_file_path = NULL;
-	client->temp_file_position = 0;
+	sinfo->id = STREAM_DEFAULT;
+	sinfo->key = 0;
+	sinfo->request_type = RT_INVALID;
+	CloseFile(sinfo->response_file);
+	sinfo->response_file = NULL;
+	ReleaseResponse(sinfo);
+	free(sinfo->temp_file_path);
+	sinfo->temp_file_path = NULL;
+	sinfo->temp_file_position = 0;
+	sinfo->job_id = JOB_NONE;
+	sinfo->written_size = 0;
+	sinfo->committed_size = 0;
+	sinfo->checkpoint_time = 0;
+	sinfo->uploaded = 0;
+	if (sinfo->handle != NULL)
+		sinfo->handle->readers--;
+	sinfo->handle = NULL;
+	sinfo->range_offset = 0;
+	LeaveStripeJob(sinfo);
+	sinfo->range_length = 0;
+	AbortHash(&(sinfo->upload_hash));
+	memset(sinfo->content_digest, 0, DIGEST_SIZE);
+	sinfo->batch_serial = 0;
+	sinfo->batch_total = 0;
+	sinfo->batch_received = 0;
+	sinfo->batch_pending = 0; // the entries at the workers are dropped when they complete
+	FreeBatchTasks(&(sinfo->batch_results));
 }
 
-int AppendSocketToManager(SOCKET socket)
+STREAMINFO* FindStream(CLIENTINFO* client, uint stream_id)
+{
+	for (int i = 0; i < MAX_STREAMS; ++i) {
+		if (client->streams[i].request_type != RT_INVALID && client->streams[i].id == stream_id)
+			return client->streams + i;
+	}
+	return NULL;
+}
+
+STREAMINFO* OpenStream(CLIENTINFO* client, uint stream_id)
+{
+	// without CAP_STREAMS, only one job at a time
+	int count = (client->parser.capabilities & CAP_STREAMS) ? MAX_STREAMS : 1;
+	for (int i = 0; i < count; ++i) {
+		if (client->streams[i].request_type == RT_INVALID) {
+			client->streams[i].id = stream_id;
+			ResetFlowWindow(&(client->streams[i].receive_window), client->parser.capabilities);
+			ResetFlowWindow(&(client->streams[i].send_window), client->parser.capabilities);
+			return client->streams + i;
+		}
+	}
+	return NULL;
+}
+
+void CloseStream(CLIENTINFO* client, STREAMINFO* sinfo)
+{
+	CloseFile(sinfo->response_file);
+	sinfo->response_file = NULL;
+	if (sinfo->temp_file_path != NULL)
+		RemoveFile(sinfo->temp_file_path);
+	ResetStream(sinfo);
+	client->parser.mode = PM_MESSAGE; // keep the version and the received bytes of the next request
+}
+
+int FailStream(CLIENTINFO* client, STREAMINFO* sinfo)
+{
+	if (client->parser.version == PROTOCOL_V1) // can not tell the client -> close the connection
+		return FAIL;
+
+#ifdef _ERROR_DEBUGGING
+	printf("[%s] Fail the job on stream %u of client %d\n", WARNING_FLAGS, sinfo->id, client->socketex.socket);
+#endif // _ERROR_DEBUGGING
+	uint stream_id = sinfo->id;
+	CloseStream(client, sinfo); // the frames of the stream after this are dropped
+	return SendErrorMessage(&(client->socketex), client->parser.version, stream_id);
+}
+
+int AppendSocketToManager(SOCKET socket, ADDRESS address)
 {
 	if (clients_count < MAX_CLIENTS) {
 		WSAEventSelect(socket, NULL, 0); // unset event for accepted socket.
 
-		clients[clients_count] = CreateClientInfo(socket);
+		clients[clients_count] = CreateClientInfo(socket, address);
 		clients_count++;
 
 		return clients_count - 1;
@@ -256,14 +548,47 @@ int AppendSocketToManager(SOCKET socket)
 
 void RemoveClientFromManager(CLIENTINFO* client)
 {
+	if (client->socketex.socket == (SOCKET)0) // already removed
+		return;
 #ifdef _ERROR_DEBUGGING
 	printf("[%s] Remove client %d\n", INFO_FLAGS, client->socketex.socket);
 #endif // _ERROR_DEBUGGING
 
 	DestroySocketExtend(&(client->socketex));
 
-	RemoveFile(client->temp_file_path);
-	free(client->temp_file_path);
+	for (int i = 0; i < MAX_STREAMS; ++i) {
+		STREAMINFO* sinfo = client->streams + i;
+		CloseFile(sinfo->response_file);
+		sinfo->response_file = NULL;
+		if (sinfo->job_id != JOB_NONE && sinfo->temp_file_path != NULL) // keep the temp file for resuming
+			DetachJob(client, sinfo);
+		else if (sinfo->temp_file_path != NULL)
+			RemoveFile(sinfo->temp_file_path);
+		ResetStream(sinfo);
+	}
+}
+
+CLIENTINFO* FindClientByJob(ullong job_id)
+{
+	CLIENTINFO* found = NULL;
+	EnterCriticalSection(&critical_section);
+	for (int i = 0; i < clients_count && found == NULL; ++i) {
+		if (clients[i].socketex.socket == (SOCKET)0)
+			continue;
+		for (int k = 0; k < MAX_STREAMS; ++k) {
+			if (clients[i].streams[k].request_type != RT_INVALID && clients[i].streams[k].job_id == job_id) {
+				found = clients + i;
+				break;
+			}
+		}
+	}
+	LeaveCriticalSection(&critical_section);
+	return found;
+}
+
+int IsOwner(const CLIENTINFO* client, IN_ADDR owner)
+{
+	return client->address.sin_addr.s_addr == owner.s_addr;
 }
 
 CLIENTINFO* GetClientInfo(OVERLAPPED* socketex_overlapped)
@@ -271,11 +596,447 @@ CLIENTINFO* GetClientInfo(OVERLAPPED* socketex_overlapped)
 	return (CLIENTINFO*)socketex_overlapped;
 }
 
+CLIENTINFO* GetClientInfo(SOCKETEX* socketex)
+{
+	return (CLIENTINFO*)socketex;
+}
+
+#pragma endregion
+
+#pragma region Job Manager
+
+void DetachJob(CLIENTINFO* client, STREAMINFO* sinfo)
+{
+	ExpireJobs();
+	CheckpointUpload(sinfo, 1); // the bytes written since the last checkpoint are kept only if they can be synced
+
+	// a free slot, or the oldest job
+	JOBINFO* slot = jobs;
+	for (int i = 0; i < MAX_JOBS && slot->id != JOB_NONE; ++i) {
+		if (jobs[i].id == JOB_NONE || jobs[i].detached_time < slot->detached_time)
+			slot = jobs + i;
+	}
+	if (slot->id != JOB_NONE)
+		DropJob(slot);
+
+	slot->id = sinfo->job_id;
+	slot->owner = client->address.sin_addr;
+	slot->request_type = sinfo->request_type;
+	slot->key = sinfo->key;
+	slot->temp_file_path = sinfo->temp_file_path;
+	slot->committed_size = sinfo->committed_size;
+	slot->uploaded = sinfo->uploaded;
+	memcpy_s(slot->content_digest, DIGEST_SIZE, sinfo->content_digest, DIGEST_SIZE);
+	slot->detached_time = time(0);
+	sinfo->temp_file_path = NULL;
+	sinfo->job_id = JOB_NONE;
+#ifdef _ERROR_DEBUGGING
+	printf("[%s] Keep job %llu (%u bytes uploaded)\n", INFO_FLAGS, slot->id, slot->committed_size);
+#endif // _ERROR_DEBUGGING
+}
+
+int AttachJob(CLIENTINFO* client, STREAMINFO* sinfo, ullong job_id)
+{
+	ExpireJobs();
+
+	if (job_id == JOB_NONE)
+		return FAIL;
+	JOBINFO* job = FindJob(job_id);
+	if (job == NULL) { // the old connection of the job may not notice the loss yet -> close it, only for its owner
+		CLIENTINFO* old = FindClientByJob(job_id);
+		if (old == NULL || old == client || !IsOwner(client, old->address.sin_addr))
+			return FAIL;
+		EnterCriticalSection(&critical_section);
+		RemoveClientFromManager(old);
+		LeaveCriticalSection(&critical_section);
+		if ((job = FindJob(job_id)) == NULL)
+			return FAIL;
+	}
+	if (!IsOwner(client, job->owner)) // knowing the ID is not enough
+		return FAIL;
+
+	sinfo->job_id = job->id;
+	sinfo->request_type = job->request_type;
+	sinfo->key = job->key;
+	sinfo->temp_file_path = job->temp_file_path;
+	sinfo->written_size = job->committed_size;
+	sinfo->committed_size = job->committed_size;
+	sinfo->checkpoint_time = time(0);
+	sinfo->uploaded = job->uploaded;
+	memcpy_s(sinfo->content_digest, DIGEST_SIZE, job->content_digest, DIGEST_SIZE);
+	if (!sinfo->uploaded) // drop a partial write after the checkpoint
+		TruncateFile(sinfo->temp_file_path, sinfo->committed_size);
+
+	job->id = JOB_NONE;
+	job->temp_file_path = NULL;
+	return SUCCESS;
+}
+
+JOBINFO* FindJob(ullong job_id)
+{
+	for (int i = 0; i < MAX_JOBS; ++i) {
+		if (jobs[i].id == job_id)
+			return jobs + i;
+	}
+	return NULL;
+}
+
+void DropJob(JOBINFO* job)
+{
+	RemoveFile(job->temp_file_path);
+	free(job->temp_file_path);
+	job->temp_file_path = NULL;
+	job->id = JOB_NONE;
+}
+
+void ExpireJobs()
+{
+	time_t now = time(0);
+	for (int i = 0; i < MAX_JOBS; ++i) {
+		if (jobs[i].id != JOB_NONE && now - jobs[i].detached_time > JOB_RETAIN_SECONDS)
+			DropJob(jobs + i);
+	}
+}
+
+#pragma endregion
+
+#pragma region Handle Manager
+
+int RetainUpload(CLIENTINFO* client, STREAMINFO* sinfo)
+{
+	ExpireHandles();
+
+	// a free slot, or the least recently used upload not being read
+	HANDLEINFO* slot = NULL;
+	for (int i = 0; i < MAX_HANDLES; ++i) {
+		if (handles[i].id == HANDLE_NONE) {
+			slot = handles + i;
+			break;
+		}
+		if (handles[i].readers == 0 && (slot == NULL || handles[i].last_used < slot->last_used))
+			slot = handles + i;
+	}
+	ullong handle_id;
+	do {
+		handle_id = CreateRandomID();
+	} while (handle_id != HANDLE_NONE && FindHandle(handle_id) != NULL);
+	if (slot == NULL || sinfo->committed_size == 0 || handle_id == HANDLE_NONE) // all uploads are being read, nothing to keep or no random ID
+		return FailStream(client, sinfo);
+	if (slot->id != HANDLE_NONE)
+		DropHandle(slot);
+
+	slot->id = handle_id;
+	slot->owner = client->address.sin_addr;
+	slot->path = sinfo->temp_file_path;
+	slot->size = sinfo->committed_size;
+	memcpy_s(slot->content_digest, DIGEST_SIZE, sinfo->content_digest, DIGEST_SIZE);
+	slot->last_used = time(0);
+	slot->readers = 0;
+	sinfo->temp_file_path = NULL;
+#ifdef _ERROR_DEBUGGING
+	printf("[%s] Keep %u bytes from client %d as handle %llu\n", INFO_FLAGS, slot->size, client->socketex.socket, slot->id);
+#endif // _ERROR_DEBUGGING
+
+	uint stream_id = sinfo->id;
+	CloseStream(client, sinfo);
+	return SendHandleMessage(&(client->socketex), client->parser.version, stream_id, handle_id, HANDLE_TTL_SECONDS);
+}
+
+HANDLEINFO* FindHandle(ullong handle_id)
+{
+	for (int i = 0; i < MAX_HANDLES; ++i) {
+		if (handles[i].id != HANDLE_NONE && handles[i].id == handle_id)
+			return handles + i;
+	}
+	return NULL;
+}
+
+void DropHandle(HANDLEINFO* handle)
+{
+	RemoveFile(handle->path);
+	free(handle->path);
+	handle->path = NULL;
+	handle->id = HANDLE_NONE;
+}
+
+void ExpireHandles()
+{
+	time_t now = time(0);
+	for (int i = 0; i < MAX_HANDLES; ++i) {
+		if (handles[i].id != HANDLE_NONE && handles[i].readers == 0 && now - handles[i].last_used > HANDLE_TTL_SECONDS)
+			DropHandle(handles + i);
+	}
+}
+
+#pragma endregion
+
+#pragma region Stripe Manager
+
+STRIPEJOB* FindStripeJob(ullong job_id)
+{
+	for (int i = 0; i < MAX_STRIPE_JOBS; ++i) {
+		if (stripe_jobs[i].id != JOB_NONE && stripe_jobs[i].id == job_id)
+			return stripe_jobs + i;
+	}
+	return NULL;
+}
+
+STRIPEJOB* CreateStripeJob(ullong job_id, int request_type, uint key, uint count, uint size)
+{
+	STRIPEJOB* job = NULL;
+	for (int i = 0; i < MAX_STRIPE_JOBS && job == NULL; ++i) {
+		if (stripe_jobs[i].id == JOB_NONE)
+			job = stripe_jobs + i;
+	}
+	if (job == NULL)
+		return NULL;
+
+	// the ranges are written in place: the file must exist
+	job->path = CreateUniquePath(DEFAULT_TEMP_FOLDER, strlen(DEFAULT_TEMP_FOLDER));
+	FILE* fp = job->path != NULL ? OpenFile(job->path, FOM_WRITE) : NULL;
+	if (fp == NULL) {
+		free(job->path);
+		job->path = NULL;
+		return NULL;
+	}
+	CloseFile(fp);
+
+	job->id = job_id;
+	job->request_type = request_type;
+	job->key = key;
+	job->size = size;
+	job->count = count;
+	job->joined = 0;
+	job->uploaded = 0;
+	job->members = 0;
+	job->failed = 0;
+	return job;
+}
+
+void DropStripeJob(STRIPEJOB* job)
+{
+	RemoveFile(job->path);
+	free(job->path);
+	job->path = NULL;
+	job->id = JOB_NONE;
+}
+
+void LeaveStripeJob(STREAMINFO* sinfo)
+{
+	STRIPEJOB* job = sinfo->stripe;
+	if (job == NULL)
+		return;
+	sinfo->stripe = NULL;
+	job->members--;
+	if (!job->failed && job->uploaded < job->count) // the job can not complete without the range
+		FailStripeJob(job);
+	if (job->members == 0 && job->id != JOB_NONE) // the last stream may leave inside FailStripeJob()
+		DropStripeJob(job);
+}
+
+void FailStripeJob(STRIPEJOB* job)
+{
+	job->failed = 1;
+#ifdef _ERROR_DEBUGGING
+	printf("[%s] Fail the striped job %llu (%u of %u ranges uploaded)\n", WARNING_FLAGS, job->id, job->uploaded, job->count);
+#endif // _ERROR_DEBUGGING
+	EnterCriticalSection(&critical_section); // the accept thread appends clients
+	for (int i = 0; i < clients_count; ++i) {
+		for (int k = 0; k < MAX_STREAMS && clients[i].socketex.socket != (SOCKET)0; ++k) {
+			if (clients[i].streams[k].stripe == job && FailStream(clients + i, clients[i].streams + k) == FATAL_ERROR)
+				RemoveClientFromManager(clients + i);
+		}
+	}
+	LeaveCriticalSection(&critical_section);
+}
+
+int CompleteStripe(CLIENTINFO* client, STREAMINFO* sinfo)
+{
+	if (sinfo->committed_size != sinfo->range_length) // the range is not complete
+		return FailStream(client, sinfo);
+
+	STRIPEJOB* job = sinfo->stripe;
+	job->uploaded++;
+	if (job->uploaded < job->count) // wait for the other ranges
+		return SUCCESS;
+
+#ifdef _ERROR_DEBUGGING
+	printf("[%s] Success receive all %u ranges of the striped job %llu\n", INFO_FLAGS, job->count, job->id);
+#endif // _ERROR_DEBUGGING
+	int status = SUCCESS;
+	EnterCriticalSection(&critical_section); // the accept thread appends clients
+	for (int i = 0; i < clients_count; ++i) {
+		CLIENTINFO* member = clients + i;
+		int responding = 0;
+		for (int k = 0; k < MAX_STREAMS && member->socketex.socket != (SOCKET)0; ++k)
+			responding |= member->streams[k].stripe == job;
+		if (!responding)
+			continue;
+
+		int ret = Respond(member);
+		if (member == client)
+			status = ret;
+		else if (ret == FATAL_ERROR)
+			RemoveClientFromManager(member);
+	}
+	LeaveCriticalSection(&critical_section);
+	return status;
+}
+
+#pragma endregion
+
+#pragma region Result Cache
+
+CACHEENTRY* FindCache(const stream digest, int request_type, uint key, uint size)
+{
+	for (int i = 0; i < MAX_CACHE_ENTRIES; ++i) {
+		if (cache[i].result_path != NULL && cache[i].request_type == request_type && cache[i].key == key &&
+			cache[i].size == size && memcmp(cache[i].digest, digest, DIGEST_SIZE) == 0)
+			return cache + i;
+	}
+	return NULL;
+}
+
+void InsertCache(const stream digest, int request_type, uint key, uint size, IN_ADDR owner, char* result_path)
+{
+	if (size > CACHE_MAX_BYTES || FindCache(digest, request_type, key, size) != NULL) { // too large, or stored by another stream
+		RemoveFile(result_path);
+		free(result_path);
+		return;
+	}
+
+	CACHEENTRY* slot;
+	while (1) {
+		// a free slot, and the least recently used result not being read
+		CACHEENTRY* lru = NULL;
+		slot = NULL;
+		for (int i = 0; i < MAX_CACHE_ENTRIES; ++i) {
+			if (cache[i].result_path == NULL) {
+				if (slot == NULL)
+					slot = cache + i;
+			}
+			else if (cache[i].readers == 0 && (lru == NULL || cache[i].last_used < lru->last_used))
+				lru = cache + i;
+		}
+		if (slot != NULL && cache_bytes + size <= CACHE_MAX_BYTES)
+			break;
+		if (lru == NULL) { // all results are being read
+			RemoveFile(result_path);
+			free(result_path);
+			return;
+		}
+		DropCache(lru);
+		cache_metrics.evictions++;
+	}
+
+	memcpy_s(slot->digest, DIGEST_SIZE, digest, DIGEST_SIZE);
+	slot->request_type = request_type;
+	slot->key = key;
+	slot->size = size;
+	slot->owner = owner;
+	slot->result_path = result_path;
+	slot->last_used = ++cache_clock;
+	slot->readers = 0;
+	cache_bytes += size;
+}
+
+void DropCache(CACHEENTRY* entry)
+{
+	RemoveFile(entry->result_path);
+	free(entry->result_path);
+	entry->result_path = NULL;
+	cache_bytes -= entry->size;
+}
+
+void HashUpload(STREAMINFO* sinfo, const stream data, uint length)
+{
+	if (sinfo->stripe != NULL) // a range has no digest
+		return;
+	if (sinfo->written_size == 0) // a new upload. A resumed one is hashed from the temp file once uploaded
+		BeginHash(&(sinfo->upload_hash));
+	if (sinfo->upload_hash.hash == NULL)
+		return;
+	if (sinfo->written_size + length > CACHE_MAX_BYTES || UpdateHash(&(sinfo->upload_hash), data, length) != SUCCESS)
+		AbortHash(&(sinfo->upload_hash));
+}
+
+int DigestUpload(STREAMINFO* sinfo)
+{
+	if (sinfo->committed_size > CACHE_MAX_BYTES) { // never cached
+		AbortHash(&(sinfo->upload_hash));
+		return SUCCESS;
+	}
+	if (sinfo->upload_hash.hash != NULL) // hashed while uploading
+		return FinishHash(&(sinfo->upload_hash), sinfo->content_digest) == SUCCESS ? SUCCESS : FAIL;
+
+	FILE* fp = OpenFile(sinfo->temp_file_path, FOM_READ);
+	if (fp == NULL)
+		return FAIL;
+	int status = HashFile(fp, sinfo->content_digest) == SUCCESS ? SUCCESS : FAIL;
+	CloseFile(fp);
+	return status;
+}
+
+int OpenResponse(STREAMINFO* sinfo)
+{
+	// a byte range of a kept upload or a striped job has no hash: not cached
+	int cacheable = sinfo->stripe == NULL && (sinfo->handle == NULL || sinfo->committed_size == sinfo->handle->size);
+	CACHEENTRY* entry = cacheable ? FindCache(sinfo->content_digest, sinfo->request_type, sinfo->key, sinfo->committed_size) : NULL;
+	if (entry != NULL && (sinfo->response_file = OpenFile(entry->result_path, FOM_READ)) != NULL) { // the same job has run
+		sinfo->cached = entry;
+		entry->readers++;
+		entry->last_used = ++cache_clock;
+		cache_metrics.hits++;
+	}
+	else {
+		const char* source_path = sinfo->handle != NULL ? sinfo->handle->path :
+			sinfo->stripe != NULL ? sinfo->stripe->path : sinfo->temp_file_path;
+		if (source_path == NULL) // a probed job: the cached result has gone
+			return FAIL;
+		if ((sinfo->response_file = OpenFile(source_path, FOM_READ)) == NULL)
+			return FAIL;
+		cache_metrics.misses++;
+		if (cacheable && sinfo->temp_file_position == 0) { // record the whole result for the next same jobs
+			sinfo->cache_file_path = CreateUniquePath(DEFAULT_CACHE_FOLDER, strlen(DEFAULT_CACHE_FOLDER));
+			if (sinfo->cache_file_path != NULL)
+				sinfo->cache_file = OpenFile(sinfo->cache_file_path, FOM_WRITE);
+			if (sinfo->cache_file == NULL)
+				ReleaseResponse(sinfo);
+		}
+	}
+#ifdef _ERROR_DEBUGGING
+	PrintCacheMetrics();
+#endif // _ERROR_DEBUGGING
+	// a cached result is the whole content: "range_offset" is 0
+	return MoveFilePointer(sinfo->response_file, SEEK_SET, (llong)sinfo->range_offset + sinfo->temp_file_position) ? SUCCESS : FAIL;
+}
+
+void ReleaseResponse(STREAMINFO* sinfo)
+{
+	if (sinfo->cached != NULL) {
+		sinfo->cached->readers--;
+		sinfo->cached = NULL;
+	}
+	if (sinfo->cache_file_path != NULL) { // the record is not finished
+		CloseFile(sinfo->cache_file);
+		RemoveFile(sinfo->cache_file_path);
+		free(sinfo->cache_file_path);
+	}
+	sinfo->cache_file = NULL;
+	sinfo->cache_file_path = NULL;
+}
+
+void PrintCacheMetrics()
+{
+	printf("[%s] Result cache: %u hits, %u misses, %u evictions, %llu bytes served, %u bytes stored\n", INFO_FLAGS,
+		cache_metrics.hits, cache_metrics.misses, cache_metrics.evictions, cache_metrics.served_bytes, cache_bytes);
+}
+
 #pragma endregion
 
 #pragma region Handle Respond
 
-int ProcessData(int request_type, int key, FILE* tempfp, stream* oresult, uint* oresult_len)
+int ProcessData(int request_type, int key, FILE* tempfp, uint length, stream* oresult, uint* oresult_len)
 {
 	if (oresult == NULL || oresult_len == NULL)
 		return INVALID_ARGUMENTS;
@@ -284,7 +1045,7 @@ int ProcessData(int request_type, int key, FILE* tempfp, stream* oresult, uint*
 	stream buffer = NULL;
 	uint read_count;
 
-	int ret = ReadFromFile(tempfp, MESSAGE_PAYLOAD_MAX_SIZE, &buffer, &read_count);
+	int ret = ReadFromFile(tempfp, length, &buffer, &read_count);
 
 	if (ret != FATAL_ERROR) {
 		stream result = NULL;
@@ -301,43 +1062,116 @@ int ProcessData(int request_type, int key, FILE* tempfp, stream* oresult, uint*
 	return ret;
 }
 
-int Respond(CLIENTINFO* client)
+int IsResponding(const STREAMINFO* sinfo)
 {
-	if (client->temp_file_position == UEOF) { // eof -> send Data End Message
-		RemoveFile(client->temp_file_path);
+	if (sinfo->request_type == RT_BATCH)
+		return sinfo->batch_results.head != NULL;
+	if (sinfo->stripe != NULL && sinfo->stripe->uploaded < sinfo->stripe->count) // wait for the other ranges
+		return 0;
+	// Data End Message was sent -> wait for the client closes the credits
+	return sinfo->request_type != RT_INVALID && sinfo->uploaded && sinfo->temp_file_position != UEOF;
+}
+
+int RespondStream(CLIENTINFO* client, STREAMINFO* sinfo)
+{
+	if (sinfo->request_type == RT_BATCH)
+		return RespondBatch(client, sinfo);
+
+	if (sinfo->response_file == NULL && OpenResponse(sinfo) != SUCCESS) // the first chunk of the response
+		return FailStream(client, sinfo);
+
+	stream message_content = NULL;
+	uint message_content_len = 0;
+	uint chunk = MESSAGE_PAYLOAD_MAX_SIZE;
+	if ((sinfo->handle != NULL || sinfo->stripe != NULL) && sinfo->committed_size - sinfo->temp_file_position < chunk) // the range ends before the file
+		chunk = sinfo->committed_size - sinfo->temp_file_position;
+	int read_status;
+	if (chunk == 0) // the end of the byte range
+		read_status = FAIL;
+	else if (sinfo->cached != NULL) { // the result as is
+		read_status = ReadFromFile(sinfo->response_file, chunk, &message_content, &message_content_len);
+		cache_metrics.served_bytes += message_content_len;
+	}
+	else
+		read_status = ProcessData(sinfo->request_type, sinfo->key, sinfo->response_file, chunk, &message_content, &message_content_len);
+	if (read_status == FATAL_ERROR)
+		return FailStream(client, sinfo);
+	if (sinfo->cache_file != NULL && message_content_len > 0 &&
+		WriteToFile(sinfo->cache_file, message_content_len, message_content) != SUCCESS)
+		ReleaseResponse(sinfo); // stop recording, the response goes on
+
+	int status = WAIT;
+	if (message_content_len > 0) {
+		status = SendDataMessage(&(client->socketex), client->parser.version, client->parser.capabilities, sinfo->id, message_content, message_content_len);
+		sinfo->temp_file_position += message_content_len;
+		sinfo->send_window.transfered++;
+	}
+	DestroyStream(message_content);
+
+	if (read_status == FAIL && status != FATAL_ERROR) { // eof -> send Data End Message
+		if (message_content_len > 0 && !(client->parser.capabilities & CAP_CREDIT)) // stop-and-wait: after the ACK Packet of the last chunk
+			return status;
+		if (sinfo->cache_file != NULL && sinfo->temp_file_position == sinfo->committed_size) { // the whole result is recorded
+			CloseFile(sinfo->cache_file);
+			sinfo->cache_file = NULL;
+			InsertCache(sinfo->content_digest, sinfo->request_type, sinfo->key, sinfo->committed_size,
+				client->address.sin_addr, sinfo->cache_file_path);
+			sinfo->cache_file_path = NULL;
+		}
+		ReleaseResponse(sinfo);
+		sinfo->temp_file_position = UEOF; // keep the temp file until the client closes the credits, the download may be resumed
+		CloseFile(sinfo->response_file);
+		sinfo->response_file = NULL;
 #ifdef _ERROR_DEBUGGING
-		printf("[%s] Success respond result to client %d\n", INFO_FLAGS, client->socketex.socket);
+		printf("[%s] Success respond result to client %d (stream %u)\n", INFO_FLAGS, client->socketex.socket, sinfo->id);
 #endif
-		UpdateStatus(&(client->socketex), SS_FREE);
-		return SendDataMessage(&(client->socketex), NULLSTR, 0);
+		status = SendDataMessage(&(client->socketex), client->parser.version, client->parser.capabilities, sinfo->id, NULLSTR, 0);
+		if (status != FATAL_ERROR && !(client->parser.capabilities & CAP_CREDIT)) // stop-and-wait: Data End Message is not ACKed -> the job completes
+			CloseStream(client, sinfo);
 	}
+	return status;
+}
 
-	FILE* tempfile = OpenFile(client->temp_file_path, FOM_READ);
-	if (tempfile == NULL)
-		return FAIL;
-
-	int status = FAIL;
-	stream message_content;
-	uint message_content_len;
-
-	MoveFilePointer(tempfile, SEEK_SET, client->temp_file_position);
-	int read_status = ProcessData(client->request_type, client->key, tempfile, &message_content, &message_content_len);
+int RespondBatch(CLIENTINFO* client, STREAMINFO* sinfo)
+{
+	BATCHTASK* task = PopBatchTask(&(sinfo->batch_results));
+	int status = SendBatchResult(&(client->socketex), client->parser.version, client->parser.capabilities, sinfo->id, task->index, task->data, task->length, task->status != SUCCESS);
+	DestroyBatchTask(task);
+	if (status == FATAL_ERROR || status == FAIL)
+		return FATAL_ERROR;
+	sinfo->send_window.transfered++;
+
+	// the entries in progress never exceed the credit: new credit for each sent result
+	uint limit;
+	if (sinfo->batch_received < sinfo->batch_total && ConsumeCredit(&(sinfo->receive_window), &limit) == SUCCESS)
+		status = SendACK(&(client->socketex), client->parser.version, sinfo->id, limit);
+	return status;
+}
 
-	if (read_status != FATAL_ERROR) {
-		UpdateStatus(&(client->socketex), SS_SEND);
-		status = SendDataMessage(&(client->socketex), message_content, message_content_len);
-		if (status == SUCCESS || status == WAIT) {
+int Respond(CLIENTINFO* client)
+{
+	int status = WAIT;
+	int sent = 1;
+	// round robin: one chunk of each responding stream in a round, while the streams have credit
+	while (sent) {
+		sent = 0;
+		for (int i = 0; i < MAX_STREAMS; ++i) {
+			if (IsSendQueuePaused(&(client->socketex))) { // slow reader -> stop reading temp files until the queue drains
+				client->paused_operation |= CS_RESPONDING;
+				return status;
+			}
 
-			client->temp_file_position += message_content_len;
+			STREAMINFO* sinfo = client->streams + (client->next_stream + i) % MAX_STREAMS;
+			if (!IsResponding(sinfo) || !HasCredit(&(sinfo->send_window))) // continue on the next ack
+				continue;
 
-			if (read_status == FAIL) { // end of file
-				client->temp_file_position = UEOF;
-			}
+			status = RespondStream(client, sinfo);
+			if (status == FATAL_ERROR || status == FAIL)
+				return status;
+			sent = 1;
 		}
+		client->next_stream = (client->next_stream + 1) % MAX_STREAMS; // another stream goes first in the next round
 	}
-
-	DestroyStream(message_content);
-	CloseFile(tempfile);
 	return status;
 }
 
@@ -345,66 +1179,359 @@ int Respond(CLIENTINFO* client)
 
 #pragma region Handle Request
 
-int HandleDataRequest(CLIENTINFO* client, const stream payload, uint payload_length)
+int HandleDataRequest(CLIENTINFO* client, STREAMINFO* sinfo, const stream payload, uint payload_length)
 {
-	if (client->temp_file_path == NULL) {
+	if (sinfo->uploaded) // the upload has ended
+		return FAIL;
+
+	if (sinfo->temp_file_path == NULL && sinfo->stripe == NULL) {
 		// create temp file to store data: random name . All temp file is in DEFAULT_TEMP_FOLDER
-		client->temp_file_path = CreateUniquePath(DEFAULT_TEMP_FOLDER, strlen(DEFAULT_TEMP_FOLDER));
+		sinfo->temp_file_path = CreateUniquePath(DEFAULT_TEMP_FOLDER, strlen(DEFAULT_TEMP_FOLDER));
 	}
 
 	if (payload_length != 0) {
-		FILE* tempfp = OpenFile(client->temp_file_path, FOM_APPEND);
-		if (tempfp != NULL) {
-			WriteToFile(tempfp, payload_length, payload);
-			CloseFile(tempfp);
+		if (sinfo->stripe != NULL && payload_length > sinfo->range_length - sinfo->written_size) // beyond the range
+			return FailStream(client, sinfo);
+		if (payload_length >= UEOF - sinfo->written_size) // beyond the sizes the protocol can address (32-bit, UEOF reserved)
+			return FailStream(client, sinfo);
+		FILE* tempfp = OpenUploadFile(sinfo);
+		if (tempfp == NULL)
+			return FailStream(client, sinfo);
+		int write_status = WriteToFile(tempfp, payload_length, payload);
+		CloseFile(tempfp);
+		if (write_status == SUCCESS) {
+			HashUpload(sinfo, payload, payload_length);
+			sinfo->written_size += payload_length;
+			write_status = CheckpointUpload(sinfo, 0);
 		}
-		return SUCCESS;
+		if (write_status != SUCCESS) // the checkpoint stays at the last synced bytes
+			return FailStream(client, sinfo);
+		return SendAckReceiveStatus(client, sinfo);
 	}
-	else { // Data End -> send result
+	else { // Data End -> close the credits of the upload (if negotiated) and send result
+		if (CheckpointUpload(sinfo, 1) != SUCCESS) // the whole upload is the checkpoint
+			return FailStream(client, sinfo);
 #ifdef _ERROR_DEBUGGING
-		printf("[%s] Success receive all file from client %d\n", INFO_FLAGS, client->socketex.socket);
+		printf("[%s] Success receive all file from client %d (stream %u)\n", INFO_FLAGS, client->socketex.socket, sinfo->id);
 #endif
-		UpdateStatus(&(client->socketex), SS_SEND);
+		sinfo->uploaded = 1;
+		if ((client->parser.capabilities & CAP_CREDIT) &&
+			SendACK(&(client->socketex), client->parser.version, sinfo->id, FLOW_CREDIT_END) == FATAL_ERROR)
+			return FATAL_ERROR;
+		if (sinfo->stripe == NULL && DigestUpload(sinfo) != SUCCESS) // the cache key of the results
+			return FailStream(client, sinfo);
+		if (sinfo->request_type == RT_STORE) // keep the upload instead of responding
+			return RetainUpload(client, sinfo);
+		if (sinfo->stripe != NULL)
+			return CompleteStripe(client, sinfo);
+		client->parser.mode = PM_ACK; // [v1] the client sends only ACK packets until the response completes
 		return Respond(client);
 	}
 }
 
-int HandleEncryptDecryptRequest(CLIENTINFO* client, int request_type, const stream payload)
+FILE* OpenUploadFile(STREAMINFO* sinfo)
+{
+	if (sinfo->stripe == NULL)
+		return OpenFile(sinfo->temp_file_path, FOM_APPEND);
+
+	FILE* fp = OpenFile(sinfo->stripe->path, FOM_UPDATE);
+	if (fp != NULL && !MoveFilePointer(fp, SEEK_SET, (llong)sinfo->range_offset + sinfo->written_size)) {
+		CloseFile(fp);
+		fp = NULL;
+	}
+	return fp;
+}
+
+int CheckpointUpload(STREAMINFO* sinfo, int force)
 {
-	client->request_type = request_type;
-	client->key = ToHostByteOrder(ToUnsignedInt(payload));
+	if (sinfo->written_size == sinfo->committed_size)
+		return SUCCESS;
+	if (sinfo->job_id != JOB_NONE) { // only the checkpoint of a resumable job must survive a crash
+		if (!force && sinfo->written_size - sinfo->committed_size < CHECKPOINT_BYTES &&
+			time(0) - sinfo->checkpoint_time < CHECKPOINT_SECONDS)
+			return SUCCESS;
+		FILE* fp = OpenUploadFile(sinfo);
+		int status = fp != NULL ? SyncFile(fp) : FAIL;
+		CloseFile(fp);
+		if (status != SUCCESS)
+			return FAIL;
+		sinfo->checkpoint_time = time(0);
+	}
+	sinfo->committed_size = sinfo->written_size;
 	return SUCCESS;
 }
 
-int Request(CLIENTINFO* client)
+int HandleEncryptDecryptRequest(CLIENTINFO* client, uint stream_id, int request_type, const stream payload, uint payload_length)
+{
+	if (payload_length < sizeof(uint) || FindStream(client, stream_id) != NULL) // invalid key or the stream is running a job
+		return FAIL;
+	STREAMINFO* sinfo = OpenStream(client, stream_id);
+	if (sinfo == NULL) // too many jobs on the connection
+		return client->parser.version >= PROTOCOL_V2 ? SendErrorMessage(&(client->socketex), client->parser.version, stream_id) : FAIL;
+
+	sinfo->request_type = request_type;
+	sinfo->key = ToHostByteOrder(ToUnsignedInt(payload));
+	if ((client->parser.capabilities & CAP_RESUME) && payload_length > sizeof(uint) && payload[sizeof(uint)]) { // resumable request -> issue a job ID
+		ullong job_id;
+		do {
+			job_id = CreateRandomID();
+		} while (job_id != JOB_NONE && (FindJob(job_id) != NULL || FindClientByJob(job_id) != NULL));
+		if (job_id == JOB_NONE)
+			return FailStream(client, sinfo);
+		sinfo->job_id = job_id;
+		if (SendJobMessage(&(client->socketex), client->parser.version, sinfo->id, job_id, 0) == FATAL_ERROR)
+			return FATAL_ERROR;
+	}
+	return AcceptUpload(client, sinfo);
+}
+
+int HandleHelloRequest(CLIENTINFO* client, const FRAME* frame)
 {
-	stream payload;
-	uint payload_len;
-	int status;
+	int version;
+	uint capabilities;
+	if (ExtractHello(frame, &version, &capabilities) != SUCCESS || version < PROTOCOL_V1)
+		return FAIL;
+	// choose the newest version and the capabilities supported by both sides
+	client->parser.version = version > PROTOCOL_VERSION ? PROTOCOL_VERSION : version;
+	client->parser.capabilities = capabilities & CAP_SUPPORTED;
+	if (!(client->parser.capabilities & CAP_CREDIT)) // the streams share the connection by credit, the batch entries in progress are bounded by credit
+		client->parser.capabilities &= ~(CAP_STREAMS | CAP_BATCH);
+	return SendHello(&(client->socketex), client->parser.version, client->parser.capabilities);
+}
 
-	int command = ExtractMessage(client->socketex.data, client->socketex.expected_transfer, &payload, &payload_len);
-	if (command == MC_ENCRYPT) {
-		status = HandleEncryptDecryptRequest(client, RT_ENCRYPT, payload);
+int HandleResumeRequest(CLIENTINFO* client, const FRAME* frame)
+{
+	ullong job_id;
+	uint downloaded;
+	if (!(client->parser.capabilities & CAP_RESUME) || FindStream(client, frame->stream_id) != NULL ||
+		ExtractJobPayload(frame, &job_id, &downloaded) != SUCCESS)
+		return FAIL;
+
+	STREAMINFO* sinfo = OpenStream(client, frame->stream_id);
+	if (sinfo == NULL || AttachJob(client, sinfo, job_id) != SUCCESS) { // expired or not owned -> the client must start over
+#ifdef _ERROR_DEBUGGING
+		printf("[%s] Client %d resumes unknown job %llu\n", WARNING_FLAGS, client->socketex.socket, job_id);
+#endif // _ERROR_DEBUGGING
+		if (sinfo != NULL)
+			ResetStream(sinfo);
+		return SendErrorMessage(&(client->socketex), client->parser.version, frame->stream_id);
 	}
-	else if (command == MC_DECRYPT) {
-		status = HandleEncryptDecryptRequest(client, RT_DECRYPT, payload);
+
+	if (!sinfo->uploaded) // continue the upload from the checkpoint, with new credit
+		return SendJobMessage(&(client->socketex), client->parser.version, sinfo->id, job_id, sinfo->committed_size);
+
+	// continue the download
+	sinfo->temp_file_position = downloaded;
+	client->parser.mode = PM_ACK;
+	if (SendJobMessage(&(client->socketex), client->parser.version, sinfo->id, job_id, JOB_UPLOADED) == FATAL_ERROR)
+		return FATAL_ERROR;
+	return Respond(client);
+}
+
+int HandleProbeRequest(CLIENTINFO* client, const FRAME* frame)
+{
+	STREAMINFO* sinfo = FindStream(client, frame->stream_id);
+	if (!(client->parser.capabilities & CAP_PROBE) || sinfo == NULL)
+		return FAIL;
+	char digest[DIGEST_SIZE];
+	uint size;
+	if ((sinfo->request_type != RT_ENCRYPT && sinfo->request_type != RT_DECRYPT) || sinfo->uploaded ||
+		sinfo->written_size > 0 || ExtractProbe(frame, digest, &size) != SUCCESS)
+		return FAIL;
+
+	// only the uploader of the content may skip the upload: a hit would give the result to anyone who knows the digest
+	CACHEENTRY* entry = FindCache(digest, sinfo->request_type, sinfo->key, size);
+	if (entry == NULL || !IsOwner(client, entry->owner)) // upload as usual
+		return SendHeldMessage(&(client->socketex), client->parser.version, sinfo->id, 0);
+
+#ifdef _ERROR_DEBUGGING
+	printf("[%s] Client %d skips the upload of %u bytes (stream %u)\n", INFO_FLAGS, client->socketex.socket, size, sinfo->id);
+#endif // _ERROR_DEBUGGING
+	memcpy_s(sinfo->content_digest, DIGEST_SIZE, digest, DIGEST_SIZE);
+	sinfo->committed_size = size;
+	sinfo->uploaded = 1;
+	sinfo->job_id = JOB_NONE; // no temp file to keep
+	if (SendHeldMessage(&(client->socketex), client->parser.version, sinfo->id, 1) == FATAL_ERROR)
+		return FATAL_ERROR;
+	return Respond(client);
+}
+
+int HandleStoreRequest(CLIENTINFO* client, const FRAME* frame)
+{
+	if (!(client->parser.capabilities & CAP_STORE) || FindStream(client, frame->stream_id) != NULL)
+		return FAIL;
+	STREAMINFO* sinfo = OpenStream(client, frame->stream_id);
+	if (sinfo == NULL) // too many jobs on the connection
+		return SendErrorMessage(&(client->socketex), client->parser.version, frame->stream_id);
+
+	sinfo->request_type = RT_STORE;
+	return AcceptUpload(client, sinfo);
+}
+
+int HandleApplyRequest(CLIENTINFO* client, const FRAME* frame)
+{
+	ullong handle_id;
+	uint key, offset, length;
+	int request_type;
+	if (!(client->parser.capabilities & CAP_STORE) || FindStream(client, frame->stream_id) != NULL ||
+		ExtractApply(frame, &handle_id, &request_type, &key, &offset, &length) != SUCCESS)
+		return FAIL;
+
+	ExpireHandles();
+	HANDLEINFO* handle = FindHandle(handle_id);
+	STREAMINFO* sinfo = NULL;
+	if (handle == NULL || !IsOwner(client, handle->owner) || offset > handle->size ||
+		(sinfo = OpenStream(client, frame->stream_id)) == NULL) { // expired, kept by another client, out of the upload or too many jobs
+#ifdef _ERROR_DEBUGGING
+		printf("[%s] Client %d applies to unknown handle %llu or out of range\n", WARNING_FLAGS, client->socketex.socket, handle_id);
+#endif // _ERROR_DEBUGGING
+		return SendErrorMessage(&(client->socketex), client->parser.version, frame->stream_id);
 	}
-	else if (command == MC_DATA) {
-		status = HandleDataRequest(client, payload, payload_len);
+	if (length == 0 || length > handle->size - offset) // to the end of the upload
+		length = handle->size - offset;
+
+	sinfo->request_type = request_type;
+	sinfo->key = key;
+	sinfo->handle = handle;
+	handle->readers++;
+	handle->last_used = time(0);
+	sinfo->range_offset = offset;
+	sinfo->committed_size = length;
+	memcpy_s(sinfo->content_digest, DIGEST_SIZE, handle->content_digest, DIGEST_SIZE); // only used if the range is the whole upload
+	sinfo->uploaded = 1; // no upload: respond at once
+	return Respond(client);
+}
+
+int HandleStripeRequest(CLIENTINFO* client, const FRAME* frame)
+{
+	ullong job_id;
+	uint key, count, size, offset, length;
+	int request_type;
+	if (!(client->parser.capabilities & CAP_STRIPE) || FindStream(client, frame->stream_id) != NULL ||
+		ExtractStripe(frame, &job_id, &request_type, &key, &count, &size, &offset, &length) != SUCCESS)
+		return FAIL;
+
+	STRIPEJOB* job = FindStripeJob(job_id);
+	if (job == NULL)
+		job = CreateStripeJob(job_id, request_type, key, count, size);
+	else if (job->failed || job->joined >= job->count || job->request_type != request_type || job->key != key ||
+		job->count != count || job->size != size) // the job failed, or the range belongs to another job
+		job = NULL;
+	STREAMINFO* sinfo = job != NULL ? OpenStream(client, frame->stream_id) : NULL;
+	if (sinfo == NULL) {
+#ifdef _ERROR_DEBUGGING
+		printf("[%s] Client %d can not join the striped job %llu\n", WARNING_FLAGS, client->socketex.socket, job_id);
+#endif // _ERROR_DEBUGGING
+		if (job != NULL && job->members == 0)
+			DropStripeJob(job);
+		return SendErrorMessage(&(client->socketex), client->parser.version, frame->stream_id);
 	}
-	else {
+
+	sinfo->request_type = request_type;
+	sinfo->key = key;
+	sinfo->stripe = job;
+	job->members++;
+	job->joined++;
+	sinfo->range_offset = offset;
+	sinfo->range_length = length;
+	return AcceptUpload(client, sinfo);
+}
+
+int HandleBatchRequest(CLIENTINFO* client, const FRAME* frame)
+{
+	if (!(client->parser.capabilities & CAP_BATCH))
+		return FAIL;
+	FRAME entry = *frame;
+	if (InflateFrame(&entry, inflate_buffer, MESSAGE_PAYLOAD_MAX_SIZE) != SUCCESS)
+		return FAIL;
+
+	STREAMINFO* sinfo = FindStream(client, frame->stream_id);
+	if (entry.flags & FF_MANIFEST) { // open the batch
+		uint count;
+		if (sinfo != NULL || ExtractBatchManifest(&entry, &count) != SUCCESS)
+			return FAIL;
+		if ((sinfo = OpenStream(client, frame->stream_id)) == NULL) // too many jobs on the connection
+			return SendErrorMessage(&(client->socketex), client->parser.version, frame->stream_id);
+		sinfo->request_type = RT_BATCH;
+		sinfo->batch_serial = ++batch_serial;
+		sinfo->batch_total = count;
+		return AcceptUpload(client, sinfo);
+	}
+
+	if (sinfo == NULL) // the batch failed -> drop the rest of the entries
+		return SUCCESS;
+	uint index, key, content_len;
+	int request_type;
+	stream content;
+	if (sinfo->request_type != RT_BATCH || sinfo->batch_received >= sinfo->batch_total ||
+		ExtractBatchEntry(&entry, &index, &request_type, &key, &content, &content_len) != SUCCESS)
+		return FAIL;
+
+	BATCHTASK* task = CreateBatchTask(client, sinfo, index, request_type, key, content, content_len);
+	if (task == NULL)
+		return FailStream(client, sinfo);
+	sinfo->batch_received++;
+	if (batch_workers == 0) { // no worker thread -> process on the IO thread
+		ProcessBatchTask(task);
+		PushBatchTask(&(sinfo->batch_results), task);
+		return Respond(client);
+	}
+	sinfo->batch_pending++;
+	SubmitBatchTask(task);
+	return SUCCESS;
+}
+
+int Request(CLIENTINFO* client, const FRAME* frame)
+{
+	STREAMINFO* sinfo;
+	switch (frame->code) {
+	case MC_HELLO:
+		return HandleHelloRequest(client, frame);
+
+	case MC_ENCRYPT:
+		return HandleEncryptDecryptRequest(client, frame->stream_id, RT_ENCRYPT, frame->payload, frame->length);
+
+	case MC_DECRYPT:
+		return HandleEncryptDecryptRequest(client, frame->stream_id, RT_DECRYPT, frame->payload, frame->length);
+
+	case MC_RESUME:
+		return HandleResumeRequest(client, frame);
+
+	case MC_PROBE:
+		return HandleProbeRequest(client, frame);
+
+	case MC_STORE:
+		return HandleStoreRequest(client, frame);
+
+	case MC_APPLY:
+		return HandleApplyRequest(client, frame);
+
+	case MC_STRIPE:
+		return HandleStripeRequest(client, frame);
+
+	case MC_BATCH:
+		return HandleBatchRequest(client, frame);
+
+	case MC_DATA: {
+		if ((sinfo = FindStream(client, frame->stream_id)) == NULL) // the job failed -> drop the rest of the upload
+			return SUCCESS;
+		FRAME data = *frame;
+		if (InflateFrame(&data, inflate_buffer, MESSAGE_PAYLOAD_MAX_SIZE) != SUCCESS)
+			return FAIL;
+		return HandleDataRequest(client, sinfo, data.payload, data.length);
+	}
+
+	case MC_ACK:
+		if ((sinfo = FindStream(client, frame->stream_id)) == NULL) // the job failed
+			return SUCCESS;
+		return HandleACK(client, sinfo, ExtractACK(frame));
+
+	default:
 #ifdef _ERROR_DEBUGGING
 		printf("[%s] Receive message with invalid code from client %p\n", WARNING_FLAGS, client);
 #endif // _ERROR_DEBUGGING
-		status = FAIL;
-	}
-	DestroyStream(payload);
-	if (status == SUCCESS) {
-		if (client->socketex.status != SS_SEND) { // not receive Data End Message
-			status = SendAckReceiveStatus(client);
-		}
+		return FAIL;
 	}
-	return status;
 }
 
 #pragma endregion
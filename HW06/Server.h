@@ -10,31 +10,261 @@
 #pragma region Constant Definitions
 
 #define DEFAULT_TEMP_FOLDER "d:\\temp\\"
+#define DEFAULT_CACHE_FOLDER "d:\\temp\\cache\\"
 
 #define CS_FREE				0 // response complete and wait for another request
-#define CS_RECEIVING		1 // receive file
-#define CS_RESPONDING		2 // send response to client
+#define CS_RECEIVING		1 // receive requests. [Flag]
+#define CS_RESPONDING		2 // send response to client. [Flag]
+
+#define MAX_JOBS			256 // Interrupted jobs kept for resuming. The oldest is dropped if full
+#define JOB_RETAIN_SECONDS	600 // Interrupted jobs are dropped if not resumed in this time
+#define CHECKPOINT_BYTES	(4u * 1024 * 1024) // A resumable upload is synced to disk once this many bytes are written since the last checkpoint
+#define CHECKPOINT_SECONDS	2 // ...or once this time has passed since the last checkpoint
+
+#define MAX_CACHE_ENTRIES	1024 // Cached results. The least recently used is evicted if full
+#define CACHE_MAX_BYTES		(256u * 1024 * 1024) // Total size of cached results. The least recently used are evicted beyond this
+
+#define MAX_HANDLES			256 // Kept uploads (See MC_STORE). The least recently used not being read is dropped if full
+#define HANDLE_TTL_SECONDS	900 // Kept uploads are dropped if not used in this time. Each use restarts it
+
+#define MAX_STRIPE_JOBS		64 // Striped jobs (See MC_STRIPE) being uploaded or responded at once
+
+#define BATCH_WORKERS		4 // Worker threads process batch entries in parallel. Entries are processed on the IO thread if none can be created
 
 #pragma endregion
 
 #pragma region Type Definitions
 
-typedef struct _client_info {
+/// <summary>
+/// An entry of a batch (See MC_BATCH) processed by a worker thread
+/// </summary>
+typedef struct _batch_task {
 
-	SOCKETEX socketex; // Socket use for sending and receiving
+	struct _client_info* client; // The client sends the entry
+
+	SOCKET socket; // The socket of the client when the entry is received. The result is dropped if the client has been removed
+
+	uint stream_id; // The stream of the batch
+
+	uint serial; // The batch of the entry. The result is dropped if the batch has been closed (See "batch_serial" field in STREAMINFO)
+
+	uint index; // The index of the entry in the manifest
 
 	int request_type; // RT_ENCRYPT || RT_DECRYPT
 
 	uint key; // encryption|decryption key
 
+	stream data; // The content of the entry. Replaced by the result after processing
+
+	uint length; // The size of "data"
+
+	int status; // 1 if processed. 0 if fail to allocate memory
+
+	struct _batch_task* next; // The next task in the queue
+
+} BATCHTASK;
+
+/// <summary>
+/// A FIFO linked list of batch tasks
+/// </summary>
+typedef struct _batch_queue {
+
+	BATCHTASK* head; // The first task. NULL if the queue is empty
+
+	BATCHTASK* tail; // The last task
+
+} BATCHQUEUE;
+
+/// <summary>
+/// A job (Encrypt/Decrypt request or batch) running on a stream of a connection
+/// </summary>
+typedef struct _stream_info {
+
+	uint id; // The stream ID chosen by the client. Always STREAM_DEFAULT without CAP_STREAMS
+
+	int request_type; // RT_ENCRYPT || RT_DECRYPT || RT_BATCH || RT_STORE. RT_INVALID if the stream is free
+
+	uint key; // encryption|decryption key
+
 	uint temp_file_position; // The current file pointer int temp file (same as the successfully sent bytes)
 
-	//int status; // See CS_ for some client status
+	FLOWWINDOW receive_window; // Credit granted to the client for uploading
+
+	FLOWWINDOW send_window; // Credit granted by the client for downloading the result
 
 	char* temp_file_path; // The path to the temp file.
 
+	FILE* response_file; // The temp file opened for reading while responding. NULL otherwise
+
+	ullong job_id; // The job of the request, issued by the server. JOB_NONE if the request is not resumable
+
+	uint written_size; // Number of uploaded bytes written to the temp file. Ahead of "committed_size" until the next checkpoint
+
+	uint committed_size; // Number of uploaded bytes known to be in the temp file, synced to disk for a resumable job (See CheckpointUpload()). The checkpoint of the upload
+
+	time_t checkpoint_time; // When the upload of a resumable job was synced last
+
+	int uploaded; // 1 if receive Data End Request
+
+	struct _handle_info* handle; // [MC_APPLY] The kept upload the job processes. NULL if the job processes its own upload
+
+	uint range_offset; // [MC_APPLY, MC_STRIPE] The first byte of the range to process. The size of the range is "committed_size" after the upload
+
+	struct _stripe_job* stripe; // [MC_STRIPE] The striped job the stream uploads and responds a range of. NULL otherwise
+
+	uint range_length; // [MC_STRIPE] The size of the range to upload
+
+	HASHSTATE upload_hash; // The SHA-256 of the bytes uploaded so far (See HashUpload()). Not begun for a range, a resumed job or an upload larger than the cache
+
+	char content_digest[DIGEST_SIZE]; // The SHA-256 of the upload, once uploaded (See DigestUpload()). Identify the result in the cache
+
+	struct _cache_entry* cached; // The cached result the response is read from. NULL if the response is processed from the temp file
+
+	char* cache_file_path; // The file records the processed response for the cache. NULL if not recorded
+
+	FILE* cache_file; // The opened "cache_file_path". NULL if not recorded
+
+	uint batch_serial; // [RT_BATCH] Identify the batch among all batches the server has run
+
+	uint batch_total; // [RT_BATCH] Number of entries in the manifest
+
+	uint batch_received; // [RT_BATCH] Number of entries received
+
+	uint batch_pending; // [RT_BATCH] Number of entries being processed by the worker threads
+
+	BATCHQUEUE batch_results; // [RT_BATCH] Processed entries wait for credit to be sent
+
+} STREAMINFO;
+
+typedef struct _client_info {
+
+	SOCKETEX socketex; // Socket use for sending and receiving
+
+	ADDRESS address; // The address of the client. Its IP owns the jobs of the client
+
+	//int status; // See CS_ for some client status
+
+	int paused_operation; // The operations wait for the send queue drains. CS_RECEIVING | CS_RESPONDING. CS_FREE if nothing paused
+
+	FRAMEPARSER parser; // Extract requests from received bytes. Its buffer is the "data" field of "socketex"
+
+	STREAMINFO streams[MAX_STREAMS]; // The jobs of the client. Only the first one is used without CAP_STREAMS
+
+	int next_stream; // The stream sends first in the next response round. Streams take turns
+
 } CLIENTINFO;
 
+/// <summary>
+/// A job interrupted by a lost connection, waits for the client reconnects and resumes it (See MC_RESUME)
+/// </summary>
+typedef struct _job_info {
+
+	ullong id; // The job ID. JOB_NONE if the slot is free
+
+	IN_ADDR owner; // The IP of the client that ran the job. Only it may resume the job
+
+	int request_type; // RT_ENCRYPT || RT_DECRYPT
+
+	uint key; // encryption|decryption key
+
+	char* temp_file_path; // The path to the temp file.
+
+	uint committed_size; // Number of uploaded bytes synced to the temp file. The upload resumes from here
+
+	int uploaded; // 1 if the upload completed
+
+	char content_digest[DIGEST_SIZE]; // The SHA-256 of the upload, if uploaded
+
+	time_t detached_time; // When the connection was lost
+
+} JOBINFO;
+
+/// <summary>
+/// A result kept for repeated jobs: The same content, request type and key give the same result
+/// </summary>
+typedef struct _cache_entry {
+
+	char digest[DIGEST_SIZE]; // The SHA-256 of the uploaded content. Not a weak hash: a crafted upload can not take the result of another content
+
+	int request_type; // RT_ENCRYPT || RT_DECRYPT
+
+	uint key; // encryption|decryption key
+
+	uint size; // The size of the content (same as the result)
+
+	IN_ADDR owner; // The IP of the client that uploaded the content. Only it may skip the upload by a probe (See MC_PROBE)
+
+	char* result_path; // The file holds the result. NULL if the slot is free
+
+	ullong last_used; // The cache clock when the result was stored or served. The least recently used is evicted first
+
+	int readers; // Number of streams sending the result. The entry is not evicted while being read
+
+} CACHEENTRY;
+
+/// <summary>
+/// Counters of the result cache
+/// </summary>
+typedef struct _cache_metrics {
+
+	uint hits; // Responses served from the cache
+
+	uint misses; // Responses processed from the temp file
+
+	uint evictions; // Results evicted to make room
+
+	ullong served_bytes; // Bytes served from the cache
+
+} CACHEMETRICS;
+
+/// <summary>
+/// An upload kept on the server (See MC_STORE), processed by later requests (See MC_APPLY) until it expires
+/// </summary>
+typedef struct _handle_info {
+
+	ullong id; // The handle ID, random 64 bits. HANDLE_NONE if the slot is free
+
+	IN_ADDR owner; // The IP of the client that kept the upload. Only it may process the upload
+
+	char* path; // The file holds the upload
+
+	uint size; // The size of the upload
+
+	char content_digest[DIGEST_SIZE]; // The SHA-256 of the upload. Identify the results of the whole upload in the cache
+
+	time_t last_used; // When the upload was kept or last processed
+
+	int readers; // Number of streams processing the upload. The upload is not dropped while being read
+
+} HANDLEINFO;
+
+/// <summary>
+/// A job split into byte ranges, each uploaded and responded on a stream of its own connection (See MC_STRIPE)
+/// </summary>
+typedef struct _stripe_job {
+
+	ullong id; // The job ID chosen at random by the client. JOB_NONE if the slot is free
+
+	int request_type; // RT_ENCRYPT || RT_DECRYPT
+
+	uint key; // encryption|decryption key
+
+	char* path; // The file the ranges are written into at their offsets
+
+	uint size; // The size of the whole content
+
+	uint count; // Number of ranges
+
+	uint joined; // Number of ranges joined
+
+	uint uploaded; // Number of ranges uploaded. The ranges are responded when all are uploaded
+
+	int members; // Number of streams on the job. The job is dropped when the last one closes
+
+	int failed; // 1 if a range is lost before all are uploaded: the other ranges are failed too
+
+} STRIPEJOB;
+
 #pragma endregion
 
 #pragma region Function Declarations
@@ -59,6 +289,82 @@ HANDLE CreateThread(WSAEVENT listener_event);
 
 #pragma endregion
 
+#pragma region Batch Workers
+
+/// <summary>
+/// Create worker threads for processing batch entries (See RunBatchWorker()).
+/// </summary>
+/// <param name="count">Number of worker threads</param>
+/// <returns>Number of created worker threads</returns>
+int CreateBatchWorkers(int count);
+
+/// <summary>
+/// [Thread] Take entries from the pending queue, Encrypt/Decrypt them and Move them to the completed queue.
+/// The IO thread is signaled to send the results (See CompleteBatchTasks()).
+/// </summary>
+/// <param name="arguments">Not used</param>
+/// <returns>0 always.</returns>
+unsigned __stdcall RunBatchWorker(void* arguments);
+
+/// <summary>
+/// Create a task for a received batch entry. The content is copied.
+/// </summary>
+/// <param name="client">The client sends the entry</param>
+/// <param name="sinfo">The stream of the batch</param>
+/// <param name="index">The index of the entry</param>
+/// <param name="request_type">RT_ENCRYPT or RT_DECRYPT</param>
+/// <param name="key">The key used for shift cipher</param>
+/// <param name="content">The content of the entry</param>
+/// <param name="content_len">The size of the content</param>
+/// <returns>The created task. NULL if fail to allocate memory</returns>
+BATCHTASK* CreateBatchTask(CLIENTINFO* client, STREAMINFO* sinfo, uint index, int request_type, uint key, const stream content, uint content_len);
+
+/// <summary>
+/// Free memory for a batch task and its data.
+/// </summary>
+/// <param name="task">A pointer to the task</param>
+void DestroyBatchTask(BATCHTASK* task);
+
+/// <summary>
+/// Append a task to the end of a queue.
+/// </summary>
+/// <param name="queue">A pointer to the queue</param>
+/// <param name="task">A pointer to the task</param>
+void PushBatchTask(BATCHQUEUE* queue, BATCHTASK* task);
+
+/// <summary>
+/// Take the first task of a queue.
+/// </summary>
+/// <param name="queue">A pointer to the queue</param>
+/// <returns>The first task. NULL if the queue is empty</returns>
+BATCHTASK* PopBatchTask(BATCHQUEUE* queue);
+
+/// <summary>
+/// Destroy all tasks of a queue.
+/// </summary>
+/// <param name="queue">A pointer to the queue</param>
+void FreeBatchTasks(BATCHQUEUE* queue);
+
+/// <summary>
+/// Encrypt/Decrypt the content of a batch entry. Replace the content by the result.
+/// </summary>
+/// <param name="task">A pointer to the task</param>
+void ProcessBatchTask(BATCHTASK* task);
+
+/// <summary>
+/// Hand a task to the worker threads.
+/// </summary>
+/// <param name="task">A pointer to the task</param>
+void SubmitBatchTask(BATCHTASK* task);
+
+/// <summary>
+/// [IO thread] Move the tasks completed by the worker threads to their streams and Send the results.
+/// The results of removed clients or closed batches are dropped.
+/// </summary>
+void CompleteBatchTasks();
+
+#pragma endregion
+
 
 #pragma region Client Manager
 /// <summary>
@@ -69,25 +375,81 @@ HANDLE CreateThread(WSAEVENT listener_event);
 /// <returns>A pointer to the CLIENTINFO object contains the OVERLAPPED object</returns>
 CLIENTINFO* GetClientInfo(OVERLAPPED* socketex_overlapped);
 
+/// <summary>
+/// Find the connected client runs a job. [Take critical_section]
+/// </summary>
+/// <param name="job_id">The job ID. Not JOB_NONE</param>
+/// <returns>A pointer to the client. NULL if not found</returns>
+CLIENTINFO* FindClientByJob(ullong job_id);
+
+/// <summary>
+/// Get a pointer to CLIENTINFO object from a pointer to its SOCKETEX object.
+/// </summary>
+/// <param name="socketex">A pointer to the "socketex" field of the CLIENTINFO object</param>
+/// <returns>A pointer to the CLIENTINFO object contains the SOCKETEX object</returns>
+CLIENTINFO* GetClientInfo(SOCKETEX* socketex);
+
 /// <summary>
 /// Create a CLIENTINFO object (initialize default value for all fields) contains infos about a client identified by a SOCKET object.
 /// </summary>
 /// <param name="socket">The SOCKET object identifys the client</param>
+/// <param name="address">The address of the client</param>
 /// <returns>The CLIENTINFO object</returns>
-CLIENTINFO CreateClientInfo(SOCKET socket);
+CLIENTINFO CreateClientInfo(SOCKET socket, ADDRESS address);
+
+/// <summary>
+/// Reset value for all fields in STREAMINFO object before using it for new job. The temp file is kept.
+/// </summary>
+/// <param name="sinfo">A pointer to the STREAMINFO object</param>
+void ResetStream(STREAMINFO* sinfo);
+
+/// <summary>
+/// Find the running job on a stream of a client.
+/// </summary>
+/// <param name="client">A pointer to the client</param>
+/// <param name="stream_id">The stream ID</param>
+/// <returns>A pointer to the stream. NULL if no job runs on the stream</returns>
+STREAMINFO* FindStream(CLIENTINFO* client, uint stream_id);
+
+/// <summary>
+/// Take a free stream of a client for a new job and Reset its credits. Without CAP_STREAMS, a client has only one stream.
+/// </summary>
+/// <param name="client">A pointer to the client</param>
+/// <param name="stream_id">The stream ID</param>
+/// <returns>A pointer to the stream. NULL if the client runs too many jobs (MAX_STREAMS)</returns>
+STREAMINFO* OpenStream(CLIENTINFO* client, uint stream_id);
+
+/// <summary>
+/// Complete the job on a stream: Delete the temp file and Free the stream.
+/// </summary>
+/// <param name="client">A pointer to the client</param>
+/// <param name="sinfo">A pointer to the stream</param>
+void CloseStream(CLIENTINFO* client, STREAMINFO* sinfo);
 
 /// <summary>
-/// Reset value for some fields in CLIENTINFO object before using it for new session.
+/// Stop the job on a stream because of errors on file: Close the stream and Send a Error frame to the client.
+/// The other streams keep running. Before v2, the client can not be told, the connection should be closed.
 /// </summary>
-/// <param name="client">A pointer to the CLIENTINFO object</param>
-void Reset(CLIENTINFO* client);
+/// <param name="client">A pointer to the client</param>
+/// <param name="sinfo">A pointer to the stream</param>
+/// <returns>99 if wait on completion routine. 0 if the connection should be closed (v1). -1 if have fatal error that the socket should be closed</returns>
+int FailStream(CLIENTINFO* client, STREAMINFO* sinfo);
 
 /// <summary>
 /// Append new client (identified by a SOCKET object) to Application Client Manager.
 /// </summary>
 /// <param name="socket">The SOCKET object identify the client</param>
+/// <param name="address">The address of the client</param>
 /// <returns>The index of new client in Application Client Manager. -1 if Application Client Manager full</returns>
-int AppendSocketToManager(SOCKET socket);
+int AppendSocketToManager(SOCKET socket, ADDRESS address);
+
+/// <summary>
+/// Check whether a client owns something kept on the server: It connects from the same IP.
+/// </summary>
+/// <param name="client">A pointer to the client</param>
+/// <param name="owner">The IP recorded as the owner</param>
+/// <returns>1 if the client is the owner. 0 otherwise</returns>
+int IsOwner(const CLIENTINFO* client, IN_ADDR owner);
 
 /// <summary>
 /// Remove client from Application Client Manager.
@@ -96,6 +458,187 @@ int AppendSocketToManager(SOCKET socket);
 void RemoveClientFromManager(CLIENTINFO* client);
 #pragma endregion
 
+#pragma region Job Manager
+/// <summary>
+/// Keep the resumable job of a removed client: Move the request info and the temp file of the stream to a free job slot. The job resumes from the last checkpoint (See CheckpointUpload()).
+/// </summary>
+/// <param name="client">A pointer to the client. It owns the job</param>
+/// <param name="sinfo">A pointer to the stream runs the job</param>
+void DetachJob(CLIENTINFO* client, STREAMINFO* sinfo);
+
+/// <summary>
+/// Continue a kept job on a stream: Move the request info and the temp file of the job to the stream.
+/// If the job is still run by another connection of the same owner (its loss is not noticed yet), that connection is closed first.
+/// The temp file is cut to the committed size.
+/// </summary>
+/// <param name="client">A pointer to the client. It must own the job (See IsOwner())</param>
+/// <param name="sinfo">A pointer to the stream. It must not have a running request</param>
+/// <param name="job_id">The job ID</param>
+/// <returns>1 if success. 0 if the job does not exist (or expired) or belongs to another client</returns>
+int AttachJob(CLIENTINFO* client, STREAMINFO* sinfo, ullong job_id);
+
+/// <summary>
+/// Find a kept job.
+/// </summary>
+/// <param name="job_id">The job ID</param>
+/// <returns>A pointer to the job. NULL if not found</returns>
+JOBINFO* FindJob(ullong job_id);
+
+/// <summary>
+/// Drop a kept job and Delete its temp file.
+/// </summary>
+/// <param name="job">A pointer to the job</param>
+void DropJob(JOBINFO* job);
+
+/// <summary>
+/// Drop kept jobs not resumed in JOB_RETAIN_SECONDS.
+/// </summary>
+void ExpireJobs();
+#pragma endregion
+
+#pragma region Handle Manager
+/// <summary>
+/// Keep the completed upload of a stream (RT_STORE): Move the temp file to a handle slot, Reply the handle and Close the stream.
+/// If all slots are used, the least recently used upload not being read is dropped.
+/// </summary>
+/// <param name="client">The client sends the upload</param>
+/// <param name="sinfo">A pointer to the stream. The upload has completed</param>
+/// <returns>1 or 99 if success. 0 if the upload can not be kept (v1). -1 if have fatal error that the socket should be closed</returns>
+int RetainUpload(CLIENTINFO* client, STREAMINFO* sinfo);
+
+/// <summary>
+/// Find a kept upload.
+/// </summary>
+/// <param name="handle_id">The handle ID</param>
+/// <returns>A pointer to the handle. NULL if not found</returns>
+HANDLEINFO* FindHandle(ullong handle_id);
+
+/// <summary>
+/// Drop a kept upload and Delete its file.
+/// </summary>
+/// <param name="handle">A pointer to the handle. It must not be being read</param>
+void DropHandle(HANDLEINFO* handle);
+
+/// <summary>
+/// Drop kept uploads not used in HANDLE_TTL_SECONDS and not being read.
+/// </summary>
+void ExpireHandles();
+#pragma endregion
+
+#pragma region Stripe Manager
+/// <summary>
+/// Find a striped job.
+/// </summary>
+/// <param name="job_id">The job ID</param>
+/// <returns>A pointer to the job. NULL if not found</returns>
+STRIPEJOB* FindStripeJob(ullong job_id);
+
+/// <summary>
+/// Take a free slot for a striped job and Create the file its ranges are written into.
+/// </summary>
+/// <param name="job_id">The job ID</param>
+/// <param name="request_type">RT_ENCRYPT or RT_DECRYPT</param>
+/// <param name="key">The key used for shift cipher</param>
+/// <param name="count">Number of ranges</param>
+/// <param name="size">The size of the whole content</param>
+/// <returns>A pointer to the job. NULL if all slots are used or the file can not be created</returns>
+STRIPEJOB* CreateStripeJob(ullong job_id, int request_type, uint key, uint count, uint size);
+
+/// <summary>
+/// Drop a striped job and Delete its file.
+/// </summary>
+/// <param name="job">A pointer to the job. No stream is on it</param>
+void DropStripeJob(STRIPEJOB* job);
+
+/// <summary>
+/// Take a stream off its striped job. If the ranges have not all been uploaded, the job can not complete: Fail the other ranges.
+/// The job is dropped when its last stream leaves.
+/// </summary>
+/// <param name="sinfo">A pointer to the stream</param>
+void LeaveStripeJob(STREAMINFO* sinfo);
+
+/// <summary>
+/// Fail all streams on a striped job, on every connection. A connection that can not be told is removed. [Take critical_section]
+/// </summary>
+/// <param name="job">A pointer to the job</param>
+void FailStripeJob(STRIPEJOB* job);
+
+/// <summary>
+/// Complete the upload of a range. When all ranges are uploaded, every stream of the job (on every connection) starts responding its range.
+/// [Take critical_section]
+/// </summary>
+/// <param name="client">The client uploads the range</param>
+/// <param name="sinfo">The stream of the range</param>
+/// <returns>1 or 99 if success. -1 if have fatal error that the socket should be closed</returns>
+int CompleteStripe(CLIENTINFO* client, STREAMINFO* sinfo);
+#pragma endregion
+
+#pragma region Result Cache
+/// <summary>
+/// Find a cached result.
+/// </summary>
+/// <param name="digest">The SHA-256 of the content</param>
+/// <param name="request_type">RT_ENCRYPT or RT_DECRYPT</param>
+/// <param name="key">The key used for shift cipher</param>
+/// <param name="size">The size of the content</param>
+/// <returns>A pointer to the cache entry. NULL if not found</returns>
+CACHEENTRY* FindCache(const stream digest, int request_type, uint key, uint size);
+
+/// <summary>
+/// Store a result in the cache. The least recently used results not being read are evicted to make room.
+/// </summary>
+/// <param name="digest">The SHA-256 of the content</param>
+/// <param name="request_type">RT_ENCRYPT or RT_DECRYPT</param>
+/// <param name="key">The key used for shift cipher</param>
+/// <param name="size">The size of the result</param>
+/// <param name="owner">The IP of the client that uploaded the content</param>
+/// <param name="result_path">The file holds the result. The cache takes the ownership, the file is deleted if can not be stored</param>
+void InsertCache(const stream digest, int request_type, uint key, uint size, IN_ADDR owner, char* result_path);
+
+/// <summary>
+/// Hash the next uploaded bytes of a stream as they are written to the temp file, so the digest is ready at the Data End.
+/// The first bytes begin the hash. The hash is given up beyond CACHE_MAX_BYTES or on errors.
+/// </summary>
+/// <param name="sinfo">A pointer to the stream. Its "written_size" does not count the bytes yet</param>
+/// <param name="data">The uploaded bytes</param>
+/// <param name="length">The number of bytes</param>
+void HashUpload(STREAMINFO* sinfo, const stream data, uint length);
+
+/// <summary>
+/// Get the digest of the completed upload of a stream: The digest is the cache key of its results.
+/// The bytes are hashed while uploading (See HashUpload()). Only a resumed job, which lost that hash with the connection, hashes the temp file (See HashFile()).
+/// Uploads larger than the cache are not hashed, their results are never cached.
+/// </summary>
+/// <param name="sinfo">A pointer to the stream. Its upload is in the temp file</param>
+/// <returns>1 if success. 0 if the temp file can not be read or the hash fails</returns>
+int DigestUpload(STREAMINFO* sinfo);
+
+/// <summary>
+/// Remove a result from the cache and Delete its file.
+/// </summary>
+/// <param name="entry">A pointer to the cache entry. It must not be being read</param>
+void DropCache(CACHEENTRY* entry);
+
+/// <summary>
+/// Prepare the response of a stream: Serve the cached result if the same job has run, otherwise Process the temp file
+/// and Record the result for the cache.
+/// </summary>
+/// <param name="sinfo">A pointer to the stream. The upload has completed</param>
+/// <returns>1 if success. 0 if the result or the temp file (or the kept upload) can not be opened</returns>
+int OpenResponse(STREAMINFO* sinfo);
+
+/// <summary>
+/// Stop using the cache for the response of a stream: Release the cached result, or Discard the unfinished record.
+/// </summary>
+/// <param name="sinfo">A pointer to the stream</param>
+void ReleaseResponse(STREAMINFO* sinfo);
+
+/// <summary>
+/// Print the counters of the result cache. [Debugging only]
+/// </summary>
+void PrintCacheMetrics();
+#pragma endregion
+
 #pragma region Winsock Completion IO
 /// <summary>
 /// Completion Routine function called after a Overlapped IO operation completes.
@@ -108,32 +651,64 @@ void RemoveClientFromManager(CLIENTINFO* client);
 void CALLBACK RoutineCallback(DWORD error, DWORD transfered_bytes, LPWSAOVERLAPPED overlapped, DWORD flags);
 
 /// <summary>
-/// Invoke Overlapped IO to receive a ACK packet after sending response to client.
+/// Completion Routine function called after a queued send (See EnqueueSend()) completes.
+/// Resume the paused operation of the client when its send queue drains to low watermark.
+/// [This function will be feed automatically by Winsock. Just assign it to the "send_callback" field in a SOCKETEX object]
+/// </summary>
+/// <param name="error">The errors occured during the Overlapped IO operation</param>
+/// <param name="transfered_bytes">Number of bytes transfer successfully during Overlapped IO operation</param>
+/// <param name="overlapped">The overlapped object of the send queue</param>
+/// <param name="flags">The flags return after Overlapped IO operation completes</param>
+void CALLBACK SendRoutineCallback(DWORD error, DWORD transfered_bytes, LPWSAOVERLAPPED overlapped, DWORD flags);
+
+/// <summary>
+/// Resume the operation paused by backpressure (See "paused_operation" field in CLIENTINFO).
+/// </summary>
+/// <param name="client">The communicated client</param>
+/// <returns>1 if nothing paused. 99 if wait on completion routine. -1 if have fatal error that the socket should be closed</returns>
+int ResumePausedOperation(CLIENTINFO* client);
+
+/// <summary>
+/// Invoke Overlapped IO to receive available bytes from client into the frame parser of the client
+/// </summary>
+/// <param name="client">The communicated client</param>
+/// <returns>1 if finish immediately. 99 if wait on completion routine. 0 if the parser buffer is full. -1 if have fatal error that the socket should be closed</returns>
+int ReceiveRequests(CLIENTINFO* client);
+
+/// <summary>
+/// Handle every complete frame received from client, then Invoke Overlapped IO to receive more bytes.
+/// Handling pauses while the send queue of the client is paused, and is resumed by ResumePausedOperation().
 /// </summary>
 /// <param name="client">The communicated client</param>
-/// <returns>1 if finish immediately. 99 if wait on completion routine. -1 if have fatal error that the socket should be closed</returns>
-int ReceiveAckSendStatus(CLIENTINFO* client);
+/// <returns>99 if wait on completion routine or paused. -1 if have fatal error that the socket should be closed</returns>
+int HandleFrames(CLIENTINFO* client);
 
 /// <summary>
-/// Invoke Overlapped IO to receive a Segment Header from client
+/// Handle a received ACK packet of a stream: Update the credit and Continue sending response.
+/// If the ACK packet closes the credits, the response completes and the stream can run new job.
 /// </summary>
 /// <param name="client">The communicated client</param>
-/// <returns>1 if finish immediately. 99 if wait on completion routine. -1 if have fatal error that the socket should be closed</returns>
-int ReceiveRequestHeader(CLIENTINFO* client);
+/// <param name="sinfo">The stream of the ACK packet</param>
+/// <param name="limit">The credit limit in the ACK packet</param>
+/// <returns>1 if the response completes. 99 if success. 0 if have errors on file. -1 if have fatal error that the socket should be closed</returns>
+int HandleACK(CLIENTINFO* client, STREAMINFO* sinfo, uint limit);
 
 /// <summary>
-/// Invoke Overlapped IO to receive a Segment Content from client
+/// Consume the credit of a received Data Request and Queue an ACK packet if the client need new credit.
 /// </summary>
 /// <param name="client">The communicated client</param>
-/// <returns>1 if finish immediately. 99 if wait on completion routine. 0 if too much bytes. -1 if have fatal error that the socket should be closed</returns>
-int ReceiveRequestContent(CLIENTINFO* client);
+/// <param name="sinfo">The stream of the Data Request</param>
+/// <returns>1 if not need. 99 if wait on completion routine. -1 if have fatal error that the socket should be closed</returns>
+int SendAckReceiveStatus(CLIENTINFO* client, STREAMINFO* sinfo);
 
 /// <summary>
-/// Invoke Overlapped IO to send an ACK packet after receive a request from client.
+/// Accept a request which starts an upload on a stream. Without CAP_CREDIT, Queue the ACK packet of the request (stop-and-wait), the client waits for it before uploading.
+/// With CAP_CREDIT, the request is not ACKed: the client starts with FLOW_WINDOW_CHUNKS credit.
 /// </summary>
 /// <param name="client">The communicated client</param>
-/// <returns>1 if finish immediately. 99 if wait on completion routine. -1 if have fatal error that the socket should be closed</returns>
-int SendAckReceiveStatus(CLIENTINFO* client);
+/// <param name="sinfo">The stream of the request</param>
+/// <returns>1 if not need. 99 if wait on completion routine. -1 if have fatal error that the socket should be closed</returns>
+int AcceptUpload(CLIENTINFO* client, STREAMINFO* sinfo);
 
 /// <summary>
 /// Invoke Overlapped IO functions depends on current status of SOCKETEX object.
@@ -150,32 +725,124 @@ int HandleIOResult(CLIENTINFO* client, int sockex_status);
 
 /// <summary>
 /// Process Upload Request (Message Code = MC_DATA) from a client.
-/// [This function only called by Request() after exatract info from a received MESSAGE object]
-/// If the Request is Data End Request (payload = NULL), this function will invoke a Overlapped IO function from Respond().
+/// [This function only called by Request() after exatract info from a received frame]
+/// If the Request is Data End Request (payload = NULL), this function will invoke a Overlapped IO function from Respond(),
+/// or Keep the upload for a Store Request (See RetainUpload()).
+/// Otherwise, consume the credit of the request.
 /// </summary>
 /// <param name="client">The client send request</param>
+/// <param name="sinfo">The stream of the request</param>
 /// <param name="payload">The payload of the MESSAGE object. For MC_DATA Message, this may contains data or NULL</param>
 /// <param name="payload_length">The size of the payload.</param>
-/// <returns>1 or 99 if success [99 if this function invoke Respond()]. 0 if this function invoke Respond() and have errors on file. -1 if have fatal error that the socket should be closed.</returns>
-int HandleDataRequest(CLIENTINFO* client, const stream payload, uint payload_length);
+/// <returns>99 if success. 0 if have errors on file (v1) or the upload has ended. -1 if have fatal error that the socket should be closed.</returns>
+int HandleDataRequest(CLIENTINFO* client, STREAMINFO* sinfo, const stream payload, uint payload_length);
+
+/// <summary>
+/// Open the file the next uploaded bytes of a stream are written to: Append to the temp file, or Write in the range of a striped job.
+/// </summary>
+/// <param name="sinfo">A pointer to the stream</param>
+/// <returns>The opened file. NULL if fail to open</returns>
+FILE* OpenUploadFile(STREAMINFO* sinfo);
+
+/// <summary>
+/// Advance the checkpoint of an upload ("committed_size") to the written bytes.
+/// The bytes of a resumable job are synced to disk first, only once CHECKPOINT_BYTES or CHECKPOINT_SECONDS have passed unless forced.
+/// </summary>
+/// <param name="sinfo">A pointer to the stream</param>
+/// <param name="force">1 to sync now: The upload ends or the job is detached</param>
+/// <returns>1 if success (or not due yet). 0 if fail to sync: The checkpoint stays at the last synced bytes</returns>
+int CheckpointUpload(STREAMINFO* sinfo, int force);
 
 /// <summary>
 /// Process Encrypt/Decrypt Request (Message Code = MC_ENCRYPT || MC_DECRYPT) from a client.
-/// [This function only called by Request() after exatract info from a received MESSAGE object]
+/// [This function only called by Request() after exatract info from a received frame]
 /// </summary>
 /// <param name="client">The client send request</param>
+/// <param name="stream_id">The stream to run the job. A Error frame is replied if the client runs too many jobs</param>
 /// <param name="request_type">The request type (Encrypt or Decrypt). See RT_ for some request types</param>
-/// <param name="payload">The payload of the MESSAGE object. For MC_ECNRYPT||MC_DECRYPT Message, this contains the key of the request</param>
-/// <returns>1 always</returns>
-int HandleEncryptDecryptRequest(CLIENTINFO* client, int request_type, const stream payload);
+/// <param name="payload">The payload of the frame. For MC_ECNRYPT||MC_DECRYPT frame, this contains the key (and the resumable flag) of the request. A resumable request gets a job ID issued by the server</param>
+/// <param name="payload_length">The size of the payload.</param>
+/// <returns>1 if success. 99 if the Error frame or the ACK packet is queued. 0 if the payload is invalid or the stream is busy. -1 if have fatal error that the socket should be closed</returns>
+int HandleEncryptDecryptRequest(CLIENTINFO* client, uint stream_id, int request_type, const stream payload, uint payload_length);
+
+/// <summary>
+/// Process Hello Packet (the first bytes from a v2 client): Choose the protocol version and the capabilities, and Reply them.
+/// [This function only called by Request() after exatract info from a received frame]
+/// </summary>
+/// <param name="client">The client send request</param>
+/// <param name="frame">The MC_HELLO frame: The newest version and the capabilities supported by the client</param>
+/// <returns>99 if success. 0 if the version is invalid. -1 if have fatal error that the socket should be closed</returns>
+int HandleHelloRequest(CLIENTINFO* client, const FRAME* frame);
 
 /// <summary>
-/// Handle a request from client after receive successfully a MESSAGE object.
-/// This function may calls HandleEncryptDecryptRequest() or HandleDataRequest() depends on the message code.
+/// Process Resume Request (Frame Code = MC_RESUME): Continue a job interrupted by a lost connection.
+/// Reply the committed upload bytes if the upload has not completed. Otherwise, Respond from the downloaded bytes.
+/// [This function only called by Request() after exatract info from a received frame]
 /// </summary>
 /// <param name="client">The client send request</param>
-/// <returns>1 or 99 if success [99 if this function invoke a Overlapped IO operation]. 0 if receive invalid message from client. -1 if have fatal error that the socket should be closed</returns>
-int Request(CLIENTINFO* client);
+/// <param name="frame">The MC_RESUME frame: Job ID | Downloaded bytes</param>
+/// <returns>99 if success. 0 if the payload is invalid or have errors on file. -1 if have fatal error that the socket should be closed</returns>
+int HandleResumeRequest(CLIENTINFO* client, const FRAME* frame);
+
+/// <summary>
+/// Process Probe Request (Frame Code = MC_PROBE): If the result of the same content, request type and key is cached,
+/// and the content was uploaded by the same client (IP), the job runs on it without upload: Reply 1 and Respond. Otherwise, Reply 0 and the client uploads as usual.
+/// A job run without upload has no temp file, it is not resumable.
+/// [This function only called by Request() after exatract info from a received frame]
+/// </summary>
+/// <param name="client">The client send request</param>
+/// <param name="frame">The MC_PROBE frame: Content digest | Content size</param>
+/// <returns>99 if success. 0 if the frame is invalid or the stream has started uploading. -1 if have fatal error that the socket should be closed</returns>
+int HandleProbeRequest(CLIENTINFO* client, const FRAME* frame);
+
+/// <summary>
+/// Process Store Request (Frame Code = MC_STORE): Open a stream for an upload kept on the server (See RetainUpload()).
+/// [This function only called by Request() after exatract info from a received frame]
+/// </summary>
+/// <param name="client">The client send request</param>
+/// <param name="frame">The MC_STORE frame</param>
+/// <returns>1 if success. 99 if a Error frame or the ACK packet is queued. 0 if the stream is busy. -1 if have fatal error that the socket should be closed</returns>
+int HandleStoreRequest(CLIENTINFO* client, const FRAME* frame);
+
+/// <summary>
+/// Process Apply Request (Frame Code = MC_APPLY): Run a job on a byte range of a kept upload and Respond, no upload.
+/// A Error frame is replied if the upload has expired, was kept by another client (IP) or the range is out of the upload.
+/// [This function only called by Request() after exatract info from a received frame]
+/// </summary>
+/// <param name="client">The client send request</param>
+/// <param name="frame">The MC_APPLY frame: Handle ID | Request type | Key | Offset | Length</param>
+/// <returns>99 if success. 0 if the payload is invalid or the stream is busy. -1 if have fatal error that the socket should be closed</returns>
+int HandleApplyRequest(CLIENTINFO* client, const FRAME* frame);
+
+/// <summary>
+/// Process Stripe Request (Frame Code = MC_STRIPE): Join a byte range of a striped job (the first range creates the job).
+/// The range is written into the file of the job at its offset. A Error frame is replied if the range does not match the job.
+/// [This function only called by Request() after exatract info from a received frame]
+/// </summary>
+/// <param name="client">The client send request</param>
+/// <param name="frame">The MC_STRIPE frame: Job ID | Request type | Key | Count | Size | Offset | Length</param>
+/// <returns>1 if success. 99 if a Error frame or the ACK packet is queued. 0 if the payload is invalid or the stream is busy. -1 if have fatal error that the socket should be closed</returns>
+int HandleStripeRequest(CLIENTINFO* client, const FRAME* frame);
+
+/// <summary>
+/// Process Batch Request (Frame Code = MC_BATCH): Open a batch on a stream (FF_MANIFEST) or Hand an entry to the worker threads.
+/// The entries of a failed batch are dropped.
+/// [This function only called by Request() after exatract info from a received frame]
+/// </summary>
+/// <param name="client">The client send request</param>
+/// <param name="frame">The MC_BATCH frame: Manifest or Entry</param>
+/// <returns>1 if success. 99 if a Error frame or result is queued. 0 if the frame is invalid. -1 if have fatal error that the socket should be closed</returns>
+int HandleBatchRequest(CLIENTINFO* client, const FRAME* frame);
+
+/// <summary>
+/// Handle a frame received from client.
+/// This function may calls HandleHelloRequest(), HandleEncryptDecryptRequest(), HandleDataRequest(), HandleResumeRequest(),
+/// HandleProbeRequest(), HandleStoreRequest(), HandleApplyRequest(), HandleStripeRequest(), HandleBatchRequest() or HandleACK() depends on the frame code.
+/// </summary>
+/// <param name="client">The client send request</param>
+/// <param name="frame">The received frame</param>
+/// <returns>1 or 99 if success [99 if this function invoke a Overlapped IO operation]. 0 if receive invalid frame from client. -1 if have fatal error that the socket should be closed</returns>
+int Request(CLIENTINFO* client, const FRAME* frame);
 
 #pragma endregion
 
@@ -187,16 +854,45 @@ int Request(CLIENTINFO* client);
 /// <param name="request_type">RT_ENCRYPT or RT_DECRYPT</param>
 /// <param name="key">The key used for shift cipher</param>
 /// <param name="tempfp">A pointer to a file contains the data want to process. (Must move the file pointer before calling this function)</param>
+/// <param name="length">The maximum number of bytes to process</param>
 /// <param name="oresult">[Output:NotNull] The encrypted/decrypted result data</param>
 /// <param name="oresult_len">[Output:NotNull] The size in bytes of "oresult"</param>
 /// <returns>1 if success. 0 if the file reach EOF. -1 if have some errors on file</returns>
-int ProcessData(int request_type, int key, FILE* tempfp, stream* oresult, uint* oresult_len);
+int ProcessData(int request_type, int key, FILE* tempfp, uint length, stream* oresult, uint* oresult_len);
+
+/// <summary>
+/// Check whether a stream has response to send: The upload completed and the Data End Message has not been sent.
+/// For a batch: Some results are waiting. For a range of a striped job: All ranges are uploaded too.
+/// </summary>
+/// <param name="sinfo">A pointer to the stream</param>
+/// <returns>1 if responding. 0 otherwise</returns>
+int IsResponding(const STREAMINFO* sinfo);
+
+/// <summary>
+/// Process one chunk from temp file of a stream (or Read it from the cached result) and Send it. Send the Data End Message after the last chunk.
+/// Without CAP_CREDIT, the Data End Message waits for the ACK packet of the last chunk and completes the job (it is not ACKed).
+/// </summary>
+/// <param name="client">The client will send response to</param>
+/// <param name="sinfo">The responding stream</param>
+/// <returns>1 or 99 if success. 0 if have errors on file (v1). -1 if have fatal error that the socket should be closed</returns>
+int RespondStream(CLIENTINFO* client, STREAMINFO* sinfo);
+
+/// <summary>
+/// Send the first waiting result of a batch and Grant the client new credit for sending entries.
+/// The credit is granted as results are sent, so the entries in progress are bounded.
+/// </summary>
+/// <param name="client">The client will send response to</param>
+/// <param name="sinfo">The stream of the batch</param>
+/// <returns>1 or 99 if success. -1 if have fatal error that the socket should be closed</returns>
+int RespondBatch(CLIENTINFO* client, STREAMINFO* sinfo);
 
 /// <summary>
-/// Process data from temp file (contains data to encrypt/decrypt) and Send response to Client.
+/// Process data from temp files (contains data to encrypt/decrypt) and Send response to Client while the client grants credit.
+/// Responding streams take turns: one chunk of each stream in a round, so a large job does not delay the others.
+/// Reading the temp files pauses while the send queue of the client is paused, and is resumed by ResumePausedOperation().
 /// </summary>
 /// <param name="client">The client will send response to</param>
-/// <returns>1 or 99 if success [99 if this function invoke a Overlapped IO operation]. 0 if have errors on file. -1 if have fatal error that the socket should be closed</returns>
+/// <returns>99 if success. 0 if have errors on file (v1). -1 if have fatal error that the socket should be closed</returns>
 int Respond(CLIENTINFO* client);
 
 #pragma endregion
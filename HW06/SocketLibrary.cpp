@@ -220,6 +220,11 @@ int CreateSegment(const stream message, uint message_len, stream* osegment, uint
 	return SUCCESS;
 }
 
+SOCKETEX* GetSocketExtend(LPWSAOVERLAPPED send_overlapped)
+{
+	return CONTAINING_RECORD(send_overlapped, SOCKETEX, send_queue.overlapped);
+}
+
 #pragma endregion
 
 
@@ -388,6 +393,31 @@ int Receive(SOCKET receiver, int recv_until_succ, uint bytes, stream* obyte_stre
 	return SUCCESS;
 }
 
+int ReceiveAvailable(SOCKET receiver, stream buffer, uint capacity, uint* obyte_read)
+{
+	if (buffer == NULL || obyte_read == NULL || capacity == 0)
+		return INVALID_ARGUMENTS;
+
+	int ret = recv(receiver, buffer, capacity, 0);
+	if (ret == SOCKET_ERROR) {
+#ifdef _ERROR_DEBUGGING
+		int err = WSAGetLastError();
+		if (err == WSAECONNABORTED || err == WSAECONNRESET) {
+			printf("[%s:%d] %s\n", ERROR_FLAGS, err, _CONNECTION_DROP);
+		}
+		else {
+			printf("[%s:%d] %s\n", WARNING_FLAGS, err, _RECEIVE_FAIL);
+		}
+#endif // _ERROR_DEBUGGING
+		return FATAL_ERROR;
+	}
+	else if (ret == 0) { // 0 byte receive
+		return FATAL_ERROR;
+	}
+	*obyte_read = (uint)ret;
+	return SUCCESS;
+}
+
 int SendSegment(SOCKET sender, int send_until_succ, const stream message, uint message_len, uint* obyte_sent)
 {
 	stream segment = CreateStream(SEGMENT_MAX_SIZE);
@@ -572,11 +602,13 @@ int ReceiveSegmentContent(SOCKETEX* receiver, uint bytes)
 
 #pragma region Socket Extend
 
-SOCKETEX CreateSocketExtend(SOCKET socket, uint buffer_size, OCRCALLBACK callback)
+SOCKETEX CreateSocketExtend(SOCKET socket, uint buffer_size, OCRCALLBACK callback, OCRCALLBACK send_callback)
 {
 	SOCKETEX s; {
 		s.socket = socket;
 		s.callback = callback;
+		s.send_callback = send_callback;
+		InitializeSendQueue(&(s.send_queue));
 		memset(&(s.overlapped), 0, sizeof(s.overlapped));
 		//s.overlapped.hEvent = socket_event;
 		s.data = CreateStream(buffer_size);
@@ -609,7 +641,203 @@ void UpdateStatus(SOCKETEX* sockex, int status)
 void DestroySocketExtend(SOCKETEX* sockex)
 {
 	free(sockex->data);
+	sockex->data = NULL;
 	CloseSocket(sockex->socket, CLOSE_SAFELY);
 	sockex->socket = (SOCKET)0;
+	// a pending WSASend still reads the queued buffers: its completion routine releases them (See CompleteQueuedSend())
+	if (!sockex->send_queue.is_sending)
+		ClearSendQueue(&(sockex->send_queue));
+}
+#pragma endregion
+
+#pragma region Send Queue
+
+SENDBUFFER* CreateSendBuffer(stream data, uint length)
+{
+	SENDBUFFER* buffer = (SENDBUFFER*)malloc(sizeof(SENDBUFFER));
+	if (buffer == NULL) {
+#ifdef _ERROR_DEBUGGING
+		printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
+#endif
+		return NULL;
+	}
+	buffer->data = data;
+	buffer->length = length;
+	buffer->ref_count = 1;
+	return buffer;
+}
+
+SENDBUFFER* CreateSegmentSendBuffer(const stream message, uint message_len)
+{
+	if (message_len > MESSAGE_MAX_SIZE)
+		return NULL;
+
+	stream segment = CreateStream(message_len + SEGMENT_HEADER_SIZE);
+	if (segment == NULL)
+		return NULL;
+
+	uint segment_len;
+	CreateSegment(message, message_len, &segment, &segment_len);
+	SENDBUFFER* buffer = CreateSendBuffer(segment, segment_len);
+	if (buffer == NULL)
+		DestroyStream(segment);
+	return buffer;
+}
+
+SENDBUFFER* RetainSendBuffer(SENDBUFFER* buffer)
+{
+	InterlockedIncrement(&(buffer->ref_count));
+	return buffer;
+}
+
+void ReleaseSendBuffer(SENDBUFFER* buffer)
+{
+	if (buffer != NULL && InterlockedDecrement(&(buffer->ref_count)) == 0) {
+		DestroyStream(buffer->data);
+		free(buffer);
+	}
+}
+
+void InitializeSendQueue(SENDQUEUE* queue, uint high_watermark, uint low_watermark)
+{
+	memset(&(queue->overlapped), 0, sizeof(queue->overlapped));
+	queue->head = queue->tail = NULL;
+	queue->queued_bytes = 0;
+	queue->high_watermark = high_watermark;
+	queue->low_watermark = low_watermark;
+	queue->is_sending = 0;
+	queue->is_paused = 0;
+}
+
+void ClearSendQueue(SENDQUEUE* queue)
+{
+	SENDNODE* cur = queue->head;
+	while (cur != NULL) {
+		SENDNODE* next = cur->next;
+		ReleaseSendBuffer(cur->buffer);
+		free(cur);
+		cur = next;
+	}
+	InitializeSendQueue(queue, queue->high_watermark, queue->low_watermark);
+}
+
+int EnqueueSend(SOCKETEX* sender, SENDBUFFER* buffer)
+{
+	if (buffer == NULL)
+		return FAIL;
+
+	SENDNODE* node = (SENDNODE*)malloc(sizeof(SENDNODE));
+	if (node == NULL) {
+#ifdef _ERROR_DEBUGGING
+		printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
+#endif
+		return FAIL;
+	}
+	node->buffer = RetainSendBuffer(buffer);
+	node->sent = 0;
+	node->next = NULL;
+
+	SENDQUEUE* queue = &(sender->send_queue);
+	if (queue->tail == NULL)
+		queue->head = node;
+	else
+		queue->tail->next = node;
+	queue->tail = node;
+
+	queue->queued_bytes += buffer->length;
+	if (queue->queued_bytes >= queue->high_watermark)
+		queue->is_paused = 1;
+
+	int ret = FlushSendQueue(sender);
+	return ret == FATAL_ERROR ? FATAL_ERROR : WAIT;
+}
+
+int EnqueueSegment(SOCKETEX* sender, const stream message, uint message_len)
+{
+	SENDBUFFER* buffer = CreateSegmentSendBuffer(message, message_len);
+	int ret = EnqueueSend(sender, buffer);
+	ReleaseSendBuffer(buffer);
+	return ret;
+}
+
+int FlushSendQueue(SOCKETEX* sender)
+{
+	SENDQUEUE* queue = &(sender->send_queue);
+	if (queue->is_sending)
+		return WAIT;
+	if (queue->head == NULL)
+		return SUCCESS;
+
+	// gather the first queued buffers into one send
+	DWORD count = 0;
+	for (SENDNODE* cur = queue->head; cur != NULL && count < SEND_QUEUE_MAX_GATHER; cur = cur->next) {
+		queue->buffers[count].buf = cur->buffer->data + cur->sent;
+		queue->buffers[count].len = cur->buffer->length - cur->sent;
+		count++;
+	}
+
+	memset(&(queue->overlapped), 0, sizeof(queue->overlapped));
+	int ret = WSASend(sender->socket, queue->buffers, count, NULL, 0, &(queue->overlapped), sender->send_callback);
+	if (ret == SOCKET_ERROR) {
+		int err = WSAGetLastError();
+		if (err != WSA_IO_PENDING) {
+#ifdef _ERROR_DEBUGGING
+			if (err == WSAECONNABORTED || err == WSAECONNRESET)
+				printf("[%s:%d] %s\n", ERROR_FLAGS, err, _CONNECTION_DROP);
+			else
+				printf("[%s:%d] %s\n", WARNING_FLAGS, err, _SEND_FAIL);
+#endif // _ERROR_DEBUGGING
+			return FATAL_ERROR;
+		}
+	}
+	// the completion routine is queued even if WSASend return immediately
+	queue->is_sending = 1;
+	return WAIT;
 }
+
+int CompleteQueuedSend(SOCKETEX* sender, uint transfered_bytes, int* oresumed)
+{
+	if (oresumed == NULL)
+		return INVALID_ARGUMENTS;
+	*oresumed = 0;
+
+	SENDQUEUE* queue = &(sender->send_queue);
+	queue->is_sending = 0;
+	if (sender->socket == (SOCKET)0) { // the socket was closed while the send was pending
+		ClearSendQueue(queue);
+		return FATAL_ERROR;
+	}
+	if (transfered_bytes == 0) // the send failed: the buffers are released with the socket
+		return FATAL_ERROR;
+	queue->queued_bytes -= transfered_bytes;
+
+	// pop the buffers sent completely. The last one may be sent partially
+	uint remain = transfered_bytes;
+	while (remain > 0 && queue->head != NULL) {
+		SENDNODE* node = queue->head;
+		uint left = node->buffer->length - node->sent;
+		if (remain < left) {
+			node->sent += remain;
+			break;
+		}
+		remain -= left;
+		queue->head = node->next;
+		if (queue->head == NULL)
+			queue->tail = NULL;
+		ReleaseSendBuffer(node->buffer);
+		free(node);
+	}
+
+	if (queue->is_paused && queue->queued_bytes <= queue->low_watermark) {
+		queue->is_paused = 0;
+		*oresumed = 1;
+	}
+	return FlushSendQueue(sender);
+}
+
+int IsSendQueuePaused(const SOCKETEX* sockex)
+{
+	return sockex->send_queue.is_paused;
+}
+
 #pragma endregion
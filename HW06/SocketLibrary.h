@@ -37,6 +37,11 @@
 #define SS_RECA					4 // receive ack
 #define SS_SEND					8 // send
 #define SS_SENA					16 // send ack
+#define SS_RECF					32 // receive bytes for a frame parser
+
+#define SEND_QUEUE_HIGH_WATERMARK	(8 * SEGMENT_MAX_SIZE) // Queued bytes that pause the producers of a connection
+#define SEND_QUEUE_LOW_WATERMARK	(2 * SEGMENT_MAX_SIZE) // Queued bytes that resume the paused producers
+#define SEND_QUEUE_MAX_GATHER		8 // Maximum number of queued buffers posted in one WSASend
 #pragma endregion
 
 #pragma region Type Definitions
@@ -45,6 +50,56 @@
 #define IP						IN_ADDR
 #define OCRCALLBACK				LPWSAOVERLAPPED_COMPLETION_ROUTINE
 
+/// <summary>
+/// A reference-counted byte stream waiting on send queues.
+/// The same buffer can be queued on many connections, it is freed when the last reference released.
+/// </summary>
+typedef struct sendbuffer {
+
+	stream data; // The bytes want to send
+
+	uint length; // The size of "data" in bytes
+
+	volatile LONG ref_count; // Number of references (send queue nodes and owners) to this buffer
+
+}SENDBUFFER;
+
+typedef struct sendnode {
+
+	SENDBUFFER* buffer; // The queued buffer
+
+	uint sent; // Number of bytes in buffer sent successfully
+
+	struct sendnode* next; // Next queued buffer. Linked list
+
+}SENDNODE;
+
+/// <summary>
+/// Queue of buffers waiting to be sent on a connection.
+/// Has its own Overlapped object so a send can be in flight while the connection is receiving.
+/// </summary>
+typedef struct sendqueue {
+
+	WSAOVERLAPPED overlapped; // The Overlapped object to handle send
+
+	WSABUF buffers[SEND_QUEUE_MAX_GATHER]; // Buffer objects posted on the in-flight send
+
+	SENDNODE* head; // The first queued buffer (the one is sending)
+
+	SENDNODE* tail; // The last queued buffer
+
+	uint queued_bytes; // Number of bytes in the queue that have not been sent
+
+	uint high_watermark; // Pause producers when queued_bytes reach this
+
+	uint low_watermark; // Resume producers when queued_bytes drain to this
+
+	int is_sending; // 1 if a send is in flight. 0 otherwise
+
+	int is_paused; // 1 if queued_bytes crossed high_watermark and have not drained to low_watermark
+
+}SENDQUEUE;
+
 typedef struct socketex {
 
 	WSAOVERLAPPED overlapped; // The Overlapped object to handle receive/send
@@ -61,6 +116,10 @@ typedef struct socketex {
 
 	int status; // Current operation that the SOCKETEX object is working. See SS_ for some status
 
+	SENDQUEUE send_queue; // Buffers waiting to be sent. Sending through the queue does not change "status"
+
+	OCRCALLBACK send_callback; // Overlapped Completion Routine Callback, called after a queued send completes
+
 }SOCKETEX;
 
 #pragma endregion
@@ -225,6 +284,16 @@ int SendSegment(SOCKET sender, int send_until_succ, const stream message, uint m
 /// <returns>1 if success. 0 if number of bytes receive less than expected [Never if recv_until_succ=1]. -1 if have some fatal errors that the socket should be closed</returns>
 int Receive(SOCKET receiver, int recv_until_succ, uint bytes, stream* obyte_stream, uint* obyte_read = NULL);
 
+/// <summary>
+/// Receive bytes available in a connected socket buffer (at least one byte) into a caller buffer.
+/// </summary>
+/// <param name="receiver">The connected socket to the remote machine</param>
+/// <param name="buffer">The buffer to store received bytes</param>
+/// <param name="capacity">The size of the buffer in bytes</param>
+/// <param name="obyte_read">[Output:NotNull] Number of bytes read successfully</param>
+/// <returns>1 if success. -1 if have some fatal errors that the socket should be closed</returns>
+int ReceiveAvailable(SOCKET receiver, stream buffer, uint capacity, uint* obyte_read);
+
 /// <summary>
 /// Receive a Segment from a connected socket. 
 /// Segment = Header (SEGMENT_HEADER_SIZE) | Message (Size indicated by Header)
@@ -405,8 +474,9 @@ void UpdateStatus(SOCKETEX* sockex, int status);
 /// "len" field in buffer will 0 but the "buf" field will be initialized with buffer_size bytes.
 /// Most overlapped function will not free the memory allocated for buffer in this function, just change "len" field</param>
 /// <param name="callback">The completion routine callback fill "callback" field</param>
+/// <param name="send_callback">The completion routine callback fill "send_callback" field. Use NULL if not send with the send queue</param>
 /// <returns>Created SOCKETEX object</returns>
-SOCKETEX CreateSocketExtend(SOCKET socket, uint buffer_size, OCRCALLBACK callback);
+SOCKETEX CreateSocketExtend(SOCKET socket, uint buffer_size, OCRCALLBACK callback, OCRCALLBACK send_callback = NULL);
 
 /// <summary>
 /// Reset default values for some fields in SOCKETEX object. [Call before starting new session]
@@ -426,6 +496,104 @@ void Reset(SOCKETEX* sockex);
 /// <returns>1 if success. 0 if fail message_len exceed MESSAGE_MAX_SIZE</returns>
 int CreateSegment(const stream message, uint message_len, stream* osegment, uint* osegment_len);
 
+/// <summary>
+/// Get a pointer to SOCKETEX object from a pointer to the OVERLAPPED object of its send queue.
+/// [This is an utility function to retrieve SOCKETEX* from OVERLAPPED* extracted from send Completion Routine Callback.]
+/// </summary>
+/// <param name="send_overlapped">A pointer to the "overlapped" field in "send_queue" field of a SOCKETEX object</param>
+/// <returns>A pointer to the SOCKETEX object</returns>
+SOCKETEX* GetSocketExtend(LPWSAOVERLAPPED send_overlapped);
+
+#pragma endregion
+
+#pragma region Send Queue
+
+/// <summary>
+/// Create a SENDBUFFER object with one reference (owned by the caller).
+/// </summary>
+/// <param name="data">The bytes want to send. The SENDBUFFER takes the ownership, do not free it after calling this function</param>
+/// <param name="length">The size of "data" in bytes</param>
+/// <returns>Created SENDBUFFER. NULL if fail to allocate memory</returns>
+SENDBUFFER* CreateSendBuffer(stream data, uint length);
+
+/// <summary>
+/// Create a SENDBUFFER object contains a Segment of a message. See CreateSegment()
+/// </summary>
+/// <param name="message">The segment content (the message)</param>
+/// <param name="message_len">The size of the message. Not exceed MESSAGE_MAX_SIZE</param>
+/// <returns>Created SENDBUFFER with one reference. NULL if fail to allocate memory or message is too large</returns>
+SENDBUFFER* CreateSegmentSendBuffer(const stream message, uint message_len);
+
+/// <summary>
+/// Add a reference to a SENDBUFFER object.
+/// </summary>
+/// <param name="buffer">The SENDBUFFER object</param>
+/// <returns>The SENDBUFFER object [buffer]</returns>
+SENDBUFFER* RetainSendBuffer(SENDBUFFER* buffer);
+
+/// <summary>
+/// Remove a reference from a SENDBUFFER object. Free memory for it if this is the last reference
+/// </summary>
+/// <param name="buffer">The SENDBUFFER object</param>
+void ReleaseSendBuffer(SENDBUFFER* buffer);
+
+/// <summary>
+/// Initialize an empty SENDQUEUE.
+/// </summary>
+/// <param name="queue">A pointer to the SENDQUEUE</param>
+/// <param name="high_watermark">Number of queued bytes that pause producers</param>
+/// <param name="low_watermark">Number of queued bytes that resume producers. Should less than high_watermark</param>
+void InitializeSendQueue(SENDQUEUE* queue, uint high_watermark = SEND_QUEUE_HIGH_WATERMARK, uint low_watermark = SEND_QUEUE_LOW_WATERMARK);
+
+/// <summary>
+/// Release all buffers in a SENDQUEUE. [Call after the socket is closed and no send is pending]
+/// </summary>
+/// <param name="queue">A pointer to the SENDQUEUE</param>
+void ClearSendQueue(SENDQUEUE* queue);
+
+/// <summary>
+/// [Overlapped] Append a SENDBUFFER to the send queue of a SOCKETEX object and Start sending if the queue is idle.
+/// The queue adds its own reference to the buffer, the caller still owns its reference.
+/// </summary>
+/// <param name="sender">A pointer to SOCKETEX object</param>
+/// <param name="buffer">The buffer want to send</param>
+/// <returns>99 if wait on completion routine. 0 if allocate memory fail. -1 if have fatal error that the socket should be closed</returns>
+int EnqueueSend(SOCKETEX* sender, SENDBUFFER* buffer);
+
+/// <summary>
+/// [Overlapped] Create a Segment from a message and Append it to the send queue of a SOCKETEX object
+/// </summary>
+/// <param name="sender">A pointer to SOCKETEX object</param>
+/// <param name="message">The segment content (the message)</param>
+/// <param name="message_len">The size of the message</param>
+/// <returns>99 if wait on completion routine. 0 if too much bytes or allocate memory fail. -1 if have fatal error that the socket should be closed</returns>
+int EnqueueSegment(SOCKETEX* sender, const stream message, uint message_len);
+
+/// <summary>
+/// [Overlapped] Post a send for the first queued buffers (up to SEND_QUEUE_MAX_GATHER) of a SOCKETEX object.
+/// Do nothing if a send is in flight or the queue is empty.
+/// </summary>
+/// <param name="sender">A pointer to SOCKETEX object</param>
+/// <returns>1 if the queue is empty. 99 if wait on completion routine. -1 if have fatal error that the socket should be closed</returns>
+int FlushSendQueue(SOCKETEX* sender);
+
+/// <summary>
+/// [Overlapped] Update the send queue after a queued send completes and Continue sending remain buffers.
+/// This function should be invoked from the "send_callback" completion routine, also if the send failed or the socket has been closed.
+/// </summary>
+/// <param name="sender">A pointer to SOCKETEX object</param>
+/// <param name="transfered_bytes">Number of bytes sent successfully. 0 if the send failed</param>
+/// <param name="oresumed">[Output:NotNull] 1 if the queue drains to low watermark and paused producers should be resumed. 0 otherwise</param>
+/// <returns>1 if the queue is empty. 99 if wait on completion routine. -1 if have fatal error that the socket should be closed</returns>
+int CompleteQueuedSend(SOCKETEX* sender, uint transfered_bytes, int* oresumed);
+
+/// <summary>
+/// Check whether producers on a connection should pause because too much bytes are waiting in its send queue.
+/// </summary>
+/// <param name="sockex">A pointer to SOCKETEX object</param>
+/// <returns>1 if should pause. 0 otherwise</returns>
+int IsSendQueuePaused(const SOCKETEX* sockex);
+
 #pragma endregion
 
 #pragma endregion
@@ -12,6 +12,8 @@ FILE* OpenFile(const char* path, const char* mode)
             printf("[%s:%d] Fail to open file '%s' to %s.\n", ERROR_FLAGS, errno, path, "append");
         else if (mode[0] == 'w')
             printf("[%s:%d] Fail to open file '%s' to %s.\n", ERROR_FLAGS, errno, path, "write");
+        else if (mode[0] == 'r' && mode[1] == '+')
+            printf("[%s:%d] Fail to open file '%s' to %s.\n", ERROR_FLAGS, errno, path, "update");
         else if (mode[0] == 'r')
             printf("[%s:%d] Fail to open file '%s' to %s.\n", ERROR_FLAGS, errno, path, "read");
 #endif
@@ -31,18 +33,48 @@ int RemoveFile(const char* path)
     return (remove(path) == 0);
 }
 
-int MoveFilePointer(FILE* fp, int relative, int position)
+uint GetFileLength(const char* path)
 {
-    return fseek(fp, position, relative) == 0;
+    FILE* fp;
+    if (fopen_s(&fp, path, FOM_READ) != 0 || fp == NULL)
+        return UEOF;
+    llong length = -1;
+    if (_fseeki64(fp, 0, SEEK_END) == 0)
+        length = _ftelli64(fp);
+    fclose(fp);
+    return (length < 0 || length >= UEOF) ? UEOF : (uint)length;
+}
+
+int TruncateFile(const char* path, uint size)
+{
+    FILE* fp = OpenFile(path, FOM_UPDATE);
+    if (fp == NULL)
+        return FAIL;
+    int status = (_chsize_s(_fileno(fp), size) == 0);
+    fclose(fp);
+    return status;
+}
+
+int SyncFile(FILE* fp)
+{
+    if (fp == NULL || fflush(fp) != 0)
+        return FAIL;
+    return _commit(_fileno(fp)) == 0;
+}
+
+int MoveFilePointer(FILE* fp, int relative, llong position)
+{
+    return _fseeki64(fp, position, relative) == 0;
 }
 
 char* CreateUniquePath(const char* folderpath, uint folderlen)
 {
-    uint filelen = 20; // len of time_t in string
+    static uint sequence = 0; // Distinguish the paths created in the same second
+    uint filelen = 32; // len of time_t and sequence in string
     char* filepath = Clone(folderpath, folderlen + filelen);
     if (filepath != NULL) {
-        char* time_str = CreateStream(20); // long long max value = 9,223,372,036,854,775,807
-        sprintf_s(time_str, 20, "%lld", time(0));
+        char* time_str = CreateStream(filelen); // long long max value = 9,223,372,036,854,775,807
+        sprintf_s(time_str, filelen, "%lld_%u", time(0), sequence++);
         memcpy_s(filepath + folderlen, filelen, time_str, filelen);
         free(time_str);
     }
@@ -90,7 +122,21 @@ int ReadFromFile(FILE* fp, uint length, stream* odata, uint* read_success)
     if (_data == NULL)
         return FAIL;
 
-    uint read_count = fread(_data, sizeof(char), length, fp);
+    int status = ReadIntoStream(fp, length, _data, read_success);
+    if (status == FATAL_ERROR) {
+        DestroyStream(_data);
+        return FATAL_ERROR;
+    }
+    *odata = _data;
+    return status;
+}
+
+int ReadIntoStream(FILE* fp, uint length, stream obuffer, uint* read_success)
+{
+    if (fp == NULL || obuffer == NULL)
+        return INVALID_ARGUMENTS;
+
+    uint read_count = fread(obuffer, sizeof(char), length, fp);
 
     int status = SUCCESS;
     if (read_count < length) {
@@ -98,12 +144,10 @@ int ReadFromFile(FILE* fp, uint length, stream* odata, uint* read_success)
 #ifdef _ERROR_DEBUGGING
             printf("[%s:%d] Unexpected error occurs when reading file\n", WARNING_FLAGS, errno);
 #endif // _ERROR_DEBUGGING
-            DestroyStream(_data);
             return FATAL_ERROR;
         }
         status = FAIL; // eof
     }
-    *odata = _data;
     if (read_success != NULL)
         *read_success = read_count;
     return status;
@@ -111,6 +155,153 @@ int ReadFromFile(FILE* fp, uint length, stream* odata, uint* read_success)
 
 #pragma endregion
 
+#pragma region Compression
+
+/// <summary>
+/// Write a LZ4 length extension: 255 for each full byte, then the remain.
+/// </summary>
+/// <returns>Number of bytes written</returns>
+uint WriteLZLength(uint value, stream output)
+{
+    uint size = 0;
+    while (value >= 255) {
+        output[size++] = (char)255;
+        value -= 255;
+    }
+    output[size++] = (char)value;
+    return size;
+}
+
+/// <summary>
+/// Write a sequence: Token | Literals Length Extension | Literals | [Offset | Match Length Extension]
+/// </summary>
+/// <returns>Number of bytes written. 0 if the sequence does not fit the output</returns>
+uint WriteLZSequence(const char* literals, uint literal_len, uint offset, uint match_len, stream output, uint capacity)
+{
+    // worst size: token + extensions + literals + offset
+    if (2 + literal_len / 255 + literal_len + 2 + match_len / 255 + 1 > capacity)
+        return 0;
+
+    uint size = 1;
+    uint match_code = match_len >= LZ_MIN_MATCH ? match_len - LZ_MIN_MATCH : 0;
+    output[0] = (char)(((literal_len < 15 ? literal_len : 15) << 4) | (match_code < 15 ? match_code : 15));
+    if (literal_len >= 15)
+        size += WriteLZLength(literal_len - 15, output + size);
+    if (literal_len > 0)
+        memcpy_s(output + size, literal_len, literals, literal_len);
+    size += literal_len;
+
+    if (match_len > 0) { // the last sequence has only literals
+        output[size++] = (char)(offset & 0xFF);
+        output[size++] = (char)(offset >> 8);
+        if (match_code >= 15)
+            size += WriteLZLength(match_code - 15, output + size);
+    }
+    return size;
+}
+
+uint CompressLZ(const stream input, uint length, stream output, uint capacity)
+{
+    uint table[1 << LZ_HASH_BITS]; // position + 1 of the last 4 bytes having the hash. 0 if empty
+    memset(table, 0, sizeof(table));
+
+    uint size = 0, anchor = 0, i = 0, written;
+    const unsigned char* in = (const unsigned char*)input;
+    while (length > LZ_MATCH_LIMIT && i < length - LZ_MATCH_LIMIT) {
+        uint sequence, candidate;
+        memcpy(&sequence, in + i, sizeof(uint));
+        uint hash = (sequence * 2654435761u) >> (32 - LZ_HASH_BITS);
+        uint reference = table[hash];
+        table[hash] = i + 1;
+
+        if (reference == 0 || i - (reference - 1) > LZ_MAX_OFFSET) {
+            i++;
+            continue;
+        }
+        reference--;
+        memcpy(&candidate, in + reference, sizeof(uint));
+        if (candidate != sequence) {
+            i++;
+            continue;
+        }
+
+        uint match_len = LZ_MIN_MATCH;
+        while (i + match_len < length - LZ_LAST_LITERALS && in[reference + match_len] == in[i + match_len])
+            match_len++;
+
+        written = WriteLZSequence(input + anchor, i - anchor, i - reference, match_len, output + size, capacity - size);
+        if (written == 0)
+            return 0;
+        size += written;
+        i += match_len;
+        anchor = i;
+    }
+
+    written = WriteLZSequence(input + anchor, length - anchor, 0, 0, output + size, capacity - size);
+    if (written == 0)
+        return 0;
+    return size + written;
+}
+
+/// <summary>
+/// Read a LZ4 length extension (See WriteLZLength()) and Add it to the value.
+/// </summary>
+/// <returns>1 if success. 0 if the input ends</returns>
+int ReadLZLength(const unsigned char* input, uint length, uint* position, uint* value)
+{
+    unsigned char b;
+    do {
+        if (*position >= length)
+            return FAIL;
+        b = input[(*position)++];
+        *value += b;
+    } while (b == 255);
+    return SUCCESS;
+}
+
+int DecompressLZ(const stream input, uint length, stream output, uint capacity, uint* olength)
+{
+    if (olength == NULL)
+        return INVALID_ARGUMENTS;
+
+    const unsigned char* in = (const unsigned char*)input;
+    uint ip = 0, op = 0;
+    while (ip < length) {
+        unsigned char token = in[ip++];
+
+        uint literal_len = token >> 4;
+        if (literal_len == 15 && ReadLZLength(in, length, &ip, &literal_len) != SUCCESS)
+            return FAIL;
+        if (literal_len > length - ip || literal_len > capacity - op)
+            return FAIL;
+        memcpy_s(output + op, capacity - op, input + ip, literal_len);
+        ip += literal_len;
+        op += literal_len;
+        if (ip == length) // the last sequence
+            break;
+
+        if (length - ip < 2)
+            return FAIL;
+        uint offset = in[ip] | (in[ip + 1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > op)
+            return FAIL;
+
+        uint match_len = token & 0x0F;
+        if (match_len == 15 && ReadLZLength(in, length, &ip, &match_len) != SUCCESS)
+            return FAIL;
+        match_len += LZ_MIN_MATCH;
+        if (match_len > capacity - op)
+            return FAIL;
+        for (uint k = 0; k < match_len; ++k, ++op) // the match may overlap the output
+            output[op] = output[op - offset];
+    }
+    *olength = op;
+    return SUCCESS;
+}
+
+#pragma endregion
+
 #pragma region ByteStream
 
 uint ToUnsignedInt(const stream value)
@@ -118,6 +309,37 @@ uint ToUnsignedInt(const stream value)
     return *(uint*)value;
 }
 
+uint WriteVarint(uint value, stream output)
+{
+    uint size = 0;
+    while (value >= 0x80) {
+        output[size++] = (char)((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    output[size++] = (char)value;
+    return size;
+}
+
+int ReadVarint(const stream input, uint available, uint* ovalue, uint* osize)
+{
+    if (ovalue == NULL || osize == NULL)
+        return INVALID_ARGUMENTS;
+
+    uint value = 0;
+    for (uint i = 0; i < VARINT_MAX_SIZE; ++i) {
+        if (i >= available)
+            return WAIT;
+        unsigned char b = (unsigned char)input[i];
+        value |= (uint)(b & 0x7F) << (7 * i);
+        if ((b & 0x80) == 0) {
+            *ovalue = value;
+            *osize = i + 1;
+            return SUCCESS;
+        }
+    }
+    return FAIL;
+}
+
 stream CreateStream(uint size)
 {
     stream s = (stream)malloc(size);
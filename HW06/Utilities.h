@@ -12,6 +12,8 @@
 #define uint			unsigned int
 #define ushort			unsigned short
 #define ulong			unsigned long
+#define llong			long long
+#define ullong			unsigned long long
 
 #define stream			char*
 
@@ -23,9 +25,18 @@
 #define FOM_READ		"rb"
 #define FOM_WRITE		"wb"
 #define FOM_APPEND		"ab"
+#define FOM_UPDATE		"r+b" // Read and write anywhere. The file must exist
 
 #define UEOF			((uint)-1)
 
+#define VARINT_MAX_SIZE	5 // Maximum number of bytes of an unsigned int in varint encoding
+
+#define LZ_HASH_BITS		12 // The match finder remembers 2^12 positions
+#define LZ_MIN_MATCH		4
+#define LZ_MAX_OFFSET		65535
+#define LZ_LAST_LITERALS	5 // The last bytes are always literals
+#define LZ_MATCH_LIMIT		12 // A match can not start in the last bytes
+
 #pragma region Path
 
 /// <summary>
@@ -41,9 +52,9 @@ FILE* OpenFile(const char* path, const char* mode);
 /// </summary>
 /// <param name="fp">The FILE* object point to a opened file</param>
 /// <param name="relative">The relative position. See SEEK_ for some relative</param>
-/// <param name="position">The absolute position. Positive means move forward after relative position. Negative means move backward before relative position</param>
+/// <param name="position">The absolute position, 64-bit. Positive means move forward after relative position. Negative means move backward before relative position</param>
 /// <returns>1 if success. 0 otherwise</returns>
-int MoveFilePointer(FILE* fp, int relative, int position);
+int MoveFilePointer(FILE* fp, int relative, llong position);
 
 /// <summary>
 /// Close a file
@@ -60,7 +71,7 @@ int CloseFile(FILE* fp);
 int CreateFolder(const char* path);
 
 /// <summary>
-/// Create a unique path (for file/folder) in a specific folder. In fact, it is a random number.
+/// Create a unique path (for file/folder) in a specific folder. In fact, it is the current time and a sequence number.
 /// </summary>
 /// <param name="folderpath">The path to exists folder</param>
 /// <param name="folderlen">The size in bytes of "folderpath" field</param>
@@ -82,6 +93,28 @@ int IsExist(const char* path, int mode = FM_EXIST_ONLY);
 /// <returns>1 if success. 0 otherwise</returns>
 int RemoveFile(const char* path);
 
+/// <summary>
+/// Get the size of a file
+/// </summary>
+/// <param name="path">The path to the file</param>
+/// <returns>The size in bytes. UEOF if fail to open the file, or the file is too large for a 32-bit size (UEOF bytes or more)</returns>
+uint GetFileLength(const char* path);
+
+/// <summary>
+/// Cut a file to a specific size. The bytes after are discarded
+/// </summary>
+/// <param name="path">The path to the file</param>
+/// <param name="size">The new size in bytes</param>
+/// <returns>1 if success. 0 otherwise</returns>
+int TruncateFile(const char* path, uint size);
+
+/// <summary>
+/// Flush the written bytes of an opened file to the disk: They survive a crash of the process (or the machine) after this
+/// </summary>
+/// <param name="fp">The FILE* object point to the opened file</param>
+/// <returns>1 if success. 0 otherwise</returns>
+int SyncFile(FILE* fp);
+
 #pragma endregion
 
 #pragma region File IO
@@ -106,6 +139,42 @@ int WriteToFile(FILE* fp, uint length, const stream data, uint* owrite_success =
 /// <returns>1 if success. 0 if oread_success less than length (reach EOF). -1 if have some errors on file.</returns>
 int ReadFromFile(FILE* fp, uint length, stream* odata, uint* oread_success = NULL);
 
+/// <summary>
+/// Read a file into a byte stream allocated by the caller
+/// </summary>
+/// <param name="fp">The FILE* object point to the opened file</param>
+/// <param name="length">The size in bytes expected to read</param>
+/// <param name="obuffer">[Output:NotNull] The byte stream receives the read bytes. Need "length" bytes</param>
+/// <param name="oread_success">[Output] Number of bytes read successfully</param>
+/// <returns>1 if success. 0 if oread_success less than length (reach EOF). -1 if have some errors on file.</returns>
+int ReadIntoStream(FILE* fp, uint length, stream obuffer, uint* oread_success = NULL);
+
+#pragma endregion
+
+#pragma region Compression
+
+/// <summary>
+/// Compress a byte stream in LZ4 block format: Sequences of (Token | Literals | Offset | Match Length).
+/// Greedy matching with a small hash table, tuned for speed rather than ratio.
+/// </summary>
+/// <param name="input">The byte stream want to compress</param>
+/// <param name="length">The size of input</param>
+/// <param name="output">The buffer for compressed bytes</param>
+/// <param name="capacity">The size of output</param>
+/// <returns>The size of compressed bytes. 0 if the compressed bytes do not fit the output (incompressible data)</returns>
+uint CompressLZ(const stream input, uint length, stream output, uint capacity);
+
+/// <summary>
+/// Decompress a byte stream created by CompressLZ()
+/// </summary>
+/// <param name="input">The compressed bytes</param>
+/// <param name="length">The size of input</param>
+/// <param name="output">The buffer for decompressed bytes</param>
+/// <param name="capacity">The size of output</param>
+/// <param name="olength">[Output:NotNull] The size of decompressed bytes</param>
+/// <returns>1 if success. 0 if the input is corrupted or the output is too small</returns>
+int DecompressLZ(const stream input, uint length, stream output, uint capacity, uint* olength);
+
 #pragma endregion
 
 #pragma region ByteStream
@@ -117,6 +186,25 @@ int ReadFromFile(FILE* fp, uint length, stream* odata, uint* oread_success = NUL
 /// <returns>The cast value</returns>
 uint ToUnsignedInt(const stream value);
 
+/// <summary>
+/// Write an unsigned int to a byte stream in varint encoding: 7 bits per byte, least significant group first,
+/// the highest bit of a byte is set if more bytes follow.
+/// </summary>
+/// <param name="value">The value</param>
+/// <param name="output">The byte stream. Need at least VARINT_MAX_SIZE bytes</param>
+/// <returns>Number of bytes written</returns>
+uint WriteVarint(uint value, stream output);
+
+/// <summary>
+/// Read an unsigned int in varint encoding from a byte stream. See WriteVarint()
+/// </summary>
+/// <param name="input">The byte stream</param>
+/// <param name="available">Number of bytes can be read from input</param>
+/// <param name="ovalue">[Output:NotNull] The read value</param>
+/// <param name="osize">[Output:NotNull] Number of bytes read</param>
+/// <returns>1 if success. 99 if need more bytes. 0 if the varint is invalid (longer than VARINT_MAX_SIZE bytes)</returns>
+int ReadVarint(const stream input, uint available, uint* ovalue, uint* osize);
+
 /// <summary>
 /// Created a stream object and Allocate memory for it
 /// </summary>